@@ -0,0 +1,20 @@
+-- Builtin benchmark of tight loops calling math and string library
+-- functions, runs on both onemore and Lua 5.1, time it from shell,
+-- e.g. "time luna builtin_bench.lua"
+
+local s = 0
+for i = 1, 1000000 do
+    s = s + math.abs(-i) + math.floor(i / 3) + math.max(i, 7)
+end
+
+for i = 1, 1000000 do
+    s = s + math.sqrt(i) + math.sin(i) + math.fmod(i, 7)
+end
+
+local str = "onemore"
+for i = 1, 500000 do
+    s = s + string.len(string.sub(str, 1, i % 7 + 1))
+    s = s + string.len(string.upper(str))
+end
+
+print(s)
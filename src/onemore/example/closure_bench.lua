@@ -0,0 +1,25 @@
+-- Closure creation benchmark, every frame of a deep call stack keeps
+-- open upvalues while closures capture many locals at the bottom, runs on
+-- both onemore and Lua 5.1, time it from shell, e.g. "time luna closure_bench.lua"
+
+local function Level(depth, n)
+    local a, b, c, d = depth, depth + 1, depth + 2, depth + 3
+    local keep = function() return a + b + c + d end
+    if depth > 0 then
+        return Level(depth - 1, n) + keep()
+    end
+
+    local sum = 0
+    for i = 1, n do
+        local e, f, g, h = i, i + 1, i + 2, i + 3
+        local closure = function() return a + b + c + d + e + f + g + h end
+        sum = sum + closure()
+    end
+    return sum + keep()
+end
+
+local total = 0
+for round = 1, 20 do
+    total = total + Level(200, 50000)
+end
+print(total)
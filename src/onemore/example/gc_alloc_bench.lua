@@ -0,0 +1,16 @@
+-- GC allocation benchmark of many short lived small tables, closures and
+-- strings, runs on both onemore and Lua 5.1, time it from shell, e.g.
+-- compare allocating objects from size class pools and by malloc:
+--     time luna gc_alloc_bench.lua
+--     LUNA_GC_NO_POOL=1 time luna gc_alloc_bench.lua
+-- and compare with Lua 5.1:
+--     time lua gc_alloc_bench.lua
+
+local count = 0
+for i = 1, 2000000 do
+    local t = { i }
+    local f = function() return t end
+    local s = "key" .. i
+    count = count + #f() + #s % 2
+end
+print(count)
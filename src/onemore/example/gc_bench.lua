@@ -0,0 +1,44 @@
+-- GC mark benchmark over a long linked list and a deep tree, runs on
+-- both onemore and Lua 5.1, time it from shell, e.g. "time luna gc_bench.lua"
+
+-- Linked list of 10M nodes
+local list = nil
+for i = 1, 10000000 do
+    list = { list }
+end
+
+-- Binary tree of depth 20
+local function Tree(depth)
+    if depth == 0 then
+        return {}
+    end
+    return { Tree(depth - 1), Tree(depth - 1) }
+end
+local tree = Tree(20)
+
+-- Garbage keeps GC running while list and tree are alive
+local sum = 0
+for i = 1, 2000000 do
+    local t = { i }
+    sum = sum + t[1]
+end
+
+local length = 0
+local node = list
+while node do
+    length = length + 1
+    node = node[1]
+end
+
+local leaves = 0
+local function CountLeaves(t)
+    if not t[1] then
+        leaves = leaves + 1
+    else
+        CountLeaves(t[1])
+        CountLeaves(t[2])
+    end
+end
+CountLeaves(tree)
+
+print(length, leaves, sum)
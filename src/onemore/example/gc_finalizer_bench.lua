@@ -0,0 +1,22 @@
+-- GC finalizer benchmark of many dead files closed by GC, prints worst
+-- and total GC pause in milliseconds, compare closing files in GC with
+-- closing them on background finalizer thread, e.g. "luna gc_finalizer_bench.lua"
+-- and "LUNA_GC_BACKGROUND_FINALIZER=1 luna gc_finalizer_bench.lua"
+
+local written = 0
+for i = 1, 8000 do
+    local f = io.open("gc_finalizer_bench.tmp", "w")
+    if f then
+        f:write(i)
+        written = written + 1
+    end
+
+    -- Garbage keeps GC running
+    for j = 1, 50 do
+        local t = { j }
+    end
+end
+collectgarbage()
+
+local stats = collectgarbage("stats")
+print(written, stats.max_pause / 1000, stats.total_pause / 1000)
@@ -0,0 +1,28 @@
+-- GC parallel mark benchmark of a large random graph of tables which is
+-- all alive, full GC marks the graph at once, prints average pause of
+-- full GC in milliseconds, compare counts of mark threads, e.g.
+-- "luna gc_mark_bench.lua" and "LUNA_GC_MARK_THREADS=4 luna gc_mark_bench.lua"
+
+local count = 524288
+local nodes = { {} }
+for i = 2, count do
+    -- Tree edge keeps all nodes alive
+    local parent = nodes[math.random(i - 1)]
+    local node = {}
+    parent[#parent + 1] = node
+    nodes[i] = node
+end
+
+-- Cross edges make the tree a graph
+for i = 1, count do
+    local node = nodes[i]
+    node[#node + 1] = nodes[math.random(count)]
+end
+
+local rounds = 5
+local before = collectgarbage("stats")
+for i = 1, rounds do
+    collectgarbage()
+end
+local after = collectgarbage("stats")
+print(#nodes, (after.total_pause - before.total_pause) / rounds / 1000)
@@ -0,0 +1,26 @@
+-- Lexer benchmark of a large script of 20000 functions, this script
+-- generates lex_bench_main.lua, then time compiling it from shell, which
+-- is dominated by lexing, e.g.
+--     luna lex_bench.lua
+--     time luna -c lex_bench_main.lua
+-- Lex by table-driven DFA lexer instead of hand-written lexer:
+--     LUNA_LEXER=dfa time luna -c lex_bench_main.lua
+
+local functions = 20000
+
+local lines = { "local M = {}\n" }
+for i = 1, functions do
+    lines[#lines + 1] =
+        "-- function " .. i .. "\n" ..
+        "function M.func_" .. i .. "(a, b, ...)\n" ..
+        "    local t = { name = \"func_" .. i .. "\", value = " .. i .. ".5e1, [a] = b }\n" ..
+        "    if a >= b and t.value ~= 0xff then\n" ..
+        "        return a .. 'string' .. b, ...\n" ..
+        "    end\n" ..
+        "    return t[a] or #t\n" ..
+        "end\n"
+end
+
+local file = io.open("lex_bench_main.lua", "w")
+file:write(table.concat(lines))
+file:close()
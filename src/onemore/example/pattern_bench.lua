@@ -0,0 +1,45 @@
+-- Pattern matching benchmark corpus, runs on both onemore and Lua 5.1,
+-- time it from shell, e.g. "time luna pattern_bench.lua"
+
+local words = { "alpha", "beta", "gamma", "delta", "key", "value", "name" }
+local text = ""
+for i = 1, 200 do
+    local w = words[i % #words + 1]
+    text = text .. w .. i .. " = " .. (i * 37) .. " -- comment (" .. w .. ")\n"
+end
+
+local count = 0
+for round = 1, 200 do
+    -- Literal prefix search
+    local pos = 1
+    while true do
+        local b, e = string.find(text, "comment", pos)
+        if not b then break end
+        count = count + 1
+        pos = e + 1
+    end
+
+    -- Plain find
+    local b = string.find(text, "(gamma)", 1, true)
+    if b then count = count + 1 end
+
+    -- Captures
+    for k, v in string.gmatch(text, "(%a+%d+) = (%d+)") do
+        count = count + 1
+    end
+
+    -- Character class scan
+    for w in string.gmatch(text, "%a+") do
+        count = count + 1
+    end
+
+    -- Substitution
+    local s, n = string.gsub(text, "%((%a+)%)", "[%1]")
+    count = count + n
+
+    -- Anchored match
+    local m = string.match(text, "^(%a+)")
+    if m then count = count + 1 end
+end
+
+print(count)
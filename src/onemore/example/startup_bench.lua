@@ -0,0 +1,78 @@
+-- Startup benchmark of a project of 500 modules which have 25 functions
+-- each, count of modules can be passed as argument. This script generates
+-- the modules and startup_bench_main.lua which requires all of them and
+-- calls one function of each module, then time loading the project from
+-- shell, e.g.
+--     luna startup_bench.lua [modules]
+--     time luna startup_bench_main.lua
+-- Load precompiled bytecode files of all modules:
+--     luna -c startup_bench_*.lua
+--     time luna startup_bench_main.lua
+-- Load all modules from a bundle image:
+--     luna -b startup_bench.omb startup_bench_*.lua
+--     LUNA_BUNDLE=startup_bench.omb time luna startup_bench_main.lua
+-- Memory of processes sharing the bundle image, startup_bench_wait.lua
+-- loads the project and waits for a line from stdin, so start a few of
+-- them, then read Pss and Private of each process, code of the mapped
+-- image is counted in Shared_Clean and Pss instead of Private, compare
+-- with processes started without LUNA_BUNDLE:
+--     for i in 1 2 3 4; do
+--         sleep 30 | LUNA_BUNDLE=startup_bench.omb luna startup_bench_wait.lua &
+--     done
+--     sleep 5
+--     for pid in $(pgrep -x luna); do
+--         grep -E '^(Rss|Pss|Shared_Clean|Private)' /proc/$pid/smaps_rollup
+--     done
+-- Load modules through compile cache, the first run compiles sources
+-- and fills the cache, later runs load bytecode from the cache:
+--     LUNA_COMPILE_CACHE=startup_bench_cache time luna startup_bench_main.lua
+-- Compile modules on 1 to 8 worker threads before running, threads are
+-- hardware threads without LUNA_PRELOAD_THREADS, modules which have
+-- bytecode files are not compiled, so remove them first:
+--     rm -f startup_bench_*.omc
+--     preload="$(ls startup_bench_*.lua | tr '\n' ';')"
+--     for n in 1 2 4 8; do
+--         LUNA_PRELOAD="$preload" LUNA_PRELOAD_THREADS=$n time luna startup_bench_main.lua
+--     done
+-- Compile functions of modules lazily when they are called first:
+--     LUNA_LAZY_COMPILE=1 time luna startup_bench_main.lua
+
+local modules = 500
+if arg and arg[1] then
+    modules = 0
+    for i = 1, string.len(arg[1]) do
+        modules = modules * 10 + string.byte(arg[1], i) - string.byte("0")
+    end
+end
+local functions = 25
+
+local function Write(path, source)
+    local file = io.open(path, "w")
+    file:write(source)
+    file:close()
+end
+
+for i = 1, modules do
+    local lines = { "local M = {}\n" }
+    for j = 1, functions do
+        lines[#lines + 1] =
+            "function M.func_" .. j .. "(a, b, ...)\n" ..
+            "    local t = { name = 'func_" .. i .. "_" .. j .. "', value = " .. j .. ".5, [a] = b }\n" ..
+            "    if a >= b and t.value ~= " .. j .. " then\n" ..
+            "        return a .. 'string' .. b, ...\n" ..
+            "    end\n" ..
+            "    return t[a] or #t\n" ..
+            "end\n"
+    end
+    lines[#lines + 1] = "bench_modules[#bench_modules + 1] = M\n"
+    Write("startup_bench_" .. i .. ".lua", table.concat(lines))
+end
+
+local main =
+    "bench_modules = {}\n" ..
+    "for i = 1, " .. modules .. " do require('startup_bench_' .. i .. '.lua') end\n" ..
+    "local s = 0\n" ..
+    "for i, M in ipairs(bench_modules) do s = s + M.func_1(1, 2) end\n" ..
+    "print(#bench_modules, s)\n"
+Write("startup_bench_main.lua", main)
+Write("startup_bench_wait.lua", main .. "io.stdin():read('*l')\n")
@@ -0,0 +1,41 @@
+-- Vararg benchmark of wrappers forwarding '...' and reading a few
+-- of many varargs, runs on both onemore and Lua 5.1, time it from
+-- shell, e.g. "time luna vararg_bench.lua"
+
+local count = 0
+local function Sink(a, b, c, d)
+    count = count + 1
+end
+
+local function Log(level, ...)
+    if level > 0 then
+        Sink(...)
+    end
+end
+
+local function Wrap(...)
+    return Log(1, ...)
+end
+
+local function First(...)
+    local a, b = ...
+    return a
+end
+
+local sum = 0
+for i = 1, 1000000 do
+    Wrap("message", i, i + 1, i + 2)
+    sum = sum + First(i, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)
+end
+print(count, sum)
+
+-- select reads varargs in place
+local function Count(...)
+    return select('#', ...)
+end
+
+local total = 0
+for i = 1, 1000000 do
+    total = total + Count(i, i, i, i) + select(2, i, 1)
+end
+print(total)
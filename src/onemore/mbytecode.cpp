@@ -0,0 +1,595 @@
+#include "mbytecode.h"
+#include "mstate.h"
+#include "mfunction.h"
+#include "mexception.h"
+#include <stdint.h>
+#include <string.h>
+#include <cassert>
+#include <sys/stat.h>
+
+namespace oms
+{
+    namespace
+    {
+        const char kSignature[] = "\x1bOMS";
+        const char kBundleSignature[] = "\x1bOMB";
+        const uint32_t kEndianCheck = 0x01020304;
+
+        // Signature, version, endian check, sizes and source stamp
+        const std::size_t kHeaderSize = 4 + 1 + 4 + 3 + 8 + 8;
+
+        // Signature, version, endian check and module count
+        const std::size_t kBundleHeaderSize = 4 + 1 + 4 + 4;
+
+        // Register operands of instructions are 8 bits, so registers of
+        // one frame are [0, kMaxRegisterCount)
+        const int kMaxRegisterCount = 256;
+
+        // Instructions are aligned to 4 bytes in bytecode, bytecode of
+        // each module is aligned to 8 bytes in bundle
+        const std::size_t kCodeAlignment = 4;
+        const std::size_t kModuleAlignment = 8;
+
+        std::size_t AlignPadding(std::size_t offset, std::size_t alignment)
+        {
+            return (alignment - offset % alignment) % alignment;
+        }
+
+        bool CheckPlatform(const char *buffer)
+        {
+            uint32_t endian_check = 0;
+            memcpy(&endian_check, buffer, sizeof(endian_check));
+            return endian_check == kEndianCheck;
+        }
+    } // namespace
+
+    // Write function prototypes in native byte order, header records the
+    // byte order and type sizes, so bytecode of other platforms is refused
+    class BytecodeWriter
+    {
+    public:
+        explicit BytecodeWriter(std::string *out)
+            : out_(out), start_(out->size()) { }
+
+        void WriteHeader(const SourceStamp &stamp)
+        {
+            out_->append(kSignature, 4);
+            WriteByte(kBytecodeVersion);
+            WriteRaw(kEndianCheck);
+            WriteByte(sizeof(Instruction));
+            WriteByte(sizeof(double));
+            WriteByte(sizeof(int32_t));
+            WriteRaw(static_cast<int64_t>(stamp.mtime_));
+            WriteRaw(static_cast<int64_t>(stamp.size_));
+        }
+
+        void WriteFunction(const Function *func)
+        {
+            // Functions are compiled entirely for dumping
+            assert(!func->GetLazySource());
+            WriteInt(func->line_);
+            WriteInt(func->args_);
+            WriteByte(func->is_vararg_ ? 1 : 0);
+
+            // Instructions and lines can be referenced in place
+            auto opcode_size = func->OpCodeSize();
+            WriteInt(opcode_size);
+            out_->append(AlignPadding(out_->size() - start_, kCodeAlignment), '\0');
+            auto opcodes = func->GetOpCodes();
+            for (std::size_t i = 0; i < opcode_size; ++i)
+                WriteRaw(static_cast<uint32_t>(opcodes[i].opcode_));
+            for (std::size_t i = 0; i < opcode_size; ++i)
+                WriteInt(func->GetInstructionLine(i));
+
+            WriteInt(func->const_values_.size());
+            for (const auto &value : func->const_values_)
+                WriteValue(value);
+
+            WriteInt(func->local_vars_.size());
+            for (const auto &var : func->local_vars_)
+            {
+                WriteString(var.name_);
+                WriteInt(var.register_id_);
+                WriteInt(var.begin_pc_);
+                WriteInt(var.end_pc_);
+            }
+
+            WriteInt(func->upvalues_.size());
+            for (const auto &upvalue : func->upvalues_)
+            {
+                WriteString(upvalue.name_);
+                WriteByte(upvalue.parent_local_ ? 1 : 0);
+                WriteInt(upvalue.register_index_);
+            }
+
+            WriteInt(func->child_funcs_.size());
+            for (auto child : func->child_funcs_)
+                WriteFunction(child);
+        }
+
+    private:
+        template<typename T>
+        void WriteRaw(T t)
+        {
+            out_->append(reinterpret_cast<const char *>(&t), sizeof(t));
+        }
+
+        void WriteByte(unsigned char c)
+        {
+            out_->push_back(static_cast<char>(c));
+        }
+
+        void WriteInt(std::size_t i)
+        {
+            WriteRaw(static_cast<int32_t>(i));
+        }
+
+        void WriteString(const String *str)
+        {
+            WriteInt(str->GetLength());
+            out_->append(str->GetCStr(), str->GetLength());
+        }
+
+        void WriteValue(const Value &value)
+        {
+            WriteByte(value.type_);
+            switch (value.type_)
+            {
+                case ValueT_Nil:
+                    break;
+                case ValueT_Bool:
+                    WriteByte(value.bvalue_ ? 1 : 0);
+                    break;
+                case ValueT_Number:
+                    WriteRaw(value.num_);
+                    break;
+                case ValueT_String:
+                    WriteString(value.str_);
+                    break;
+                default:
+                    assert(!"const value type is not supported");
+                    break;
+            }
+        }
+
+        std::string *out_;
+        std::size_t start_;
+    };
+
+    // Read function prototypes, every read checks the rest size of
+    // bytecode and every function is verified after read, throw
+    // BytecodeException when bytecode is broken
+    class BytecodeReader
+    {
+    public:
+        BytecodeReader(State *state, String *module,
+                       const char *buffer, std::size_t size, bool ref_code)
+            : state_(state), module_(module), begin_(buffer),
+              pos_(buffer), end_(buffer + size), ref_code_(ref_code) { }
+
+        void SkipHeader()
+        {
+            Read(kHeaderSize);
+        }
+
+        Function * ReadFunction(Function *superior)
+        {
+            // New function is default on GCGen2, so barrier it
+            auto func = state_->NewFunction();
+            CHECK_BARRIER(state_->GetGC(), func);
+            func->SetModuleName(module_);
+            func->SetSuperior(superior);
+            func->line_ = ReadInt();
+            func->args_ = ReadInt();
+            func->is_vararg_ = ReadByte() != 0;
+
+            auto opcode_count = ReadCount(sizeof(uint32_t) + sizeof(int32_t));
+            Read(AlignPadding(pos_ - begin_, kCodeAlignment));
+            auto opcodes = Read(opcode_count * sizeof(uint32_t));
+            auto lines = Read(opcode_count * sizeof(int32_t));
+            if (ref_code_)
+            {
+                func->RefOpCodes(reinterpret_cast<const Instruction *>(opcodes),
+                                 reinterpret_cast<const int *>(lines),
+                                 opcode_count);
+            }
+            else
+            {
+                func->opcodes_.resize(opcode_count);
+                func->opcode_lines_.resize(opcode_count);
+                if (opcode_count > 0)
+                {
+                    memcpy(&func->opcodes_[0], opcodes, opcode_count * sizeof(uint32_t));
+                    memcpy(&func->opcode_lines_[0], lines, opcode_count * sizeof(int32_t));
+                }
+            }
+
+            auto const_count = ReadCount(1);
+            func->const_values_.reserve(const_count);
+            for (int i = 0; i < const_count; ++i)
+                func->const_values_.push_back(ReadValue());
+
+            auto var_count = ReadCount(sizeof(int32_t) * 4);
+            func->local_vars_.reserve(var_count);
+            for (int i = 0; i < var_count; ++i)
+            {
+                auto name = ReadString();
+                auto register_id = ReadInt();
+                auto begin_pc = ReadInt();
+                auto end_pc = ReadInt();
+                func->AddLocalVar(name, register_id, begin_pc, end_pc);
+            }
+
+            auto upvalue_count = ReadCount(sizeof(int32_t) * 2 + 1);
+            func->upvalues_.reserve(upvalue_count);
+            for (int i = 0; i < upvalue_count; ++i)
+            {
+                auto name = ReadString();
+                auto parent_local = ReadByte() != 0;
+                auto register_index = ReadInt();
+                func->AddUpvalue(name, parent_local, register_index);
+            }
+
+            auto child_count = ReadCount(1);
+            func->child_funcs_.reserve(child_count);
+            for (int i = 0; i < child_count; ++i)
+                func->AddChildFunction(ReadFunction(func));
+
+            Verify(func, superior);
+            return func;
+        }
+
+        bool IsEnd() const
+        {
+            return pos_ == end_;
+        }
+
+    private:
+        // Verify function like luaG_checkcode of Lua 5.1, VM trusts all
+        // operands of instructions, so every operand must be in range
+        void Verify(const Function *func, const Function *superior)
+        {
+            if (func->args_ < 0 || func->args_ >= kMaxRegisterCount)
+                Error("bad fixed arg count");
+
+            for (const auto &upvalue : func->upvalues_)
+            {
+                // Main function of module has no upvalues
+                if (!superior)
+                    Error("bad upvalue");
+                auto limit = upvalue.parent_local_ ?
+                    kMaxRegisterCount : static_cast<int>(superior->upvalues_.size());
+                if (upvalue.register_index_ < 0 || upvalue.register_index_ >= limit)
+                    Error("bad upvalue index");
+            }
+
+            auto opcodes = func->GetOpCodes();
+            int size = func->OpCodeSize();
+            int const_count = func->const_values_.size();
+            int child_count = func->child_funcs_.size();
+            int upvalue_count = func->upvalues_.size();
+            for (int pc = 0; pc < size; ++pc)
+            {
+                auto i = opcodes[pc];
+                auto a = Instruction::GetParamA(i);
+                auto b = Instruction::GetParamB(i);
+                auto c = Instruction::GetParamC(i);
+                auto bx = Instruction::GetParamBx(i);
+                auto op = Instruction::GetOpCode(i);
+                if (op < OpType_LoadNil || op > OpType_TailCall)
+                    Error("bad opcode");
+
+                switch (op)
+                {
+                    case OpType_LoadConst:
+                    case OpType_GetGlobal:
+                    case OpType_SetGlobal:
+                        if (bx >= const_count)
+                            Error("bad const index");
+                        break;
+                    case OpType_Closure:
+                        if (bx >= child_count)
+                            Error("bad child function index");
+                        break;
+                    case OpType_GetUpvalue:
+                    case OpType_SetUpvalue:
+                        if (b >= upvalue_count)
+                            Error("bad upvalue index");
+                        break;
+                    case OpType_Call:
+                    case OpType_TailCall:
+                        if (a + 1 + b > kMaxRegisterCount)
+                            Error("bad call arg count");
+                        if (c)
+                            VerifyTop(opcodes, pc, a + 1);
+                        break;
+                    case OpType_Ret:
+                        if (a + b > kMaxRegisterCount)
+                            Error("bad return value count");
+                        if (c)
+                            VerifyTop(opcodes, pc, a);
+                        break;
+                    case OpType_VarArg:
+                        if (b > 0 && a + b - 1 > kMaxRegisterCount)
+                            Error("bad vararg count");
+                        break;
+                    case OpType_JmpFalse:
+                    case OpType_JmpTrue:
+                    case OpType_JmpNil:
+                    case OpType_Jmp:
+                        VerifyJump(opcodes, size, pc + Instruction::GetParamsBx(i));
+                        break;
+                    case OpType_ForStep:
+                        if (pc + 1 >= size ||
+                            Instruction::GetOpCode(opcodes[pc + 1]) != OpType_Jmp)
+                            Error("'for' step without jump");
+                        break;
+                    default:
+                        // Other operands are registers of 8 bits
+                        break;
+                }
+            }
+        }
+
+        // Instruction uses values from its register to stack top, the
+        // previous instruction must set top at or above 'reg'
+        void VerifyTop(const Instruction *opcodes, int pc, int reg)
+        {
+            if (pc == 0)
+                Error("stack top is not set");
+
+            auto prev = opcodes[pc - 1];
+            switch (Instruction::GetOpCode(prev))
+            {
+                case OpType_Call:
+                case OpType_TailCall:
+                case OpType_VarArg:
+                case OpType_SetTop:
+                    if (Instruction::GetParamA(prev) >= reg)
+                        return ;
+                    break;
+                default:
+                    break;
+            }
+            Error("stack top is not set");
+        }
+
+        // Jump target is in [0, size], and never skips the instruction
+        // setting top of the target
+        void VerifyJump(const Instruction *opcodes, int size, int target)
+        {
+            if (target < 0 || target > size)
+                Error("bad jump target");
+            if (target == size)
+                return ;
+
+            auto i = opcodes[target];
+            switch (Instruction::GetOpCode(i))
+            {
+                case OpType_Call:
+                case OpType_TailCall:
+                case OpType_Ret:
+                    if (Instruction::GetParamC(i))
+                        Error("bad jump target");
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        void Error(const char *desc)
+        {
+            throw BytecodeException(module_->GetCStr(), desc);
+        }
+
+        const char * Read(std::size_t size)
+        {
+            if (static_cast<std::size_t>(end_ - pos_) < size)
+                throw BytecodeException(module_->GetCStr(), "truncated bytecode");
+            auto p = pos_;
+            pos_ += size;
+            return p;
+        }
+
+        template<typename T>
+        T ReadRaw()
+        {
+            T t;
+            memcpy(&t, Read(sizeof(t)), sizeof(t));
+            return t;
+        }
+
+        unsigned char ReadByte()
+        {
+            return static_cast<unsigned char>(*Read(1));
+        }
+
+        int ReadInt()
+        {
+            return ReadRaw<int32_t>();
+        }
+
+        // Read count of elements which size are at least 'element_size',
+        // so broken count can not allocate memory more than bytecode size
+        int ReadCount(std::size_t element_size)
+        {
+            auto count = ReadInt();
+            if (count < 0 ||
+                static_cast<std::size_t>(end_ - pos_) / element_size <
+                static_cast<std::size_t>(count))
+                throw BytecodeException(module_->GetCStr(), "bad element count");
+            return count;
+        }
+
+        String * ReadString()
+        {
+            auto length = ReadCount(1);
+            return state_->GetString(Read(length), length);
+        }
+
+        Value ReadValue()
+        {
+            Value value;
+            switch (ReadByte())
+            {
+                case ValueT_Nil:
+                    break;
+                case ValueT_Bool:
+                    value.type_ = ValueT_Bool;
+                    value.bvalue_ = ReadByte() != 0;
+                    break;
+                case ValueT_Number:
+                    value = Value(ReadRaw<double>());
+                    break;
+                case ValueT_String:
+                    value = Value(ReadString());
+                    break;
+                default:
+                    throw BytecodeException(module_->GetCStr(), "bad const value type");
+            }
+            return value;
+        }
+
+        State *state_;
+        String *module_;
+        const char *begin_;
+        const char *pos_;
+        const char *end_;
+        // Reference instructions and lines in bytecode buffer
+        bool ref_code_;
+    };
+
+    bool GetSourceStamp(const std::string &path, SourceStamp *stamp)
+    {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+            return false;
+
+        stamp->mtime_ = st.st_mtime;
+        stamp->size_ = st.st_size;
+        return true;
+    }
+
+    void DumpFunction(const Function *func, const SourceStamp &stamp,
+                      std::string *out)
+    {
+        BytecodeWriter writer(out);
+        writer.WriteHeader(stamp);
+        writer.WriteFunction(func);
+    }
+
+    bool ReadBytecodeStamp(const char *buffer, std::size_t size,
+                           SourceStamp *stamp)
+    {
+        if (size < kHeaderSize || memcmp(buffer, kSignature, 4) != 0)
+            return false;
+
+        if (static_cast<unsigned char>(buffer[4]) != kBytecodeVersion ||
+            !CheckPlatform(buffer + 5) ||
+            buffer[9] != sizeof(Instruction) ||
+            buffer[10] != sizeof(double) ||
+            buffer[11] != sizeof(int32_t))
+            return false;
+
+        int64_t mtime = 0;
+        int64_t source_size = 0;
+        memcpy(&mtime, buffer + 12, sizeof(mtime));
+        memcpy(&source_size, buffer + 20, sizeof(source_size));
+        stamp->mtime_ = mtime;
+        stamp->size_ = source_size;
+        return true;
+    }
+
+    Function * UndumpFunction(State *state, String *module,
+                              const char *buffer, std::size_t size,
+                              bool ref_code)
+    {
+        assert(!ref_code ||
+               reinterpret_cast<uintptr_t>(buffer) % kCodeAlignment == 0);
+        BytecodeReader reader(state, module, buffer, size, ref_code);
+        reader.SkipHeader();
+        auto func = reader.ReadFunction(nullptr);
+        if (!reader.IsEnd())
+            throw BytecodeException(module->GetCStr(), "extra data after bytecode");
+        return func;
+    }
+
+    void LinkBundle(const std::vector<BundleModule> &modules, std::string *out)
+    {
+        auto start = out->size();
+        out->append(kBundleSignature, 4);
+        out->push_back(static_cast<char>(kBytecodeVersion));
+        out->append(reinterpret_cast<const char *>(&kEndianCheck), 4);
+        auto count = static_cast<int32_t>(modules.size());
+        out->append(reinterpret_cast<const char *>(&count), 4);
+
+        // Module table: name, offset and size of bytecode from start
+        // of bundle, offsets are filled after size of table is known
+        std::vector<std::size_t> offset_pos;
+        for (const auto &module : modules)
+        {
+            auto length = static_cast<int32_t>(module.name_.size());
+            out->append(reinterpret_cast<const char *>(&length), 4);
+            out->append(module.name_);
+            offset_pos.push_back(out->size());
+            out->append(16, '\0');
+        }
+
+        for (std::size_t i = 0; i < modules.size(); ++i)
+        {
+            out->append(AlignPadding(out->size() - start, kModuleAlignment), '\0');
+            int64_t offset = out->size() - start;
+            int64_t size = modules[i].size_;
+            memcpy(&(*out)[offset_pos[i]], &offset, 8);
+            memcpy(&(*out)[offset_pos[i] + 8], &size, 8);
+            out->append(modules[i].bytecode_, modules[i].size_);
+        }
+    }
+
+    bool ReadBundle(const char *buffer, std::size_t size,
+                    std::vector<BundleModule> *modules)
+    {
+        if (size < kBundleHeaderSize ||
+            memcmp(buffer, kBundleSignature, 4) != 0 ||
+            static_cast<unsigned char>(buffer[4]) != kBytecodeVersion ||
+            !CheckPlatform(buffer + 5))
+            return false;
+
+        int32_t count = 0;
+        memcpy(&count, buffer + 9, 4);
+        if (count < 0)
+            return false;
+
+        auto pos = kBundleHeaderSize;
+        for (int32_t i = 0; i < count; ++i)
+        {
+            int32_t length = 0;
+            if (size - pos < 4)
+                return false;
+            memcpy(&length, buffer + pos, 4);
+            pos += 4;
+            if (length < 0 || size - pos < static_cast<std::size_t>(length) + 16)
+                return false;
+
+            BundleModule module;
+            module.name_.assign(buffer + pos, length);
+            pos += length;
+
+            int64_t offset = 0;
+            int64_t module_size = 0;
+            memcpy(&offset, buffer + pos, 8);
+            memcpy(&module_size, buffer + pos + 8, 8);
+            pos += 16;
+            if (offset < 0 || module_size < 0 ||
+                static_cast<uint64_t>(offset) > size ||
+                static_cast<uint64_t>(module_size) > size - offset)
+                return false;
+
+            module.bytecode_ = buffer + offset;
+            module.size_ = static_cast<std::size_t>(module_size);
+            modules->push_back(module);
+        }
+
+        return true;
+    }
+} // namespace oms
@@ -0,0 +1,78 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <string>
+#include <vector>
+
+namespace oms
+{
+    class State;
+    class String;
+    class Function;
+
+    // Version of bytecode format, increase it when format of bytecode
+    // or meaning of any instruction is changed
+    const unsigned char kBytecodeVersion = 2;
+
+    // Suffix of precompiled bytecode file of module
+    const char kBytecodeSuffix[] = ".omc";
+
+    // Bytecode of a module in bundle image
+    struct BundleModule
+    {
+        std::string name_;
+        const char *bytecode_;
+        std::size_t size_;
+
+        BundleModule() : bytecode_(nullptr), size_(0) { }
+    };
+
+    // Modify time and size of module source file, bytecode is fresh
+    // when its stamp is the same as the stamp of source file
+    struct SourceStamp
+    {
+        long long mtime_;
+        long long size_;
+
+        SourceStamp() : mtime_(0), size_(0) { }
+    };
+
+    inline bool operator == (const SourceStamp &l, const SourceStamp &r)
+    {
+        return l.mtime_ == r.mtime_ && l.size_ == r.size_;
+    }
+
+    // Get stamp of source file, return false when file is not existed
+    bool GetSourceStamp(const std::string &path, SourceStamp *stamp);
+
+    // Dump function prototype and all its child functions as bytecode
+    // with header, append bytecode to 'out'
+    void DumpFunction(const Function *func, const SourceStamp &stamp,
+                      std::string *out);
+
+    // Read stamp from bytecode header, return false when 'buffer' is
+    // not bytecode or bytecode of other version or platform
+    bool ReadBytecodeStamp(const char *buffer, std::size_t size,
+                           SourceStamp *stamp);
+
+    // Undump bytecode which header is checked by ReadBytecodeStamp,
+    // 'module' is module name of all functions, throw BytecodeException
+    // when bytecode is broken or operands of any instruction are out of
+    // range of its function. When 'ref_code' is true, instructions and
+    // lines of functions reference 'buffer' without copy, 'buffer' must
+    // be 4 bytes aligned and valid while the functions are alive
+    Function * UndumpFunction(State *state, String *module,
+                              const char *buffer, std::size_t size,
+                              bool ref_code = false);
+
+    // Link bytecode of modules into one bundle image, append it to 'out'
+    void LinkBundle(const std::vector<BundleModule> &modules, std::string *out);
+
+    // Read module table of bundle image, bytecode of modules points
+    // into 'buffer', return false when 'buffer' is not bundle image or
+    // image of other version or platform
+    bool ReadBundle(const char *buffer, std::size_t size,
+                    std::vector<BundleModule> *modules);
+} // namespace oms
+
+#endif // BYTECODE_H
@@ -5,6 +5,7 @@
 #include "mexception.h"
 #include "mguard.h"
 #include "mvisitor.h"
+#include <algorithm>
 #include <memory>
 #include <vector>
 #include <stack>
@@ -111,8 +112,9 @@ namespace oms
     class CodeGenerateVisitor : public Visitor
     {
     public:
-        explicit CodeGenerateVisitor(State *state)
-            : state_(state), current_function_(nullptr) { }
+        CodeGenerateVisitor(State *state,
+                            const std::shared_ptr<const std::string> &source)
+            : state_(state), source_(source), current_function_(nullptr) { }
 
         ~CodeGenerateVisitor()
         {
@@ -158,6 +160,10 @@ namespace oms
         virtual void Visit(FuncCallArgs *, void *);
         virtual void Visit(ExpressionList *, void *);
 
+        // Generate body of lazy function 'func' which upvalues are
+        // prepared when its closure is generated
+        void GenerateLazyFunction(FunctionBody *func_body, Function *func);
+
         // Prepare function data when enter each lexical function
         void EnterFunction()
         {
@@ -448,6 +454,8 @@ namespace oms
 
     private:
         State *state_;
+        // Source of module when child functions are generated lazily
+        std::shared_ptr<const std::string> source_;
 
         void DeleteCurrentFunction()
         {
@@ -475,6 +483,24 @@ namespace oms
             }
         }
 
+        // Set count of values copied by OpType_VarArg when it is the
+        // last instruction and copies to register_id, -1 copies all
+        void SetVarArgCount(int register_id, int count)
+        {
+            auto function = GetCurrentFunction();
+            auto size = function->OpCodeSize();
+            if (size == 0)
+                return ;
+
+            auto last = function->GetMutableInstruction(size - 1);
+            if (Instruction::GetOpCode(*last) == OpType_VarArg &&
+                Instruction::GetParamA(*last) == register_id)
+                *last = Instruction::ABCode(OpType_VarArg, register_id, count + 1);
+        }
+
+        // Generate params and block of function body in current block
+        void GenerateFunctionBody(FunctionBody *func_body);
+
         template<typename StatementType>
         void IfStatementGenerateCode(StatementType *if_stmt);
 
@@ -724,6 +750,18 @@ namespace oms
             exp_count = exp_list->exp_list_.size();
 
             exp_list->Accept(this, nullptr);
+
+            // Return a function call only, it is a tail call
+            auto last = function->OpCodeSize() - 1;
+            auto call = function->GetMutableInstruction(last);
+            if (exp_count == 1 && exp_any_ &&
+                Instruction::GetOpCode(*call) == OpType_Call &&
+                Instruction::GetParamA(*call) == register_id)
+            {
+                *call = Instruction::ABCCode(OpType_TailCall, register_id,
+                                             Instruction::GetParamB(*call),
+                                             Instruction::GetParamC(*call));
+            }
         }
 
         instruction = Instruction::ABCCode(OpType_Ret, register_id, exp_count, exp_any_);
@@ -1081,6 +1119,9 @@ namespace oms
                 exp_list->Accept(this, nullptr);
                 if (exp_list->exp_any_)
                 {
+                    // Copy varargs for names only
+                    int last_register = start_register + exp_list->exp_list_.size() - 1;
+                    SetVarArgCount(last_register, std::max(end_register - last_register, 0));
                     instruction = Instruction::ACode(OpType_SetTop, end_register);
                     function->AddInstruction(instruction, line);
                 }
@@ -1118,6 +1159,9 @@ namespace oms
             exp_list->Accept(this, nullptr);
             if (exp_list->exp_any_)
             {
+                // Copy varargs for vars only
+                int last_register = start_register + exp_list->exp_list_.size() - 1;
+                SetVarArgCount(last_register, std::max<int>(end_register - last_register, 0));
                 instruction = Instruction::ACode(OpType_SetTop, end_register);
                 function->AddInstruction(instruction, line);
             }
@@ -1239,7 +1283,9 @@ namespace oms
         }
         else if (term->token_.token_ == Token_VarArg)
         {
-            instruction = Instruction::ACode(OpType_VarArg, register_id);
+            // One value by default, exp list adjusts it when
+            // expression is the last one
+            instruction = Instruction::ABCode(OpType_VarArg, register_id, 2);
         }
 
         function->AddInstruction(instruction, term->token_.line_);
@@ -1344,22 +1390,21 @@ namespace oms
             function->SetLine(func_body->line_);
             child_index = current_function_->func_index_;
 
+            if (source_)
+            {
+                // Upvalues are prepared for generating closure, and the
+                // body is generated on first call of the function
+                for (auto name : func_body->upvalues_)
+                    PrepareUpvalue(name);
+
+                auto begin = func_body->source_begin_ - source_->data();
+                auto end = func_body->source_end_ - source_->data();
+                function->SetLazySource(source_, begin, end, func_body->has_self_);
+            }
+            else
             {
                 CODE_GENERATE_GUARD(EnterBlock, LeaveBlock);
-                // Child function generate code
-                if (func_body->has_self_)
-                {
-                    auto register_id = GenerateRegisterId();
-                    auto self = state_->GetString("self");
-                    InsertName(self, register_id);
-
-                    auto function = GetCurrentFunction();
-                    function->AddFixedArgCount(1);
-                }
-
-                if (func_body->param_list_)
-                    func_body->param_list_->Accept(this, nullptr);
-                func_body->block_->Accept(this, nullptr);
+                GenerateFunctionBody(func_body);
             }
         }
 
@@ -1371,6 +1416,35 @@ namespace oms
         function->AddInstruction(i, func_body->line_);
     }
 
+    void CodeGenerateVisitor::GenerateLazyFunction(FunctionBody *func_body,
+                                                   Function *func)
+    {
+        assert(!current_function_);
+        current_function_ = new GenerateFunction;
+        current_function_->function_ = func;
+
+        CODE_GENERATE_GUARD(EnterBlock, LeaveBlock);
+        GenerateFunctionBody(func_body);
+    }
+
+    void CodeGenerateVisitor::GenerateFunctionBody(FunctionBody *func_body)
+    {
+        // Child function generate code
+        if (func_body->has_self_)
+        {
+            auto register_id = GenerateRegisterId();
+            auto self = state_->GetString("self");
+            InsertName(self, register_id);
+
+            auto function = GetCurrentFunction();
+            function->AddFixedArgCount(1);
+        }
+
+        if (func_body->param_list_)
+            func_body->param_list_->Accept(this, nullptr);
+        func_body->block_->Accept(this, nullptr);
+    }
+
     void CodeGenerateVisitor::Visit(ParamList *param_list, void *data)
     {
         auto function = GetCurrentFunction();
@@ -1543,14 +1617,28 @@ namespace oms
         for (int i = 0; i < count; ++i)
         {
             exp_list->exp_list_[i]->Accept(this, nullptr);
-            GenerateRegisterId();
+            auto register_id = GenerateRegisterId();
+            if (i == count - 1 && exp_list->exp_any_)
+                SetVarArgCount(register_id, -1);
         }
     }
 
-    void CodeGenerate(SyntaxTree *root, State *state)
+    void CodeGenerate(SyntaxTree *root, State *state,
+                      const std::shared_ptr<const std::string> &source)
     {
         assert(root && state);
-        CodeGenerateVisitor code_generator(state);
+        CodeGenerateVisitor code_generator(state, source);
         root->Accept(&code_generator, nullptr);
     }
+
+    void CodeGenerate(SyntaxTree *func_body, Function *func, State *state)
+    {
+        assert(func_body && func && func->GetLazySource() && state);
+        CodeGenerateVisitor code_generator(state, func->GetLazySource()->source_);
+        code_generator.GenerateLazyFunction(static_cast<FunctionBody *>(func_body), func);
+        func->ClearLazySource();
+
+        // Function may be old, and references new objects now
+        CHECK_BARRIER(state->GetGC(), func);
+    }
 } // namespace oms
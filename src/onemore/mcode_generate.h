@@ -1,12 +1,26 @@
 #ifndef CODE_GENERATE_H
 #define CODE_GENERATE_H
 
+#include <memory>
+#include <string>
+
 namespace oms
 {
     class State;
+    class Function;
     class SyntaxTree;
 
-    void CodeGenerate(SyntaxTree *root, State *state);
+    // Version of code generator, increase it when generated code of the
+    // same source is changed, so cached bytecode is compiled again
+    const unsigned int kCompilerVersion = 1;
+
+    // Generate code of chunk 'root', when 'source' is not null, which is
+    // source of 'root', child functions are generated on their first call
+    void CodeGenerate(SyntaxTree *root, State *state,
+                      const std::shared_ptr<const std::string> &source = nullptr);
+
+    // Generate code of lazy function 'func' from its function body
+    void CodeGenerate(SyntaxTree *func_body, Function *func, State *state);
 } // namespace oms
 
 #endif // CODE_GENERATE_H
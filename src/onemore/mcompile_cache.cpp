@@ -0,0 +1,280 @@
+#include "mcompile_cache.h"
+#include "mbytecode.h"
+#include "mcode_generate.h"
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef _MSC_VER
+#include <Windows.h>
+#include <direct.h>
+#include <process.h>
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#endif // _MSC_VER
+
+namespace oms
+{
+    namespace
+    {
+        // Temporary files of writers older than it are left by crashed
+        // writers, other writers rename them in milliseconds
+        const long long kStaleTempSeconds = 60;
+
+        struct CacheEntry
+        {
+            std::string path_;
+            long long mtime_;
+            std::size_t size_;
+            // Temporary file of writer
+            bool temp_;
+        };
+
+        // Current time in unit of mtime_ of CacheEntry, and count of the
+        // unit per second
+#ifdef _MSC_VER
+        const long long kTimeUnitsPerSecond = 10000000;
+
+        long long GetNow()
+        {
+            FILETIME now;
+            GetSystemTimeAsFileTime(&now);
+            ULARGE_INTEGER time;
+            time.LowPart = now.dwLowDateTime;
+            time.HighPart = now.dwHighDateTime;
+            return static_cast<long long>(time.QuadPart);
+        }
+#else
+        const long long kTimeUnitsPerSecond = 1;
+
+        long long GetNow()
+        {
+            return static_cast<long long>(time(nullptr));
+        }
+#endif // _MSC_VER
+
+        // List all entries and temporary files in cache directory
+        std::vector<CacheEntry> ListEntries(const std::string &dir)
+        {
+            std::vector<CacheEntry> entries;
+            std::string suffix(kBytecodeSuffix);
+            std::string temp_suffix(".tmp");
+            auto has_suffix = [](const std::string &name, const std::string &suffix) {
+                return name.size() > suffix.size() &&
+                    name.compare(name.size() - suffix.size(),
+                                 suffix.size(), suffix) == 0;
+            };
+            auto is_entry = [&](const std::string &name) {
+                return has_suffix(name, suffix) || has_suffix(name, temp_suffix);
+            };
+
+#ifdef _MSC_VER
+            WIN32_FIND_DATAA data;
+            auto handle = FindFirstFileA((dir + "\\*").c_str(), &data);
+            if (handle == INVALID_HANDLE_VALUE)
+                return entries;
+            do
+            {
+                std::string name = data.cFileName;
+                if (!is_entry(name))
+                    continue;
+
+                ULARGE_INTEGER mtime;
+                mtime.LowPart = data.ftLastWriteTime.dwLowDateTime;
+                mtime.HighPart = data.ftLastWriteTime.dwHighDateTime;
+                CacheEntry entry;
+                entry.path_ = dir + "/" + name;
+                entry.mtime_ = static_cast<long long>(mtime.QuadPart);
+                entry.size_ = data.nFileSizeLow;
+                entry.temp_ = has_suffix(name, temp_suffix);
+                entries.push_back(entry);
+            } while (FindNextFileA(handle, &data));
+            FindClose(handle);
+#else
+            auto d = opendir(dir.c_str());
+            if (!d)
+                return entries;
+            while (auto ent = readdir(d))
+            {
+                std::string name = ent->d_name;
+                if (!is_entry(name))
+                    continue;
+
+                CacheEntry entry;
+                entry.path_ = dir + "/" + name;
+                struct stat st;
+                if (stat(entry.path_.c_str(), &st) != 0)
+                    continue;
+                entry.mtime_ = st.st_mtime;
+                entry.size_ = st.st_size;
+                entry.temp_ = has_suffix(name, temp_suffix);
+                entries.push_back(entry);
+            }
+            closedir(d);
+#endif // _MSC_VER
+            return entries;
+        }
+
+        // Rename 'from' to 'to' atomically, replace 'to' when it is existed
+        bool ReplaceFile(const std::string &from, const std::string &to)
+        {
+#ifdef _MSC_VER
+            return MoveFileExA(from.c_str(), to.c_str(),
+                               MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+            return rename(from.c_str(), to.c_str()) == 0;
+#endif // _MSC_VER
+        }
+
+        // Unique suffix of temporary file in all processes and threads
+        std::string GetTempSuffix()
+        {
+            static std::atomic<unsigned int> counter(0);
+#ifdef _MSC_VER
+            auto pid = _getpid();
+#else
+            auto pid = getpid();
+#endif // _MSC_VER
+            char suffix[64];
+            snprintf(suffix, sizeof(suffix), ".%d.%u.tmp",
+                     static_cast<int>(pid), counter++);
+            return suffix;
+        }
+    } // namespace
+
+    CompileCache::CompileCache(const std::string &dir, std::size_t max_bytes)
+        : dir_(dir), max_bytes_(max_bytes),
+          scanned_(false), total_bytes_(0), puts_(0)
+    {
+#ifdef _MSC_VER
+        _mkdir(dir_.c_str());
+#else
+        mkdir(dir_.c_str(), 0755);
+#endif // _MSC_VER
+    }
+
+    std::string CompileCache::GetKey(const char *source, std::size_t size)
+    {
+        // 64 bits FNV-1a hash of source content
+        uint64_t hash = 14695981039346656037ULL;
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            hash ^= static_cast<unsigned char>(source[i]);
+            hash *= 1099511628211ULL;
+        }
+
+        char key[64];
+        snprintf(key, sizeof(key), "%016llx%08llx-%u-%u",
+                 static_cast<unsigned long long>(hash),
+                 static_cast<unsigned long long>(size),
+                 static_cast<unsigned int>(kBytecodeVersion),
+                 kCompilerVersion);
+        return key;
+    }
+
+    bool CompileCache::Get(const std::string &key, std::string *bytecode)
+    {
+        auto path = GetPath(key);
+        FILE *file = fopen(path.c_str(), "rb");
+        if (!file)
+            return false;
+
+        char buffer[64 * 1024];
+        std::size_t count = 0;
+        bytecode->clear();
+        while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+            bytecode->append(buffer, count);
+        fclose(file);
+
+        // Touch entry, so it is recently used when evict entries
+#ifdef _MSC_VER
+        _utime(path.c_str(), nullptr);
+#else
+        utime(path.c_str(), nullptr);
+#endif // _MSC_VER
+        return true;
+    }
+
+    void CompileCache::Put(const std::string &key, const std::string &bytecode)
+    {
+        // Write a temporary file and rename it to entry, so other
+        // processes never read a partial entry
+        auto path = GetPath(key);
+        auto temp = path + GetTempSuffix();
+        FILE *file = fopen(temp.c_str(), "wb");
+        if (!file)
+            return ;
+
+        auto size = fwrite(bytecode.data(), 1, bytecode.size(), file);
+        auto closed = fclose(file) == 0;
+        if (size != bytecode.size() || !closed || !ReplaceFile(temp, path))
+        {
+            remove(temp.c_str());
+            return ;
+        }
+
+        // Count of replaced entries is not subtracted, the directory is
+        // scanned when count exceeds the cap anyway
+        std::lock_guard<std::mutex> lock(mutex_);
+        total_bytes_ += bytecode.size();
+        if (!scanned_ || total_bytes_ > max_bytes_ || ++puts_ >= kRescanPuts)
+            Evict(path);
+    }
+
+    void CompileCache::Remove(const std::string &key)
+    {
+        remove(GetPath(key).c_str());
+    }
+
+    std::string CompileCache::GetPath(const std::string &key) const
+    {
+        return dir_ + "/" + key + kBytecodeSuffix;
+    }
+
+    void CompileCache::Evict(const std::string &keep)
+    {
+        auto entries = ListEntries(dir_);
+        auto now = GetNow();
+        std::size_t total = 0;
+        for (auto it = entries.begin(); it != entries.end(); )
+        {
+            if (it->temp_)
+            {
+                if (now - it->mtime_ > kStaleTempSeconds * kTimeUnitsPerSecond)
+                    remove(it->path_.c_str());
+                it = entries.erase(it);
+            }
+            else
+            {
+                total += it->size_;
+                ++it;
+            }
+        }
+
+        scanned_ = true;
+        puts_ = 0;
+        total_bytes_ = total;
+        if (total <= max_bytes_)
+            return ;
+
+        std::sort(entries.begin(), entries.end(),
+                  [](const CacheEntry &l, const CacheEntry &r) {
+                      return l.mtime_ < r.mtime_;
+                  });
+        for (const auto &entry : entries)
+        {
+            if (total <= max_bytes_)
+                break;
+            if (entry.path_ != keep && remove(entry.path_.c_str()) == 0)
+                total -= entry.size_;
+        }
+        total_bytes_ = total;
+    }
+} // namespace oms
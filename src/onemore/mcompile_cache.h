@@ -0,0 +1,66 @@
+#ifndef COMPILE_CACHE_H
+#define COMPILE_CACHE_H
+
+#include <mutex>
+#include <string>
+
+namespace oms
+{
+    // On-disk cache of module bytecode shared by processes, entries are
+    // keyed by source content hash and compiler version, so unchanged
+    // sources are loaded without compiling in each restart. Entries are
+    // written atomically, and least recently used entries are evicted
+    // when total size of entries exceeds the size cap. Total size is
+    // counted in memory after the first scan of the directory, which is
+    // scanned again only when the count exceeds the cap or after some
+    // puts, since other processes put entries too.
+    class CompileCache
+    {
+    public:
+        // 'dir' is created when it is not existed
+        CompileCache(const std::string &dir, std::size_t max_bytes);
+
+        CompileCache(const CompileCache&) = delete;
+        void operator = (const CompileCache&) = delete;
+
+        // Get key of source content
+        static std::string GetKey(const char *source, std::size_t size);
+
+        // Get bytecode of key, return false when it is not cached
+        bool Get(const std::string &key, std::string *bytecode);
+
+        // Put bytecode of key, errors are ignored since cache is optional
+        void Put(const std::string &key, const std::string &bytecode);
+
+        // Remove entry of key, e.g. the entry is broken
+        void Remove(const std::string &key);
+
+    private:
+        std::string GetPath(const std::string &key) const;
+
+        // Scan entries and count total size of them, remove least recently
+        // used entries except 'keep' until total size is not greater than
+        // max_bytes_, mtime of file may be in seconds, so 'keep' is the
+        // entry just put. Temporary files left by crashed writers are
+        // removed too.
+        void Evict(const std::string &keep);
+
+        // Rescan the directory after the count of puts, so entries put by
+        // other processes are counted
+        static const unsigned int kRescanPuts = 256;
+
+        std::string dir_;
+        std::size_t max_bytes_;
+
+        // Guard counting of entries, Put is called by preload threads
+        std::mutex mutex_;
+        // Directory is scanned or not
+        bool scanned_;
+        // Total size of entries counted in memory
+        std::size_t total_bytes_;
+        // Count of puts after the last scan
+        unsigned int puts_;
+    };
+} // namespace oms
+
+#endif // COMPILE_CACHE_H
@@ -95,6 +95,16 @@ namespace oms
         }
     };
 
+    // For bytecode loader report broken bytecode
+    class BytecodeException : public Exception
+    {
+    public:
+        BytecodeException(const char *module, const char *desc)
+        {
+            SetWhat(module, ": ", desc);
+        }
+    };
+
     // Report error of call c function
     class CallCFuncException : public Exception
     {
@@ -0,0 +1,98 @@
+#include "mfinalizer.h"
+#include <chrono>
+#ifdef _MSC_VER
+#include <Windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif // _MSC_VER
+
+namespace oms
+{
+    Finalizer::Finalizer()
+        : head_(0), tail_(0), finished_(0),
+          sleeping_(false), quit_(false)
+    {
+        thread_ = std::thread(&Finalizer::Run, this);
+
+        // Finalizer thread runs when the mutator thread is idle, so it
+        // does not preempt the mutator in GC pauses on a busy core
+#ifdef _MSC_VER
+        SetThreadPriority(thread_.native_handle(), THREAD_PRIORITY_LOWEST);
+#elif defined(__linux__)
+        sched_param param = { 0 };
+        pthread_setschedparam(thread_.native_handle(), SCHED_IDLE, &param);
+#endif // _MSC_VER
+    }
+
+    Finalizer::~Finalizer()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            quit_ = true;
+        }
+        cond_.notify_one();
+        thread_.join();
+    }
+
+    void Finalizer::Post(FinalizeFunc func, void *data)
+    {
+        std::size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) == kQueueSize)
+        {
+            func(data);
+            finished_.fetch_add(1, std::memory_order_relaxed);
+            return ;
+        }
+
+        jobs_[tail % kQueueSize].func_ = func;
+        jobs_[tail % kQueueSize].data_ = data;
+        tail_.store(tail + 1);
+    }
+
+    void Finalizer::Flush()
+    {
+        // sleeping_ is set before finalizer thread checks the queue
+        // again, so posted jobs will not be missed
+        if (sleeping_.load() && head_.load() != tail_.load())
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            cond_.notify_one();
+        }
+    }
+
+    void Finalizer::Wait()
+    {
+        // Sleep rather than spin, finalizer thread in idle priority
+        // only runs when this thread is not running
+        Flush();
+        std::unique_lock<std::mutex> lock(mutex_);
+        drained_.wait(lock, [this] { return head_.load() == tail_.load(); });
+    }
+
+    void Finalizer::Run()
+    {
+        for (;;)
+        {
+            std::size_t head = head_.load(std::memory_order_relaxed);
+            if (head != tail_.load())
+            {
+                const Job &job = jobs_[head % kQueueSize];
+                job.func_(job.data_);
+                head_.store(head + 1);
+                finished_.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex_);
+            drained_.notify_all();
+            if (quit_)
+                break;
+
+            sleeping_ = true;
+            if (head == tail_.load())
+                cond_.wait_for(lock, std::chrono::milliseconds(10));
+            sleeping_ = false;
+        }
+    }
+} // namespace oms
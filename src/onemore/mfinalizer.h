@@ -0,0 +1,76 @@
+#ifndef FINALIZER_H
+#define FINALIZER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <cstddef>
+
+namespace oms
+{
+    // Background finalizer thread, it runs finalize jobs posted by GC,
+    // jobs must touch no VM state. Jobs are passed through a lock-free
+    // single producer single consumer queue, the mutex is only used to
+    // wake up the sleeping finalizer thread.
+    class Finalizer
+    {
+    public:
+        typedef void (*FinalizeFunc)(void *);
+
+        Finalizer();
+        // Run all posted jobs and stop finalizer thread
+        ~Finalizer();
+
+        Finalizer(const Finalizer&) = delete;
+        void operator = (const Finalizer&) = delete;
+
+        // Post a job to finalizer thread, the job runs at once in
+        // caller thread when the queue is full. Sleeping finalizer
+        // thread is not waked up until Flush, so GC posts jobs in a
+        // batch without being preempted by finalizer thread.
+        void Post(FinalizeFunc func, void *data);
+
+        // Wake up finalizer thread to run posted jobs
+        void Flush();
+
+        // Wait until all posted jobs finished
+        void Wait();
+
+        // Count of finished jobs, including jobs run in caller thread
+        std::size_t GetFinishedCount() const
+        { return finished_.load(); }
+
+    private:
+        struct Job
+        {
+            FinalizeFunc func_;
+            void *data_;
+        };
+
+        void Run();
+
+        static const std::size_t kQueueSize = 4096;
+
+        // Ring buffer of jobs, [head_, tail_) are posted jobs
+        Job jobs_[kQueueSize];
+        // Next job to run, only finalizer thread writes it
+        std::atomic<std::size_t> head_;
+        // Next free slot, only posting thread writes it
+        std::atomic<std::size_t> tail_;
+        // Count of finished jobs
+        std::atomic<std::size_t> finished_;
+
+        // Finalizer thread is waiting for jobs
+        std::atomic<bool> sleeping_;
+        // Stop finalizer thread
+        std::atomic<bool> quit_;
+        std::mutex mutex_;
+        std::condition_variable cond_;
+        // Notified when finalizer thread finished all posted jobs
+        std::condition_variable drained_;
+        std::thread thread_;
+    };
+} // namespace oms
+
+#endif // FINALIZER_H
@@ -1,11 +1,13 @@
 #include "mfunction.h"
 #include <limits>
+#include <cassert>
 
 namespace oms
 {
     Function::Function()
-        : module_(nullptr), line_(0), args_(0),
-          is_vararg_(false), superior_(nullptr)
+        : ref_opcodes_(nullptr), ref_opcode_lines_(nullptr),
+          ref_opcode_size_(0), module_(nullptr), line_(0), args_(0),
+          is_vararg_(false), superior_(nullptr), cache_(nullptr)
     {
     }
 
@@ -29,24 +31,50 @@ namespace oms
 
             for (const auto &upvalue : upvalues_)
                 upvalue.name_->Accept(v);
+
+            if (cache_)
+                cache_->Accept(v);
         }
     }
 
     const Instruction * Function::GetOpCodes() const
     {
+        if (ref_opcodes_)
+            return ref_opcodes_;
         return opcodes_.empty() ? nullptr : &opcodes_[0];
     }
 
     std::size_t Function::OpCodeSize() const
     {
-        return opcodes_.size();
+        return ref_opcodes_ ? ref_opcode_size_ : opcodes_.size();
     }
 
     Instruction * Function::GetMutableInstruction(std::size_t index)
     {
+        assert(!ref_opcodes_);
         return &opcodes_[index];
     }
 
+    void Function::RefOpCodes(const Instruction *opcodes, const int *lines,
+                              std::size_t size)
+    {
+        assert(opcodes_.empty());
+        ref_opcodes_ = opcodes;
+        ref_opcode_lines_ = lines;
+        ref_opcode_size_ = size;
+    }
+
+    void Function::SetLazySource(const std::shared_ptr<const std::string> &source,
+                                 std::size_t begin, std::size_t end, bool has_self)
+    {
+        assert(opcodes_.empty() && !ref_opcodes_);
+        lazy_.reset(new LazySource);
+        lazy_->source_ = source;
+        lazy_->begin_ = begin;
+        lazy_->end_ = end;
+        lazy_->has_self_ = has_self;
+    }
+
     std::size_t Function::AddInstruction(Instruction i, int line)
     {
         opcodes_.push_back(i);
@@ -176,7 +204,7 @@ namespace oms
 
     int Function::GetInstructionLine(int i) const
     {
-        return opcode_lines_[i];
+        return ref_opcode_lines_ ? ref_opcode_lines_[i] : opcode_lines_[i];
     }
 
     Closure::Closure()
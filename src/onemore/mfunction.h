@@ -6,6 +6,8 @@
 #include "mop_code.h"
 #include "mstring.h"
 #include "mupvalue.h"
+#include <memory>
+#include <string>
 #include <vector>
 
 namespace oms
@@ -37,6 +39,18 @@ namespace oms
             register_index_(register_index) { }
         };
 
+        // Source of function body which is compiled on first call
+        struct LazySource
+        {
+            // Source of module, shared by lazy functions of the module
+            std::shared_ptr<const std::string> source_;
+            // Function body from '(' to 'end' in source
+            std::size_t begin_;
+            std::size_t end_;
+            // Function has 'self' param or not
+            bool has_self_;
+        };
+
         Function();
 
         virtual void Accept(GCObjectVisitor *v);
@@ -47,6 +61,26 @@ namespace oms
         // Get instruction pointer, then it can be changed
         Instruction * GetMutableInstruction(std::size_t index);
 
+        // Reference instructions and their lines in a read-only image
+        // instead of own copies, 'opcodes' and 'lines' must be valid
+        // while this function is alive
+        void RefOpCodes(const Instruction *opcodes, const int *lines,
+                        std::size_t size);
+
+        // Set source of function body, instructions of this function are
+        // generated from the source on first call
+        void SetLazySource(const std::shared_ptr<const std::string> &source,
+                           std::size_t begin, std::size_t end, bool has_self);
+
+        // Get source of function body, return nullptr when this function
+        // is not compiled lazily or has been compiled
+        const LazySource * GetLazySource() const
+        { return lazy_.get(); }
+
+        // Clear source of function body after it is compiled
+        void ClearLazySource()
+        { lazy_.reset(); }
+
         // Add instruction, 'line' is line number of the instruction 'i',
         // return index of the new instruction
         std::size_t AddInstruction(Instruction i, int line);
@@ -116,7 +150,44 @@ namespace oms
         int GetLine() const
         { return line_; }
 
+        // Get and set closure cache, which is the last closure created
+        // from this prototype, it is reused when its upvalues are the
+        // same as upvalues of the closure to create
+        Closure * GetClosureCache() const
+        { return cache_; }
+        void SetClosureCache(Closure *cache)
+        { cache_ = cache; }
+
+        // Mark member GC objects by marker of GC
+        template<typename Marker>
+        void MarkMembers(Marker &marker) const
+        {
+            if (module_)
+                marker.MarkObject(module_);
+            if (superior_)
+                marker.MarkObject(superior_);
+
+            for (const auto &value : const_values_)
+                marker.MarkValue(value);
+
+            for (const auto &var : local_vars_)
+                marker.MarkObject(var.name_);
+
+            for (auto child : child_funcs_)
+                marker.MarkObject(child);
+
+            for (const auto &upvalue : upvalues_)
+                marker.MarkObject(upvalue.name_);
+
+            if (cache_)
+                marker.MarkObject(cache_);
+        }
+
     private:
+        // Bytecode dump and undump read and write members directly
+        friend class BytecodeWriter;
+        friend class BytecodeReader;
+
         // For debug
         struct LocalVarInfo
         {
@@ -139,6 +210,10 @@ namespace oms
         std::vector<Instruction> opcodes_;
         // opcodes' line number
         std::vector<int> opcode_lines_;
+        // referenced opcodes and line numbers in image
+        const Instruction *ref_opcodes_;
+        const int *ref_opcode_lines_;
+        std::size_t ref_opcode_size_;
         // const values in function
         std::vector<Value> const_values_;
         // debug info
@@ -157,6 +232,10 @@ namespace oms
         bool is_vararg_;
         // superior function pointer
         Function *superior_;
+        // closure cache
+        Closure *cache_;
+        // source of function body not compiled yet
+        std::unique_ptr<LazySource> lazy_;
     };
 
     // All runtime function are closures, this class object pointer to a
@@ -180,6 +259,16 @@ namespace oms
         Upvalue * GetUpvalue(std::size_t index) const
         { return upvalues_[index]; }
 
+        // Mark member GC objects by marker of GC
+        template<typename Marker>
+        void MarkMembers(Marker &marker) const
+        {
+            marker.MarkObject(prototype_);
+
+            for (auto upvalue : upvalues_)
+                marker.MarkObject(upvalue);
+        }
+
     private:
         // prototype Function
         Function *prototype_;
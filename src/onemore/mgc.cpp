@@ -4,13 +4,20 @@
 #include "mupvalue.h"
 #include "mstring.h"
 #include "muser_data.h"
+#include "mwork_stealing_deque.h"
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
 #include <assert.h>
-#include <time.h>
 
 namespace oms
 {
     GCObject::GCObject()
-        : next_(nullptr), generation_(GCGen0), gc_(0), gc_obj_type_(0)
+        : next_(nullptr), generation_(GCGen0), gc_(0), gc_obj_type_(0),
+          barriered_(0), size_class_(0), mark_(0)
     {
     }
 
@@ -18,83 +25,346 @@ namespace oms
     {
     }
 
-    class MinorMarkVisitor : public GCObjectVisitor
+    // Base of markers, members of GC objects are marked by per-type
+    // mark routines dispatched on GC object type, and derived marker
+    // implements MarkObject to mark each member GC object.
+    template<typename Derived>
+    class Marker
     {
     public:
-        virtual bool Visit(Table *t) { return VisitObj(t); }
-        virtual bool Visit(Function *f) { return VisitObj(f); }
-        virtual bool Visit(Closure *c) { return VisitObj(c); }
-        virtual bool Visit(Upvalue *u) { return VisitObj(u); }
-        virtual bool Visit(String *s) { return VisitObj(s); }
-        virtual bool Visit(UserData *u) { return VisitObj(u); }
+        void MarkValue(const Value &value)
+        {
+            auto derived = static_cast<Derived *>(this);
+            switch (value.type_)
+            {
+                case ValueT_Obj:
+                    derived->MarkObject(value.obj_);
+                    break;
+                case ValueT_String:
+                    derived->MarkObject(value.str_);
+                    break;
+                case ValueT_Closure:
+                    derived->MarkObject(value.closure_);
+                    break;
+                case ValueT_Table:
+                    derived->MarkObject(value.table_);
+                    break;
+                case ValueT_UserData:
+                    derived->MarkObject(value.user_data_);
+                    break;
+                default:
+                    break;
+            }
+        }
 
-    private:
-        bool VisitObj(GCObject *obj)
+        // Mark all member GC objects of obj
+        void MarkMembers(GCObject *obj)
         {
-            if (obj->generation_ == GCGen0 && obj->gc_ == GCFlag_White)
+            auto derived = static_cast<Derived *>(this);
+            switch (obj->gc_obj_type_)
             {
-                obj->gc_ = GCFlag_Black;
-                return true;
+                case GCObjectType_Table:
+                    derived->MarkTable(static_cast<Table *>(obj));
+                    break;
+                case GCObjectType_Function:
+                    derived->MarkFunction(static_cast<Function *>(obj));
+                    break;
+                case GCObjectType_Closure:
+                    static_cast<Closure *>(obj)->MarkMembers(*derived);
+                    break;
+                case GCObjectType_Upvalue:
+                    static_cast<Upvalue *>(obj)->MarkMembers(*derived);
+                    break;
+                case GCObjectType_UserData:
+                    static_cast<UserData *>(obj)->MarkMembers(*derived);
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        // Mark members of table, all members are strong by default
+        void MarkTable(Table *t)
+        { t->MarkMembers(*static_cast<Derived *>(this)); }
+
+        // Mark members of function, closure cache is strong by default
+        void MarkFunction(Function *f)
+        { f->MarkMembers(*static_cast<Derived *>(this)); }
+
+        // Object of value is gray or black in major GC, values which
+        // are not GC objects are always marked
+        static bool IsMarked(const Value &value)
+        {
+            switch (value.type_)
+            {
+                case ValueT_Obj:
+                    return value.obj_->mark_.load(std::memory_order_relaxed) != 0;
+                case ValueT_String:
+                    return value.str_->mark_.load(std::memory_order_relaxed) != 0;
+                case ValueT_Closure:
+                    return value.closure_->mark_.load(std::memory_order_relaxed) != 0;
+                case ValueT_Table:
+                    return value.table_->mark_.load(std::memory_order_relaxed) != 0;
+                case ValueT_UserData:
+                    return value.user_data_->mark_.load(std::memory_order_relaxed) != 0;
+                default:
+                    return true;
             }
-            return false;
         }
+
+        // Strings have no member GC objects, need not push them into
+        // gray stack
+        static bool HasMembers(GCObject *obj)
+        { return obj->gc_obj_type_ != GCObjectType_String; }
     };
 
-    class BarrieredMarkVisitor : public GCObjectVisitor
+    // Adapter of marker for root travellers, only root objects are
+    // visited, members of root objects are marked by gray stack.
+    template<typename MarkerType>
+    class RootVisitor : public GCObjectVisitor
     {
     public:
-        virtual bool Visit(Table *t) { return VisitObj(t); }
-        virtual bool Visit(Function *f) { return VisitObj(f); }
-        virtual bool Visit(Closure *c) { return VisitObj(c); }
-        virtual bool Visit(Upvalue *u) { return VisitObj(u); }
-        virtual bool Visit(String *s) { return VisitObj(s); }
-        virtual bool Visit(UserData *u) { return VisitObj(u); }
+        explicit RootVisitor(MarkerType &marker) : marker_(marker) { }
+
+        virtual bool Visit(Table *t) { marker_.MarkObject(t); return false; }
+        virtual bool Visit(Function *f) { marker_.MarkObject(f); return false; }
+        virtual bool Visit(Closure *c) { marker_.MarkObject(c); return false; }
+        virtual bool Visit(Upvalue *u) { marker_.MarkObject(u); return false; }
+        virtual bool Visit(String *s) { marker_.MarkObject(s); return false; }
+        virtual bool Visit(UserData *u) { marker_.MarkObject(u); return false; }
 
     private:
-        bool VisitObj(GCObject *obj)
+        MarkerType &marker_;
+    };
+
+    // Mark white GCGen0 objects black in minor GC
+    class MinorMarker : public Marker<MinorMarker>
+    {
+    public:
+        explicit MinorMarker(std::vector<GCObject *> &gray) : gray_(gray) { }
+
+        void MarkObject(GCObject *obj)
         {
-            // Visit member GC objects of obj when it is barriered object
-            if (obj->generation_ != GCGen0 && obj->gc_ == GCFlag_Black)
+            if (obj->generation_ == GCGen0 && IsWhite(obj->gc_))
             {
-                obj->gc_ = GCFlag_White;
-                return true;
+                obj->gc_ = GCFlag_Black;
+                if (HasMembers(obj))
+                    gray_.push_back(obj);
             }
+        }
 
-            // Visit GCGen0 generation object
-            if (obj->generation_ == GCGen0 && obj->gc_ == GCFlag_White)
+        // Mark members of all objects in gray stack
+        void Propagate()
+        {
+            while (!gray_.empty())
             {
-                obj->gc_ = GCFlag_Black;
-                return true;
+                auto obj = gray_.back();
+                gray_.pop_back();
+                MarkMembers(obj);
             }
-            return false;
         }
+
+    private:
+        std::vector<GCObject *> &gray_;
     };
 
-    class MajorMarkVisitor : public GCObjectVisitor
+    // Mark white objects gray and push them into gray stack in major GC
+    class GrayMarker : public Marker<GrayMarker>
     {
     public:
-        virtual bool Visit(Table *t) { return VisitObj(t); }
-        virtual bool Visit(Function *f) { return VisitObj(f); }
-        virtual bool Visit(Closure *c) { return VisitObj(c); }
-        virtual bool Visit(Upvalue *u) { return VisitObj(u); }
-        virtual bool Visit(String *s) { return VisitObj(s); }
-        virtual bool Visit(UserData *u) { return VisitObj(u); }
+        GrayMarker(std::vector<GCObject *> &gray, std::vector<Table *> &weak)
+            : gray_(gray), weak_(weak), work_(0) { }
+
+        void MarkObject(GCObject *obj)
+        {
+            ++work_;
+            if (IsWhite(obj->gc_))
+            {
+                obj->mark_.store(1, std::memory_order_relaxed);
+                if (HasMembers(obj))
+                {
+                    obj->gc_ = GCFlag_Gray;
+                    gray_.push_back(obj);
+                }
+                else
+                {
+                    obj->gc_ = GCFlag_Black;
+                }
+            }
+        }
+
+        // Mark gray object black and mark its members gray
+        void Scan(GCObject *obj)
+        {
+            ++work_;
+            obj->gc_ = GCFlag_Black;
+            MarkMembers(obj);
+        }
+
+        // Weak tables mark strong members only, and are recorded to
+        // remove dead entries after marking
+        void MarkTable(Table *t)
+        {
+            if (t->GetWeakMode() == TableWeak_None)
+            {
+                t->MarkMembers(*this);
+            }
+            else
+            {
+                weak_.push_back(t);
+                t->MarkStrongMembers(*this);
+            }
+        }
+
+        // Closure caches are dropped when major GC scans functions, so
+        // closures only referenced by caches are collected
+        void MarkFunction(Function *f)
+        {
+            f->SetClosureCache(nullptr);
+            f->MarkMembers(*this);
+        }
+
+        // Count of scanned objects and visited object references
+        unsigned int GetWork() const { return work_; }
 
     private:
-        bool VisitObj(GCObject *obj)
+        std::vector<GCObject *> &gray_;
+        std::vector<Table *> &weak_;
+        unsigned int work_;
+    };
+
+    // Mark white objects in parallel major GC marking, each marker owns
+    // a work stealing deque of gray objects. Markers claim objects by
+    // setting mark_ atomically, so each object is marked and scanned by
+    // one marker only, and other fields of objects claimed by other
+    // markers are never touched.
+    class ParallelMarker : public Marker<ParallelMarker>
+    {
+    public:
+        void MarkObject(GCObject *obj)
         {
-            if (obj->gc_ == GCFlag_White)
+            if (obj->mark_.load(std::memory_order_relaxed) != 0 ||
+                obj->mark_.exchange(1, std::memory_order_acq_rel) != 0)
+                return ;
+
+            if (HasMembers(obj))
+            {
+                obj->gc_ = GCFlag_Gray;
+                gray_.Push(obj);
+            }
+            else
             {
                 obj->gc_ = GCFlag_Black;
-                return true;
+            }
+        }
+
+        // Mark gray object black and mark its members
+        void Scan(GCObject *obj)
+        {
+            obj->gc_ = GCFlag_Black;
+            MarkMembers(obj);
+        }
+
+        void MarkTable(Table *t)
+        {
+            if (t->GetWeakMode() == TableWeak_None)
+            {
+                t->MarkMembers(*this);
             }
             else
             {
-                return false;
+                weak_.push_back(t);
+                t->MarkStrongMembers(*this);
             }
         }
+
+        void MarkFunction(Function *f)
+        {
+            f->SetClosureCache(nullptr);
+            f->MarkMembers(*this);
+        }
+
+        // Gray objects owned by this marker
+        WorkStealingDeque<GCObject> & GetGray() { return gray_; }
+
+        // Weak tables scanned by this marker
+        std::vector<Table *> & GetWeakTables() { return weak_; }
+
+    private:
+        WorkStealingDeque<GCObject> gray_;
+        std::vector<Table *> weak_;
     };
 
+    // Verify barriers of object, old objects referencing young objects
+    // need barrier, and black objects referencing white objects need
+    // barrier in major GC marking
+    class BarrierVerifier : public Marker<BarrierVerifier>
+    {
+    public:
+        explicit BarrierVerifier(bool marking)
+            : marking_(marking), missing_(false) { }
+
+        void MarkObject(GCObject *obj)
+        {
+            if (marking_ ? IsWhite(obj->gc_) : obj->generation_ == GCGen0)
+                missing_ = true;
+        }
+
+        // Weak references need no barrier in major GC marking, values
+        // of ephemeron tables are marked after marking finished
+        void MarkTable(Table *t)
+        {
+            if (marking_)
+                t->MarkStrongMembers(*this);
+            else
+                t->MarkMembers(*this);
+        }
+
+        bool IsMarked(const Value &) const { return false; }
+
+        // Verifying object references objects without barrier
+        bool IsMissing() const { return missing_; }
+
+    private:
+        bool marking_;
+        bool missing_;
+    };
+
+    // Collect member GC objects of object as references in heap
+    // snapshot, weak references are not collected, values of ephemeron
+    // tables are collected as references of the tables
+    class SnapshotCollector : public Marker<SnapshotCollector>
+    {
+    public:
+        explicit SnapshotCollector(std::vector<GCObject *> &members)
+            : members_(members) { }
+
+        void MarkObject(GCObject *obj)
+        { members_.push_back(obj); }
+
+        void MarkTable(Table *t)
+        {
+            if (t->GetWeakMode() == TableWeak_None)
+                t->MarkMembers(*this);
+            else
+                t->MarkStrongMembers(*this);
+        }
+
+        bool IsMarked(const Value &) const { return true; }
+
+    private:
+        std::vector<GCObject *> &members_;
+    };
+
+    // Wall time of GC pause, CPU time of process counts all threads
+    // of parallel marking
+    inline unsigned int MicrosecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        auto duration = std::chrono::steady_clock::now() - start;
+        return static_cast<unsigned int>(
+            std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+    }
+
 #define GC_LOG(log)                             \
     do                                          \
     {                                           \
@@ -105,10 +375,28 @@ namespace oms
     } while (0)
 
     GC::GC(const GCObjectDeleter &obj_deleter, bool log)
-        : obj_deleter_(obj_deleter)
+        : major_running_(false),
+          major_step_budget_(kMajorStepBudget),
+          major_step_bytes_(0),
+          pause_(kDefaultPause),
+          step_multiplier_(kDefaultStepMultiplier),
+          mark_threads_(1),
+          stopped_(false),
+          sweep_lists_(),
+          white_(GCFlag_White),
+          sweeping_(false),
+          lazy_sweep_(true),
+          pool_enabled_(true),
+          finalized_count_(0),
+          pause_histogram_(),
+          obj_deleter_(obj_deleter), torture_(false),
+          missing_barrier_count_(0)
     {
-        gen0_.threshold_count_ = kGen0InitThresholdCount;
-        gen1_.threshold_count_ = kGen1InitThresholdCount;
+        gen0_.threshold_bytes_ = kGen0InitThresholdBytes;
+        gen1_.threshold_bytes_ = kGen1InitThresholdBytes;
+
+        for (unsigned int i = 0; i < kSizeClassCount; ++i)
+            pools_[i].SetBlockSize((i + 1) * kSizeClassGranularity);
 
         if (log)
         {
@@ -118,9 +406,12 @@ namespace oms
 
     GC::~GC()
     {
+        LogPauseHistogram();
+        FinishSweep();
         DestroyGeneration(gen0_);
         DestroyGeneration(gen1_);
         DestroyGeneration(gen2_);
+        SetBackgroundFinalizer(false);
     }
 
     void GC::SetRootTraveller(const RootTravelType &minor, const RootTravelType &major)
@@ -129,77 +420,242 @@ namespace oms
         major_traveller_ = major;
     }
 
+    std::size_t GC::GetPoolSlabCount() const
+    {
+        std::size_t count = 0;
+        for (const auto &pool : pools_)
+            count += pool.GetSlabCount();
+        return count;
+    }
+
+    GCStats GC::GetStats() const
+    {
+        GCStats stats = stats_;
+        stats.objects_[GCGen0] = gen0_.count_;
+        stats.objects_[GCGen1] = gen1_.count_;
+        stats.objects_[GCGen2] = gen2_.count_;
+        stats.bytes_[GCGen0] = gen0_.bytes_;
+        stats.bytes_[GCGen1] = gen1_.bytes_;
+        stats.bytes_[GCGen2] = gen2_.bytes_;
+        return stats;
+    }
+
     Table * GC::NewTable(GCGeneration gen)
     {
-        auto t = new Table;
-        t->gc_obj_type_ = GCObjectType_Table;
-        SetObjectGen(t, gen);
-        return t;
+        auto table = NewObject<Table>(GCObjectType_Table, gen);
+        table->SetGC(this);
+        return table;
     }
 
     Function * GC::NewFunction(GCGeneration gen)
     {
-        auto f = new Function;
-        f->gc_obj_type_ = GCObjectType_Function;
-        SetObjectGen(f, gen);
-        return f;
+        return NewObject<Function>(GCObjectType_Function, gen);
     }
 
     Closure * GC::NewClosure(GCGeneration gen)
     {
-        auto c = new Closure;
-        c->gc_obj_type_ = GCObjectType_Closure;
-        SetObjectGen(c, gen);
-        return c;
+        return NewObject<Closure>(GCObjectType_Closure, gen);
     }
 
     Upvalue * GC::NewUpvalue(GCGeneration gen)
     {
-        auto u = new Upvalue;
-        u->gc_obj_type_ = GCObjectType_Upvalue;
-        SetObjectGen(u, gen);
-        return u;
+        return NewObject<Upvalue>(GCObjectType_Upvalue, gen);
     }
 
-    String * GC::NewString(GCGeneration gen)
+    String * GC::NewString(const char *str, std::size_t len, GCGeneration gen)
     {
-        auto s = new String;
+        unsigned int size_class = 0;
+        auto s = String::New(AllocObject(String::GetAllocSize(len), size_class),
+                             str, len);
         s->gc_obj_type_ = GCObjectType_String;
+        s->size_class_ = size_class;
         SetObjectGen(s, gen);
         return s;
     }
 
     UserData * GC::NewUserData(GCGeneration gen)
     {
-        auto u = new UserData;
-        u->gc_obj_type_ = GCObjectType_UserData;
-        SetObjectGen(u, gen);
-        return u;
+        return NewObject<UserData>(GCObjectType_UserData, gen);
+    }
+
+    void * GC::AllocObject(std::size_t size, unsigned int &size_class)
+    {
+        size_class = (size + kSizeClassGranularity - 1) / kSizeClassGranularity;
+        if (!pool_enabled_ || size_class > kSizeClassCount)
+        {
+            size_class = 0;
+            return ::operator new(size);
+        }
+        return pools_[size_class - 1].Alloc();
+    }
+
+    template<typename ObjType>
+    ObjType * GC::NewObject(GCObjectType type, GCGeneration gen)
+    {
+        unsigned int size_class = 0;
+        void *mem = AllocObject(sizeof(ObjType), size_class);
+        auto obj = new (mem) ObjType;
+        obj->gc_obj_type_ = type;
+        obj->size_class_ = size_class;
+        SetObjectGen(obj, gen);
+        return obj;
+    }
+
+    void GC::DeleteObject(GCObject *obj)
+    {
+        obj_deleter_(obj, obj->gc_obj_type_);
+
+        auto size = GetObjectSize(obj);
+        stats_.type_objects_[obj->gc_obj_type_]--;
+        stats_.type_bytes_[obj->gc_obj_type_] -= size;
+        stats_.freed_bytes_ += size;
+
+        // Destroy user data in background finalizer
+        if (finalizer_ && obj->gc_obj_type_ == GCObjectType_UserData)
+        {
+            auto user_data = static_cast<UserData *>(obj);
+            auto destroyer = user_data->TakeDestroyer();
+            if (destroyer)
+                finalizer_->Post(destroyer, user_data->GetData());
+        }
+
+        auto size_class = obj->size_class_;
+        obj->~GCObject();
+        if (size_class != 0)
+            pools_[size_class - 1].Free(obj);
+        else if (finalizer_)
+            finalizer_->Post(FreeMemory, obj);
+        else
+            ::operator delete(obj);
+    }
+
+    void GC::FreeMemory(void *memory)
+    {
+        ::operator delete(memory);
+    }
+
+    void GC::SetBackgroundFinalizer(bool enable)
+    {
+        if (enable && !finalizer_)
+        {
+            finalizer_.reset(new Finalizer);
+        }
+        else if (!enable && finalizer_)
+        {
+            finalizer_->Wait();
+            finalized_count_ += finalizer_->GetFinishedCount();
+            finalizer_.reset();
+        }
+    }
+
+    void GC::WaitFinalizer()
+    {
+        if (finalizer_)
+            finalizer_->Wait();
     }
 
     void GC::SetBarrier(GCObject *obj)
     {
+        if (major_running_)
+        {
+            // Black object becomes gray again to keep tri-color
+            // invariant, its members will be marked again when major GC
+            // finish, so objects which are modified frequently will not
+            // be marked again and again
+            if (obj->gc_ == GCFlag_Black)
+            {
+                obj->gc_ = GCFlag_Gray;
+                gray_again_.push_back(obj);
+            }
+            return ;
+        }
+
         assert(obj->generation_ != GCGen0);
-        barriered_.push_back(obj);
+        if (!obj->barriered_)
+        {
+            obj->barriered_ = 1;
+            barriered_.push_back(obj);
+        }
+    }
+
+    void GC::ResizeObject(GCObject *obj, std::size_t old_bytes,
+                          std::size_t new_bytes)
+    {
+        GenInfo &gen = obj->generation_ == GCGen0 ? gen0_ :
+            (obj->generation_ == GCGen1 ? gen1_ : gen2_);
+        gen.bytes_ = gen.bytes_ - old_bytes + new_bytes;
+        stats_.type_bytes_[obj->gc_obj_type_] =
+            stats_.type_bytes_[obj->gc_obj_type_] - old_bytes + new_bytes;
+        if (new_bytes > old_bytes)
+            stats_.allocated_bytes_ += new_bytes - old_bytes;
+        else
+            stats_.freed_bytes_ += old_bytes - new_bytes;
     }
 
     void GC::CheckGC()
     {
-        if (gen0_.count_ >= gen0_.threshold_count_)
+        if (torture_)
+            VerifyBarriers();
+
+        if (stopped_)
+            return ;
+
+        // Old objects grow without new objects when their owned memory
+        // grows, e.g. filling a table in a loop, so major GC starts and
+        // steps by allocated bytes including it
+        bool run = false;
+        if (major_running_)
+            run = stats_.allocated_bytes_ >= major_step_bytes_ || torture_;
+        else if (sweeping_)
+            run = stats_.allocated_bytes_ >= major_step_bytes_ ||
+                gen0_.bytes_ >= gen0_.threshold_bytes_ || torture_;
+        else
+            run = gen0_.bytes_ >= gen0_.threshold_bytes_ ||
+                GetOldBytes() >= gen1_.threshold_bytes_ ||
+                (torture_ && gen0_.count_ >= kTortureThresholdCount);
+
+        if (run)
         {
-            unsigned int gen0_count = gen0_.count_;
-            unsigned int gen0_threshold = gen0_.threshold_count_;
-            unsigned int gen1_count = gen1_.count_;
-            unsigned int gen1_threshold = gen1_.threshold_count_;
-            unsigned int gen2_count = gen2_.count_;
-            unsigned int gen2_threshold = gen2_.threshold_count_;
+            std::size_t gen0_bytes = gen0_.bytes_;
+            std::size_t gen0_threshold = gen0_.threshold_bytes_;
+            std::size_t old_bytes = GetOldBytes();
+            std::size_t old_threshold = gen1_.threshold_bytes_;
 
             const char *gc_name = "";
-            clock_t start = clock();
-            if (gen1_.count_ >= gen1_.threshold_count_)
+            bool major_finished = false;
+            auto start = std::chrono::steady_clock::now();
+            if (major_running_)
             {
-                gc_name = "major";
-                MajorGC();
+                gc_name = "major step";
+                if (MajorGCStep(major_step_budget_))
+                {
+                    gc_name = "major finish";
+                    FinishMajorGC();
+                    major_finished = !sweeping_;
+                }
+            }
+            else if (sweeping_ && gen0_.bytes_ < gen0_.threshold_bytes_)
+            {
+                gc_name = "sweep step";
+                if (MajorGCSweepStep(kSweepStepCount))
+                {
+                    gc_name = "sweep finish";
+                    major_finished = true;
+                }
+            }
+            else if (!sweeping_ && GetOldBytes() >= gen1_.threshold_bytes_)
+            {
+                if (major_step_budget_ == 0)
+                {
+                    gc_name = "major";
+                    MajorGC();
+                    major_finished = !sweeping_;
+                }
+                else
+                {
+                    gc_name = "major start";
+                    StartMajorGC();
+                }
             }
             else
             {
@@ -207,15 +663,103 @@ namespace oms
                 MinorGC();
             }
 
-            clock_t duration = clock() - start;
-            unsigned int microseconds = duration * 1000000 / CLOCKS_PER_SEC;
+            if (major_running_ || sweeping_)
+                major_step_bytes_ = stats_.allocated_bytes_ + kMajorStepAllocBytes;
+
+            unsigned int microseconds = MicrosecondsSince(start);
+            RecordPause(microseconds);
             GC_LOG(gc_name << "[" << microseconds << " microseconds]: " <<
-                   gen0_count << " " << gen0_threshold << " | " <<
-                   gen1_count << " " << gen1_threshold << " | " <<
-                   gen2_count << " " << gen2_threshold << " - " <<
-                   gen0_.count_ << " " << gen0_.threshold_count_ << " | " <<
-                   gen1_.count_ << " " << gen1_.threshold_count_ << " | " <<
-                   gen2_.count_ << " " << gen2_.threshold_count_);
+                   gen0_bytes << " " << gen0_threshold << " | " <<
+                   old_bytes << " " << old_threshold << " - " <<
+                   gen0_.bytes_ << " " << gen0_.threshold_bytes_ << " | " <<
+                   GetOldBytes() << " " << gen1_.threshold_bytes_ <<
+                   " | objects " << gen0_.count_ << " " << gen1_.count_ <<
+                   " " << gen2_.count_ <<
+                   " | gray " << gray_.size() << " " << gray_again_.size() <<
+                   (sweeping_ ? " | sweeping" : ""));
+
+            if (major_finished)
+                LogPauseHistogram();
+            if (finalizer_)
+                finalizer_->Flush();
+        }
+    }
+
+    void GC::FullGC()
+    {
+        auto start = std::chrono::steady_clock::now();
+        if (major_running_)
+            FinishMajorGC();
+        else
+            MajorGC();
+        FinishSweep();
+
+        unsigned int microseconds = MicrosecondsSince(start);
+        RecordPause(microseconds);
+        GC_LOG("full[" << microseconds << " microseconds]: " <<
+               gen0_.bytes_ << " " << gen0_.threshold_bytes_ << " | " <<
+               GetOldBytes() << " " << gen1_.threshold_bytes_);
+        LogPauseHistogram();
+        if (finalizer_)
+            finalizer_->Flush();
+    }
+
+    bool GC::StepGC()
+    {
+        bool finished = false;
+        major_step_bytes_ = stats_.allocated_bytes_ + kMajorStepAllocBytes;
+        if (sweeping_)
+        {
+            finished = MajorGCSweepStep(kSweepStepCount);
+        }
+        else if (!major_running_ && major_step_budget_ == 0)
+        {
+            MajorGC();
+            finished = !sweeping_;
+        }
+        else
+        {
+            if (!major_running_)
+                StartMajorGC();
+            if (MajorGCStep(major_step_budget_))
+            {
+                FinishMajorGC();
+                finished = !sweeping_;
+            }
+        }
+
+        if (finalizer_)
+            finalizer_->Flush();
+        return finished;
+    }
+
+    void GC::SetStepMultiplier(unsigned int percent)
+    {
+        step_multiplier_ = percent;
+        major_step_budget_ = static_cast<unsigned int>(
+            static_cast<unsigned long long>(kMajorStepBudget) * percent /
+            kDefaultStepMultiplier);
+    }
+
+    std::size_t GC::GetObjectSize(GCObject *obj) const
+    {
+        switch (obj->gc_obj_type_)
+        {
+            case GCObjectType_Table:
+                return sizeof(Table) + static_cast<Table *>(obj)->GetStorageBytes();
+            case GCObjectType_Function:
+                return sizeof(Function);
+            case GCObjectType_Closure:
+                return sizeof(Closure);
+            case GCObjectType_Upvalue:
+                return sizeof(Upvalue);
+            case GCObjectType_String:
+                return String::GetAllocSize(static_cast<String *>(obj)->GetLength());
+            case GCObjectType_UserData:
+                return sizeof(UserData);
+            default:
+                assert(0);
+                return 0;
         }
     }
 
@@ -239,56 +783,114 @@ namespace oms
         assert(gen_info);
 
         obj->generation_ = gen;
+        obj->gc_ = white_;
         obj->next_ = gen_info->gen_;
         gen_info->gen_ = obj;
         gen_info->count_++;
+
+        auto size = GetObjectSize(obj);
+        gen_info->bytes_ += size;
+        stats_.type_objects_[obj->gc_obj_type_]++;
+        stats_.type_bytes_[obj->gc_obj_type_] += size;
+        stats_.allocated_bytes_ += size;
     }
 
     void GC::MinorGC()
     {
-        unsigned int old_gen1_count = gen1_.count_;
+        std::size_t old_gen1_bytes = gen1_.bytes_;
+        stats_.minor_count_++;
+        stats_.young_bytes_ += gen0_.bytes_;
 
         MinorGCMark();
+        ClearBarriered();
         MinorGCSweep();
 
-        barriered_.clear();
-
-        // Caculate objects count from gen0_ to gen1_, which is how
-        // many alived objects in gen0_ after mark-sweep, and adjust
-        // gen0_'s threshold count by the alived_gen0_count
-        unsigned int alived_gen0_count = gen1_.count_ - old_gen1_count;
-        AdjustThreshold(alived_gen0_count, gen0_, kGen0InitThresholdCount,
-                        kGen0MaxThresholdCount);
+        // Caculate bytes from gen0_ to gen1_, which is how many bytes
+        // of objects alived in gen0_ after mark-sweep, and adjust
+        // gen0_'s threshold bytes by the survived bytes
+        std::size_t alived_gen0_bytes = gen1_.bytes_ - old_gen1_bytes;
+        stats_.promoted_bytes_ += alived_gen0_bytes;
+        AdjustThreshold(alived_gen0_bytes, gen0_, kGen0InitThresholdBytes,
+                        kGen0MaxThresholdBytes);
     }
 
     void GC::MajorGC()
     {
-        MajorGCMark();
-        MajorGCSweep();
+        StartMajorGC();
+        FinishMajorGC();
+    }
 
-        barriered_.clear();
+    void GC::StartMajorGC()
+    {
+        assert(!major_running_ && gray_.empty() && gray_again_.empty() &&
+               weak_tables_.empty());
+
+        // Objects of previous major GC must be swept before marking
+        FinishSweep();
+
+        // Barriered objects may be swept in major GC, and barriers
+        // keep tri-color invariant in major GC, so clear them
+        ClearBarriered();
+
+        major_running_ = true;
+        MajorGCMarkRoot();
+    }
+
+    bool GC::MajorGCStep(unsigned int budget)
+    {
+        if (budget == 0 && mark_threads_ > 1)
+        {
+            ParallelMark();
+            return true;
+        }
+
+        GrayMarker marker(gray_, weak_tables_);
+        while (!gray_.empty())
+        {
+            if (budget != 0 && marker.GetWork() >= budget)
+                return false;
+
+            auto obj = gray_.back();
+            gray_.pop_back();
+            marker.Scan(obj);
+        }
+        return true;
+    }
+
+    void GC::FinishMajorGC()
+    {
+        // Mark roots again, objects which are referenced by roots only
+        // after major GC started are marked
+        MajorGCMarkRoot();
+        gray_.insert(gray_.end(), gray_again_.begin(), gray_again_.end());
+        gray_again_.clear();
+        MajorGCStep(0);
+        MarkEphemerons();
+        ClearWeakTables();
+
+        stats_.major_count_++;
+        major_running_ = false;
+        MajorGCSweep();
     }
 
     void GC::MinorGCMark()
     {
         assert(minor_traveller_);
 
-        // Visit all minor GC root objects
-        MinorMarkVisitor marker;
-        minor_traveller_(&marker);
+        // Mark all minor GC root objects
+        MinorMarker marker(gray_);
+        RootVisitor<MinorMarker> root_visitor(marker);
+        minor_traveller_(&root_visitor);
 
-        // Visit all barriered GC objects
-        BarrieredMarkVisitor barriered_maker;
+        // Mark members of all barriered GC objects
         for (auto obj : barriered_)
         {
             // All barriered objects must be GCGen1 or GCGen2.
             assert(obj->generation_ != GCGen0);
-
-            // Mark barriered objects, and visitor can visit
-            // member GC objects of barriered objects.
-            obj->gc_ = GCFlag_Black;
-            obj->Accept(&barriered_maker);
+            marker.MarkMembers(obj);
         }
+
+        marker.Propagate();
     }
 
     void GC::MinorGCSweep()
@@ -302,105 +904,545 @@ namespace oms
             // Move object to GCGen1 generation when object is black
             if (obj->gc_ == GCFlag_Black)
             {
-                obj->gc_ = GCFlag_White;
+                obj->gc_ = white_;
                 obj->generation_ = GCGen1;
                 obj->next_ = gen1_.gen_;
                 gen1_.gen_ = obj;
                 gen1_.count_++;
+                gen1_.bytes_ += GetObjectSize(obj);
             }
             else
             {
-                obj_deleter_(obj, obj->gc_obj_type_);
+                DeleteObject(obj);
             }
         }
 
         gen0_.count_ = 0;
+        gen0_.bytes_ = 0;
     }
 
-    void GC::MajorGCMark()
+    void GC::MajorGCMarkRoot()
     {
         assert(major_traveller_);
 
-        // Visit all major GC root objects
-        MajorMarkVisitor marker;
-        major_traveller_(&marker);
+        // Mark all major GC root objects gray
+        GrayMarker marker(gray_, weak_tables_);
+        RootVisitor<GrayMarker> root_visitor(marker);
+        major_traveller_(&root_visitor);
     }
 
-    void GC::MajorGCSweep()
+    void GC::ParallelMark()
     {
-        // Sweep all generations
-        SweepGeneration(gen2_);
-        SweepGeneration(gen1_);
-        SweepGeneration(gen0_);
+        std::vector<std::unique_ptr<ParallelMarker>> markers;
+        for (unsigned int i = 0; i < mark_threads_; ++i)
+            markers.emplace_back(new ParallelMarker);
 
-        // Move all GCGen0 objects to GCGen1
-        while (gen0_.gen_)
+        // Gray objects are claimed already, other markers steal them
+        // from the marker of this thread
+        for (auto obj : gray_)
+            markers[0]->GetGray().Push(obj);
+        gray_.clear();
+
+        // Count of running markers and markers found no gray objects,
+        // marking finished when all running markers are idle. Only the
+        // owner pushes into its deque, so a marker has gray objects
+        // only if its owner is not idle.
+        std::atomic<unsigned int> running(mark_threads_);
+        std::atomic<unsigned int> idle(0);
+
+        auto steal = [&](unsigned int index) -> GCObject * {
+            for (unsigned int i = 1; i < markers.size(); ++i)
+            {
+                auto &gray = markers[(index + i) % markers.size()]->GetGray();
+                if (auto obj = gray.Steal())
+                    return obj;
+            }
+            return nullptr;
+        };
+
+        auto has_gray = [&]() {
+            for (auto &marker : markers)
+            {
+                if (!marker->GetGray().IsEmpty())
+                    return true;
+            }
+            return false;
+        };
+
+        auto mark = [&](unsigned int index) {
+            auto &marker = *markers[index];
+            for (;;)
+            {
+                while (auto obj = marker.GetGray().Pop())
+                    marker.Scan(obj);
+
+                if (auto obj = steal(index))
+                {
+                    marker.Scan(obj);
+                    continue;
+                }
+
+                idle.fetch_add(1);
+                for (;;)
+                {
+                    if (idle.load() == running.load())
+                        return ;
+                    if (has_gray())
+                    {
+                        idle.fetch_sub(1);
+                        break;
+                    }
+                    std::this_thread::yield();
+                }
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (unsigned int i = 1; i < mark_threads_; ++i)
         {
-            GCObject *obj = gen0_.gen_;
-            gen0_.gen_ = gen0_.gen_->next_;
+            try
+            {
+                threads.emplace_back(mark, i);
+            }
+            catch (const std::system_error &)
+            {
+                break;
+            }
+        }
 
-            obj->generation_ = GCGen1;
-            obj->next_ = gen1_.gen_;
-            gen1_.gen_ = obj;
+        // Markers not started have no gray objects, do not wait them
+        running.store(static_cast<unsigned int>(threads.size()) + 1);
+        mark(0);
+        for (auto &thread : threads)
+            thread.join();
+
+        for (auto &marker : markers)
+        {
+            auto &weak = marker->GetWeakTables();
+            weak_tables_.insert(weak_tables_.end(), weak.begin(), weak.end());
         }
+    }
+
+    void GC::MarkEphemerons()
+    {
+        // Marked values may make keys of other ephemeron tables alived,
+        // so mark them until no more values marked
+        for (;;)
+        {
+            bool marked = false;
+            GrayMarker marker(gray_, weak_tables_);
+            for (auto t : weak_tables_)
+            {
+                if (t->GetWeakMode() == TableWeak_Ephemeron &&
+                    t->MarkEphemeronValues(marker))
+                    marked = true;
+            }
+
+            if (!marked)
+                break;
+            MajorGCStep(0);
+        }
+    }
+
+    void GC::ClearWeakTables()
+    {
+        // Weak tables scanned again by barrier are recorded repeatedly
+        std::sort(weak_tables_.begin(), weak_tables_.end());
+        weak_tables_.erase(std::unique(weak_tables_.begin(), weak_tables_.end()),
+                           weak_tables_.end());
+
+        auto is_dead = [](const Value &value) { return !GrayMarker::IsMarked(value); };
+        for (auto t : weak_tables_)
+            t->RemoveDeadEntries(is_dead);
+        weak_tables_.clear();
+    }
 
-        // Adjust GCGen0 threshold count
-        AdjustThreshold(gen0_.count_, gen0_, kGen0InitThresholdCount,
-                        kGen0MaxThresholdCount);
+    void GC::MajorGCSweep()
+    {
+        // All GCGen0 objects become GCGen1 objects, alived objects in
+        // sweep lists must be old, so stores into them are barriered
+        for (auto obj = gen0_.gen_; obj; obj = obj->next_)
+            obj->generation_ = GCGen1;
 
         gen1_.count_ += gen0_.count_;
+        gen1_.bytes_ += gen0_.bytes_;
         gen0_.count_ = 0;
+        gen0_.bytes_ = 0;
 
-        // Adjust GCGen1 threshold count
-        AdjustThreshold(gen1_.count_, gen1_, kGen1InitThresholdCount,
-                        kGen1MaxThresholdCount);
-        if (gen1_.count_ >= kGen1MaxThresholdCount)
+        // Move all generations into sweep lists, alived objects are
+        // moved back to their generations when they are swept, new
+        // objects and objects promoted by minor GC are never swept
+        assert(!sweeping_);
+        sweep_lists_[GCGen0] = gen0_.gen_;
+        sweep_lists_[GCGen1] = gen1_.gen_;
+        sweep_lists_[GCGen2] = gen2_.gen_;
+        gen0_.gen_ = nullptr;
+        gen1_.gen_ = nullptr;
+        gen2_.gen_ = nullptr;
+        sweeping_ = true;
+
+        // Flip current white, objects of the other white are dead, new
+        // objects and swept alived objects are current white
+        white_ = DeadWhite();
+
+        if (!lazy_sweep_)
+            MajorGCSweepStep(0);
+    }
+
+    bool GC::MajorGCSweepStep(unsigned int budget)
+    {
+        assert(sweeping_);
+        unsigned int dead_white = DeadWhite();
+        unsigned int swept = 0;
+        for (auto &list : sweep_lists_)
         {
-            gen1_.threshold_count_ = gen1_.count_ + kGen1MaxThresholdCount;
+            while (list)
+            {
+                if (budget != 0 && swept++ >= budget)
+                    return false;
+
+                GCObject *obj = list;
+                list = obj->next_;
+
+                assert(obj->gc_ != GCFlag_Gray);
+                GenInfo &gen = obj->generation_ == GCGen2 ? gen2_ : gen1_;
+                if (obj->gc_ == dead_white)
+                {
+                    gen.count_--;
+                    gen.bytes_ -= GetObjectSize(obj);
+                    DeleteObject(obj);
+                }
+                else
+                {
+                    obj->gc_ = white_;
+                    obj->mark_.store(0, std::memory_order_relaxed);
+                    obj->next_ = gen.gen_;
+                    gen.gen_ = obj;
+                }
+            }
         }
+
+        sweeping_ = false;
+
+        // Release idle slabs of object pools to system, minor GC keeps
+        // them for the next young objects
+        for (auto &pool : pools_)
+            pool.ReleaseIdleSlabs();
+
+        // Next major GC starts when old generations grow to pause
+        // percent of bytes alived now
+        gen1_.threshold_bytes_ = GetOldBytes() / 100 * pause_;
+        if (gen1_.threshold_bytes_ < kGen1InitThresholdBytes)
+            gen1_.threshold_bytes_ = kGen1InitThresholdBytes;
+        return true;
     }
 
-    void GC::SweepGeneration(GenInfo &gen)
+    void GC::FinishSweep()
     {
-        GCObject *alived = nullptr;
+        if (sweeping_)
+            MajorGCSweepStep(0);
+    }
 
-        while (gen.gen_)
+    void GC::ClearBarriered()
+    {
+        for (auto obj : barriered_)
+            obj->barriered_ = 0;
+        barriered_.clear();
+    }
+
+    void GC::VerifyBarriers()
+    {
+        if (major_running_)
+            VerifyListBarriers(gen0_.gen_, true);
+        VerifyListBarriers(gen1_.gen_, major_running_);
+        VerifyListBarriers(gen2_.gen_, major_running_);
+
+        // Alived objects in sweep lists are black, others are dead
+        for (auto list : sweep_lists_)
+            VerifyListBarriers(list, false, true);
+    }
+
+    void GC::VerifyListBarriers(GCObject *list, bool marking, bool sweeping)
+    {
+        for (auto obj = list; obj; obj = obj->next_)
         {
-            GCObject *obj = gen.gen_;
-            gen.gen_ = obj->next_;
+            // Verify black objects in major GC marking, otherwise verify
+            // not barriered old objects
+            if (marking ? obj->gc_ != GCFlag_Black : obj->barriered_ != 0)
+                continue;
 
-            if (obj->gc_ == GCFlag_Black)
+            // Dead objects in sweep lists may reference deleted objects
+            if (sweeping && obj->gc_ == DeadWhite())
+                continue;
+
+            // Open upvalue references stack value, which is GC root
+            if (obj->gc_obj_type_ == GCObjectType_Upvalue &&
+                !static_cast<Upvalue *>(obj)->IsClosed())
+                continue;
+
+            BarrierVerifier verifier(marking);
+            verifier.MarkMembers(obj);
+            if (verifier.IsMissing())
+            {
+                ++missing_barrier_count_;
+                GC_LOG("missing barrier of object type " << obj->gc_obj_type_);
+            }
+        }
+    }
+
+    void GC::AdjustThreshold(std::size_t alived_bytes, GenInfo &gen,
+                             std::size_t min_threshold,
+                             std::size_t max_threshold)
+    {
+        if (alived_bytes != 0)
+        {
+            while (gen.threshold_bytes_ < 2 * alived_bytes)
+                gen.threshold_bytes_ *= 2;
+            while (gen.threshold_bytes_ >= 4 * alived_bytes)
+                gen.threshold_bytes_ /= 2;
+        }
+
+        if (gen.threshold_bytes_ < min_threshold)
+            gen.threshold_bytes_ = min_threshold;
+        else if (gen.threshold_bytes_ > max_threshold)
+            gen.threshold_bytes_ = max_threshold;
+    }
+
+    void GC::DumpHeapSnapshot(std::ostream &out)
+    {
+        assert(major_traveller_);
+
+        // Node 0 is a virtual root referencing all root objects, other
+        // nodes are objects found from roots in breadth first order,
+        // references of node i are edges[edge_begin[i], edge_begin[i + 1])
+        std::vector<GCObject *> nodes(1, nullptr);
+        std::unordered_map<GCObject *, std::size_t> ids;
+        std::vector<std::size_t> edges;
+        std::vector<std::size_t> edge_begin;
+        std::vector<GCObject *> members;
+
+        SnapshotCollector collector(members);
+        RootVisitor<SnapshotCollector> root_visitor(collector);
+        for (std::size_t i = 0; i < nodes.size(); ++i)
+        {
+            members.clear();
+            if (i == 0)
+                major_traveller_(&root_visitor);
+            else
+                collector.MarkMembers(nodes[i]);
+
+            edge_begin.push_back(edges.size());
+            for (auto obj : members)
             {
-                obj->gc_ = GCFlag_White;
-                obj->next_ = alived;
-                alived = obj;
+                auto result = ids.insert(std::make_pair(obj, nodes.size()));
+                if (result.second)
+                    nodes.push_back(obj);
+                edges.push_back(result.first->second);
+            }
+        }
+        edge_begin.push_back(edges.size());
+
+        // Post order of depth first search from the virtual root
+        const std::size_t kNone = static_cast<std::size_t>(-1);
+        const std::size_t count = nodes.size();
+        std::vector<std::size_t> order(count, kNone);
+        std::vector<std::size_t> postorder;
+        std::vector<std::pair<std::size_t, std::size_t>> stack;
+        stack.push_back(std::make_pair(0, edge_begin[0]));
+        order[0] = 0;
+        while (!stack.empty())
+        {
+            auto node = stack.back().first;
+            auto edge = stack.back().second;
+            if (edge < edge_begin[node + 1])
+            {
+                stack.back().second++;
+                auto next = edges[edge];
+                if (order[next] == kNone)
+                {
+                    order[next] = 0;
+                    stack.push_back(std::make_pair(next, edge_begin[next]));
+                }
             }
             else
             {
-                obj_deleter_(obj, obj->gc_obj_type_);
-                gen.count_--;
+                order[node] = postorder.size();
+                postorder.push_back(node);
+                stack.pop_back();
+            }
+        }
+
+        // Predecessors of node i are preds[pred_begin[i], pred_begin[i + 1])
+        std::vector<std::size_t> pred_begin(count + 1, 0);
+        std::vector<std::size_t> preds(edges.size());
+        for (auto to : edges)
+            pred_begin[to + 1]++;
+        for (std::size_t i = 0; i < count; ++i)
+            pred_begin[i + 1] += pred_begin[i];
+        std::vector<std::size_t> pred_end(pred_begin.begin(), pred_begin.end() - 1);
+        for (std::size_t from = 0; from < count; ++from)
+        {
+            for (auto e = edge_begin[from]; e < edge_begin[from + 1]; ++e)
+                preds[pred_end[edges[e]]++] = from;
+        }
+
+        // Immediate dominators by the iterative algorithm of Cooper,
+        // Harvey and Kennedy, in reverse post order
+        std::vector<std::size_t> idom(count, kNone);
+        idom[0] = 0;
+        auto intersect = [&](std::size_t a, std::size_t b) {
+            while (a != b)
+            {
+                while (order[a] < order[b])
+                    a = idom[a];
+                while (order[b] < order[a])
+                    b = idom[b];
+            }
+            return a;
+        };
+
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (auto i = postorder.size() - 1; i-- > 0; )
+            {
+                auto node = postorder[i];
+                auto dominator = kNone;
+                for (auto p = pred_begin[node]; p < pred_begin[node + 1]; ++p)
+                {
+                    auto pred = preds[p];
+                    if (idom[pred] == kNone)
+                        continue;
+                    dominator = dominator == kNone ? pred : intersect(pred, dominator);
+                }
+
+                if (idom[node] != dominator)
+                {
+                    idom[node] = dominator;
+                    changed = true;
+                }
             }
         }
 
-        gen.gen_ = alived;
+        // Dominators are after objects they dominate in post order
+        std::vector<std::size_t> retained(count, 0);
+        for (std::size_t i = 1; i < count; ++i)
+            retained[i] = GetObjectSize(nodes[i]);
+        for (auto node : postorder)
+        {
+            if (node != 0)
+                retained[idom[node]] += retained[node];
+        }
+
+        std::vector<std::size_t> sorted;
+        for (std::size_t i = 1; i < count; ++i)
+            sorted.push_back(i);
+        std::stable_sort(sorted.begin(), sorted.end(),
+                         [&](std::size_t l, std::size_t r) {
+                             return retained[l] > retained[r];
+                         });
+
+        static const char *kTypeNames[] = {
+            "", "table", "function", "closure", "upvalue", "string", "userdata"
+        };
+
+        auto describe = [&](GCObject *obj) {
+            switch (obj->gc_obj_type_)
+            {
+                case GCObjectType_Table:
+                    out << "array=" << static_cast<Table *>(obj)->ArraySize();
+                    break;
+                case GCObjectType_Function:
+                case GCObjectType_Closure:
+                {
+                    auto func = obj->gc_obj_type_ == GCObjectType_Function ?
+                        static_cast<Function *>(obj) :
+                        static_cast<Closure *>(obj)->GetPrototype();
+                    if (func && func->GetModule())
+                        out << func->GetModule()->GetCStr();
+                    out << ":" << (func ? func->GetLine() : 0);
+                    break;
+                }
+                case GCObjectType_Upvalue:
+                    out << (static_cast<Upvalue *>(obj)->IsClosed() ? "closed" : "open");
+                    break;
+                case GCObjectType_String:
+                {
+                    // Quote at most 32 bytes of string
+                    auto str = static_cast<String *>(obj);
+                    auto len = str->GetLength() > 32 ? 32 : str->GetLength();
+                    out << '"';
+                    for (std::size_t i = 0; i < len; ++i)
+                    {
+                        char c = str->GetCStr()[i];
+                        if (c == '"' || c == '\\')
+                            out << '\\' << c;
+                        else if (c < ' ' || c > '~')
+                            out << '.';
+                        else
+                            out << c;
+                    }
+                    out << (str->GetLength() > len ? "\"..." : "\"");
+                    break;
+                }
+                default:
+                    out << "-";
+                    break;
+            }
+        };
+
+        out << "heap snapshot: " << count - 1 << " objects, " <<
+            retained[0] << " bytes\n";
+        out << "id type bytes retained dominator description -> references\n";
+        for (auto node : sorted)
+        {
+            auto obj = nodes[node];
+            out << node << " " << kTypeNames[obj->gc_obj_type_] << " " <<
+                GetObjectSize(obj) << " " << retained[node] << " " <<
+                idom[node] << " ";
+            describe(obj);
+            out << " ->";
+            for (auto e = edge_begin[node]; e < edge_begin[node + 1]; ++e)
+                out << " " << edges[e];
+            out << "\n";
+        }
     }
 
-    void GC::AdjustThreshold(unsigned int alived_count, GenInfo &gen,
-                             unsigned int min_threshold,
-                             unsigned int max_threshold)
+    void GC::RecordPause(unsigned int microseconds)
     {
-        if (alived_count != 0)
+        stats_.pause_count_++;
+        stats_.total_pause_ += microseconds;
+        if (microseconds > stats_.max_pause_)
+            stats_.max_pause_ = microseconds;
+
+        int bucket = 0;
+        while (microseconds != 0 && bucket < kPauseHistogramBuckets - 1)
         {
-            while (gen.threshold_count_ < 2 * alived_count)
-                gen.threshold_count_ *= 2;
-            while (gen.threshold_count_ >= 4 * alived_count)
-                gen.threshold_count_ /= 2;
+            microseconds >>= 1;
+            ++bucket;
         }
+        pause_histogram_[bucket]++;
+    }
+
+    void GC::LogPauseHistogram()
+    {
+        if (!log_stream_.is_open())
+            return ;
+
+        GC_LOG("pause histogram, max pause " << stats_.max_pause_ << " microseconds:");
+        for (int i = 0; i < kPauseHistogramBuckets; ++i)
+        {
+            if (pause_histogram_[i] == 0)
+                continue;
 
-        if (gen.threshold_count_ < min_threshold)
-            gen.threshold_count_ = min_threshold;
-        else if (gen.threshold_count_ > max_threshold)
-            gen.threshold_count_ = max_threshold;
+            unsigned int low = i == 0 ? 0 : 1u << (i - 1);
+            if (i == kPauseHistogramBuckets - 1)
+                GC_LOG("  >= " << low << " microseconds: " << pause_histogram_[i]);
+            else
+                GC_LOG("  [" << low << ", " << (1u << i) << ") microseconds: " <<
+                       pause_histogram_[i]);
+        }
     }
 
     void GC::DestroyGeneration(GenInfo &gen)
@@ -409,8 +1451,9 @@ namespace oms
         {
             GCObject *obj = gen.gen_;
             gen.gen_ = gen.gen_->next_;
-            obj_deleter_(obj, obj->gc_obj_type_);
+            DeleteObject(obj);
         }
         gen.count_ = 0;
+        gen.bytes_ = 0;
     }
 } // namespace oms
@@ -1,8 +1,12 @@
 #ifndef GC_OBJECT_H
 #define GC_OBJECT_H
 
+#include "mobject_pool.h"
+#include "mfinalizer.h"
+#include <atomic>
 #include <functional>
-#include <deque>
+#include <memory>
+#include <vector>
 #include <fstream>
 
 namespace oms
@@ -15,13 +19,22 @@ namespace oms
         GCGen2,         // Oldest generation
     };
 
-    // GC flag for mark GC object
+    // GC flag for mark GC object, there are two whites, objects
+    // alived and new objects are current white, objects of the other
+    // white are dead when major GC is sweeping lazily
     enum GCFlag
     {
         GCFlag_White,
         GCFlag_Black,
+        GCFlag_Gray,        // Marked but members not marked in major GC
+        GCFlag_OtherWhite,
     };
 
+    inline bool IsWhite(unsigned int gc)
+    {
+        return gc == GCFlag_White || gc == GCFlag_OtherWhite;
+    }
+
     // GC object type allocated by GC
     enum GCObjectType
     {
@@ -58,9 +71,11 @@ namespace oms
     class GCObject
     {
         friend class GC;
-        friend class MinorMarkVisitor;
-        friend class BarrieredMarkVisitor;
-        friend class MajorMarkVisitor;
+        template<typename> friend class Marker;
+        friend class MinorMarker;
+        friend class GrayMarker;
+        friend class ParallelMarker;
+        friend class BarrierVerifier;
         friend bool CheckBarrier(GCObject *);
     public:
         GCObject();
@@ -77,23 +92,76 @@ namespace oms
         unsigned int gc_ : 2;
         // GCObjectType
         unsigned int gc_obj_type_ : 4;
+        // Object is in barriered objects of GC already
+        unsigned int barriered_ : 1;
+        // Size class of object pool which object allocated from,
+        // 0 means object allocated by operator new
+        unsigned int size_class_ : 5;
+        // Object is gray or black in major GC, parallel markers claim
+        // objects by setting it atomically, it is reset when swept
+        std::atomic<unsigned char> mark_;
     };
 
-    // GC object barrier checker
-    inline bool CheckBarrier(GCObject *obj) { return obj->generation_ != GCGen0; }
+    // GC object barrier checker, objects which are barriered already
+    // need not barrier again until next GC. Objects are black only in
+    // major GC marking, black objects need barrier to keep tri-color
+    // invariant.
+    inline bool CheckBarrier(GCObject *obj)
+    {
+        return (obj->generation_ != GCGen0 || obj->gc_ == GCFlag_Black) &&
+            !obj->barriered_;
+    }
     #define CHECK_BARRIER(gc, obj) \
         do { if (oms::CheckBarrier(obj)) gc.SetBarrier(obj); } while (0)
 
+    // Statistics of GC, alived objects are objects not freed yet
+    struct GCStats
+    {
+        // Count and bytes of objects of each generation, bytes include
+        // memory owned by objects such as array and hash parts of tables
+        std::size_t objects_[GCGen2 + 1];
+        std::size_t bytes_[GCGen2 + 1];
+        // Count and bytes of alived objects of each GCObjectType
+        std::size_t type_objects_[GCObjectType_UserData + 1];
+        std::size_t type_bytes_[GCObjectType_UserData + 1];
+        // Count of minor GC and finished major GC
+        std::size_t minor_count_;
+        std::size_t major_count_;
+        // Count of GC pauses, total and worst pause in microseconds
+        std::size_t pause_count_;
+        unsigned long long total_pause_;
+        unsigned int max_pause_;
+        // Bytes of young objects checked by minor GC, and bytes of
+        // them alived and promoted to GCGen1
+        unsigned long long young_bytes_;
+        unsigned long long promoted_bytes_;
+        // Bytes of all objects allocated and freed
+        unsigned long long allocated_bytes_;
+        unsigned long long freed_bytes_;
+
+        GCStats()
+            : objects_(), bytes_(), type_objects_(), type_bytes_(),
+              minor_count_(0), major_count_(0), pause_count_(0),
+              total_pause_(0), max_pause_(0), young_bytes_(0),
+              promoted_bytes_(0), allocated_bytes_(0), freed_bytes_(0) { }
+
+        // Ratio of young bytes promoted by minor GC
+        double GetPromotionRate() const
+        { return young_bytes_ == 0 ? 0.0 : static_cast<double>(promoted_bytes_) / young_bytes_; }
+    };
+
     class GC
     {
     public:
         typedef std::function<void (GCObjectVisitor *)> RootTravelType;
+        // Deleter is called before GC destroys the object and returns
+        // its memory, objects are owned by GC, deleter must not
+        // delete them
         typedef std::function<void (GCObject *, unsigned int)> GCObjectDeleter;
 
         struct DefaultDeleter
         {
-            inline void operator () (GCObject *obj, unsigned int) const
-            { delete obj; }
+            inline void operator () (GCObject *, unsigned int) const { }
         };
 
         explicit GC(const GCObjectDeleter &obj_deleter = DefaultDeleter(), bool log = false);
@@ -113,15 +181,126 @@ namespace oms
         Function * NewFunction(GCGeneration gen = GCGen2);
         Closure * NewClosure(GCGeneration gen = GCGen0);
         Upvalue * NewUpvalue(GCGeneration gen = GCGen0);
-        String * NewString(GCGeneration gen = GCGen0);
+        String * NewString(const char *str, std::size_t len, GCGeneration gen = GCGen0);
         UserData * NewUserData(GCGeneration gen = GCGen0);
 
         // Set GC object barrier
         void SetBarrier(GCObject *obj);
 
+        // Memory owned by object, e.g. array and hash parts of tables,
+        // changed from 'old_bytes' to 'new_bytes', it is charged to the
+        // generation of the object like bytes of the object itself
+        void ResizeObject(GCObject *obj, std::size_t old_bytes,
+                          std::size_t new_bytes);
+
+        // Dead object which is not swept yet becomes alive again, it
+        // is used for objects found without references, e.g. strings
+        // in string pool, object must have no member GC objects
+        void Resurrect(GCObject *obj)
+        { if (sweeping_ && obj->gc_ == DeadWhite()) obj->gc_ = white_; }
+
         // Check run GC
         void CheckGC();
 
+        // Run a full major GC at once, finish the running incremental
+        // major GC if there is one
+        void FullGC();
+
+        // Run one major GC step, start a major GC when it is not
+        // running, return true when the major GC finished
+        bool StepGC();
+
+        // Stop and restart running GC automatically by CheckGC
+        void Stop() { stopped_ = true; }
+        void Restart() { stopped_ = false; }
+        bool IsStopped() const { return stopped_; }
+
+        // Major GC starts when bytes of old generations grow to pause
+        // percent of bytes alived after the previous major GC
+        void SetPause(unsigned int percent) { pause_ = percent; }
+        unsigned int GetPause() const { return pause_; }
+
+        // Step multiplier scales work budget of each major GC step
+        // relative to allocation, kDefaultStepMultiplier percent for
+        // kMajorStepBudget, 0 makes major GC stop the world
+        void SetStepMultiplier(unsigned int percent);
+        unsigned int GetStepMultiplier() const { return step_multiplier_; }
+
+        // Set work budget of each major GC step, which is count of
+        // visited object references, major GC runs incrementally in
+        // steps when budget is not 0, otherwise it stops the world.
+        void SetMajorStepBudget(unsigned int budget)
+        { major_step_budget_ = budget; }
+
+        // Count of threads marking gray objects in parallel when major
+        // GC marks all of them at once, which happens when major GC
+        // finishes or stops the world, 1 by default marks in the
+        // calling thread only
+        void SetMarkThreads(unsigned int threads)
+        { mark_threads_ = threads == 0 ? 1 : threads; }
+        unsigned int GetMarkThreads() const { return mark_threads_; }
+
+        // Bytes of all GC objects, includes memory owned by objects such
+        // as array and hash parts of tables
+        std::size_t GetTotalBytes() const
+        { return gen0_.bytes_ + GetOldBytes(); }
+
+        // Get statistics of GC
+        GCStats GetStats() const;
+
+        // Write snapshot of object graph alived from major roots, one
+        // line for each object with its bytes, retained bytes which are
+        // bytes of objects only reachable through it, and dominator,
+        // objects retaining most bytes are written first
+        void DumpHeapSnapshot(std::ostream &out);
+
+        // Alloc GC objects from size class object pools or by operator
+        // new, pools are enabled by default
+        void SetObjectPoolEnabled(bool enable)
+        { pool_enabled_ = enable; }
+
+        // Count of slabs of all object pools
+        std::size_t GetPoolSlabCount() const;
+
+        // Destroy user data and free memory of objects which are not
+        // allocated from pools in background finalizer thread or not,
+        // it is disabled by default
+        void SetBackgroundFinalizer(bool enable);
+
+        // Wait until background finalizer finished all posted jobs
+        void WaitFinalizer();
+
+        // Count of finished jobs posted to background finalizer
+        std::size_t GetFinalizedCount() const
+        { return finalizer_ ? finalized_count_ + finalizer_->GetFinishedCount()
+                            : finalized_count_; }
+
+        // Incremental major GC is running or not
+        bool IsMajorGCRunning() const
+        { return major_running_; }
+
+        // Sweep dead objects of major GC lazily in steps after marking
+        // finished, otherwise sweep them at once, lazy sweep is enabled
+        // by default
+        void SetLazySweep(bool lazy)
+        { lazy_sweep_ = lazy; }
+
+        // Dead objects of major GC are sweeping lazily or not
+        bool IsSweeping() const
+        { return sweeping_; }
+
+        // Torture mode verifies barriers of all old objects at every
+        // check, and runs GC after a few objects allocated, it is used
+        // to find missing barriers
+        void SetTortureMode(bool torture)
+        { torture_ = torture; }
+
+        // Count of objects which reference young objects without
+        // barrier, or black objects which reference white objects in
+        // major GC marking, found by torture mode
+        std::size_t GetMissingBarrierCount() const
+        { return missing_barrier_count_; }
+
     private:
         struct GenInfo
         {
@@ -129,12 +308,36 @@ namespace oms
             GCObject *gen_;
             // Count of GC objects
             unsigned int count_;
-            // Current threshold count of GC objects
-            unsigned int threshold_count_;
+            // Bytes of GC objects
+            std::size_t bytes_;
+            // Current threshold bytes of GC objects
+            std::size_t threshold_bytes_;
 
-            GenInfo() : gen_(nullptr), count_(0), threshold_count_(0) { }
+            GenInfo()
+                : gen_(nullptr), count_(0), bytes_(0), threshold_bytes_(0) { }
         };
 
+        // Alloc memory for object of size, return size class of pool
+        // which memory allocated from through size_class
+        void * AllocObject(std::size_t size, unsigned int &size_class);
+        template<typename ObjType>
+        ObjType * NewObject(GCObjectType type, GCGeneration gen);
+
+        // Destroy object and return its memory
+        void DeleteObject(GCObject *obj);
+        static void FreeMemory(void *memory);
+
+        // Bytes allocated for object
+        std::size_t GetObjectSize(GCObject *obj) const;
+
+        // White of dead objects when sweeping
+        unsigned int DeadWhite() const
+        { return white_ == GCFlag_White ? GCFlag_OtherWhite : GCFlag_White; }
+
+        // Bytes of old generations
+        std::size_t GetOldBytes() const
+        { return gen1_.bytes_ + gen2_.bytes_; }
+
         void SetObjectGen(GCObject *obj, GCGeneration gen);
 
         // Run minor and major GC
@@ -144,23 +347,75 @@ namespace oms
         void MinorGCMark();
         void MinorGCSweep();
 
-        void MajorGCMark();
+        // Incremental major GC, start marks roots gray, each step marks
+        // gray objects in budget, finish marks roots again and marks
+        // all gray objects, then sweep
+        void StartMajorGC();
+        bool MajorGCStep(unsigned int budget);
+        void FinishMajorGC();
+
+        void MajorGCMarkRoot();
+
+        // Mark all gray objects by mark_threads_ threads
+        void ParallelMark();
+
+        // Mark values of ephemeron tables which keys are alived, then
+        // remove entries of dead objects from weak tables
+        void MarkEphemerons();
+        void ClearWeakTables();
+
+        // Move all objects into sweep lists and sweep them at once or
+        // lazily, each step sweeps objects in budget, return true when
+        // all objects swept
         void MajorGCSweep();
+        bool MajorGCSweepStep(unsigned int budget);
+        void FinishSweep();
+
+        // Reset all barriered objects
+        void ClearBarriered();
 
-        void SweepGeneration(GenInfo &gen);
+        // Verify all old objects which reference young objects are
+        // barriered
+        void VerifyBarriers();
+        void VerifyListBarriers(GCObject *list, bool marking,
+                                bool sweeping = false);
 
-        // Adjust GenInfo's threshold_count_ by alived_count
-        void AdjustThreshold(unsigned int alived_count, GenInfo &gen,
-                             unsigned int min_threshold,
-                             unsigned int max_threshold);
+        // Adjust GenInfo's threshold_bytes_ by alived_bytes
+        void AdjustThreshold(std::size_t alived_bytes, GenInfo &gen,
+                             std::size_t min_threshold,
+                             std::size_t max_threshold);
 
         // Delete generation all objects
         void DestroyGeneration(GenInfo &gen);
 
-        static const unsigned int kGen0InitThresholdCount = 512;
-        static const unsigned int kGen1InitThresholdCount = 512;
-        static const unsigned int kGen0MaxThresholdCount = 2048;
-        static const unsigned int kGen1MaxThresholdCount = 102400;
+        // Record GC pause time into histogram
+        void RecordPause(unsigned int microseconds);
+        void LogPauseHistogram();
+
+        // GCGen0 threshold bytes adjust by survived bytes of minor GC
+        static const std::size_t kGen0InitThresholdBytes = 64 * 1024;
+        static const std::size_t kGen0MaxThresholdBytes = 1024 * 1024;
+        // Minimum threshold bytes of old generations to start major GC
+        static const std::size_t kGen1InitThresholdBytes = 1024 * 1024;
+        // Default pause and step multiplier percent
+        static const unsigned int kDefaultPause = 200;
+        static const unsigned int kDefaultStepMultiplier = 200;
+        // Young objects are not promoted at once in torture mode, so
+        // stores of them into old objects can be verified
+        static const unsigned int kTortureThresholdCount = 8;
+        // Default work budget of each major GC step
+        static const unsigned int kMajorStepBudget = 4096;
+        // Run one major GC step after the bytes of objects allocated
+        static const std::size_t kMajorStepAllocBytes = 4096;
+        // Count of objects swept in each lazy sweep step
+        static const unsigned int kSweepStepCount = 4096;
+        // Object pools are size classes of kSizeClassGranularity bytes,
+        // larger objects are allocated by operator new
+        static const unsigned int kSizeClassGranularity = 16;
+        static const unsigned int kSizeClassCount = 16;
+        // Bucket i of pause histogram counts pauses in
+        // [2^(i-1), 2^i) microseconds, the last bucket counts others
+        static const int kPauseHistogramBuckets = 24;
 
         // Youngest generation
         GenInfo gen0_;
@@ -174,13 +429,66 @@ namespace oms
         // Major root traveller
         RootTravelType major_traveller_;
 
-        // Barriered GC objects
-        std::deque<GCObject *> barriered_;
+        // Barriered GC objects, each object is in it at most once
+        std::vector<GCObject *> barriered_;
+        // Gray stack of GC objects which members need to be marked
+        std::vector<GCObject *> gray_;
+        // Black GC objects which become gray by barrier, mark them
+        // when major GC finish
+        std::vector<GCObject *> gray_again_;
+        // Weak tables scanned in major GC marking
+        std::vector<Table *> weak_tables_;
+
+        // Major GC is marking incrementally
+        bool major_running_;
+        // Work budget of each major GC step
+        unsigned int major_step_budget_;
+        // Run next major GC mark or sweep step when allocated bytes of
+        // stats_ reach it, which include growth of memory owned by old
+        // objects
+        unsigned long long major_step_bytes_;
+        // Pause percent of major GC
+        unsigned int pause_;
+        // Step multiplier percent of major GC
+        unsigned int step_multiplier_;
+        // Count of threads marking in parallel
+        unsigned int mark_threads_;
+        // GC does not run automatically when stopped
+        bool stopped_;
+
+        // Lists of objects to be swept, one list for each generation
+        GCObject *sweep_lists_[GCGen2 + 1];
+        // Current white of alived objects and new objects
+        unsigned int white_;
+        // Major GC is sweeping lazily
+        bool sweeping_;
+        // Sweep lazily or not
+        bool lazy_sweep_;
+
+        // Object pools of size classes, pools_[i] allocates objects
+        // of size class i + 1
+        ObjectPool pools_[kSizeClassCount];
+        // Alloc objects from pools
+        bool pool_enabled_;
+
+        // Background finalizer
+        std::unique_ptr<Finalizer> finalizer_;
+        // Count of jobs finished by stopped background finalizers
+        std::size_t finalized_count_;
+
+        // Histogram of GC pause time
+        unsigned int pause_histogram_[kPauseHistogramBuckets];
+        // Statistics of GC
+        GCStats stats_;
 
         // GC object Deleter
         GCObjectDeleter obj_deleter_;
         // Log file
         std::ofstream log_stream_;
+        // Torture mode
+        bool torture_;
+        // Count of missing barriers found by torture mode
+        std::size_t missing_barrier_count_;
     };
 } // namespace oms
 
@@ -1,11 +1,13 @@
 #include "mlex.h"
+#include "mlex_dfa.h"
 #include "mstate.h"
+#include "mstring.h"
 #include "mexception.h"
 #include <assert.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <ctype.h>
-#include <algorithm>
+#include <string.h>
 
 namespace
 {
@@ -16,18 +18,36 @@ namespace
         "return", "then", "true", "until", "while"
     };
 
-    bool IsKeyWord(const std::string& name, int *token)
+    // Compare keyword with name in [name, name + len)
+    int CompareKeyWord(const char *keyword, const char *name, std::size_t len)
+    {
+        int cmp = strncmp(keyword, name, len);
+        if (cmp != 0)
+            return cmp;
+        return keyword[len] == 0 ? 0 : 1;
+    }
+
+    bool IsKeyWord(const char *name, std::size_t len, int *token)
     {
         assert(token);
-        auto result = std::equal_range(keyword, keyword + sizeof(keyword) / sizeof(keyword[0]),
-                                       name.c_str(), [](const char *left, const char *right) {
-                                           return strcmp(left, right) < 0;
-                                       });
-        if (result.first == result.second)
-            return false;
+        std::size_t low = 0;
+        std::size_t high = sizeof(keyword) / sizeof(keyword[0]);
+        while (low < high)
+        {
+            auto mid = (low + high) / 2;
+            int cmp = CompareKeyWord(keyword[mid], name, len);
+            if (cmp == 0)
+            {
+                *token = mid + oms::Token_And;
+                return true;
+            }
 
-        *token = result.first - keyword + oms::Token_And;
-        return true;
+            if (cmp < 0)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+        return false;
     }
 
     bool IsIdLeftLetter(int c)
@@ -45,6 +65,125 @@ namespace
         return strchr("_", c) || isalnum(c);
     }
 
+    // Powers of 10 which can be represented exactly by double
+    const double kExactPow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    int HexValue(int c)
+    {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    }
+
+    // Parse number in [begin, end) in place, return false when
+    // number is malformed
+    bool ParseNumber(const char *begin, const char *end, double *number)
+    {
+        auto p = begin;
+        if (end - begin >= 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+        {
+            p += 2;
+            if (p == end)
+                return false;
+
+            double value = 0.0;
+            for (; p < end; ++p)
+            {
+                int v = HexValue(*p);
+                if (v < 0)
+                    return false;
+                value = value * 16 + v;
+            }
+
+            *number = value;
+            return true;
+        }
+
+        // Mantissa digits, only 15 significant digits can be
+        // represented exactly in double
+        unsigned long long mantissa = 0;
+        int significant = 0;
+        int digits = 0;
+        int exponent = 0;
+        bool dot = false;
+        for (; p < end; ++p)
+        {
+            if (*p == '.' && !dot)
+            {
+                dot = true;
+                continue;
+            }
+
+            if (!isdigit(static_cast<unsigned char>(*p)))
+                break;
+
+            ++digits;
+            if (significant < 19)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa != 0)
+                    ++significant;
+                if (dot)
+                    --exponent;
+            }
+            else if (!dot)
+            {
+                ++exponent;
+            }
+        }
+
+        if (digits == 0)
+            return false;
+
+        if (p < end && (*p == 'e' || *p == 'E'))
+        {
+            ++p;
+            bool negative = false;
+            if (p < end && (*p == '+' || *p == '-'))
+                negative = *p++ == '-';
+
+            if (p == end)
+                return false;
+
+            int e = 0;
+            for (; p < end; ++p)
+            {
+                if (!isdigit(static_cast<unsigned char>(*p)))
+                    return false;
+                if (e < 10000)
+                    e = e * 10 + (*p - '0');
+            }
+            exponent += negative ? -e : e;
+        }
+
+        if (p != end)
+            return false;
+
+        // Fast path, both mantissa and power of 10 are exact, so
+        // the result is correctly rounded
+        if (significant <= 15 && exponent >= -22 && exponent <= 22)
+        {
+            double value = static_cast<double>(mantissa);
+            if (exponent < 0)
+                value /= kExactPow10[-exponent];
+            else
+                value *= kExactPow10[exponent];
+            *number = value;
+            return true;
+        }
+
+        std::string str(begin, end);
+        *number = strtod(str.c_str(), nullptr);
+        return true;
+    }
+
 } // namespace
 
 namespace oms
@@ -55,6 +194,7 @@ namespace oms
         detail->line_ = line_;                                  \
         detail->column_ = column_;                              \
         detail->module_ = module_;                              \
+        detail->end_ = CurrentPos();                            \
         return token;                                           \
     } while (0)
 
@@ -70,6 +210,12 @@ namespace oms
         RETURN_NORMAL_TOKEN_DETAIL(detail, token);              \
     } while (0)
 
+#define RETURN_SPAN_TOKEN_DETAIL(detail, begin, end, hash, token) \
+    do {                                                        \
+        detail->str_ = state_->GetString(begin, end - begin, hash); \
+        RETURN_NORMAL_TOKEN_DETAIL(detail, token);              \
+    } while (0)
+
 #define SET_EOF_TOKEN_DETAIL(detail)                            \
     do {                                                        \
         detail->str_ = nullptr;                                 \
@@ -77,22 +223,31 @@ namespace oms
         detail->line_ = line_;                                  \
         detail->column_ = column_;                              \
         detail->module_ = module_;                              \
+        detail->end_ = end_;                                    \
     } while (0)
 
-    Lexer::Lexer(State *state, String *module, CharInStream in)
+    Lexer::Lexer(State *state, String *module, const char *buffer, std::size_t size,
+                 int line)
         : state_(state),
           module_(module),
-          in_stream_(in),
+          dfa_(nullptr),
+          pos_(buffer),
+          end_(buffer + size),
           current_(EOF),
-          line_(1),
+          line_(line),
           column_(0)
     {
+        if (state->GetLexerType() == LexerType_DFA)
+            dfa_ = &LexDFA::GetInstance();
         Next();
     }
 
     int Lexer::GetToken(TokenDetail *detail)
     {
         assert(detail);
+        if (dfa_)
+            return GetTokenByDFA(detail);
+
         SET_EOF_TOKEN_DETAIL(detail);
         while (current_ != EOF)
         {
@@ -129,8 +284,8 @@ namespace oms
                     }
                     else if (isdigit(current_))
                     {
-                        token_buffer_.assign(1,'.');
-                        return LexNumber(detail);
+                        // Number begins with '.'
+                        return LexNumber(detail, CurrentPos() - 1);
                     }
                     else
                     {
@@ -172,8 +327,7 @@ namespace oms
                 }
                 else if (isdigit(current_))
                 {
-                    token_buffer_.clear();
-                    return LexNumber(detail);
+                    return LexNumber(detail, CurrentPos());
                 }
                 else if (IsIdFirstLetter(current_))
                 {
@@ -191,19 +345,74 @@ namespace oms
         return Token_EOF;
     }
 
-    void Lexer::SetInputStream(CharInStream in)
+    int Lexer::GetTokenByDFA(TokenDetail *detail)
     {
-        in_stream_ = in;
-        line_ = 1;
-        column_ = 0;
-        Next();
+        SET_EOF_TOKEN_DETAIL(detail);
+        while (current_ != EOF)
+        {
+            auto begin = CurrentPos();
+            const char *end = nullptr;
+            int accept = dfa_->Match(begin, end_, end);
+            switch (accept) {
+            case LexAction_Skip:
+                SetCurrentPos(end);
+                break;
+            case LexAction_NewLine:
+                LexNewLine();
+                break;
+            case LexAction_Comment:
+                SetCurrentPos(begin + 1);
+                LexComment();
+                break;
+            case LexAction_String:
+                return LexSingleLineString(detail);
+            case LexAction_LongString:
+                SetCurrentPos(begin + 1);
+                return LexMultiLineString(detail);
+            case LexAction_Id:
+                {
+                    unsigned int hash = String::kHashSeed;
+                    for (auto p = begin; p < end; ++p)
+                        hash = String::HashChar(hash, *p);
+                    SetCurrentPos(end);
+                    RETURN_SPAN_TOKEN_DETAIL(detail, begin, end, hash, Token_Id);
+                }
+            case LexAction_Number:
+                {
+                    SetCurrentPos(end);
+                    double number = 0.0;
+                    if (!ParseNumber(begin, end, &number))
+                    {
+                        throw LexException(module_->GetCStr(), line_, column_,
+                            "bad number '", std::string(begin, end), "'");
+                    }
+                    RETURN_NUMBER_TOKEN_DETAIL(detail, number);
+                }
+            case LexAction_Error:
+                SetCurrentPos(end);
+                throw LexException(module_->GetCStr(),
+                        line_, column_, "expect '=' after '~'");
+            case LexAction_Char:
+                SetCurrentPos(end);
+                RETURN_NORMAL_TOKEN_DETAIL(detail, static_cast<unsigned char>(*begin));
+            default:
+                // Keywords and operators, keywords are not interned
+                assert(accept > 0);
+                SetCurrentPos(end);
+                RETURN_NORMAL_TOKEN_DETAIL(detail, accept);
+            }
+        }
+
+        return Token_EOF;
     }
 
-    void Lexer::Next()
+    void Lexer::SetInputBuffer(const char *buffer, std::size_t size)
     {
-        current_ = in_stream_();
-        assert(current_ != 0);
-        if (current_ != EOF) ++column_;
+        pos_ = buffer;
+        end_ = buffer + size;
+        line_ = 1;
+        column_ = 0;
+        Next();
     }
 
     void Lexer::LexNewLine()
@@ -285,50 +494,40 @@ namespace oms
 
     void Lexer::LexSingleLineComment()
     {
-        while (current_ != '\r' && current_ != '\n' && current_ != EOF)
-        {
-            Next();
-        }
+        if (current_ == '\r' || current_ == '\n' || current_ == EOF)
+            return ;
+
+        // Skip to the end of line in buffer directly
+        auto p = pos_;
+        while (p < end_ && *p != '\r' && *p != '\n')
+            ++p;
+
+        column_ += p - pos_;
+        pos_ = p;
+        Next();
     }
 
-    int Lexer::LexNumber(TokenDetail *detail)
+    int Lexer::LexNumber(TokenDetail *detail, const char *begin)
     {
         assert(isdigit(current_));
         do{
-            token_buffer_.push_back(current_);
             Next();
         } while (isdigit(current_) || '.' == current_);
-        if (strchr("Ee", current_))
+        if (current_ == 'E' || current_ == 'e')
         {
-            token_buffer_.push_back(current_);
             Next();
-            if (strchr("+-", current_))
-            {
-                token_buffer_.push_back(current_);
+            if (current_ == '+' || current_ == '-')
                 Next();
-            }
         }
         while (isalnum(current_))
-        {
-            token_buffer_.push_back(current_);
             Next();
-        }
-
-        double number;
-        char *end_ptr;
-        if ('X' == token_buffer_[1] || 'x' == token_buffer_[1])
-        {
-            number = static_cast<double>(strtoul(token_buffer_.c_str(), &end_ptr, 16));
-        }
-        else
-        {
-            number = strtod(token_buffer_.c_str(), &end_ptr);
-        }
 
-        if (*end_ptr != '\0')
+        auto end = CurrentPos();
+        double number = 0.0;
+        if (!ParseNumber(begin, end, &number))
         {
             throw LexException(module_->GetCStr(), line_, column_,
-                "bad number '", token_buffer_, "'");
+                "bad number '", std::string(begin, end), "'");
         }
         RETURN_NUMBER_TOKEN_DETAIL(detail, number);
     }
@@ -412,8 +611,26 @@ namespace oms
     {
         int quote = current_;
         Next();
-        token_buffer_.clear();
 
+        // String without escape characters is interned from input
+        // buffer directly
+        auto begin = CurrentPos();
+        unsigned int hash = String::kHashSeed;
+        while (current_ != quote && current_ != '\\' &&
+               current_ != '\r' && current_ != '\n' && current_ != EOF)
+        {
+            hash = String::HashChar(hash, static_cast<char>(current_));
+            Next();
+        }
+
+        if (current_ == quote)
+        {
+            auto end = CurrentPos();
+            Next();
+            RETURN_SPAN_TOKEN_DETAIL(detail, begin, end, hash, Token_String);
+        }
+
+        token_buffer_.assign(begin, CurrentPos());
         while (current_ != quote)
         {
             if (current_ == EOF)
@@ -492,15 +709,17 @@ namespace oms
     int Lexer::LexId(TokenDetail *detail)
     {
         assert(IsIdFirstLetter(current_));
-        token_buffer_.clear();
+        auto begin = CurrentPos();
+        unsigned int hash = String::kHashSeed;
         do{
-            token_buffer_.push_back(current_);
+            hash = String::HashChar(hash, static_cast<char>(current_));
             Next();
         } while (IsIdLeftLetter(current_));
 
+        auto end = CurrentPos();
         int token = 0;
-        if (!IsKeyWord(token_buffer_, &token))
+        if (!IsKeyWord(begin, end - begin, &token))
             token = Token_Id;
-        RETURN_TOKEN_DETAIL(detail, token_buffer_, token);
+        RETURN_SPAN_TOKEN_DETAIL(detail, begin, end, hash, token);
     }
 } // namespace oms
@@ -3,19 +3,30 @@
 
 #include "mtoken.h"
 #include <string>
-#include <functional>
+#include <assert.h>
+#include <stdio.h>
 
 namespace oms
 {
     class String;
     class State;
+    class LexDFA;
+
+    // Lexer implementations
+    enum LexerType
+    {
+        LexerType_HandWritten,      // Hand-written state machine
+        LexerType_DFA,              // Table-driven DFA built from token spec
+    };
 
     class Lexer
     {
     public:
-        typedef std::function<int ()> CharInStream;
-
-        Lexer(State *state, String *module, CharInStream in);
+        // Lexer scans the contiguous input buffer directly, the buffer
+        // must be valid until lexer finished. 'line' is line number of the
+        // beginning of the buffer.
+        Lexer(State *state, String *module, const char *buffer, std::size_t size,
+              int line = 1);
 
         Lexer(const Lexer&) = delete;
         void operator = (const Lexer&) = delete;
@@ -30,17 +41,39 @@ namespace oms
             return module_;
         }
 
-        void SetInputStream(CharInStream in);
+        void SetInputBuffer(const char *buffer, std::size_t size);
 
     private:
-        void Next();
+        int GetTokenByDFA(TokenDetail *detail);
+
+        void Next()
+        {
+            current_ = pos_ < end_ ? static_cast<unsigned char>(*pos_++) : EOF;
+            assert(current_ != 0);
+            if (current_ != EOF) ++column_;
+        }
+
+        // Position of current_ in input buffer
+        const char * CurrentPos() const
+        {
+            return current_ == EOF ? end_ : pos_ - 1;
+        }
+
+        // Move current_ to 'pos' which is not before current position
+        void SetCurrentPos(const char *pos)
+        {
+            column_ += static_cast<int>(pos - CurrentPos()) - 1;
+            pos_ = pos;
+            Next();
+        }
 
         void LexNewLine();
         void LexComment();
         void LexNamedComment();
         void LexSingleLineComment();
 
-        int LexNumber(TokenDetail *detail);
+        // Lex number begins at 'begin' in input buffer
+        int LexNumber(TokenDetail *detail, const char *begin);
 
         int LexXEqual(TokenDetail *detail, int equal_token);
 
@@ -52,7 +85,11 @@ namespace oms
 
         State *state_;
         String *module_;
-        CharInStream in_stream_;
+        // DFA of LexerType_DFA, nullptr for LexerType_HandWritten
+        const LexDFA *dfa_;
+        // Next char position and end of input buffer
+        const char *pos_;
+        const char *end_;
 
         int current_;
         int line_;
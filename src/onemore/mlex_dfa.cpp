@@ -0,0 +1,226 @@
+#include "mlex_dfa.h"
+#include "mtoken.h"
+#include <ctype.h>
+#include <string.h>
+#include <assert.h>
+#include <map>
+
+namespace
+{
+    using namespace oms;
+
+    // Token spec of literal tokens, keywords are resolved by these
+    // literals, so they are never interned as identifiers.
+    struct LiteralSpec
+    {
+        const char *literal_;
+        int accept_;
+    };
+
+    const LiteralSpec kLiteralSpec[] = {
+        { "and", Token_And }, { "break", Token_Break },
+        { "continue", Token_Continue }, { "do", Token_Do },
+        { "else", Token_Else }, { "elseif", Token_Elseif },
+        { "end", Token_End }, { "false", Token_False },
+        { "for", Token_For }, { "function", Token_Function },
+        { "if", Token_If }, { "in", Token_In },
+        { "local", Token_Local }, { "nil", Token_Nil },
+        { "not", Token_Not }, { "or", Token_Or },
+        { "repeat", Token_Repeat }, { "return", Token_Return },
+        { "then", Token_Then }, { "true", Token_True },
+        { "until", Token_Until }, { "while", Token_While },
+
+        { "==", Token_Equal }, { "~=", Token_NotEqual },
+        { "<=", Token_LessEqual }, { ">=", Token_GreaterEqual },
+        { "..", Token_Concat }, { "...", Token_VarArg },
+
+        { "+", '+' }, { "-", '-' }, { "*", '*' }, { "/", '/' },
+        { "%", '%' }, { "^", '^' }, { "#", '#' }, { "<", '<' },
+        { ">", '>' }, { "=", '=' }, { "(", '(' }, { ")", ')' },
+        { "{", '{' }, { "}", '}' }, { "[", '[' }, { "]", ']' },
+        { ";", ';' }, { ":", ':' }, { ",", ',' }, { ".", '.' },
+
+        { "--", LexAction_Comment },
+        { "[[", LexAction_LongString }, { "[=", LexAction_LongString },
+        { "\"", LexAction_String }, { "'", LexAction_String },
+        { "\r", LexAction_NewLine }, { "\n", LexAction_NewLine },
+        { "~", LexAction_Error },
+    };
+
+    // Char classes of rule tokens
+    bool IsIdFirst(int c) { return c == '$' || c == '_' || isalpha(c); }
+    bool IsIdRest(int c) { return c == '_' || isalnum(c); }
+    bool IsSpace(int c) { return c == ' ' || c == '\t' || c == '\v' || c == '\f'; }
+    bool IsDigit(int c) { return isdigit(c) != 0; }
+    bool IsAlnum(int c) { return isalnum(c) != 0; }
+
+    // DFA under construction, every state has transitions of all
+    // 256 bytes before compression
+    class DFABuilder
+    {
+    public:
+        struct State
+        {
+            int next_[256];
+            int accept_;
+            // State is a node of literal trie
+            bool literal_;
+
+            State() : accept_(LexAction_None), literal_(false)
+            { memset(next_, 0, sizeof(next_)); }
+        };
+
+        DFABuilder()
+        {
+            // Dead state and start state
+            states_.resize(2);
+        }
+
+        int NewState(int accept)
+        {
+            states_.push_back(State());
+            states_.back().accept_ = accept;
+            return static_cast<int>(states_.size()) - 1;
+        }
+
+        // Add transitions from 'from' to 'to' of all bytes in class
+        template<typename CharClass>
+        void AddTransitions(int from, CharClass char_class, int to)
+        {
+            for (int c = 0; c < 256; ++c)
+            {
+                if (char_class(c))
+                    states_[from].next_[c] = to;
+            }
+        }
+
+        // Add literal into trie which starts from start state, trie
+        // nodes copy transitions of rule states they override
+        int AddLiteral(const char *literal, int accept)
+        {
+            int state = kStart;
+            for (auto p = literal; *p; ++p)
+            {
+                auto c = static_cast<unsigned char>(*p);
+                int next = states_[state].next_[c];
+                if (next == 0 || !states_[next].literal_)
+                {
+                    int node = NewState(LexAction_None);
+                    if (next != 0)
+                        states_[node] = states_[next];
+                    states_[node].literal_ = true;
+                    states_[state].next_[c] = node;
+                    next = node;
+                }
+                state = next;
+            }
+
+            states_[state].accept_ = accept;
+            return state;
+        }
+
+        State & GetState(int state)
+        { return states_[state]; }
+
+        // Compress bytes into classes and fill tables
+        void Compress(unsigned char *byte_class,
+                      std::vector<unsigned short> &transitions,
+                      std::vector<int> &accept, unsigned int &class_count)
+        {
+            // Bytes with the same transitions column are in one class
+            std::map<std::vector<int>, int> columns;
+            std::vector<int> representative;
+            for (int c = 0; c < 256; ++c)
+            {
+                std::vector<int> column;
+                column.reserve(states_.size());
+                for (const auto &state : states_)
+                    column.push_back(state.next_[c]);
+
+                auto it = columns.find(column);
+                if (it == columns.end())
+                {
+                    it = columns.insert(std::make_pair(column,
+                            static_cast<int>(representative.size()))).first;
+                    representative.push_back(c);
+                }
+                byte_class[c] = static_cast<unsigned char>(it->second);
+            }
+
+            class_count = representative.size();
+            transitions.resize(states_.size() * class_count);
+            accept.resize(states_.size());
+            for (std::size_t s = 0; s < states_.size(); ++s)
+            {
+                for (std::size_t k = 0; k < class_count; ++k)
+                {
+                    auto next = states_[s].next_[representative[k]];
+                    transitions[s * class_count + k] = static_cast<unsigned short>(next);
+                }
+                accept[s] = states_[s].accept_;
+            }
+        }
+
+        static const int kStart = 1;
+
+    private:
+        std::vector<State> states_;
+    };
+} // namespace
+
+namespace oms
+{
+    const LexDFA & LexDFA::GetInstance()
+    {
+        static const LexDFA dfa;
+        return dfa;
+    }
+
+    LexDFA::LexDFA()
+        : class_count_(0)
+    {
+        DFABuilder builder;
+        const int start = DFABuilder::kStart;
+
+        // Any other byte is a single char token
+        int single = builder.NewState(LexAction_Char);
+        builder.AddTransitions(start, [](int) { return true; }, single);
+
+        // White spaces except new lines
+        int space = builder.NewState(LexAction_Skip);
+        builder.AddTransitions(start, IsSpace, space);
+        builder.AddTransitions(space, IsSpace, space);
+
+        // Identifier: [$_a-zA-Z][_a-zA-Z0-9]*
+        int id = builder.NewState(LexAction_Id);
+        builder.AddTransitions(start, IsIdFirst, id);
+        builder.AddTransitions(id, IsIdRest, id);
+
+        // Number: [0-9][0-9.]*([eE][+-]?)?[a-zA-Z0-9]*, all bytes which
+        // may belong to a number are accepted, then the number is
+        // checked when it is parsed
+        int digits = builder.NewState(LexAction_Number);
+        int exponent = builder.NewState(LexAction_Number);
+        int sign = builder.NewState(LexAction_Number);
+        int tail = builder.NewState(LexAction_Number);
+        builder.AddTransitions(start, IsDigit, digits);
+        builder.AddTransitions(digits, IsAlnum, tail);
+        builder.AddTransitions(digits, [](int c) { return IsDigit(c) || c == '.'; }, digits);
+        builder.AddTransitions(digits, [](int c) { return c == 'e' || c == 'E'; }, exponent);
+        builder.AddTransitions(exponent, IsAlnum, tail);
+        builder.AddTransitions(exponent, [](int c) { return c == '+' || c == '-'; }, sign);
+        builder.AddTransitions(sign, IsAlnum, tail);
+        builder.AddTransitions(tail, IsAlnum, tail);
+
+        // Literals override rule tokens
+        for (const auto &spec : kLiteralSpec)
+            builder.AddLiteral(spec.literal_, spec.accept_);
+
+        // Number begins with '.'
+        int dot = builder.AddLiteral(".", '.');
+        builder.AddTransitions(dot, IsDigit, digits);
+
+        builder.Compress(byte_class_, transitions_, accept_, class_count_);
+        assert(accept_.size() < 65536);
+    }
+} // namespace oms
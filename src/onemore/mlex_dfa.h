@@ -0,0 +1,84 @@
+#ifndef LEX_DFA_H
+#define LEX_DFA_H
+
+#include <vector>
+#include <stddef.h>
+
+namespace oms
+{
+    // Accept values of DFA states which are not tokens, tokens are
+    // positive values
+    enum LexAction
+    {
+        LexAction_None = 0,         // Not accept state
+        LexAction_Id = -1,          // Identifier
+        LexAction_Number = -2,      // Number
+        LexAction_Skip = -3,        // White spaces
+        LexAction_NewLine = -4,     // '\r' or '\n'
+        LexAction_Comment = -5,     // "--"
+        LexAction_String = -6,      // Quote of single line string
+        LexAction_LongString = -7,  // "[[" or "[="
+        LexAction_Char = -8,        // Other single char token
+        LexAction_Error = -9,       // '~' without '='
+    };
+
+    // Table-driven DFA built from token spec, bytes are compressed
+    // into byte classes which have the same transitions in all states.
+    class LexDFA
+    {
+    public:
+        // DFA of the token spec, it is built once and shared
+        static const LexDFA & GetInstance();
+
+        LexDFA(const LexDFA&) = delete;
+        void operator = (const LexDFA&) = delete;
+
+        // Match the longest token in [begin, end), return accept value
+        // of the token and set 'match_end' to the end of token, return
+        // LexAction_None when no token matched.
+        int Match(const char *begin, const char *end, const char *&match_end) const
+        {
+            int accept = LexAction_None;
+            unsigned int state = kStartState;
+            match_end = begin;
+
+            for (auto p = begin; p < end; )
+            {
+                auto c = byte_class_[static_cast<unsigned char>(*p++)];
+                state = transitions_[state * class_count_ + c];
+                if (state == kDeadState)
+                    break;
+
+                if (accept_[state] != LexAction_None)
+                {
+                    accept = accept_[state];
+                    match_end = p;
+                }
+            }
+
+            return accept;
+        }
+
+        std::size_t GetStateCount() const
+        { return accept_.size(); }
+
+        std::size_t GetClassCount() const
+        { return class_count_; }
+
+    private:
+        static const unsigned int kDeadState = 0;
+        static const unsigned int kStartState = 1;
+
+        LexDFA();
+
+        // Byte class of all bytes
+        unsigned char byte_class_[256];
+        // Transitions table, index is state * class_count_ + class
+        std::vector<unsigned short> transitions_;
+        // Accept value of states
+        std::vector<int> accept_;
+        unsigned int class_count_;
+    };
+} // namespace oms
+
+#endif // LEX_DFA_H
@@ -2,6 +2,7 @@
 #include "mstate.h"
 #include "mruntime.h"
 #include "mtable.h"
+#include "mvm.h"
 #include <assert.h>
 
 namespace oms
@@ -91,8 +92,10 @@ namespace oms
 
     CFunctionType StackAPI::GetCFunction(int index)
     {
+        // Leaf C functions have a different signature, so return
+        // nullptr for them instead of a reinterpreted pointer
         Value *v = GetValue(index);
-        if (v)
+        if (v && v->type_ == ValueT_CFunction)
             return v->cfunc_;
         else
             return nullptr;
@@ -179,6 +182,22 @@ namespace oms
         *PushValue() = value;
     }
 
+    void StackAPI::Pop(int count)
+    {
+        stack_->SetNewTop(stack_->top_ - count);
+    }
+
+    int StackAPI::Call(int arg_count)
+    {
+        Value *f = stack_->top_ - arg_count - 1;
+        if (state_->CallFunction(f, arg_count))
+        {
+            VM vm(state_);
+            vm.Execute();
+        }
+        return stack_->top_ - f;
+    }
+
     void StackAPI::ArgCountError(int expect_count)
     {
         auto cfunc_error = state_->GetCFunctionErrorData();
@@ -194,11 +213,40 @@ namespace oms
         cfunc_error->expect_type_ = expect_type;
     }
 
+    void StackAPI::Error(const std::string &message)
+    {
+        auto cfunc_error = state_->GetCFunctionErrorData();
+        cfunc_error->type_ = CFuntionErrorType_Message;
+        cfunc_error->message_ = message;
+    }
+
     Value * StackAPI::PushValue()
     {
         return stack_->top_++;
     }
 
+    void LeafArgs::ArgCountError(int expect_count)
+    {
+        auto cfunc_error = state_->GetCFunctionErrorData();
+        cfunc_error->type_ = CFuntionErrorType_ArgCount;
+        cfunc_error->expect_arg_count_ = expect_count;
+    }
+
+    void LeafArgs::ArgTypeError(int arg_index, ValueT expect_type)
+    {
+        auto cfunc_error = state_->GetCFunctionErrorData();
+        cfunc_error->type_ = CFuntionErrorType_ArgType;
+        cfunc_error->arg_index_ = arg_index;
+        cfunc_error->expect_type_ = expect_type;
+    }
+
+    void LeafArgs::Error(const std::string &message)
+    {
+        auto cfunc_error = state_->GetCFunctionErrorData();
+        cfunc_error->type_ = CFuntionErrorType_Message;
+        cfunc_error->message_ = message;
+    }
+
     Library::Library(State *state)
         : state_(state),
           global_(state->global_.table_)
@@ -210,6 +258,11 @@ namespace oms
         RegisterFunc(global_, name, func);
     }
 
+    void Library::RegisterFunc(const char *name, LeafCFunctionType func)
+    {
+        RegisterFunc(global_, name, func);
+    }
+
     void Library::RegisterTableFunction(const char *name, const TableMemberReg *table,
                                         std::size_t size)
     {
@@ -222,6 +275,7 @@ namespace oms
         v.type_ = ValueT_Table;
         v.table_ = t;
         global_->SetValue(k, v);
+        CHECK_BARRIER(state_->GetGC(), global_);
 
         RegisterToTable(t, table, size);
     }
@@ -243,6 +297,9 @@ namespace oms
                 case ValueT_CFunction:
                     RegisterFunc(table, table_reg[i].name_, table_reg[i].func_);
                     break;
+                case ValueT_LeafCFunction:
+                    RegisterFunc(table, table_reg[i].name_, table_reg[i].leaf_func_);
+                    break;
                 case ValueT_Number:
                     RegisterNumber(table, table_reg[i].name_, table_reg[i].number_);
                     break;
@@ -264,6 +321,17 @@ namespace oms
         v.type_ = ValueT_CFunction;
         v.cfunc_ = func;
         table->SetValue(k, v);
+        CHECK_BARRIER(state_->GetGC(), table);
+    }
+
+    void Library::RegisterFunc(Table *table, const char *name, LeafCFunctionType func)
+    {
+        Value k;
+        k.type_ = ValueT_String;
+        k.str_ = state_->GetString(name);
+
+        table->SetValue(k, Value(func));
+        CHECK_BARRIER(state_->GetGC(), table);
     }
 
     void Library::RegisterNumber(Table *table, const char *name, double number)
@@ -276,6 +344,7 @@ namespace oms
         v.type_ = ValueT_Number;
         v.num_ = number;
         table->SetValue(k, v);
+        CHECK_BARRIER(state_->GetGC(), table);
     }
 
     void Library::RegisterString(Table *table, const char *name, const char *str)
@@ -288,5 +357,6 @@ namespace oms
         v.type_ = ValueT_String;
         v.str_ = state_->GetString(str);
         table->SetValue(k, v);
+        CHECK_BARRIER(state_->GetGC(), table);
     }
 } // namespace oms
@@ -11,25 +11,19 @@ namespace oms
     class Table;
     class Closure;
 
-    // This class is API for library to manipulate stack,
-    // stack index value is:
-    // -1 ~ -n is top to bottom,
-    // 0 ~ n is bottom to top.
-    class StackAPI
+    // Helper functions for check arguments of C functions, Derived
+    // implements GetStackSize, GetValueType, ArgCountError and
+    // ArgTypeError.
+    // e.g.
+    //   bool result = CheckArgs(2, ValueT_String, ValueT_Number);
+    //   2: min arguments to call API
+    //   ValueT_String: type of the first argument
+    //   ValueT_Number: type of the second argument
+    //   all arguments are valid when result == true
+    template<typename Derived>
+    class ArgChecker
     {
     public:
-        explicit StackAPI(State *state);
-
-        StackAPI(const StackAPI&) = delete;
-        void operator = (const StackAPI&) = delete;
-
-        // Helper functions for check API arguments
-        // e.g.
-        //   bool result = CheckArgs(2, ValueT_String, ValueT_Number);
-        //   2: min arguments to call API
-        //   ValueT_String: type of the first argument
-        //   ValueT_Number: type of the second argument
-        //   all arguments are valid when result == true
         bool CheckArgs(int index, int params)
         {
             // No more expect argument to check, success
@@ -44,9 +38,10 @@ namespace oms
                 return true;
 
             // Check type of the index + 1 argument
-            if (GetValueType(index) != type)
+            auto derived = static_cast<Derived *>(this);
+            if (derived->GetValueType(index) != type)
             {
-                ArgTypeError(index, type);
+                derived->ArgTypeError(index, type);
                 return false;
             }
 
@@ -58,15 +53,29 @@ namespace oms
         bool CheckArgs(int minCount, ValueTypes... types)
         {
             // Check count of arguments
-            auto params = GetStackSize();
+            auto derived = static_cast<Derived *>(this);
+            auto params = derived->GetStackSize();
             if (params < minCount)
             {
-                ArgCountError(minCount);
+                derived->ArgCountError(minCount);
                 return false;
             }
 
             return CheckArgs(0, params, types...);
         }
+    };
+
+    // This class is API for library to manipulate stack,
+    // stack index value is:
+    // -1 ~ -n is top to bottom,
+    // 0 ~ n is bottom to top.
+    class StackAPI : public ArgChecker<StackAPI>
+    {
+    public:
+        explicit StackAPI(State *state);
+
+        StackAPI(const StackAPI&) = delete;
+        void operator = (const StackAPI&) = delete;
 
         // Get count of value in this function stack
         int GetStackSize() const;
@@ -81,7 +90,11 @@ namespace oms
         bool IsClosure(int index) { return GetValueType(index) == ValueT_Closure; }
         bool IsTable(int index) { return GetValueType(index) == ValueT_Table; }
         bool IsUserData(int index) { return GetValueType(index) == ValueT_UserData; }
-        bool IsCFunction(int index) { return GetValueType(index) == ValueT_CFunction; }
+        bool IsCFunction(int index)
+        {
+            auto type = GetValueType(index);
+            return type == ValueT_CFunction || type == ValueT_LeafCFunction;
+        }
 
         // Get value from stack by index
         double GetNumber(int index);
@@ -106,10 +119,21 @@ namespace oms
         void PushCFunction(CFunctionType function);
         void PushValue(const Value &value);
 
+        // Pop 'count' values from stack
+        void Pop(int count);
+
+        // Call the function which is below 'arg_count' arguments on
+        // stack top, the function and arguments are replaced by results,
+        // return count of results.
+        int Call(int arg_count);
+
         // For report argument error
         void ArgCountError(int expect_count);
         void ArgTypeError(int arg_index, ValueT expect_type);
 
+        // For report other errors by description
+        void Error(const std::string &message);
+
     private:
         // Push value to stack, and return the value
         Value * PushValue();
@@ -118,6 +142,47 @@ namespace oms
         Stack *stack_;
     };
 
+    // Arguments of leaf C function, they are read in place, errors are
+    // reported into State only when the leaf C function fails, then it
+    // returns kLeafCFunctionError
+    class LeafArgs : public ArgChecker<LeafArgs>
+    {
+    public:
+        LeafArgs(State *state, const Value *args, int arg_count)
+            : state_(state), args_(args), arg_count_(arg_count) { }
+
+        LeafArgs(const LeafArgs&) = delete;
+        void operator = (const LeafArgs&) = delete;
+
+        // Get count of arguments
+        int GetStackSize() const { return arg_count_; }
+
+        // Get value type by index of arguments
+        ValueT GetValueType(int index) const
+        { return index < arg_count_ ? args_[index].type_ : ValueT_Nil; }
+
+        // Check value type by index of arguments
+        bool IsNumber(int index) const { return GetValueType(index) == ValueT_Number; }
+        bool IsString(int index) const { return GetValueType(index) == ValueT_String; }
+
+        // Get argument by index, index must be less than count
+        double GetNumber(int index) const { return args_[index].num_; }
+        const String * GetString(int index) const { return args_[index].str_; }
+        const Value * GetValue(int index) const { return &args_[index]; }
+
+        // For report argument error
+        void ArgCountError(int expect_count);
+        void ArgTypeError(int arg_index, ValueT expect_type);
+
+        // For report other errors by description
+        void Error(const std::string &message);
+
+    private:
+        State *state_;
+        const Value *args_;
+        int arg_count_;
+    };
+
     // For register table member
     struct TableMemberReg
     {
@@ -128,6 +193,7 @@ namespace oms
         union
         {
             CFunctionType func_;
+            LeafCFunctionType leaf_func_;
             double number_;
             const char *str_;
         };
@@ -140,6 +206,11 @@ namespace oms
         {
         }
 
+        TableMemberReg(const char *name, LeafCFunctionType leaf_func)
+            : name_(name), leaf_func_(leaf_func), type_(ValueT_LeafCFunction)
+        {
+        }
+
         TableMemberReg(const char *name, double number)
             : name_(name), number_(number), type_(ValueT_Number)
         {
@@ -163,6 +234,11 @@ namespace oms
         // Register global function 'func' as 'name'
         void RegisterFunc(const char *name, CFunctionType func);
 
+        // Register global leaf C function 'func' as 'name', leaf C
+        // functions return at most one result, they are called with
+        // args in place and without CallInfo
+        void RegisterFunc(const char *name, LeafCFunctionType func);
+
         // Register a table of functions
         void RegisterTableFunction(const char *name, const TableMemberReg *table,
                                    std::size_t size);
@@ -186,6 +262,7 @@ namespace oms
     private:
         void RegisterToTable(Table *table, const TableMemberReg *table_reg, std::size_t size);
         void RegisterFunc(Table *table, const char *name, CFunctionType func);
+        void RegisterFunc(Table *table, const char *name, LeafCFunctionType func);
         void RegisterNumber(Table *table, const char *name, double number);
         void RegisterString(Table *table, const char *name, const char *str);
 
@@ -4,6 +4,7 @@
 #include "mstate.h"
 #include "mstring.h"
 #include <string>
+#include <fstream>
 #include <iostream>
 #include <assert.h>
 #include <stdio.h>
@@ -45,6 +46,9 @@ namespace base {
                 case oms::ValueT_CFunction:
                     printf("function:\t%p", api.GetCFunction(i));
                     break;
+                case oms::ValueT_LeafCFunction:
+                    printf("function:\t%p", api.GetValue(i)->leaf_cfunc_);
+                    break;
                 default:
                     break;
             }
@@ -96,6 +100,7 @@ namespace base {
                 break;
             case oms::ValueT_Closure:
             case oms::ValueT_CFunction:
+            case oms::ValueT_LeafCFunction:
                 api.PushString("function");
                 break;
             default:
@@ -105,6 +110,37 @@ namespace base {
         return 1;
     }
 
+    // select('#', ...) returns count of varargs, select(n, ...) returns
+    // varargs from the nth one, they are on stack top already, so they
+    // are returned in place without copying
+    int Select(oms::State *state)
+    {
+        oms::StackAPI api(state);
+        if (!api.CheckArgs(1))
+            return 0;
+
+        int count = api.GetStackSize() - 1;
+        if (api.IsString(0) && api.GetString(0)->GetStdString() == "#")
+        {
+            api.PushNumber(count);
+            return 1;
+        }
+
+        if (!api.CheckArgs(1, oms::ValueT_Number))
+            return 0;
+
+        // Negative index counts from the last vararg
+        int index = static_cast<int>(api.GetNumber(0));
+        if (index < 0)
+            index += count + 1;
+        if (index < 1)
+        {
+            api.Error("index out of range");
+            return 0;
+        }
+        return index > count ? 0 : count - index + 1;
+    }
+
     int DoIPairs(oms::State *state)
     {
         oms::StackAPI api(state);
@@ -196,6 +232,119 @@ namespace base {
         return 0;
     }
 
+    // Push table of GC statistics
+    void PushGCStats(oms::State *state, oms::StackAPI &api)
+    {
+        auto stats = state->GetGC().GetStats();
+        auto table = state->NewTable();
+        auto set = [&](const char *name, double value) {
+            table->SetValue(oms::Value(state->GetString(name)), oms::Value(value));
+        };
+
+        const char *gens[] = { "gen0", "gen1", "gen2" };
+        for (int i = oms::GCGen0; i <= oms::GCGen2; ++i)
+        {
+            set((std::string(gens[i]) + "_objects").c_str(), stats.objects_[i]);
+            set((std::string(gens[i]) + "_bytes").c_str(), stats.bytes_[i]);
+        }
+
+        const char *types[] = {
+            "", "table", "function", "closure", "upvalue", "string", "userdata"
+        };
+        for (int i = oms::GCObjectType_Table; i <= oms::GCObjectType_UserData; ++i)
+        {
+            set((std::string(types[i]) + "_objects").c_str(), stats.type_objects_[i]);
+            set((std::string(types[i]) + "_bytes").c_str(), stats.type_bytes_[i]);
+        }
+
+        set("minor_count", stats.minor_count_);
+        set("major_count", stats.major_count_);
+        set("pause_count", stats.pause_count_);
+        set("total_pause", static_cast<double>(stats.total_pause_));
+        set("max_pause", stats.max_pause_);
+        set("promotion_rate", stats.GetPromotionRate());
+        set("allocated_bytes", static_cast<double>(stats.allocated_bytes_));
+        set("freed_bytes", static_cast<double>(stats.freed_bytes_));
+        api.PushTable(table);
+    }
+
+    int CollectGarbage(oms::State *state)
+    {
+        oms::StackAPI api(state);
+        if (!api.CheckArgs(0, oms::ValueT_String))
+            return 0;
+
+        std::string option = "collect";
+        if (api.GetStackSize() > 0)
+            option = api.GetString(0)->GetStdString();
+
+        // Write heap snapshot into file
+        if (option == "snapshot")
+        {
+            if (!api.CheckArgs(2, oms::ValueT_String, oms::ValueT_String))
+                return 0;
+
+            std::ofstream out(api.GetString(1)->GetCStr());
+            if (out.is_open())
+                state->GetGC().DumpHeapSnapshot(out);
+            api.PushBool(out.is_open() && out.good());
+            return 1;
+        }
+
+        double arg = 0;
+        if (api.GetStackSize() > 1)
+        {
+            if (!api.CheckArgs(2, oms::ValueT_String, oms::ValueT_Number))
+                return 0;
+            arg = api.GetNumber(1);
+        }
+
+        auto &gc = state->GetGC();
+        if (option == "collect")
+        {
+            gc.FullGC();
+            api.PushNumber(0);
+        }
+        else if (option == "stop")
+        {
+            gc.Stop();
+            api.PushNumber(0);
+        }
+        else if (option == "restart")
+        {
+            gc.Restart();
+            api.PushNumber(0);
+        }
+        else if (option == "count")
+        {
+            api.PushNumber(gc.GetTotalBytes() / 1024.0);
+        }
+        else if (option == "stats")
+        {
+            PushGCStats(state, api);
+        }
+        else if (option == "step")
+        {
+            api.PushBool(gc.StepGC());
+        }
+        else if (option == "setpause")
+        {
+            api.PushNumber(gc.GetPause());
+            gc.SetPause(arg < 0 ? 0 : static_cast<unsigned int>(arg));
+        }
+        else if (option == "setstepmul")
+        {
+            api.PushNumber(gc.GetStepMultiplier());
+            gc.SetStepMultiplier(arg < 0 ? 0 : static_cast<unsigned int>(arg));
+        }
+        else
+        {
+            api.Error("invalid option '" + option + "'");
+            return 0;
+        }
+        return 1;
+    }
+
     void RegisterLibBase(oms::State *state)
     {
         oms::Library lib(state);
@@ -204,8 +353,10 @@ namespace base {
         lib.RegisterFunc("ipairs", IPairs);
         lib.RegisterFunc("pairs", Pairs);
         lib.RegisterFunc("type", Type);
+        lib.RegisterFunc("select", Select);
         lib.RegisterFunc("getline", GetLine);
         lib.RegisterFunc("require", Require);
+        lib.RegisterFunc("collectgarbage", CollectGarbage);
     }
 
 } // namespace base
@@ -289,6 +289,7 @@ namespace io {
         auto user_data = state->NewUserData();
         auto metatable = state->GetMetatable(METATABLE_FILE);
         user_data->Set(file, metatable);
+        CHECK_BARRIER(state->GetGC(), user_data);
         user_data->SetDestroyer(CloseFile);
         api.PushUserData(user_data);
         return 1;
@@ -300,6 +301,7 @@ namespace io {
         auto user_data = state->NewUserData();
         auto metatable = state->GetMetatable(METATABLE_FILE);
         user_data->Set(stdin, metatable);
+        CHECK_BARRIER(state->GetGC(), user_data);
         api.PushUserData(user_data);
         return 1;
     }
@@ -310,6 +312,7 @@ namespace io {
         auto user_data = state->NewUserData();
         auto metatable = state->GetMetatable(METATABLE_FILE);
         user_data->Set(stdout, metatable);
+        CHECK_BARRIER(state->GetGC(), user_data);
         api.PushUserData(user_data);
         return 1;
     }
@@ -320,6 +323,7 @@ namespace io {
         auto user_data = state->NewUserData();
         auto metatable = state->GetMetatable(METATABLE_FILE);
         user_data->Set(stderr, metatable);
+        CHECK_BARRIER(state->GetGC(), user_data);
         api.PushUserData(user_data);
         return 1;
     }
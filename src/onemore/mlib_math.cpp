@@ -7,27 +7,29 @@ namespace lib {
 namespace math {
 
 // Define one parameter one return value math function
-#define MATH_FUNCTION(name, std_name)                       \
-    int name(oms::State *state)                            \
-    {                                                       \
-        oms::StackAPI api(state);                          \
-        if (!api.CheckArgs(1, oms::ValueT_Number))         \
-            return 0;                                       \
-        api.PushNumber(std::std_name(api.GetNumber(0)));    \
-        return 1;                                           \
+#define MATH_FUNCTION(name, std_name)                                   \
+    int name(oms::State *state, const oms::Value *args, int arg_count, \
+             oms::Value *result)                                        \
+    {                                                                   \
+        oms::LeafArgs leaf(state, args, arg_count);                     \
+        if (!leaf.CheckArgs(1, oms::ValueT_Number))                     \
+            return oms::kLeafCFunctionError;                            \
+        *result = oms::Value(std::std_name(leaf.GetNumber(0)));         \
+        return 1;                                                       \
     }
 
 // Define two parameters one return value math function
-#define MATH_FUNCTION2(name, std_name)                      \
-    int name(oms::State *state)                            \
-    {                                                       \
-        oms::StackAPI api(state);                          \
-        if (!api.CheckArgs(2, oms::ValueT_Number,          \
-                           oms::ValueT_Number))            \
-            return 0;                                       \
-        api.PushNumber(std::std_name(api.GetNumber(0),      \
-                                     api.GetNumber(1)));    \
-        return 1;                                           \
+#define MATH_FUNCTION2(name, std_name)                                  \
+    int name(oms::State *state, const oms::Value *args, int arg_count, \
+             oms::Value *result)                                        \
+    {                                                                   \
+        oms::LeafArgs leaf(state, args, arg_count);                     \
+        if (!leaf.CheckArgs(2, oms::ValueT_Number,                      \
+                            oms::ValueT_Number))                        \
+            return oms::kLeafCFunctionError;                            \
+        *result = oms::Value(std::std_name(leaf.GetNumber(0),           \
+                                           leaf.GetNumber(1)));         \
+        return 1;                                                       \
     }
 
     MATH_FUNCTION(Abs, abs)
@@ -52,88 +54,93 @@ namespace math {
 #pragma warning(default:4244)
     MATH_FUNCTION2(Pow, pow)
 
-    int Deg(oms::State *state)
+    int Deg(oms::State *state, const oms::Value *args, int arg_count,
+            oms::Value *result)
     {
-        oms::StackAPI api(state);
-        if (!api.CheckArgs(1, oms::ValueT_Number))
-            return 0;
+        oms::LeafArgs leaf(state, args, arg_count);
+        if (!leaf.CheckArgs(1, oms::ValueT_Number))
+            return oms::kLeafCFunctionError;
 
-        api.PushNumber(api.GetNumber(0) / M_PI * 180);
+        *result = oms::Value(leaf.GetNumber(0) / M_PI * 180);
         return 1;
     }
 
-    int Rad(oms::State *state)
+    int Rad(oms::State *state, const oms::Value *args, int arg_count,
+            oms::Value *result)
     {
-        oms::StackAPI api(state);
-        if (!api.CheckArgs(1, oms::ValueT_Number))
-            return 0;
+        oms::LeafArgs leaf(state, args, arg_count);
+        if (!leaf.CheckArgs(1, oms::ValueT_Number))
+            return oms::kLeafCFunctionError;
 
-        api.PushNumber(api.GetNumber(0) / 180 * M_PI);
+        *result = oms::Value(leaf.GetNumber(0) / 180 * M_PI);
         return 1;
     }
 
-    int Log(oms::State *state)
+    int Log(oms::State *state, const oms::Value *args, int arg_count,
+            oms::Value *result)
     {
-        oms::StackAPI api(state);
-        if (!api.CheckArgs(1, oms::ValueT_Number, oms::ValueT_Number))
-            return 0;
+        oms::LeafArgs leaf(state, args, arg_count);
+        if (!leaf.CheckArgs(1, oms::ValueT_Number, oms::ValueT_Number))
+            return oms::kLeafCFunctionError;
 
-        auto l = std::log(api.GetNumber(0));
-        if (api.GetStackSize() > 1)
+        auto l = std::log(leaf.GetNumber(0));
+        if (leaf.GetStackSize() > 1)
         {
-            auto b = std::log(api.GetNumber(1));
+            auto b = std::log(leaf.GetNumber(1));
             l /= b;
         }
 
-        api.PushNumber(l);
+        *result = oms::Value(l);
         return 1;
     }
 
-    int Min(oms::State *state)
+    int Min(oms::State *state, const oms::Value *args, int arg_count,
+            oms::Value *result)
     {
-        oms::StackAPI api(state);
-        if (!api.CheckArgs(1, oms::ValueT_Number))
-            return 0;
+        oms::LeafArgs leaf(state, args, arg_count);
+        if (!leaf.CheckArgs(1, oms::ValueT_Number))
+            return oms::kLeafCFunctionError;
 
-        auto min = api.GetNumber(0);
-        auto params = api.GetStackSize();
+        auto min = leaf.GetNumber(0);
+        auto params = leaf.GetStackSize();
         for (int i = 1; i < params; ++i)
         {
-            if (!api.IsNumber(i))
+            if (!leaf.IsNumber(i))
             {
-                api.ArgTypeError(i, oms::ValueT_Number);
-                return 0;
+                leaf.ArgTypeError(i, oms::ValueT_Number);
+                return oms::kLeafCFunctionError;
             }
 
-            auto n = api.GetNumber(i);
+            auto n = leaf.GetNumber(i);
             if (n < min) min = n;
         }
 
-        api.PushNumber(min);
+        *result = oms::Value(min);
         return 1;
     }
 
-    int Max(oms::State *state)
+    int Max(oms::State *state, const oms::Value *args, int arg_count,
+            oms::Value *result)
     {
-        oms::StackAPI api(state);
-        if (!api.CheckArgs(1, oms::ValueT_Number))
-            return 0;
+        oms::LeafArgs leaf(state, args, arg_count);
+        if (!leaf.CheckArgs(1, oms::ValueT_Number))
+            return oms::kLeafCFunctionError;
 
-        auto max = api.GetNumber(0);
-        auto params = api.GetStackSize();
+        auto max = leaf.GetNumber(0);
+        auto params = leaf.GetStackSize();
         for (int i = 1; i < params; ++i)
         {
-            if (!api.IsNumber(i))
+            if (!leaf.IsNumber(i))
             {
-                api.ArgTypeError(i, oms::ValueT_Number);
-                return 0;
+                leaf.ArgTypeError(i, oms::ValueT_Number);
+                return oms::kLeafCFunctionError;
             }
 
-            auto n = api.GetNumber(i);
+            auto n = leaf.GetNumber(i);
             if (n > max) max = n;
         }
 
-        api.PushNumber(max);
+        *result = oms::Value(max);
         return 1;
     }
 
@@ -182,35 +189,36 @@ namespace math {
         void operator = (const RandEngine&) = delete;
     };
 
-    int Random(oms::State *state)
+    int Random(oms::State *state, const oms::Value *args, int arg_count,
+               oms::Value *result)
     {
-        oms::StackAPI api(state);
-        if (!api.CheckArgs(0, oms::ValueT_Number, oms::ValueT_Number))
-            return 0;
+        oms::LeafArgs leaf(state, args, arg_count);
+        if (!leaf.CheckArgs(0, oms::ValueT_Number, oms::ValueT_Number))
+            return oms::kLeafCFunctionError;
 
-        auto params = api.GetStackSize();
+        auto params = leaf.GetStackSize();
         if (params == 0)
         {
             RandEngine engine;
             std::uniform_real_distribution<> dis;
-            api.PushNumber(dis(engine));
+            *result = oms::Value(dis(engine));
         }
         else if (params == 1)
         {
-            auto max = static_cast<unsigned long long>(api.GetNumber(0));
+            auto max = static_cast<unsigned long long>(leaf.GetNumber(0));
 
             RandEngine engine;
             std::uniform_int_distribution<unsigned long long> dis(1, max);
-            api.PushNumber(static_cast<double>(dis(engine)));
+            *result = oms::Value(static_cast<double>(dis(engine)));
         }
         else if (params >= 2)
         {
-            auto min = static_cast<long long>(api.GetNumber(0));
-            auto max = static_cast<long long>(api.GetNumber(1));
+            auto min = static_cast<long long>(leaf.GetNumber(0));
+            auto max = static_cast<long long>(leaf.GetNumber(1));
 
             RandEngine engine;
             std::uniform_int_distribution<long long> dis(min, max);
-            api.PushNumber(static_cast<double>(dis(engine)));
+            *result = oms::Value(static_cast<double>(dis(engine)));
         }
 
         return 1;
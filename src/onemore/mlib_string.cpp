@@ -1,13 +1,110 @@
 #include "mlib_string.h"
+#include "mstate.h"
 #include "mstring.h"
+#include "mtable.h"
+#include "mstring_pattern.h"
+#include "mfunction.h"
+#include "mupvalue.h"
 #include <algorithm>
 #include <string>
 #include <cctype>
 #include <cmath>
+#include <cstdio>
 
 namespace lib {
 namespace string {
 
+    // Get the optional integer argument, report type error when the
+    // argument is neither nil nor number
+    bool GetOptInteger(oms::StackAPI &api, int index, int &num)
+    {
+        auto type = api.GetValueType(index);
+        if (type == oms::ValueT_Nil)
+            return true;
+
+        if (type != oms::ValueT_Number)
+        {
+            api.ArgTypeError(index, oms::ValueT_Number);
+            return false;
+        }
+
+        num = static_cast<int>(api.GetNumber(index));
+        return true;
+    }
+
+    // Convert relative string position to absolute position,
+    // negative position means counting back from the end
+    int PosRelative(int pos, std::size_t len)
+    {
+        if (pos < 0)
+            pos += static_cast<int>(len) + 1;
+        return pos >= 0 ? pos : 0;
+    }
+
+    void AppendNumber(std::string &buffer, double num)
+    {
+        char temp[64];
+        snprintf(temp, sizeof(temp), "%.14g", num);
+        buffer.append(temp);
+    }
+
+    // Get compiled pattern of argument 'index', report error when
+    // pattern is malformed
+    std::shared_ptr<const oms::Pattern> GetPattern(oms::State *state,
+                                                   oms::StackAPI &api, int index)
+    {
+        std::string error;
+        auto pattern = state->GetPatternCache()->GetPattern(api.GetString(index), error);
+        if (!pattern)
+            api.Error(error);
+        return pattern;
+    }
+
+    // Push capture 'i', the whole match is capture 0 when pattern
+    // has no captures
+    void PushCapture(oms::StackAPI &api, const oms::Pattern::MatchState &ms,
+                     int i, const char *s, const char *e)
+    {
+        if (i >= ms.level_)
+        {
+            api.PushString(s, e - s);
+            return ;
+        }
+
+        const auto &capture = ms.capture_[i];
+        if (capture.len_ == oms::Pattern::kCapturePosition)
+            api.PushNumber(capture.init_ - ms.src_init_ + 1);
+        else
+            api.PushString(capture.init_, capture.len_);
+    }
+
+    // Push all captures, push the whole match when pattern has no
+    // captures and 's' is not nullptr, return count of pushed values
+    int PushCaptures(oms::StackAPI &api, const oms::Pattern::MatchState &ms,
+                     const char *s, const char *e)
+    {
+        int count = (ms.level_ == 0 && s) ? 1 : ms.level_;
+        for (int i = 0; i < count; ++i)
+            PushCapture(api, ms, i, s, e);
+        return count;
+    }
+
+    void AppendCapture(std::string &buffer, const oms::Pattern::MatchState &ms,
+                       int i, const char *s, const char *e)
+    {
+        if (i >= ms.level_)
+        {
+            buffer.append(s, e - s);
+            return ;
+        }
+
+        const auto &capture = ms.capture_[i];
+        if (capture.len_ == oms::Pattern::kCapturePosition)
+            AppendNumber(buffer, capture.init_ - ms.src_init_ + 1);
+        else
+            buffer.append(capture.init_, capture.len_);
+    }
+
     int Byte(oms::State *state)
     {
         oms::StackAPI api(state);
@@ -67,23 +164,401 @@ namespace string {
         return 1;
     }
 
-    int Len(oms::State *state)
+    // Common part of string.find and string.match
+    int FindAux(oms::State *state, bool find)
     {
         oms::StackAPI api(state);
-        if (!api.CheckArgs(1, oms::ValueT_String))
+        if (!api.CheckArgs(2, oms::ValueT_String, oms::ValueT_String))
+            return 0;
+
+        auto str = api.GetString(0);
+        auto pattern_str = api.GetString(1);
+        auto s = str->GetCStr();
+        auto len = str->GetLength();
+
+        int init = 1;
+        if (!GetOptInteger(api, 2, init))
             return 0;
 
-        api.PushNumber(api.GetString(0)->GetLength());
+        init = PosRelative(init, len) - 1;
+        if (init < 0)
+            init = 0;
+        else if (static_cast<std::size_t>(init) > len)
+            init = static_cast<int>(len);
+
+        bool plain = api.GetStackSize() > 3 && !api.GetValue(3)->IsFalse();
+        std::shared_ptr<const oms::Pattern> pattern;
+        if (!plain)
+        {
+            pattern = GetPattern(state, api, 1);
+            if (!pattern)
+                return 0;
+            plain = pattern->IsPlain();
+        }
+
+        if (find && plain)
+        {
+            // Do a plain search
+            auto p_len = pattern_str->GetLength();
+            auto found = oms::Pattern::FindLiteral(s + init, len - init,
+                                                   pattern_str->GetCStr(), p_len);
+            if (!found)
+            {
+                api.PushNil();
+                return 1;
+            }
+
+            api.PushNumber(found - s + 1);
+            api.PushNumber(found - s + p_len);
+            return 2;
+        }
+
+        if (!pattern)
+        {
+            pattern = GetPattern(state, api, 1);
+            if (!pattern)
+                return 0;
+        }
+
+        oms::Pattern::MatchState ms;
+        ms.src_init_ = s;
+        ms.src_end_ = s + len;
+
+        const char *e = nullptr;
+        auto b = pattern->Find(ms, s + init, e);
+        if (!b)
+        {
+            api.PushNil();
+            return 1;
+        }
+
+        if (find)
+        {
+            api.PushNumber(b - s + 1);
+            api.PushNumber(e - s);
+            return 2 + PushCaptures(api, ms, nullptr, nullptr);
+        }
+
+        return PushCaptures(api, ms, b, e);
+    }
+
+    int Find(oms::State *state)
+    {
+        return FindAux(state, true);
+    }
+
+    int DoGMatch(oms::State *state)
+    {
+        oms::StackAPI api(state);
+        if (!api.CheckArgs(1, oms::ValueT_Table))
+            return 0;
+
+        // Iterate state is { string, pattern, position }
+        auto table = api.GetTable(0);
+        oms::Value key(1.0);
+        auto str_value = table->GetValue(key);
+        key.num_ = 2;
+        auto pattern_value = table->GetValue(key);
+        key.num_ = 3;
+        auto pos_value = table->GetValue(key);
+        if (str_value.type_ != oms::ValueT_String ||
+            pattern_value.type_ != oms::ValueT_String ||
+            pos_value.type_ != oms::ValueT_Number)
+        {
+            api.Error("bad gmatch iterate state");
+            return 0;
+        }
+
+        auto str = str_value.str_;
+        auto pos = static_cast<std::size_t>(pos_value.num_);
+
+        std::string error;
+        auto pattern = state->GetPatternCache()->GetPattern(pattern_value.str_, error);
+        if (!pattern)
+        {
+            api.Error(error);
+            return 0;
+        }
+
+        auto s = str->GetCStr();
+        oms::Pattern::MatchState ms;
+        ms.src_init_ = s;
+        ms.src_end_ = s + str->GetLength();
+
+        const char *b = nullptr;
+        const char *e = nullptr;
+        if (pattern->IsAnchor())
+        {
+            // '^' is not an anchor in gmatch, it matches itself
+            for (b = s + pos; b < ms.src_end_; ++b)
+            {
+                if (*b == '^' && (e = pattern->Match(ms, b + 1)))
+                    break;
+            }
+            if (b >= ms.src_end_)
+                b = nullptr;
+        }
+        else if (pos <= str->GetLength())
+        {
+            b = pattern->Find(ms, s + pos, e);
+        }
+
+        if (!b)
+            return 0;
+
+        // Empty match, go at least one position
+        pos = e - s;
+        if (e == b)
+            ++pos;
+
+        oms::Value value(static_cast<double>(pos));
+        table->SetValue(key, value);
+        return PushCaptures(api, ms, b, e);
+    }
+
+    // New closed upvalue of 'value'
+    oms::Upvalue * NewClosedUpvalue(oms::State *state, oms::Value value)
+    {
+        auto upvalue = state->NewUpvalue();
+        upvalue->SetValuePtr(&value);
+        upvalue->Close();
+        return upvalue;
+    }
+
+    // Prototype of gmatch iterators, which is 'return DoGMatch(state)'
+    // with DoGMatch as constant and iterate state as upvalue, so scripts
+    // can not pass other iterate state to DoGMatch. It is built once for
+    // each State, instructions have no lines, so errors are reported at
+    // the caller of iterators.
+    oms::Function * GetGMatchPrototype(oms::State *state)
+    {
+        auto proto = state->GetGMatchPrototype();
+        if (proto)
+            return proto;
+
+        proto = state->NewFunction();
+        proto->SetModuleName(state->GetString("string.gmatch"));
+        proto->AddUpvalue(state->GetString("state"), true, 0);
+        auto index = proto->AddConstValue(oms::Value(DoGMatch));
+        proto->AddInstruction(oms::Instruction::ABxCode(oms::OpType_LoadConst, 0, index), 0);
+        proto->AddInstruction(oms::Instruction::ABCode(oms::OpType_GetUpvalue, 1, 0), 0);
+        proto->AddInstruction(oms::Instruction::ABCCode(oms::OpType_Call, 0, 1, 0), 0);
+        proto->AddInstruction(oms::Instruction::ABCCode(oms::OpType_Ret, 0, 1, 1), 0);
+        // New function is default on GCGen2, so barrier it
+        CHECK_BARRIER(state->GetGC(), proto);
+
+        state->SetGMatchPrototype(proto);
+        return proto;
+    }
+
+    // New iterator closure of gmatch with its iterate state
+    oms::Closure * NewGMatchIterator(oms::State *state, oms::Table *iterate_state)
+    {
+        auto closure = state->NewClosure();
+        closure->SetPrototype(GetGMatchPrototype(state));
+        closure->AddUpvalue(NewClosedUpvalue(state, oms::Value(iterate_state)));
+        return closure;
+    }
+
+    int GMatch(oms::State *state)
+    {
+        oms::StackAPI api(state);
+        if (!api.CheckArgs(2, oms::ValueT_String, oms::ValueT_String))
+            return 0;
+
+        if (!GetPattern(state, api, 1))
+            return 0;
+
+        auto table = state->NewTable();
+        table->SetArrayValue(1, *api.GetValue(0));
+        table->SetArrayValue(2, *api.GetValue(1));
+        table->SetArrayValue(3, oms::Value(0.0));
+
+        api.PushValue(oms::Value(NewGMatchIterator(state, table)));
         return 1;
     }
 
-    int Lower(oms::State *state)
+    // Append the replacement of one match of gsub, return false
+    // when error occurred
+    bool AddValue(oms::StackAPI &api,
+                  const oms::Pattern::MatchState &ms,
+                  const char *s, const char *e, std::string &buffer)
+    {
+        auto repl = api.GetValue(2);
+        if (repl->type_ == oms::ValueT_String || repl->type_ == oms::ValueT_Number)
+        {
+            std::string num;
+            const char *news = nullptr;
+            std::size_t l = 0;
+            if (repl->type_ == oms::ValueT_String)
+            {
+                news = repl->str_->GetCStr();
+                l = repl->str_->GetLength();
+            }
+            else
+            {
+                AppendNumber(num, repl->num_);
+                news = num.c_str();
+                l = num.size();
+            }
+
+            for (std::size_t i = 0; i < l; ++i)
+            {
+                if (news[i] != '%' || i + 1 >= l)
+                {
+                    buffer.push_back(news[i]);
+                    continue;
+                }
+
+                ++i;
+                if (!isdigit(static_cast<unsigned char>(news[i])))
+                {
+                    buffer.push_back(news[i]);
+                }
+                else if (news[i] == '0')
+                {
+                    buffer.append(s, e - s);
+                }
+                else
+                {
+                    int index = news[i] - '1';
+                    if (index >= ms.level_ && !(index == 0 && ms.level_ == 0))
+                    {
+                        api.Error("invalid capture index");
+                        return false;
+                    }
+                    AppendCapture(buffer, ms, index, s, e);
+                }
+            }
+            return true;
+        }
+
+        if (repl->type_ == oms::ValueT_Table)
+        {
+            PushCapture(api, ms, 0, s, e);
+            auto value = repl->table_->GetValue(*api.GetValue(-1));
+            api.Pop(1);
+            api.PushValue(value);
+        }
+        else
+        {
+            api.PushValue(*repl);
+            int count = PushCaptures(api, ms, s, e);
+            int results = api.Call(count);
+            if (results == 0)
+                api.PushNil();
+            else if (results > 1)
+                api.Pop(results - 1);
+        }
+
+        // Keep original text when the result is false or nil
+        auto result = api.GetValue(-1);
+        if (result->IsFalse())
+            buffer.append(s, e - s);
+        else if (result->type_ == oms::ValueT_String)
+            buffer.append(result->str_->GetCStr(), result->str_->GetLength());
+        else if (result->type_ == oms::ValueT_Number)
+            AppendNumber(buffer, result->num_);
+        else
+        {
+            api.Error(std::string("invalid replacement value (a ") +
+                      result->TypeName() + ")");
+            return false;
+        }
+
+        api.Pop(1);
+        return true;
+    }
+
+    int GSub(oms::State *state)
     {
         oms::StackAPI api(state);
-        if (!api.CheckArgs(1, oms::ValueT_String))
+        if (!api.CheckArgs(3, oms::ValueT_String, oms::ValueT_String))
+            return 0;
+
+        auto repl_type = api.GetValueType(2);
+        if (repl_type != oms::ValueT_String && repl_type != oms::ValueT_Number &&
+            repl_type != oms::ValueT_Table && repl_type != oms::ValueT_Closure &&
+            repl_type != oms::ValueT_CFunction &&
+            repl_type != oms::ValueT_LeafCFunction)
+        {
+            api.ArgTypeError(2, oms::ValueT_String);
             return 0;
+        }
 
         auto str = api.GetString(0);
+        auto s = str->GetCStr();
+        auto len = str->GetLength();
+
+        int max_n = static_cast<int>(len) + 1;
+        if (!GetOptInteger(api, 3, max_n))
+            return 0;
+
+        auto pattern = GetPattern(state, api, 1);
+        if (!pattern)
+            return 0;
+
+        oms::Pattern::MatchState ms;
+        ms.src_init_ = s;
+        ms.src_end_ = s + len;
+
+        std::string buffer;
+        const char *src = s;
+        int n = 0;
+        while (n < max_n)
+        {
+            const char *e = nullptr;
+            auto b = pattern->Find(ms, src, e);
+            if (!b)
+                break;
+
+            buffer.append(src, b - src);
+            ++n;
+            if (!AddValue(api, ms, b, e, buffer))
+                return 0;
+
+            if (e > b)
+                src = e;
+            else if (b < ms.src_end_)
+            {
+                buffer.push_back(*b);
+                src = b + 1;
+            }
+            else
+            {
+                src = b;
+                break;
+            }
+
+            if (pattern->IsAnchor())
+                break;
+        }
+
+        buffer.append(src, ms.src_end_ - src);
+        api.PushString(buffer);
+        api.PushNumber(n);
+        return 2;
+    }
+
+    int Len(oms::State *state, const oms::Value *args, int arg_count,
+            oms::Value *result)
+    {
+        oms::LeafArgs leaf(state, args, arg_count);
+        if (!leaf.CheckArgs(1, oms::ValueT_String))
+            return oms::kLeafCFunctionError;
+
+        *result = oms::Value(static_cast<double>(leaf.GetString(0)->GetLength()));
+        return 1;
+    }
+
+    int Lower(oms::State *state, const oms::Value *args, int arg_count,
+              oms::Value *result)
+    {
+        oms::LeafArgs leaf(state, args, arg_count);
+        if (!leaf.CheckArgs(1, oms::ValueT_String))
+            return oms::kLeafCFunctionError;
+
+        auto str = leaf.GetString(0);
         auto size = str->GetLength();
         auto c_str = reinterpret_cast<const unsigned char *>(str->GetCStr());
 
@@ -92,17 +567,23 @@ namespace string {
         for (std::size_t i = 0; i < size; ++i)
             lower.push_back(std::tolower(c_str[i]));
 
-        api.PushString(lower);
+        *result = oms::Value(state->GetString(lower));
         return 1;
     }
 
-    int Reverse(oms::State *state)
+    int Match(oms::State *state)
     {
-        oms::StackAPI api(state);
-        if (!api.CheckArgs(1, oms::ValueT_String))
-            return 0;
+        return FindAux(state, false);
+    }
 
-        auto str = api.GetString(0);
+    int Reverse(oms::State *state, const oms::Value *args, int arg_count,
+                oms::Value *result)
+    {
+        oms::LeafArgs leaf(state, args, arg_count);
+        if (!leaf.CheckArgs(1, oms::ValueT_String))
+            return oms::kLeafCFunctionError;
+
+        auto str = leaf.GetString(0);
         auto size = str->GetLength();
         auto c_str = str->GetCStr();
 
@@ -111,24 +592,25 @@ namespace string {
         for (; size > 0; --size)
             reverse.push_back(c_str[size - 1]);
 
-        api.PushString(reverse);
+        *result = oms::Value(state->GetString(reverse));
         return 1;
     }
 
-    int Sub(oms::State *state)
+    int Sub(oms::State *state, const oms::Value *args, int arg_count,
+            oms::Value *result)
     {
-        oms::StackAPI api(state);
-        if (!api.CheckArgs(2, oms::ValueT_String,
+        oms::LeafArgs leaf(state, args, arg_count);
+        if (!leaf.CheckArgs(2, oms::ValueT_String,
                            oms::ValueT_Number, oms::ValueT_Number))
-            return 0;
+            return oms::kLeafCFunctionError;
 
-        auto str = api.GetString(0);
+        auto str = leaf.GetString(0);
         int size = str->GetLength();
         auto c_str = str->GetCStr();
-        auto start = static_cast<int>(api.GetNumber(1));
+        auto start = static_cast<int>(leaf.GetNumber(1));
         auto end = size;
 
-        auto params = api.GetStackSize();
+        auto params = leaf.GetStackSize();
         if (params <= 2)
         {
             if (start == 0)
@@ -144,7 +626,7 @@ namespace string {
         else
         {
             start = start == 0 ? 1 : std::abs(start);
-            end = std::abs(static_cast<int>(api.GetNumber(2)));
+            end = std::abs(static_cast<int>(leaf.GetNumber(2)));
             end = std::min(end, size);
         }
 
@@ -152,17 +634,18 @@ namespace string {
         for (int i = start; i <= end; ++i)
             sub.push_back(c_str[i - 1]);
 
-        api.PushString(sub);
+        *result = oms::Value(state->GetString(sub));
         return 1;
     }
 
-    int Upper(oms::State *state)
+    int Upper(oms::State *state, const oms::Value *args, int arg_count,
+              oms::Value *result)
     {
-        oms::StackAPI api(state);
-        if (!api.CheckArgs(1, oms::ValueT_String))
-            return 0;
+        oms::LeafArgs leaf(state, args, arg_count);
+        if (!leaf.CheckArgs(1, oms::ValueT_String))
+            return oms::kLeafCFunctionError;
 
-        auto str = api.GetString(0);
+        auto str = leaf.GetString(0);
         auto size = str->GetLength();
         auto c_str = reinterpret_cast<const unsigned char *>(str->GetCStr());
 
@@ -171,7 +654,7 @@ namespace string {
         for (std::size_t i = 0; i < size; ++i)
             upper.push_back(std::toupper(c_str[i]));
 
-        api.PushString(upper);
+        *result = oms::Value(state->GetString(upper));
         return 1;
     }
 
@@ -181,8 +664,12 @@ namespace string {
         oms::TableMemberReg string[] = {
             { "byte", Byte },
             { "char", Char },
+            { "find", Find },
+            { "gmatch", GMatch },
+            { "gsub", GSub },
             { "len", Len },
             { "lower", Lower },
+            { "match", Match },
             { "reverse", Reverse },
             { "sub", Sub },
             { "upper", Upper }
@@ -99,7 +99,9 @@ namespace table {
             value = 2;
         }
 
-        api.PushBool(table->InsertArrayValue(index, *api.GetValue(value)));
+        auto success = table->InsertArrayValue(index, *api.GetValue(value));
+        CHECK_BARRIER(state->GetGC(), table);
+        api.PushBool(success);
         return 1;
     }
 
@@ -170,14 +172,72 @@ namespace table {
         return count;
     }
 
+    // Weak modes of tables, "k" weak keys, "v" weak values, "kv" weak
+    // keys and values, "e" ephemeron keys, "" not weak
+    const struct
+    {
+        const char *name_;
+        oms::TableWeakMode mode_;
+    } kWeakModes[] = {
+        { "", oms::TableWeak_None },
+        { "k", oms::TableWeak_Key },
+        { "v", oms::TableWeak_Value },
+        { "kv", oms::TableWeak_KeyValue },
+        { "e", oms::TableWeak_Ephemeron }
+    };
+
+    int SetWeak(oms::State *state)
+    {
+        oms::StackAPI api(state);
+        if (!api.CheckArgs(2, oms::ValueT_Table, oms::ValueT_String))
+            return 0;
+
+        auto table = api.GetTable(0);
+        auto name = api.GetString(1)->GetStdString();
+        for (const auto &weak : kWeakModes)
+        {
+            if (name == weak.name_)
+            {
+                // GC may be marking the table with the old weak mode
+                table->SetWeakMode(weak.mode_);
+                CHECK_BARRIER(state->GetGC(), table);
+                api.PushTable(table);
+                return 1;
+            }
+        }
+
+        api.Error("invalid weak mode '" + name + "'");
+        return 0;
+    }
+
+    int GetWeak(oms::State *state)
+    {
+        oms::StackAPI api(state);
+        if (!api.CheckArgs(1, oms::ValueT_Table))
+            return 0;
+
+        auto mode = api.GetTable(0)->GetWeakMode();
+        for (const auto &weak : kWeakModes)
+        {
+            if (mode == weak.mode_)
+            {
+                api.PushString(weak.name_);
+                return 1;
+            }
+        }
+        return 0;
+    }
+
     void RegisterLibTable(oms::State *state)
     {
         oms::Library lib(state);
         oms::TableMemberReg table[] = {
             { "concat", Concat },
+            { "getweak", GetWeak },
             { "insert", Insert },
             { "pack", Pack },
             { "remove", Remove },
+            { "setweak", SetWeak },
             { "unpack", Unpack }
         };
 
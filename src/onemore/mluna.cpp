@@ -1,4 +1,5 @@
 #include "mstate.h"
+#include "mtable.h"
 #include "mexception.h"
 #include "mlib_base.h"
 #include "mlib_io.h"
@@ -6,6 +7,10 @@
 #include "mlib_string.h"
 #include "mlib_table.h"
 #include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
 
 void Repl(oms::State &state)
 {
@@ -28,8 +33,25 @@ void Repl(oms::State &state)
     }
 }
 
-void ExecuteFile(const char **argv, oms::State &state)
+// Set global 'arg' like Lua, script name is arg[0] and arguments
+// after it start from arg[1]
+void SetArgs(int argc, const char **argv, oms::State &state)
 {
+    auto args = state.NewTable();
+    for (int i = 1; i < argc; ++i)
+    {
+        args->SetValue(oms::Value(static_cast<double>(i - 1)),
+                       oms::Value(state.GetString(argv[i])));
+    }
+
+    auto global = state.GetGlobal()->table_;
+    global->SetValue(oms::Value(state.GetString("arg")), oms::Value(args));
+    CHECK_BARRIER(state.GetGC(), global);
+}
+
+void ExecuteFile(int argc, const char **argv, oms::State &state)
+{
+    SetArgs(argc, argv, state);
     try
     {
         state.DoModule(argv[1]);
@@ -44,9 +66,122 @@ void ExecuteFile(const char **argv, oms::State &state)
     }
 }
 
+void CompileFiles(int argc, const char **argv, oms::State &state)
+{
+    for (int i = 2; i < argc; ++i)
+    {
+        try
+        {
+            state.CompileModule(argv[i]);
+        }
+        catch (const oms::OpenFileFail &exp)
+        {
+            printf("%s: can not open file %s\n", argv[0], exp.What().c_str());
+        }
+        catch (const oms::Exception &exp)
+        {
+            printf("%s\n", exp.What().c_str());
+        }
+    }
+}
+
+void BuildBundle(int argc, const char **argv, oms::State &state)
+{
+    try
+    {
+        std::vector<std::string> modules(argv + 3, argv + argc);
+        state.BuildBundle(modules, argv[2]);
+    }
+    catch (const oms::OpenFileFail &exp)
+    {
+        printf("%s: can not open file %s\n", argv[0], exp.What().c_str());
+    }
+    catch (const oms::Exception &exp)
+    {
+        printf("%s\n", exp.What().c_str());
+    }
+}
+
+void LoadBundle(const char **argv, const char *path, oms::State &state)
+{
+    try
+    {
+        state.LoadBundle(path);
+    }
+    catch (const oms::OpenFileFail &exp)
+    {
+        printf("%s: can not open file %s\n", argv[0], exp.What().c_str());
+    }
+    catch (const oms::Exception &exp)
+    {
+        printf("%s\n", exp.What().c_str());
+    }
+}
+
+// Split module names separated by ';'
+std::vector<std::string> SplitModules(const char *names)
+{
+    std::vector<std::string> modules;
+    std::string name;
+    for (const char *c = names; ; ++c)
+    {
+        if (*c == ';' || *c == '\0')
+        {
+            if (!name.empty())
+                modules.push_back(name);
+            name.clear();
+            if (*c == '\0')
+                break;
+        }
+        else
+        {
+            name.push_back(*c);
+        }
+    }
+    return modules;
+}
+
 int main(int argc, const char **argv)
 {
-    oms::State state;
+    // Lex sources by table-driven DFA instead of hand-written lexer
+    const char *lexer = getenv("LUNA_LEXER");
+    oms::State state(lexer && strcmp(lexer, "dfa") == 0 ?
+                     oms::LexerType_DFA : oms::LexerType_HandWritten);
+
+    // Cache compiled modules across runs when cache directory is set
+    const char *cache_dir = getenv("LUNA_COMPILE_CACHE");
+    if (cache_dir)
+        state.SetCompileCache(cache_dir, 64 * 1024 * 1024);
+
+    // Compile functions on their first call
+    if (getenv("LUNA_LAZY_COMPILE"))
+        state.SetLazyCompile(true);
+
+    // Allocate GC objects by operator new instead of size class pools
+    if (getenv("LUNA_GC_NO_POOL"))
+        state.GetGC().SetObjectPoolEnabled(false);
+
+    // Run destroyers of dead user data on background finalizer thread
+    if (getenv("LUNA_GC_BACKGROUND_FINALIZER"))
+        state.GetGC().SetBackgroundFinalizer(true);
+
+    // Mark gray objects by threads in parallel when major GC marks at once
+    const char *mark_threads = getenv("LUNA_GC_MARK_THREADS");
+    if (mark_threads)
+        state.GetGC().SetMarkThreads(atoi(mark_threads));
+
+    // Load modules from bundle image instead of module files
+    const char *bundle = getenv("LUNA_BUNDLE");
+    if (bundle)
+        LoadBundle(argv, bundle, state);
+
+    // Compile modules separated by ';' on worker threads before running,
+    // count of threads is hardware threads by default
+    const char *preload = getenv("LUNA_PRELOAD");
+    const char *preload_threads = getenv("LUNA_PRELOAD_THREADS");
+    if (preload)
+        state.PreloadModules(SplitModules(preload),
+                             preload_threads ? atoi(preload_threads) : 0);
 
     lib::base::RegisterLibBase(&state);
     lib::io::RegisterLibIO(&state);
@@ -58,9 +193,19 @@ int main(int argc, const char **argv)
     {
         Repl(state);
     }
+    else if (strcmp(argv[1], "-c") == 0)
+    {
+        // Precompile modules to bytecode files
+        CompileFiles(argc, argv, state);
+    }
+    else if (strcmp(argv[1], "-b") == 0 && argc > 2)
+    {
+        // Link modules into a bundle image
+        BuildBundle(argc, argv, state);
+    }
     else
     {
-        ExecuteFile(argv, state);
+        ExecuteFile(argc, argv, state);
     }
 
     return 0;
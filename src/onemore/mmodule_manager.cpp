@@ -7,12 +7,51 @@
 #include "msemantic_analysis.h"
 #include "mcode_generate.h"
 #include "mtext_in_stream.h"
+#include "mbytecode.h"
+#include "mfunction.h"
+#include <algorithm>
+#include <atomic>
 #include <functional>
+#include <system_error>
+#include <thread>
+#include <stdio.h>
+#include <assert.h>
 
 namespace oms
 {
+    namespace
+    {
+        void WriteFile(const std::string &path, const std::string &data)
+        {
+            FILE *file = fopen(path.c_str(), "wb");
+            if (!file)
+                throw OpenFileFail(path);
+            auto size = fwrite(data.data(), 1, data.size(), file);
+            fclose(file);
+            if (size != data.size())
+            {
+                remove(path.c_str());
+                throw OpenFileFail(path);
+            }
+        }
+
+        // Bytecode is fresh when its stamp matches the source file, or
+        // the source file is not existed, e.g. only bytecode is deployed
+        bool IsFreshBytecode(const std::string &module_name,
+                             const io::text::InStream &is)
+        {
+            SourceStamp bytecode_stamp;
+            if (!ReadBytecodeStamp(is.GetBuffer(), is.GetSize(), &bytecode_stamp))
+                return false;
+
+            SourceStamp source_stamp;
+            return !GetSourceStamp(module_name, &source_stamp) ||
+                source_stamp == bytecode_stamp;
+        }
+    } // namespace
+
     ModuleManager::ModuleManager(State *state, Table *modules)
-        : state_(state), modules_(modules)
+        : state_(state), modules_(modules), lazy_compile_(false)
     {
     }
 
@@ -30,37 +69,343 @@ namespace oms
 
     void ModuleManager::LoadModule(const std::string &module_name)
     {
-        io::text::InStream is(module_name);
-        if (!is.IsOpen())
-            throw OpenFileFail(module_name);
-
-        Lexer lexer(state_, state_->GetString(module_name),
-                    [&is] () { return is.GetChar(); });
-        Load(lexer);
+        if (!LoadFromBundle(module_name) && !LoadPreloaded(module_name) &&
+            !LoadBytecode(module_name))
+            LoadSource(module_name, lazy_compile_);
 
         // Add to modules' table
         Value key(state_->GetString(module_name));
         Value value = *(state_->stack_.top_ - 1);
         modules_->SetValue(key, value);
+        CHECK_BARRIER(state_->GetGC(), modules_);
+    }
+
+    void ModuleManager::CompileModule(const std::string &module_name)
+    {
+        WriteFile(module_name + kBytecodeSuffix, Compile(module_name));
+    }
+
+    void ModuleManager::BuildBundle(const std::vector<std::string> &module_names,
+                                    const std::string &path)
+    {
+        std::vector<std::string> bytecodes;
+        for (const auto &module_name : module_names)
+            bytecodes.push_back(Compile(module_name));
+
+        std::vector<BundleModule> modules(module_names.size());
+        for (std::size_t i = 0; i < modules.size(); ++i)
+        {
+            modules[i].name_ = module_names[i];
+            modules[i].bytecode_ = bytecodes[i].data();
+            modules[i].size_ = bytecodes[i].size();
+        }
+
+        std::string bundle;
+        LinkBundle(modules, &bundle);
+        WriteFile(path, bundle);
+    }
+
+    void ModuleManager::LoadBundle(const std::string &path)
+    {
+        std::unique_ptr<io::text::InStream> is(new io::text::InStream(path));
+        if (!is->IsOpen())
+            throw OpenFileFail(path);
+
+        std::vector<BundleModule> modules;
+        if (!ReadBundle(is->GetBuffer(), is->GetSize(), &modules))
+            throw BytecodeException(path.c_str(), "bad bundle image");
+
+        for (const auto &module : modules)
+            bundle_modules_[module.name_] = module;
+        bundles_.push_back(std::move(is));
+    }
+
+    void ModuleManager::PreloadModules(const std::vector<std::string> &module_names,
+                                       unsigned int threads)
+    {
+        // Modules with fresh bytecode are loaded without compiling
+        std::vector<std::string> names;
+        for (const auto &module_name : module_names)
+        {
+            if (IsLoaded(module_name) ||
+                bundle_modules_.find(module_name) != bundle_modules_.end() ||
+                preloaded_modules_.find(module_name) != preloaded_modules_.end())
+                continue;
+
+            io::text::InStream is(module_name + kBytecodeSuffix);
+            if (!is.IsOpen() || !IsFreshBytecode(module_name, is))
+                names.push_back(module_name);
+        }
+
+        // Each worker compiles modules with its own State, so strings
+        // are interned by string pool of the worker State
+        std::vector<PreloadedModule> modules(names.size());
+        std::atomic<std::size_t> next(0);
+        auto compile = [&]() {
+            State state(state_->GetLexerType());
+            for (auto i = next++; i < names.size(); i = next++)
+            {
+                try
+                {
+                    state.module_manager_->PreloadCompile(names[i], compile_cache_.get(),
+                                                          &modules[i].bytecode_);
+                }
+                catch (const OpenFileFail &)
+                {
+                    // LoadModule reports it when the module is not
+                    // existed in any other way
+                }
+                catch (...)
+                {
+                    modules[i].error_ = std::current_exception();
+                }
+            }
+        };
+
+        if (threads == 0)
+            threads = std::max(std::thread::hardware_concurrency(), 1u);
+        threads = std::min(threads, static_cast<unsigned int>(names.size()));
+
+        std::vector<std::thread> workers;
+        for (unsigned int i = 1; i < threads; ++i)
+        {
+            try
+            {
+                workers.emplace_back(compile);
+            }
+            catch (const std::system_error &)
+            {
+                break;
+            }
+        }
+
+        compile();
+        for (auto &worker : workers)
+            worker.join();
+
+        // Modules not compiled are loaded in the normal way
+        for (std::size_t i = 0; i < names.size(); ++i)
+        {
+            if (!modules[i].bytecode_.empty() || modules[i].error_)
+                preloaded_modules_[names[i]] = std::move(modules[i]);
+        }
+    }
+
+    void ModuleManager::SetCompileCache(const std::string &dir,
+                                        std::size_t max_bytes)
+    {
+        compile_cache_.reset(new CompileCache(dir, max_bytes));
+    }
+
+    void ModuleManager::SetLazyCompile(bool lazy)
+    {
+        lazy_compile_ = lazy;
+    }
+
+    void ModuleManager::CompileLazyFunction(Function *func)
+    {
+        auto lazy = func->GetLazySource();
+        assert(lazy);
+
+        // Source of function body begins at line of the function
+        auto buffer = lazy->source_->data() + lazy->begin_;
+        Lexer lexer(state_, func->GetModule(), buffer,
+                    lazy->end_ - lazy->begin_, func->GetLine());
+        auto ast = ParseFunctionBody(&lexer);
+        static_cast<FunctionBody *>(ast.get())->has_self_ = lazy->has_self_;
+
+        // Upvalues of the function are prepared when it is loaded
+        std::vector<String *> upvalues;
+        for (std::size_t i = 0; i < func->GetUpvalueCount(); ++i)
+            upvalues.push_back(func->GetUpvalue(i)->name_);
+        SemanticAnalysis(ast.get(), state_, upvalues);
+
+        CodeGenerate(ast.get(), func, state_);
     }
 
     void ModuleManager::LoadString(const std::string &str, const std::string &name)
     {
         io::text::InStringStream is(str);
-        Lexer lexer(state_, state_->GetString(name),
-                    [&is] () { return is.GetChar(); });
-        Load(lexer);
+        Load(is.GetBuffer(), is.GetSize(), name, lazy_compile_);
     }
 
-    void ModuleManager::Load(Lexer &lexer)
+    std::string ModuleManager::Compile(const std::string &module_name)
     {
+        SourceStamp stamp;
+        if (!GetSourceStamp(module_name, &stamp))
+            throw OpenFileFail(module_name);
+
+        LoadSource(module_name, false);
+        auto closure = (state_->stack_.top_ - 1)->closure_;
+        std::string bytecode;
+        DumpFunction(closure->GetPrototype(), stamp, &bytecode);
+        --state_->stack_.top_;
+        return bytecode;
+    }
+
+    void ModuleManager::PreloadCompile(const std::string &module_name,
+                                       CompileCache *cache, std::string *bytecode)
+    {
+        if (!cache)
+        {
+            *bytecode = Compile(module_name);
+            return ;
+        }
+
+        io::text::InStream is(module_name);
+        if (!is.IsOpen())
+            throw OpenFileFail(module_name);
+
+        // Cached module is undumped from compile cache by LoadSource,
+        // other modules are compiled and put into compile cache
+        auto key = CompileCache::GetKey(is.GetBuffer(), is.GetSize());
+        std::string cached;
+        if (cache->Get(key, &cached))
+            return ;
+
+        Load(is.GetBuffer(), is.GetSize(), module_name, false);
+        auto closure = (state_->stack_.top_ - 1)->closure_;
+        DumpFunction(closure->GetPrototype(), SourceStamp(), bytecode);
+        --state_->stack_.top_;
+        cache->Put(key, *bytecode);
+    }
+
+    bool ModuleManager::LoadFromBundle(const std::string &module_name)
+    {
+        auto it = bundle_modules_.find(module_name);
+        if (it == bundle_modules_.end())
+            return false;
+
+        const auto &module = it->second;
+        SourceStamp stamp;
+        if (!ReadBytecodeStamp(module.bytecode_, module.size_, &stamp))
+            throw BytecodeException(module_name.c_str(), "bad bytecode in bundle");
+
+        // Instructions reference the image, so pages of the image are
+        // shared by all processes which load the same bundle
+        auto module_string = state_->GetString(module_name);
+        PushClosure(UndumpFunction(state_, module_string,
+                                   module.bytecode_, module.size_, true));
+        return true;
+    }
+
+    bool ModuleManager::LoadPreloaded(const std::string &module_name)
+    {
+        auto it = preloaded_modules_.find(module_name);
+        if (it == preloaded_modules_.end())
+            return false;
+
+        auto module = std::move(it->second);
+        preloaded_modules_.erase(it);
+        if (module.error_)
+            std::rethrow_exception(module.error_);
+
+        // Strings of bytecode are interned into this State by undump
+        auto module_string = state_->GetString(module_name);
+        PushClosure(UndumpFunction(state_, module_string,
+                                   module.bytecode_.data(),
+                                   module.bytecode_.size()));
+        return true;
+    }
+
+    bool ModuleManager::LoadBytecode(const std::string &module_name)
+    {
+        io::text::InStream is(module_name + kBytecodeSuffix);
+        if (!is.IsOpen() || !IsFreshBytecode(module_name, is))
+            return false;
+
+        auto module = state_->GetString(module_name);
+        PushClosure(UndumpFunction(state_, module, is.GetBuffer(), is.GetSize()));
+        return true;
+    }
+
+    void ModuleManager::PushClosure(Function *prototype)
+    {
+        auto closure = state_->NewClosure();
+        closure->SetPrototype(prototype);
+
+        auto top = state_->stack_.top_++;
+        top->closure_ = closure;
+        top->type_ = ValueT_Closure;
+    }
+
+    void ModuleManager::LoadSource(const std::string &module_name, bool lazy)
+    {
+        io::text::InStream is(module_name);
+        if (!is.IsOpen())
+            throw OpenFileFail(module_name);
+
+        if (!compile_cache_)
+        {
+            Load(is.GetBuffer(), is.GetSize(), module_name, lazy);
+            return ;
+        }
+
+        auto key = CompileCache::GetKey(is.GetBuffer(), is.GetSize());
+        if (LoadFromCache(module_name, key))
+            return ;
+
+        // Cached bytecode contains code of all functions
+        Load(is.GetBuffer(), is.GetSize(), module_name, false);
+
+        auto closure = (state_->stack_.top_ - 1)->closure_;
+        std::string bytecode;
+        DumpFunction(closure->GetPrototype(), SourceStamp(), &bytecode);
+        compile_cache_->Put(key, bytecode);
+    }
+
+    bool ModuleManager::LoadFromCache(const std::string &module_name,
+                                      const std::string &key)
+    {
+        std::string bytecode;
+        if (!compile_cache_->Get(key, &bytecode))
+            return false;
+
+        // Broken entry is removed and compiled again
+        SourceStamp stamp;
+        Function *func = nullptr;
+        if (ReadBytecodeStamp(bytecode.data(), bytecode.size(), &stamp))
+        {
+            try
+            {
+                func = UndumpFunction(state_, state_->GetString(module_name),
+                                      bytecode.data(), bytecode.size());
+            }
+            catch (const BytecodeException &)
+            {
+            }
+        }
+
+        if (!func)
+        {
+            compile_cache_->Remove(key);
+            return false;
+        }
+
+        PushClosure(func);
+        return true;
+    }
+
+    void ModuleManager::Load(const char *buffer, std::size_t size,
+                             const std::string &name, bool lazy)
+    {
+        // Lazy functions are compiled from source after loading, so
+        // keep a copy of source for them
+        std::shared_ptr<const std::string> source;
+        if (lazy)
+        {
+            source = std::make_shared<const std::string>(buffer, size);
+            buffer = source->data();
+        }
+
         // Parse to AST
+        Lexer lexer(state_, state_->GetString(name), buffer, size);
         auto ast = Parse(&lexer);
 
         // Semantic analysis
         SemanticAnalysis(ast.get(), state_);
 
         // Generate code
-        CodeGenerate(ast.get(), state_);
+        CodeGenerate(ast.get(), state_, source);
     }
 } // namespace oms
@@ -2,12 +2,19 @@
 #define MODULE_MANAGER_H
 
 #include "mvalue.h"
+#include "mbytecode.h"
+#include "mcompile_cache.h"
+#include "mtext_in_stream.h"
 #include <string>
+#include <vector>
+#include <memory>
+#include <exception>
+#include <unordered_map>
 
 namespace oms
 {
     class State;
-    class Lexer;
+    class Function;
 
     // Load and manage all modules or load string
     class ModuleManager
@@ -26,19 +33,105 @@ namespace oms
         Value GetModuleClosure(const std::string &module_name) const;
 
         // Load module, when loaded success, push the closure of the module
-        // onto stack
+        // onto stack. Precompiled bytecode file of the module is loaded
+        // instead of the source file when it is fresh
         void LoadModule(const std::string &module_name);
 
+        // Compile module and save bytecode to precompiled bytecode file
+        // of the module
+        void CompileModule(const std::string &module_name);
+
+        // Compile modules and link their bytecode into one bundle image
+        void BuildBundle(const std::vector<std::string> &module_names,
+                         const std::string &path);
+
+        // Map bundle image, modules in it are loaded from the image before
+        // module files, and their instructions reference the image
+        void LoadBundle(const std::string &path);
+
+        // Compile modules concurrently on 'threads' threads, 0 means
+        // count of hardware threads. Modules are compiled to bytecode
+        // by worker States, and undumped into this State when they are
+        // loaded, errors of compiling are also thrown when they are loaded.
+        // Modules with fresh bytecode or in compile cache are not compiled,
+        // and modules without source are loaded in the normal way
+        void PreloadModules(const std::vector<std::string> &module_names,
+                            unsigned int threads);
+
+        // Use compile cache in 'dir' for loading module source files,
+        // total size of cache entries is capped by 'max_bytes'
+        void SetCompileCache(const std::string &dir, std::size_t max_bytes);
+
+        // Generate code of child functions of loaded sources on their
+        // first call when 'lazy' is true. Sources compiled for bytecode
+        // or compile cache are always compiled entirely
+        void SetLazyCompile(bool lazy);
+
+        // Generate code of function which is compiled lazily
+        void CompileLazyFunction(Function *func);
+
         // Load string, when loaded success, push the closure of the string
         // onto stack
         void LoadString(const std::string &str, const std::string &name);
 
     private:
-        // Load and push the closure onto stack
-        void Load(Lexer &lexer);
+        // Load source in 'buffer' and push the closure onto stack, child
+        // functions are compiled lazily when 'lazy' is true
+        void Load(const char *buffer, std::size_t size,
+                  const std::string &name, bool lazy);
+
+        // Load and push the closure of fresh bytecode onto stack,
+        // return false when bytecode is not existed or not fresh
+        bool LoadBytecode(const std::string &module_name);
+
+        // Load source file and push the closure onto stack, the source
+        // is compiled only when it is not in compile cache, child
+        // functions are compiled lazily when 'lazy' is true and compile
+        // cache is not used
+        void LoadSource(const std::string &module_name, bool lazy);
+
+        // Load and push the closure of preloaded module onto stack,
+        // return false when module is not preloaded
+        bool LoadPreloaded(const std::string &module_name);
+
+        // Load and push the closure of cached bytecode of 'key' onto
+        // stack, return false when it is not cached or broken
+        bool LoadFromCache(const std::string &module_name,
+                           const std::string &key);
+
+        // Load and push the closure of module in loaded bundles onto
+        // stack, return false when module is not in any bundle
+        bool LoadFromBundle(const std::string &module_name);
+
+        // Compile module and return its bytecode
+        std::string Compile(const std::string &module_name);
+
+        // Compile module on worker State for preloading, 'cache' is the
+        // compile cache of loading State. 'bytecode' is empty when the
+        // module is in compile cache, and it is loaded from the cache
+        void PreloadCompile(const std::string &module_name,
+                            CompileCache *cache, std::string *bytecode);
+
+        // New closure of module prototype and push it onto stack
+        void PushClosure(Function *prototype);
 
         State *state_;
         Table *modules_;
+        // Mapped bundle images and modules in them
+        std::vector<std::unique_ptr<io::text::InStream>> bundles_;
+        std::unordered_map<std::string, BundleModule> bundle_modules_;
+        // Compile cache of module source files
+        std::unique_ptr<CompileCache> compile_cache_;
+        // Compile child functions on their first call
+        bool lazy_compile_;
+
+        // Bytecode or compile error of preloaded module
+        struct PreloadedModule
+        {
+            std::string bytecode_;
+            std::exception_ptr error_;
+        };
+        std::unordered_map<std::string, PreloadedModule> preloaded_modules_;
     };
 } // namespace oms
 
@@ -0,0 +1,169 @@
+#include "mobject_pool.h"
+#include <new>
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif // _MSC_VER
+
+namespace oms
+{
+    namespace
+    {
+        // Alignment of the first block in slab
+        const std::size_t kBlockAlign = 16;
+
+        void * AllocAligned(std::size_t size)
+        {
+#ifdef _MSC_VER
+            void *p = _aligned_malloc(size, size);
+#else
+            void *p = nullptr;
+            if (posix_memalign(&p, size, size) != 0)
+                p = nullptr;
+#endif // _MSC_VER
+            if (!p)
+                throw std::bad_alloc();
+            return p;
+        }
+
+        void FreeAligned(void *p)
+        {
+#ifdef _MSC_VER
+            _aligned_free(p);
+#else
+            free(p);
+#endif // _MSC_VER
+        }
+    } // namespace
+
+    ObjectPool::ObjectPool(std::size_t block_size)
+        : block_size_(0), blocks_per_slab_(0),
+          partial_(nullptr), slab_count_(0)
+    {
+        if (block_size != 0)
+            SetBlockSize(block_size);
+    }
+
+    ObjectPool::~ObjectPool()
+    {
+        ReleaseIdleSlabs();
+        assert(slab_count_ == 0);
+    }
+
+    void ObjectPool::SetBlockSize(std::size_t block_size)
+    {
+        assert(slab_count_ == 0);
+        assert(block_size >= sizeof(void *));
+
+        auto header = (sizeof(Slab) + kBlockAlign - 1) / kBlockAlign * kBlockAlign;
+        block_size_ = (block_size + kBlockAlign - 1) / kBlockAlign * kBlockAlign;
+        blocks_per_slab_ = (kSlabSize - header) / block_size_;
+        assert(blocks_per_slab_ > 0);
+    }
+
+    void * ObjectPool::Alloc()
+    {
+        if (!partial_)
+            LinkSlab(NewSlab());
+
+        Slab *slab = partial_;
+        void *block = nullptr;
+        if (slab->free_)
+        {
+            block = slab->free_;
+            slab->free_ = *static_cast<void **>(block);
+        }
+        else
+        {
+            assert(slab->unused_ < slab->end_);
+            block = slab->unused_;
+            slab->unused_ += block_size_;
+        }
+
+        // Slab is full, unlink it from partial list
+        if (++slab->used_ == blocks_per_slab_)
+            UnlinkSlab(slab);
+        return block;
+    }
+
+    void ObjectPool::Free(void *block)
+    {
+        Slab *slab = SlabOf(block);
+        assert(slab->used_ > 0);
+
+        // Slab is full, it has free block now
+        if (slab->used_-- == blocks_per_slab_)
+            LinkSlab(slab);
+
+        *static_cast<void **>(block) = slab->free_;
+        slab->free_ = block;
+    }
+
+    void ObjectPool::ReleaseIdleSlabs()
+    {
+        Slab *slab = partial_;
+        while (slab)
+        {
+            Slab *next = slab->next_;
+            if (slab->used_ == 0)
+            {
+                UnlinkSlab(slab);
+                DeleteSlab(slab);
+            }
+            slab = next;
+        }
+    }
+
+    ObjectPool::Slab * ObjectPool::SlabOf(void *block)
+    {
+        auto addr = reinterpret_cast<uintptr_t>(block);
+        return reinterpret_cast<Slab *>(addr & ~uintptr_t(kSlabSize - 1));
+    }
+
+    ObjectPool::Slab * ObjectPool::NewSlab()
+    {
+        assert(block_size_ != 0);
+        auto mem = static_cast<char *>(AllocAligned(kSlabSize));
+        auto header = (sizeof(Slab) + kBlockAlign - 1) / kBlockAlign * kBlockAlign;
+
+        auto slab = new (mem) Slab;
+        slab->prev_ = nullptr;
+        slab->next_ = nullptr;
+        slab->free_ = nullptr;
+        slab->unused_ = mem + header;
+        slab->end_ = slab->unused_ + blocks_per_slab_ * block_size_;
+        slab->used_ = 0;
+
+        ++slab_count_;
+        return slab;
+    }
+
+    void ObjectPool::DeleteSlab(Slab *slab)
+    {
+        --slab_count_;
+        FreeAligned(slab);
+    }
+
+    void ObjectPool::LinkSlab(Slab *slab)
+    {
+        slab->prev_ = nullptr;
+        slab->next_ = partial_;
+        if (partial_)
+            partial_->prev_ = slab;
+        partial_ = slab;
+    }
+
+    void ObjectPool::UnlinkSlab(Slab *slab)
+    {
+        if (slab->prev_)
+            slab->prev_->next_ = slab->next_;
+        else
+            partial_ = slab->next_;
+        if (slab->next_)
+            slab->next_->prev_ = slab->prev_;
+        slab->prev_ = nullptr;
+        slab->next_ = nullptr;
+    }
+} // namespace oms
@@ -0,0 +1,74 @@
+#ifndef OBJECT_POOL_H
+#define OBJECT_POOL_H
+
+#include <cstddef>
+
+namespace oms
+{
+    // Fixed size block pool, blocks are allocated from slabs which
+    // are aligned to slab size, so slab of a block is found by its
+    // address. Each slab has its own free list, slabs which have free
+    // blocks are linked in a list, idle slabs are released by
+    // ReleaseIdleSlabs in bulk.
+    class ObjectPool
+    {
+    public:
+        explicit ObjectPool(std::size_t block_size = 0);
+        ~ObjectPool();
+
+        ObjectPool(const ObjectPool&) = delete;
+        void operator = (const ObjectPool&) = delete;
+
+        // Set block size, it must be called before any allocation
+        void SetBlockSize(std::size_t block_size);
+
+        // Alloc a block
+        void * Alloc();
+
+        // Free a block allocated by this pool
+        void Free(void *block);
+
+        // Release all slabs which have no allocated blocks
+        void ReleaseIdleSlabs();
+
+        // Count of slabs allocated from system
+        std::size_t GetSlabCount() const
+        { return slab_count_; }
+
+        static const std::size_t kSlabSize = 64 * 1024;
+
+    private:
+        struct Slab
+        {
+            // Slabs which have free blocks
+            Slab *prev_;
+            Slab *next_;
+            // Free list of blocks which are freed
+            void *free_;
+            // Blocks in [unused_, end) are never allocated
+            char *unused_;
+            char *end_;
+            // Count of allocated blocks
+            std::size_t used_;
+        };
+
+        static Slab * SlabOf(void *block);
+
+        Slab * NewSlab();
+        void DeleteSlab(Slab *slab);
+
+        void LinkSlab(Slab *slab);
+        void UnlinkSlab(Slab *slab);
+
+        // Size of each block
+        std::size_t block_size_;
+        // Count of blocks in each slab
+        std::size_t blocks_per_slab_;
+        // Slabs which have free blocks
+        Slab *partial_;
+        // Count of all slabs
+        std::size_t slab_count_;
+    };
+} // namespace oms
+
+#endif // OBJECT_POOL_H
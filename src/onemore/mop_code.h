@@ -16,7 +16,7 @@ namespace oms
         OpType_SetGlobal,               // ABx  A: value register Bx: const index
         OpType_Closure,                 // ABx  A: register Bx: proto index
         OpType_Call,                    // ABC  A: register B: arg count C: is any arg
-        OpType_VarArg,                  // A    A: register
+        OpType_VarArg,                  // AB   A: register B: value count + 1, 0 is all varargs
         OpType_Ret,                     // ABC  A: return value start register B: return value count C: return any count
         OpType_JmpFalse,                // AsBx A: register sBx: diff of instruction index
         OpType_JmpTrue,                 // AsBx A: register sBx: diff of instruction index
@@ -45,6 +45,7 @@ namespace oms
         OpType_ForStep,                 // ABC  ABC same with OpType_ForInit, next instruction sBx: diff of instruction index
         OpType_CloseUpvalue,            // A    A: close upvalue to this register
         OpType_SetTop,                  // A    A: set new top to this register,current for exp list and table define last exp
+        OpType_TailCall,                // ABC  A: register B: arg count C: is any arg, next instruction is OpType_Ret
     };
 
     struct Instruction
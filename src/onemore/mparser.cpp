@@ -131,6 +131,7 @@ namespace
             int line = LookAhead().line_;
             if (NextToken().token_ != '(')
                 throw ParseException("unexpect token after 'function', expect '('", current_);
+            auto source_begin = current_.end_ - 1;
 
             std::unique_ptr<SyntaxTree> param_list;
 
@@ -146,7 +147,17 @@ namespace
                 throw ParseException("unexpect token after function body, expect 'end'", current_);
 
             return std::unique_ptr<SyntaxTree>(new FunctionBody(std::move(param_list),
-                                                                std::move(block), line));
+                                                                std::move(block), line,
+                                                                source_begin, current_.end_));
+        }
+
+        // Parse source of a function body only
+        std::unique_ptr<SyntaxTree> ParseLazyFunctionBody()
+        {
+            auto body = ParseFunctionBody();
+            if (NextToken().token_ != Token_EOF)
+                throw ParseException("expect <eof>", current_);
+            return body;
         }
 
         std::unique_ptr<SyntaxTree> ParseParamList()
@@ -921,4 +932,10 @@ namespace oms
         ParserImpl impl(lexer);
         return impl.Parse();
     }
+
+    std::unique_ptr<SyntaxTree> ParseFunctionBody(Lexer *lexer)
+    {
+        ParserImpl impl(lexer);
+        return impl.ParseLazyFunctionBody();
+    }
 } // namespace oms
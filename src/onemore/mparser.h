@@ -10,6 +10,10 @@ namespace oms
     class SyntaxTree;
 
     std::unique_ptr<SyntaxTree> Parse(Lexer *lexer);
+
+    // Parse source of function body from '(' to 'end', which is
+    // compiled lazily
+    std::unique_ptr<SyntaxTree> ParseFunctionBody(Lexer *lexer);
 } // namespace oms
 
 #endif // PARSER_H
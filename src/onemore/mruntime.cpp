@@ -5,7 +5,8 @@ namespace oms
 {
     Stack::Stack()
         : stack_(kBaseStackSize),
-          top_(nullptr)
+          top_(nullptr),
+          open_upvalues_(nullptr)
     {
         top_ = &stack_[0];
     }
@@ -16,20 +17,33 @@ namespace oms
         top_->SetNil();
     }
 
-    void Stack::CloseUpvalueTo(Value *ptr)
+    Upvalue * Stack::GetOpenUpvalue(Value *ptr, GC &gc)
     {
-        while (!upvalue_list_.empty())
+        // Upvalues of the current function are at the head of list
+        Upvalue **link = &open_upvalues_;
+        while (*link && (*link)->GetValue() >= ptr)
         {
-            auto upvalue = upvalue_list_.back();
-            if (upvalue->GetValue() >= ptr)
-            {
-                upvalue->Close();
-                upvalue_list_.pop_back();
-            }
-            else
-            {
-                break;
-            }
+            if ((*link)->GetValue() == ptr)
+                return *link;
+            link = &(*link)->next_open_;
+        }
+
+        auto upvalue = gc.NewUpvalue();
+        upvalue->SetValuePtr(ptr);
+        upvalue->next_open_ = *link;
+        *link = upvalue;
+        return upvalue;
+    }
+
+    void Stack::CloseUpvalueTo(Value *ptr, GC &gc)
+    {
+        while (open_upvalues_ && open_upvalues_->GetValue() >= ptr)
+        {
+            auto upvalue = open_upvalues_;
+            open_upvalues_ = upvalue->next_open_;
+            upvalue->next_open_ = nullptr;
+            upvalue->Close();
+            CHECK_BARRIER(gc, upvalue);
         }
     }
 
@@ -37,7 +51,9 @@ namespace oms
         : register_(nullptr),
           func_(nullptr),
           instruction_(nullptr),
-          end_(nullptr)
+          end_(nullptr),
+          vararg_(nullptr),
+          vararg_count_(0)
     {
     }
 } // namespace oms
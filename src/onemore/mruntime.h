@@ -3,11 +3,11 @@
 
 #include "mvalue.h"
 #include <vector>
-#include <list>
 
 namespace oms
 {
     class Closure;
+    class GC;
     struct Instruction;
 
     // Runtime stack, registers of each function is one part of stack.
@@ -17,8 +17,9 @@ namespace oms
 
         std::vector<Value> stack_;
         Value *top_;
-        // open upvalues list
-        std::list<Upvalue*> upvalue_list_;
+        // Intrusive list of open upvalues, sorted by the stack values
+        // they point to from high address to low address
+        Upvalue *open_upvalues_;
 
         Stack();
         Stack(const Stack&) = delete;
@@ -27,8 +28,13 @@ namespace oms
         // Set new top pointer, and [new top, old top) will be set nil
         void SetNewTop(Value *top);
 
-        // close upvalues to ptr
-        void CloseUpvalueTo(Value *ptr);
+        // Get open upvalue of stack value ptr, create it by gc when
+        // not existed, only upvalues above ptr are walked
+        Upvalue * GetOpenUpvalue(Value *ptr, GC &gc);
+
+        // close upvalues to ptr, closed upvalues may be old
+        // generation, so barrier them by gc
+        void CloseUpvalueTo(Value *ptr, GC &gc);
     };
 
     // Function call stack info
@@ -42,6 +48,10 @@ namespace oms
         const Instruction *instruction_;
         // Instruction end
         const Instruction *end_;
+        // varargs of vararg function, they stay where caller pushed
+        // them, and are read in place
+        Value *vararg_;
+        int vararg_count_;
 
         CallInfo();
     };
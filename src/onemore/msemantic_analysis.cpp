@@ -6,6 +6,7 @@
 #include "mguard.h"
 #include "msyntax_tree.h"
 #include <unordered_set>
+#include <algorithm>
 #include <assert.h>
 
 namespace oms
@@ -63,11 +64,14 @@ namespace oms
         LexicalFunction *parent_;
         LexicalBlock *current_block_;
         const SyntaxTree *current_loop_;
+        // FunctionBody AST of this function, nullptr for chunk
+        FunctionBody *func_body_;
         bool has_vararg;
 
         LexicalFunction()
             : parent_(nullptr), current_block_(nullptr),
-              current_loop_(nullptr), has_vararg(false) { }
+              current_loop_(nullptr), func_body_(nullptr),
+              has_vararg(false) { }
     };
 
     class SemanticAnalysisVisitor : public Visitor
@@ -159,8 +163,10 @@ namespace oms
             current_function_->current_block_->names_.insert(name);
         }
 
-        // Search LexicalScoping of a name
-        LexicalScoping SearchName(const String *str) const
+        // Search LexicalScoping of a name, upvalue name is added to
+        // upvalues of functions from current function to the function
+        // which has the name as local
+        LexicalScoping SearchName(String *str)
         {
             assert(current_function_ && current_function_->current_block_);
 
@@ -173,8 +179,11 @@ namespace oms
                     auto it = block->names_.find(str);
                     if (it != block->names_.end())
                     {
-                        return function == current_function_ ?
-                            LexicalScoping_Local : LexicalScoping_Upvalue;
+                        if (function == current_function_)
+                            return LexicalScoping_Local;
+
+                        AddUpvalue(str, function);
+                        return LexicalScoping_Upvalue;
                     }
 
                     block = block->parent_;
@@ -186,6 +195,25 @@ namespace oms
             return LexicalScoping_Global;
         }
 
+        // Add upvalue name to functions from current function to 'owner'
+        void AddUpvalue(String *str, const LexicalFunction *owner)
+        {
+            for (auto function = current_function_; function != owner;
+                 function = function->parent_)
+            {
+                auto &upvalues = function->func_body_->upvalues_;
+                if (std::find(upvalues.begin(), upvalues.end(), str) != upvalues.end())
+                    break;
+                upvalues.push_back(str);
+            }
+        }
+
+        // Set current FunctionBody AST
+        void SetFunctionBody(FunctionBody *func_body)
+        {
+            current_function_->func_body_ = func_body;
+        }
+
         // Set current loop AST
         void SetLoopAST(const SyntaxTree *loop)
         {
@@ -594,6 +622,7 @@ namespace oms
     void SemanticAnalysisVisitor::Visit(FunctionBody *func_body, void *data)
     {
         SEMANTIC_ANALYSIS_GUARD(EnterFunction, LeaveFunction);
+        SetFunctionBody(func_body);
         {
             SEMANTIC_ANALYSIS_GUARD(EnterBlock, LeaveBlock);
 
@@ -750,4 +779,20 @@ namespace oms
         SemanticAnalysisVisitor semantic_analysis(state);
         root->Accept(&semantic_analysis, nullptr);
     }
+
+    void SemanticAnalysis(SyntaxTree *func_body, State *state,
+                          const std::vector<String *> &upvalues)
+    {
+        assert(func_body && state);
+        SemanticAnalysisVisitor semantic_analysis(state);
+
+        // Upvalues are locals of a virtual enclosing function, which is
+        // deleted by destructor of visitor
+        semantic_analysis.EnterFunction();
+        semantic_analysis.EnterBlock();
+        for (auto name : upvalues)
+            semantic_analysis.InsertName(name);
+
+        func_body->Accept(&semantic_analysis, nullptr);
+    }
 } // namespace oms
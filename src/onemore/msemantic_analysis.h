@@ -1,12 +1,20 @@
 #ifndef SEMANTIC_ANALYSIS_H
 #define SEMANTIC_ANALYSIS_H
 
+#include <vector>
+
 namespace oms
 {
     class State;
+    class String;
     class SyntaxTree;
 
     void SemanticAnalysis(SyntaxTree *root, State *state);
+
+    // Analyse function body which is compiled lazily, 'upvalues' are
+    // names of upvalues of the function
+    void SemanticAnalysis(SyntaxTree *func_body, State *state,
+                          const std::vector<String *> &upvalues);
 }
 
 #endif // SEMANTIC_ANALYSIS_H
@@ -14,9 +14,11 @@ namespace oms
 #define METATABLES "__metatables"
 #define MODULES_TABLE "__modules"
 
-    State::State()
+    State::State(LexerType lexer_type)
+        : gmatch_proto_(nullptr), lexer_type_(lexer_type)
     {
         string_pool_.reset(new StringPool);
+        pattern_cache_.reset(new PatternCache);
 
         // Init GC
         gc_.reset(new GC([&](GCObject *obj, unsigned int type) {
@@ -24,7 +26,6 @@ namespace oms
             {
                 string_pool_->DeleteString(static_cast<String *>(obj));
             }
-            delete obj;
         }));
         auto root = std::bind(&State::FullGCRoot, this, std::placeholders::_1);
         gc_->SetRootTraveller(root, root);
@@ -82,6 +83,38 @@ namespace oms
         }
     }
 
+    void State::CompileModule(const std::string &module_name)
+    {
+        module_manager_->CompileModule(module_name);
+    }
+
+    void State::BuildBundle(const std::vector<std::string> &module_names,
+                            const std::string &path)
+    {
+        module_manager_->BuildBundle(module_names, path);
+    }
+
+    void State::LoadBundle(const std::string &path)
+    {
+        module_manager_->LoadBundle(path);
+    }
+
+    void State::PreloadModules(const std::vector<std::string> &module_names,
+                               unsigned int threads)
+    {
+        module_manager_->PreloadModules(module_names, threads);
+    }
+
+    void State::SetCompileCache(const std::string &dir, std::size_t max_bytes)
+    {
+        module_manager_->SetCompileCache(dir, max_bytes);
+    }
+
+    void State::SetLazyCompile(bool lazy)
+    {
+        module_manager_->SetLazyCompile(lazy);
+    }
+
     void State::DoString(const std::string &str, const std::string &name)
     {
         module_manager_->LoadString(str, name);
@@ -94,7 +127,8 @@ namespace oms
 
     bool State::CallFunction(Value *f, int arg_count)
     {
-        assert(f->type_ == ValueT_Closure || f->type_ == ValueT_CFunction);
+        assert(f->type_ == ValueT_Closure || f->type_ == ValueT_CFunction ||
+               f->type_ == ValueT_LeafCFunction);
 
         if (f->type_ == ValueT_Closure)
         {
@@ -102,6 +136,11 @@ namespace oms
             CallClosure(f, arg_count);
             return true;
         }
+        else if (f->type_ == ValueT_LeafCFunction)
+        {
+            CallLeafCFunction(f, arg_count);
+            return false;
+        }
         else
         {
             CallCFunction(f, arg_count);
@@ -111,14 +150,7 @@ namespace oms
 
     String * State::GetString(const std::string &str)
     {
-        auto s = string_pool_->GetString(str);
-        if (!s)
-        {
-            s = gc_->NewString();
-            s->SetValue(str);
-            string_pool_->AddString(s);
-        }
-        return s;
+        return GetString(str.c_str(), str.size());
     }
 
     String * State::GetString(const char *str, std::size_t len)
@@ -126,22 +158,35 @@ namespace oms
         auto s = string_pool_->GetString(str, len);
         if (!s)
         {
-            s = gc_->NewString();
-            s->SetValue(str, len);
+            s = gc_->NewString(str, len);
             string_pool_->AddString(s);
         }
+        else
+        {
+            // String may be dead and not swept yet
+            gc_->Resurrect(s);
+        }
         return s;
     }
 
     String * State::GetString(const char *str)
     {
-        auto s = string_pool_->GetString(str);
+        return GetString(str, strlen(str));
+    }
+
+    String * State::GetString(const char *str, std::size_t len, unsigned int hash)
+    {
+        auto s = string_pool_->GetString(str, len, hash);
         if (!s)
         {
-            s = gc_->NewString();
-            s->SetValue(str);
+            s = gc_->NewString(str, len);
             string_pool_->AddString(s);
         }
+        else
+        {
+            // String may be dead and not swept yet
+            gc_->Resurrect(s);
+        }
         return s;
     }
 
@@ -197,6 +242,7 @@ namespace oms
             metatable.type_ = ValueT_Table;
             metatable.table_ = NewTable();
             metatables->SetValue(k, metatable);
+            CHECK_BARRIER(GetGC(), metatables);
         }
 
         assert(metatable.type_ == ValueT_Table);
@@ -219,16 +265,21 @@ namespace oms
         // Visit global table
         global_.Accept(v);
 
+        // Visit prototype of string.gmatch iterators
+        if (gmatch_proto_)
+            gmatch_proto_->Accept(v);
+
         // Visit stack values
         for (const auto &value : stack_.stack_)
         {
             value.Accept(v);
         }
 
-        // Visit upvalue values
-        for (const auto &value : stack_.upvalue_list_)
+        // Visit open upvalues
+        for (auto upvalue = stack_.open_upvalues_; upvalue;
+             upvalue = upvalue->GetNextOpen())
         {
-            value->Accept(v);
+            upvalue->Accept(v);
         }
 
         // Visit call info
@@ -253,10 +304,12 @@ namespace oms
         return v.table_;
     }
 
-    void State::CallClosure(Value *f, int arg_count)
+    void State::CallClosure(Value *f, int arg_count, bool tail_call)
     {
         CallInfo callee;
         Function *callee_proto = f->closure_->GetPrototype();
+        if (callee_proto->GetLazySource())
+            module_manager_->CompileLazyFunction(callee_proto);
 
         callee.func_ = f;
         callee.instruction_ = callee_proto->GetOpCodes();
@@ -264,12 +317,15 @@ namespace oms
 
         int fixed_args = callee_proto->FixedArgCount();
         Value *arg = f + 1;
-        if (callee_proto->HasVararg())
+        if (callee_proto->HasVararg() && arg_count > fixed_args)
         {
-            // move args for var_arg
+            // Varargs stay in place, registers start above them, so
+            // only fixed args are moved
+            callee.vararg_ = arg + fixed_args;
+            callee.vararg_count_ = arg_count - fixed_args;
             Value *old_arg = arg;
             arg += arg_count;
-            for (int i = 0; i < arg_count && i < fixed_args; ++i)
+            for (int i = 0; i < fixed_args; ++i)
                 *(arg + i) = *old_arg++;
         }
         callee.register_ = arg;
@@ -279,7 +335,10 @@ namespace oms
             (callee.register_ + i)->SetNil();
         }
 
-        calls_.push_back(callee);
+        if (tail_call)
+            calls_.back() = callee;
+        else
+            calls_.push_back(callee);
     }
 
     void State::CallCFunction(Value *f, int arg_count)
@@ -312,12 +371,35 @@ namespace oms
         calls_.pop_back();
     }
 
+    void State::CallLeafCFunction(Value *f, int arg_count)
+    {
+        // Result replaces the leaf C function, no CallInfo is pushed
+        // and error data is read only when it failed
+        Value result;
+        int res_count = f->leaf_cfunc_(this, f + 1, arg_count, &result);
+        if (res_count == kLeafCFunctionError)
+            ThrowCFunctionError(f + 1);
+
+        if (res_count > 0)
+            *f++ = result;
+        stack_.SetNewTop(f);
+    }
+
     void State::CheckCFunctionError()
     {
         auto error = GetCFunctionErrorData();
         if (error->type_ == CFuntionErrorType_NoError)
             return ;
 
+        // Pop the c function CallInfo
+        auto args = calls_.back().register_;
+        calls_.pop_back();
+        ThrowCFunctionError(args);
+    }
+
+    void State::ThrowCFunctionError(const Value *args)
+    {
+        auto error = GetCFunctionErrorData();
         CallCFuncException exp;
         if (error->type_ == CFuntionErrorType_ArgCount)
         {
@@ -326,15 +408,16 @@ namespace oms
         }
         else if (error->type_ == CFuntionErrorType_ArgType)
         {
-            auto &call = calls_.back();
-            auto arg = call.register_ + error->arg_index_;
+            auto arg = args + error->arg_index_;
             exp = CallCFuncException("argument #", error->arg_index_ + 1,
                     " is a ", arg->TypeName(), " value, expect a ",
                     Value::TypeName(error->expect_type_), " value");
         }
+        else if (error->type_ == CFuntionErrorType_Message)
+        {
+            exp = CallCFuncException(error->message_);
+        }
 
-        // Pop the c function CallInfo
-        calls_.pop_back();
         throw exp;
     }
 } // namespace oms
@@ -2,9 +2,11 @@
 #define STATE_H
 
 #include "mgc.h"
+#include "mlex.h"
 #include "mruntime.h"
 #include "mmodule_manager.h"
 #include "mstring_pool.h"
+#include "mstring_pattern.h"
 #include <string>
 #include <memory>
 #include <vector>
@@ -20,6 +22,7 @@ namespace oms
         CFuntionErrorType_NoError,
         CFuntionErrorType_ArgCount,
         CFuntionErrorType_ArgType,
+        CFuntionErrorType_Message,
     };
 
     // Error reported by called c function
@@ -36,6 +39,9 @@ namespace oms
             };
         };
 
+        // Error description for CFuntionErrorType_Message
+        std::string message_;
+
         CFunctionError() : type_(CFuntionErrorType_NoError) { }
     };
 
@@ -47,7 +53,7 @@ namespace oms
         friend class ModuleManager;
         friend class CodeGenerateVisitor;
     public:
-        State();
+        explicit State(LexerType lexer_type = LexerType_HandWritten);
         ~State();
 
         State(const State&) = delete;
@@ -64,6 +70,36 @@ namespace oms
         // loaded success.
         void DoModule(const std::string &module_name);
 
+        // Compile module to precompiled bytecode file, which is loaded
+        // instead of the source file while the source is not changed
+        void CompileModule(const std::string &module_name);
+
+        // Compile modules and link them into one bundle image file
+        void BuildBundle(const std::vector<std::string> &module_names,
+                         const std::string &path);
+
+        // Map bundle image file, modules in it are loaded from the image
+        // by LoadModule, and share pages of the image between processes
+        void LoadBundle(const std::string &path);
+
+        // Compile modules concurrently on worker threads before they are
+        // required, 'threads' is 0 means count of hardware threads. Modules
+        // which are loaded without compiling are skipped
+        void PreloadModules(const std::vector<std::string> &module_names,
+                            unsigned int threads = 0);
+
+        // Cache bytecode of module source files in 'dir' across processes,
+        // unchanged sources are loaded without compiling, least recently
+        // used entries are evicted when total size exceeds 'max_bytes'
+        void SetCompileCache(const std::string &dir, std::size_t max_bytes);
+
+        // Compile functions of module sources and strings on their first
+        // call, functions never called are not compiled, so large modules
+        // load faster and use less memory. Code generation errors of a
+        // function, e.g. too many local variables, are thrown on its first
+        // call, syntax errors are still thrown when loading
+        void SetLazyCompile(bool lazy);
+
         // Load string and call the string function when the string
         // loaded success.
         void DoString(const std::string &str, const std::string &name = "");
@@ -78,6 +114,8 @@ namespace oms
         String * GetString(const std::string &str);
         String * GetString(const char *str, std::size_t len);
         String * GetString(const char *str);
+        // Get string with precomputed hash of String::HashChar
+        String * GetString(const char *str, std::size_t len, unsigned int hash);
         Function * NewFunction();
         Closure * NewClosure();
         Upvalue * NewUpvalue();
@@ -107,6 +145,17 @@ namespace oms
         // Get the GC
         GC& GetGC() { return *gc_; }
 
+        // Get compiled string patterns cache
+        PatternCache * GetPatternCache() { return pattern_cache_.get(); }
+
+        // Get and set prototype of string.gmatch iterators, which is built
+        // once and shared by all iterators of this State
+        Function * GetGMatchPrototype() const { return gmatch_proto_; }
+        void SetGMatchPrototype(Function *proto) { gmatch_proto_ = proto; }
+
+        // Get lexer type of loading modules
+        LexerType GetLexerType() const { return lexer_type_; }
+
         // Check and run GC
         void CheckRunGC() { gc_->CheckGC(); }
 
@@ -114,10 +163,14 @@ namespace oms
         // Full GC root
         void FullGCRoot(GCObjectVisitor *v);
 
-        // For CallFunction
-        void CallClosure(Value *f, int arg_count);
+        // For CallFunction, callee CallInfo replaces current CallInfo
+        // when it is a tail call
+        void CallClosure(Value *f, int arg_count, bool tail_call = false);
         void CallCFunction(Value *f, int arg_count);
+        void CallLeafCFunction(Value *f, int arg_count);
         void CheckCFunctionError();
+        // Throw error of C function which args start from args
+        void ThrowCFunctionError(const Value *args);
 
         // Get the table which stores all metatables
         Table * GetMetatables();
@@ -128,9 +181,15 @@ namespace oms
         std::unique_ptr<StringPool> string_pool_;
         // The GC
         std::unique_ptr<GC> gc_;
+        // Compiled string patterns
+        std::unique_ptr<PatternCache> pattern_cache_;
+        // Prototype of string.gmatch iterators
+        Function *gmatch_proto_;
 
         // Error of call c function
         CFunctionError cfunc_error_;
+        // Lexer type of loading modules
+        LexerType lexer_type_;
 
         // Stack data
         Stack stack_;
@@ -1,9 +1,10 @@
 #include "mstring.h"
+#include <new>
 
 namespace oms
 {
     String::String()
-        : in_heap_(0), str_(nullptr), length_(0), hash_(0)
+        : length_(0), hash_(0), storage_(Storage_Inline), chars_()
     {
     }
 
@@ -15,16 +16,27 @@ namespace oms
 
     String::~String()
     {
-        if (in_heap_)
-            delete [] str_;
+        Release();
+    }
+
+    String * String::New(const char *str, std::size_t len)
+    {
+        return New(::operator new(GetAllocSize(len)), str, len);
+    }
+
+    String * String::New(void *buffer, const char *str, std::size_t len)
+    {
+        auto s = new (buffer) String;
+        memcpy(s->chars_, str, len);
+        s->chars_[len] = 0;
+        s->length_ = len;
+        s->Hash(s->chars_);
+        return s;
     }
 
     std::string String::GetStdString() const
     {
-        if (in_heap_)
-            return std::string(str_, length_);
-        else
-            return std::string(str_buffer_, length_);
+        return std::string(GetCStr(), length_);
     }
 
     void String::SetValue(const std::string &str)
@@ -39,33 +51,57 @@ namespace oms
 
     void String::SetValue(const char *str, std::size_t len)
     {
-        if (in_heap_)
-            delete [] str_;
+        Release();
 
         length_ = len;
-        if (len < sizeof(str_buffer_))
+        if (len < sizeof(chars_))
         {
-            memcpy(str_buffer_, str, len);
-            str_buffer_[len] = 0;
-            in_heap_ = 0;
-            Hash(str_buffer_);
+            memcpy(chars_, str, len);
+            chars_[len] = 0;
+            storage_ = Storage_Inline;
+            Hash(chars_);
         }
         else
         {
             str_ = new char[len + 1];
             memcpy(str_, str, len);
             str_[len] = 0;
-            in_heap_ = 1;
+            storage_ = Storage_Heap;
             Hash(str_);
         }
     }
 
+    void String::RefValue(const char *str, std::size_t len)
+    {
+        Release();
+
+        length_ = len;
+        str_ = const_cast<char *>(str);
+        storage_ = Storage_Ref;
+        Hash(str_);
+    }
+
+    void String::RefValue(const char *str, std::size_t len, unsigned int hash)
+    {
+        Release();
+
+        length_ = len;
+        str_ = const_cast<char *>(str);
+        storage_ = Storage_Ref;
+        hash_ = hash;
+    }
+
     void String::Hash(const char *s)
     {
-        hash_ = 5381;
-        int c = 0;
+        hash_ = kHashSeed;
+        for (unsigned int i = 0; i < length_; ++i)
+            hash_ = HashChar(hash_, s[i]);
+    }
 
-        while ((c = *s++))
-            hash_ = ((hash_ << 5) + hash_) + c;
+    void String::Release()
+    {
+        if (storage_ == Storage_Heap)
+            delete [] str_;
+        storage_ = Storage_Inline;
     }
 } // namespace oms
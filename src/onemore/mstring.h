@@ -18,6 +18,28 @@ namespace oms
         String(const String &) = delete;
         void operator = (const String &) = delete;
 
+        // New string which characters are stored in the same
+        // allocation after the object, delete it by operator delete
+        static String * New(const char *str, std::size_t len);
+        // New string in buffer which size is GetAllocSize(len), the
+        // buffer is released by owner after destruct the string
+        static String * New(void *buffer, const char *str, std::size_t len);
+
+        // Memory size of string allocated by New
+        static std::size_t GetAllocSize(std::size_t len)
+        {
+            return std::max(sizeof(String), sizeof(String) - sizeof(chars_) + len + 1);
+        }
+
+        static void operator delete (void *p)
+        { ::operator delete(p); }
+
+        // Hash function steps, hash of string is the result of
+        // HashChar over all characters starting from kHashSeed
+        static const unsigned int kHashSeed = 5381;
+        static unsigned int HashChar(unsigned int hash, char c)
+        { return ((hash << 5) + hash) + c; }
+
         virtual void Accept(GCObjectVisitor *v)
         { v->Visit(this); }
 
@@ -28,7 +50,7 @@ namespace oms
         { return length_; }
 
         const char * GetCStr() const
-        { return in_heap_ ? str_ : str_buffer_; }
+        { return storage_ == Storage_Inline ? chars_ : str_; }
 
         // Convert to std::string
         std::string GetStdString() const;
@@ -38,12 +60,17 @@ namespace oms
         void SetValue(const char *str);
         void SetValue(const char *str, std::size_t len);
 
+        // Reference to 'str' without copying, 'str' must be valid
+        // until context of string is changed again, and GetCStr()
+        // may be not null terminated
+        void RefValue(const char *str, std::size_t len);
+        void RefValue(const char *str, std::size_t len, unsigned int hash);
+
         friend bool operator == (const String &l, const String &r)
         {
             return l.hash_ == r.hash_ &&
                 l.length_ == r.length_ &&
-                (l.in_heap_ ? memcmp(l.str_, r.str_, l.length_) :
-                 memcmp(l.str_buffer_, r.str_buffer_, l.length_)) == 0;
+                memcmp(l.GetCStr(), r.GetCStr(), l.length_) == 0;
         }
 
         friend bool operator != (const String &l, const String &r)
@@ -53,10 +80,8 @@ namespace oms
 
         friend bool operator < (const String &l, const String &r)
         {
-            auto *l_s = l.in_heap_ ? l.str_ : l.str_buffer_;
-            auto *r_s = r.in_heap_ ? r.str_ : r.str_buffer_;
             auto len = std::min(l.length_, r.length_);
-            auto cmp = memcmp(l_s, r_s, len);
+            auto cmp = memcmp(l.GetCStr(), r.GetCStr(), len);
             if (cmp == 0)
                 return l.length_ < r.length_;
             else
@@ -79,23 +104,33 @@ namespace oms
         }
 
     private:
+        enum Storage
+        {
+            Storage_Inline,     // Characters in chars_
+            Storage_Heap,       // Characters in heap pointed by str_
+            Storage_Ref,        // Characters referenced by str_
+        };
+
         // Calculate hash of string
         void Hash(const char *s);
 
-        // String in heap or not
-        char in_heap_;
-        union
-        {
-            // Buffer for short string
-            char str_buffer_[11];
-            // Pointer to heap which stored long string
-            char *str_;
-        };
+        // Free heap characters
+        void Release();
 
         // Length of string
         unsigned int length_;
         // Hash value of string
-        std::size_t hash_;
+        unsigned int hash_;
+        // Storage of characters
+        unsigned char storage_;
+        union
+        {
+            // Pointer to characters when storage_ is not Storage_Inline
+            char *str_;
+            // Buffer for short string, and strings allocated by New
+            // extend this buffer to the end of allocation
+            char chars_[sizeof(char *)];
+        };
     };
 } // namespace oms
 
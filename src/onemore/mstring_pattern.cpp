@@ -0,0 +1,603 @@
+#include "mstring_pattern.h"
+#include "mstring.h"
+#include <ctype.h>
+#include <string.h>
+
+namespace
+{
+    const char *kSpecials = "^$*+?.([%-";
+
+    bool IsClassLetter(unsigned char cl)
+    {
+        return strchr("acdlpsuwxz", tolower(cl)) != nullptr && cl != 0;
+    }
+
+    bool MatchClass(int c, int cl)
+    {
+        int res = 0;
+        switch (tolower(cl))
+        {
+            case 'a': res = isalpha(c); break;
+            case 'c': res = iscntrl(c); break;
+            case 'd': res = isdigit(c); break;
+            case 'l': res = islower(c); break;
+            case 'p': res = ispunct(c); break;
+            case 's': res = isspace(c); break;
+            case 'u': res = isupper(c); break;
+            case 'w': res = isalnum(c); break;
+            case 'x': res = isxdigit(c); break;
+            case 'z': res = (c == 0); break;
+            default: return cl == c;
+        }
+
+        if (isupper(cl))
+            return !res;
+        return res != 0;
+    }
+} // namespace
+
+namespace oms
+{
+    Pattern::Pattern()
+        : first_set_(-1), capture_count_(0),
+          anchor_(false), plain_(false)
+    {
+    }
+
+    bool Pattern::Compile(const char *p, std::size_t len, std::string &error)
+    {
+        source_.assign(p, len);
+        items_.clear();
+        sets_.clear();
+        capture_count_ = 0;
+        anchor_ = false;
+
+        plain_ = true;
+        for (std::size_t i = 0; i < len && plain_; ++i)
+        {
+            if (p[i] != 0 && strchr(kSpecials, p[i]))
+                plain_ = false;
+        }
+
+        const char *end = p + len;
+        if (p < end && *p == '^')
+        {
+            anchor_ = true;
+            ++p;
+        }
+
+        // Open captures and whether captures can be back referenced
+        std::vector<int> open;
+        std::vector<bool> closed;
+
+        while (p < end)
+        {
+            Item item = Item();
+            item.quantifier_ = Quantifier_One;
+
+            if (*p == '(')
+            {
+                if (capture_count_ >= kMaxCaptures)
+                {
+                    error = "too many captures";
+                    return false;
+                }
+
+                item.c_ = capture_count_++;
+                if (p + 1 < end && p[1] == ')')
+                {
+                    item.type_ = ItemType_PositionCapture;
+                    closed.push_back(false);
+                    p += 2;
+                }
+                else
+                {
+                    item.type_ = ItemType_CaptureBegin;
+                    open.push_back(item.c_);
+                    closed.push_back(false);
+                    ++p;
+                }
+                items_.push_back(item);
+                continue;
+            }
+            else if (*p == ')')
+            {
+                if (open.empty())
+                {
+                    error = "invalid pattern capture";
+                    return false;
+                }
+
+                item.type_ = ItemType_CaptureEnd;
+                item.c_ = open.back();
+                closed[open.back()] = true;
+                open.pop_back();
+                items_.push_back(item);
+                ++p;
+                continue;
+            }
+            else if (*p == '$' && p + 1 == end)
+            {
+                item.type_ = ItemType_EndAnchor;
+                items_.push_back(item);
+                ++p;
+                continue;
+            }
+            else if (*p == '%')
+            {
+                if (p + 1 >= end)
+                {
+                    error = "malformed pattern (ends with '%')";
+                    return false;
+                }
+
+                if (p[1] == 'b')
+                {
+                    if (end - p < 4)
+                    {
+                        error = "unbalanced pattern";
+                        return false;
+                    }
+
+                    item.type_ = ItemType_Balance;
+                    item.c_ = p[2];
+                    item.c2_ = p[3];
+                    items_.push_back(item);
+                    p += 4;
+                    continue;
+                }
+                else if (p[1] == 'f')
+                {
+                    p += 2;
+                    if (p >= end || *p != '[')
+                    {
+                        error = "missing '[' after '%f' in pattern";
+                        return false;
+                    }
+
+                    CharSet set;
+                    p = CompileSet(p, end, set, error);
+                    if (!p)
+                        return false;
+
+                    item.type_ = ItemType_Frontier;
+                    item.set_ = sets_.size();
+                    sets_.push_back(set);
+                    items_.push_back(item);
+                    continue;
+                }
+                else if (isdigit(static_cast<unsigned char>(p[1])))
+                {
+                    int l = p[1] - '1';
+                    if (l < 0 || l >= capture_count_ || !closed[l])
+                    {
+                        error = "invalid capture index";
+                        return false;
+                    }
+
+                    item.type_ = ItemType_BackRef;
+                    item.c_ = l;
+                    items_.push_back(item);
+                    p += 2;
+                    continue;
+                }
+            }
+
+            // Single character class
+            if (*p == '.')
+            {
+                item.type_ = ItemType_Any;
+                ++p;
+            }
+            else if (*p == '%')
+            {
+                unsigned char cl = p[1];
+                if (IsClassLetter(cl))
+                {
+                    CharSet set;
+                    AddClass(cl, set);
+                    item.type_ = ItemType_Set;
+                    item.set_ = sets_.size();
+                    sets_.push_back(set);
+                }
+                else
+                {
+                    item.type_ = ItemType_Char;
+                    item.c_ = cl;
+                }
+                p += 2;
+            }
+            else if (*p == '[')
+            {
+                CharSet set;
+                p = CompileSet(p, end, set, error);
+                if (!p)
+                    return false;
+
+                item.type_ = ItemType_Set;
+                item.set_ = sets_.size();
+                sets_.push_back(set);
+            }
+            else
+            {
+                item.type_ = ItemType_Char;
+                item.c_ = *p++;
+            }
+
+            // Quantifier of single character class
+            if (p < end)
+            {
+                switch (*p)
+                {
+                    case '?': item.quantifier_ = Quantifier_ZeroOrOne; ++p; break;
+                    case '*': item.quantifier_ = Quantifier_ZeroOrMore; ++p; break;
+                    case '+': item.quantifier_ = Quantifier_OneOrMore; ++p; break;
+                    case '-': item.quantifier_ = Quantifier_Lazy; ++p; break;
+                    default: break;
+                }
+            }
+
+            items_.push_back(item);
+        }
+
+        if (!open.empty())
+        {
+            error = "unfinished capture";
+            return false;
+        }
+
+        AnalyzePrefix();
+        return true;
+    }
+
+    const char * Pattern::Find(MatchState &ms, const char *s, const char *&e) const
+    {
+        do
+        {
+            // Skip the positions which can not be the beginning of match
+            if (!anchor_)
+            {
+                if (!prefix_.empty())
+                {
+                    s = FindLiteral(s, ms.src_end_ - s, prefix_.data(), prefix_.size());
+                    if (!s)
+                        return nullptr;
+                }
+                else if (first_set_ >= 0)
+                {
+                    const auto &set = sets_[first_set_];
+                    while (s < ms.src_end_ && !set.Has(*s))
+                        ++s;
+                    if (s == ms.src_end_)
+                        return nullptr;
+                }
+            }
+
+            ms.level_ = 0;
+            e = DoMatch(ms, s, 0);
+            if (e)
+                return s;
+        } while (s++ < ms.src_end_ && !anchor_);
+
+        return nullptr;
+    }
+
+    const char * Pattern::Match(MatchState &ms, const char *s) const
+    {
+        ms.level_ = 0;
+        return DoMatch(ms, s, 0);
+    }
+
+    const char * Pattern::FindLiteral(const char *s, std::size_t s_len,
+                                      const char *p, std::size_t p_len)
+    {
+        if (p_len == 0)
+            return s;
+        if (p_len > s_len)
+            return nullptr;
+
+        // First char is searched by memchr, then compare the rest
+        --p_len;
+        s_len -= p_len;
+        while (s_len > 0)
+        {
+            auto init = static_cast<const char *>(memchr(s, *p, s_len));
+            if (!init)
+                break;
+
+            ++init;
+            if (memcmp(init, p + 1, p_len) == 0)
+                return init - 1;
+
+            s_len -= init - s;
+            s = init;
+        }
+
+        return nullptr;
+    }
+
+    const char * Pattern::CompileSet(const char *p, const char *end,
+                                     CharSet &set, std::string &error)
+    {
+        // Search the ']' of set, the first char of set is never the end
+        const char *ec = p + 1;
+        if (ec < end && *ec == '^')
+            ++ec;
+        do
+        {
+            if (ec >= end)
+            {
+                error = "malformed pattern (missing ']')";
+                return nullptr;
+            }
+            if (*ec++ == '%' && ec < end)
+                ++ec;
+        } while (ec >= end || *ec != ']');
+
+        bool negate = p[1] == '^';
+        if (negate)
+            ++p;
+
+        while (++p < ec)
+        {
+            if (*p == '%')
+            {
+                AddClass(*++p, set);
+            }
+            else if (p[1] == '-' && p + 2 < ec)
+            {
+                for (int c = static_cast<unsigned char>(p[0]);
+                     c <= static_cast<unsigned char>(p[2]); ++c)
+                    set.Add(c);
+                p += 2;
+            }
+            else
+            {
+                set.Add(*p);
+            }
+        }
+
+        if (negate)
+            set.Invert();
+        return ec + 1;
+    }
+
+    void Pattern::AddClass(unsigned char cl, CharSet &set)
+    {
+        if (!IsClassLetter(cl))
+        {
+            set.Add(cl);
+            return ;
+        }
+
+        for (int c = 0; c < 256; ++c)
+        {
+            if (MatchClass(c, cl))
+                set.Add(c);
+        }
+    }
+
+    void Pattern::AnalyzePrefix()
+    {
+        prefix_.clear();
+        first_set_ = -1;
+
+        // Captures at the beginning do not consume characters
+        std::size_t i = 0;
+        std::size_t size = items_.size();
+        while (i < size && (items_[i].type_ == ItemType_CaptureBegin ||
+                            items_[i].type_ == ItemType_PositionCapture))
+            ++i;
+
+        for (; i < size && items_[i].type_ == ItemType_Char; ++i)
+        {
+            if (items_[i].quantifier_ == Quantifier_One)
+            {
+                prefix_.push_back(items_[i].c_);
+            }
+            else
+            {
+                if (items_[i].quantifier_ == Quantifier_OneOrMore)
+                    prefix_.push_back(items_[i].c_);
+                return ;
+            }
+        }
+
+        if (prefix_.empty() && i < size && items_[i].type_ == ItemType_Set &&
+            (items_[i].quantifier_ == Quantifier_One ||
+             items_[i].quantifier_ == Quantifier_OneOrMore))
+            first_set_ = items_[i].set_;
+    }
+
+    const char * Pattern::DoMatch(MatchState &ms, const char *s, std::size_t i) const
+    {
+        std::size_t size = items_.size();
+        while (i < size)
+        {
+            const Item &item = items_[i];
+            switch (item.type_)
+            {
+                case ItemType_CaptureBegin:
+                    return StartCapture(ms, s, i + 1, kCaptureUnfinished);
+                case ItemType_PositionCapture:
+                    return StartCapture(ms, s, i + 1, kCapturePosition);
+                case ItemType_CaptureEnd:
+                    return EndCapture(ms, s, i);
+                case ItemType_EndAnchor:
+                    return s == ms.src_end_ ? s : nullptr;
+                case ItemType_Balance:
+                    s = MatchBalance(ms, s, item);
+                    if (!s)
+                        return nullptr;
+                    ++i;
+                    break;
+                case ItemType_Frontier:
+                    {
+                        const auto &set = sets_[item.set_];
+                        unsigned char previous = s == ms.src_init_ ? 0 : s[-1];
+                        unsigned char current = s < ms.src_end_ ? *s : 0;
+                        if (set.Has(previous) || !set.Has(current))
+                            return nullptr;
+                        ++i;
+                    }
+                    break;
+                case ItemType_BackRef:
+                    s = MatchCapture(ms, s, item.c_);
+                    if (!s)
+                        return nullptr;
+                    ++i;
+                    break;
+                default:
+                    {
+                        bool m = s < ms.src_end_ && SingleMatch(*s, item);
+                        switch (item.quantifier_)
+                        {
+                            case Quantifier_ZeroOrOne:
+                                if (m)
+                                {
+                                    auto res = DoMatch(ms, s + 1, i + 1);
+                                    if (res)
+                                        return res;
+                                }
+                                ++i;
+                                break;
+                            case Quantifier_ZeroOrMore:
+                                return MaxExpand(ms, s, i);
+                            case Quantifier_OneOrMore:
+                                return m ? MaxExpand(ms, s + 1, i) : nullptr;
+                            case Quantifier_Lazy:
+                                return MinExpand(ms, s, i);
+                            default:
+                                if (!m)
+                                    return nullptr;
+                                ++s;
+                                ++i;
+                                break;
+                        }
+                    }
+                    break;
+            }
+        }
+
+        return s;
+    }
+
+    const char * Pattern::MaxExpand(MatchState &ms, const char *s, std::size_t i) const
+    {
+        const Item &item = items_[i];
+        std::ptrdiff_t count = 0;
+        while (s + count < ms.src_end_ && SingleMatch(s[count], item))
+            ++count;
+
+        // Try with maximum repetitions, then less and less
+        while (count >= 0)
+        {
+            auto res = DoMatch(ms, s + count, i + 1);
+            if (res)
+                return res;
+            --count;
+        }
+
+        return nullptr;
+    }
+
+    const char * Pattern::MinExpand(MatchState &ms, const char *s, std::size_t i) const
+    {
+        const Item &item = items_[i];
+        for (;;)
+        {
+            auto res = DoMatch(ms, s, i + 1);
+            if (res)
+                return res;
+            else if (s < ms.src_end_ && SingleMatch(*s, item))
+                ++s;
+            else
+                return nullptr;
+        }
+    }
+
+    const char * Pattern::StartCapture(MatchState &ms, const char *s,
+                                       std::size_t i, int what) const
+    {
+        int level = ms.level_;
+        ms.capture_[level].init_ = s;
+        ms.capture_[level].len_ = what;
+        ms.level_ = level + 1;
+
+        auto res = DoMatch(ms, s, i);
+        if (!res)
+            ms.level_--;
+        return res;
+    }
+
+    const char * Pattern::EndCapture(MatchState &ms, const char *s, std::size_t i) const
+    {
+        // Captures are numbered in the order of items, so the capture
+        // index of ')' is the level to close
+        int l = items_[i].c_;
+        ms.capture_[l].len_ = static_cast<int>(s - ms.capture_[l].init_);
+
+        auto res = DoMatch(ms, s, i + 1);
+        if (!res)
+            ms.capture_[l].len_ = kCaptureUnfinished;
+        return res;
+    }
+
+    const char * Pattern::MatchBalance(MatchState &ms, const char *s, const Item &item) const
+    {
+        if (s >= ms.src_end_ || static_cast<unsigned char>(*s) != item.c_)
+            return nullptr;
+
+        int cont = 1;
+        while (++s < ms.src_end_)
+        {
+            unsigned char c = *s;
+            if (c == item.c2_)
+            {
+                if (--cont == 0)
+                    return s + 1;
+            }
+            else if (c == item.c_)
+            {
+                cont++;
+            }
+        }
+
+        return nullptr;
+    }
+
+    const char * Pattern::MatchCapture(MatchState &ms, const char *s, int l) const
+    {
+        std::size_t len = ms.capture_[l].len_;
+        if (static_cast<std::size_t>(ms.src_end_ - s) >= len &&
+            memcmp(ms.capture_[l].init_, s, len) == 0)
+            return s + len;
+        return nullptr;
+    }
+
+    std::shared_ptr<const Pattern> PatternCache::GetPattern(const String *p,
+                                                            std::string &error)
+    {
+        auto it = patterns_.find(p);
+        if (it != patterns_.end() &&
+            it->second->IsSource(p->GetCStr(), p->GetLength()))
+            return it->second;
+
+        std::shared_ptr<Pattern> pattern(new Pattern);
+        if (!pattern->Compile(p->GetCStr(), p->GetLength(), error))
+            return nullptr;
+
+        if (it != patterns_.end())
+        {
+            it->second = pattern;
+        }
+        else
+        {
+            if (patterns_.size() >= kMaxCachedPatterns)
+                patterns_.clear();
+            patterns_.insert(std::make_pair(p, pattern));
+        }
+
+        return pattern;
+    }
+} // namespace oms
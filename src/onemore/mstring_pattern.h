@@ -0,0 +1,190 @@
+#ifndef STRING_PATTERN_H
+#define STRING_PATTERN_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+namespace oms
+{
+    class String;
+
+    // Lua 5.1 compatible pattern, the pattern string is compiled into a
+    // sequence of items once, then matching walks the items instead of
+    // parsing pattern characters again and again.
+    class Pattern
+    {
+    public:
+        static const int kMaxCaptures = 32;
+
+        // Capture length of unfinished and position capture
+        static const int kCaptureUnfinished = -1;
+        static const int kCapturePosition = -2;
+
+        struct Capture
+        {
+            const char *init_;
+            int len_;
+        };
+
+        // Match state of one match, captures are stored in the fixed
+        // array, no memory allocated until captures are pushed out.
+        struct MatchState
+        {
+            const char *src_init_;
+            const char *src_end_;
+            int level_;
+            Capture capture_[kMaxCaptures];
+        };
+
+        Pattern();
+
+        Pattern(const Pattern&) = delete;
+        void operator = (const Pattern&) = delete;
+
+        // Compile pattern, return false and set 'error' when pattern
+        // is malformed
+        bool Compile(const char *p, std::size_t len, std::string &error);
+
+        // Whether source is the same as compiled pattern
+        bool IsSource(const char *p, std::size_t len) const
+        { return source_.size() == len && source_.compare(0, len, p, len) == 0; }
+
+        // Pattern starts with '^'
+        bool IsAnchor() const
+        { return anchor_; }
+
+        // Pattern has no special characters
+        bool IsPlain() const
+        { return plain_; }
+
+        // Count of captures in pattern
+        int GetCaptureCount() const
+        { return capture_count_; }
+
+        // Find first match start from 's', return match begin and set
+        // 'e' to match end, return nullptr when match failed.
+        // Only try to match at 's' when pattern is anchored.
+        const char * Find(MatchState &ms, const char *s, const char *&e) const;
+
+        // Try to match at 's', return match end or nullptr.
+        const char * Match(MatchState &ms, const char *s) const;
+
+        // Find literal string 'p' in 's', return nullptr when not found
+        static const char * FindLiteral(const char *s, std::size_t s_len,
+                                        const char *p, std::size_t p_len);
+
+    private:
+        enum ItemType
+        {
+            ItemType_Char,              // Single literal char
+            ItemType_Any,               // '.'
+            ItemType_Set,               // Character class or set
+            ItemType_CaptureBegin,      // '('
+            ItemType_PositionCapture,   // '()'
+            ItemType_CaptureEnd,        // ')'
+            ItemType_BackRef,           // '%1' ~ '%9'
+            ItemType_Balance,           // '%bxy'
+            ItemType_Frontier,          // '%f[set]'
+            ItemType_EndAnchor,         // '$' at the end of pattern
+        };
+
+        enum Quantifier
+        {
+            Quantifier_One,             // No quantifier
+            Quantifier_ZeroOrOne,       // '?'
+            Quantifier_ZeroOrMore,      // '*'
+            Quantifier_OneOrMore,       // '+'
+            Quantifier_Lazy,            // '-'
+        };
+
+        // Bitmap set of 256 characters
+        struct CharSet
+        {
+            unsigned int bits_[8];
+
+            CharSet() : bits_() { }
+
+            void Add(unsigned char c)
+            { bits_[c >> 5] |= 1u << (c & 31); }
+
+            bool Has(unsigned char c) const
+            { return (bits_[c >> 5] >> (c & 31)) & 1u; }
+
+            void Invert()
+            { for (auto &b : bits_) b = ~b; }
+        };
+
+        struct Item
+        {
+            unsigned char type_;
+            unsigned char quantifier_;
+            // Char of ItemType_Char, capture index of ItemType_BackRef,
+            // open char of ItemType_Balance
+            unsigned char c_;
+            // Close char of ItemType_Balance
+            unsigned char c2_;
+            // Index of sets_ for ItemType_Set and ItemType_Frontier
+            int set_;
+        };
+
+        const char * CompileSet(const char *p, const char *end,
+                                CharSet &set, std::string &error);
+        void AddClass(unsigned char cl, CharSet &set);
+        void AnalyzePrefix();
+
+        bool SingleMatch(unsigned char c, const Item &item) const
+        {
+            switch (item.type_)
+            {
+                case ItemType_Char: return c == item.c_;
+                case ItemType_Any: return true;
+                default: return sets_[item.set_].Has(c);
+            }
+        }
+
+        const char * DoMatch(MatchState &ms, const char *s, std::size_t i) const;
+        const char * MaxExpand(MatchState &ms, const char *s, std::size_t i) const;
+        const char * MinExpand(MatchState &ms, const char *s, std::size_t i) const;
+        const char * StartCapture(MatchState &ms, const char *s,
+                                  std::size_t i, int what) const;
+        const char * EndCapture(MatchState &ms, const char *s, std::size_t i) const;
+        const char * MatchBalance(MatchState &ms, const char *s, const Item &item) const;
+        const char * MatchCapture(MatchState &ms, const char *s, int l) const;
+
+        std::string source_;
+        std::vector<Item> items_;
+        std::vector<CharSet> sets_;
+        // Literal prefix of pattern, used to skip impossible positions
+        std::string prefix_;
+        // Set of the first character when prefix_ is empty
+        int first_set_;
+        int capture_count_;
+        bool anchor_;
+        bool plain_;
+    };
+
+    // Compiled patterns cache of one State
+    class PatternCache
+    {
+    public:
+        PatternCache() { }
+
+        PatternCache(const PatternCache&) = delete;
+        void operator = (const PatternCache&) = delete;
+
+        // Get compiled pattern, return nullptr and set 'error' when
+        // pattern is malformed
+        std::shared_ptr<const Pattern> GetPattern(const String *p, std::string &error);
+
+    private:
+        static const std::size_t kMaxCachedPatterns = 64;
+
+        // Interned String pointer as key, the pattern source is
+        // checked again when the String was freed and reused
+        std::unordered_map<const String *, std::shared_ptr<Pattern>> patterns_;
+    };
+} // namespace oms
+
+#endif // STRING_PATTERN_H
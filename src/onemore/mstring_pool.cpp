@@ -9,19 +9,25 @@ namespace oms
 
     String * StringPool::GetString(const std::string &str)
     {
-        temp_.SetValue(str);
+        temp_.RefValue(str.c_str(), str.size());
         return GetString();
     }
 
     String * StringPool::GetString(const char *str, std::size_t len)
     {
-        temp_.SetValue(str, len);
+        temp_.RefValue(str, len);
         return GetString();
     }
 
     String * StringPool::GetString(const char *str)
     {
-        temp_.SetValue(str);
+        temp_.RefValue(str, strlen(str));
+        return GetString();
+    }
+
+    String * StringPool::GetString(const char *str, std::size_t len, unsigned int hash)
+    {
+        temp_.RefValue(str, len, hash);
         return GetString();
     }
 
@@ -20,6 +20,8 @@ namespace oms
         String * GetString(const std::string &str);
         String * GetString(const char *str, std::size_t len);
         String * GetString(const char *str);
+        // Get string with precomputed hash of String::HashChar
+        String * GetString(const char *str, std::size_t len, unsigned int hash);
 
         // Add string to pool
         void AddString(String *str);
@@ -46,6 +48,8 @@ namespace oms
 
         String * GetString();
 
+        // Temp string for searching, it references the searched
+        // characters without copying
         String temp_;
         std::unordered_set<String *, StringHash, StringEqual> strings_;
     };
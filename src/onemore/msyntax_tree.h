@@ -432,11 +432,23 @@ namespace oms
 
         int line_;
 
-        FunctionBody() { }
+        // Source of function body from '(' to 'end' in input buffer
+        const char *source_begin_;
+        const char *source_end_;
+
+        // For lazy code generate, names of upvalues of this function,
+        // including upvalues of child functions which are not locals
+        // of this function
+        std::vector<String *> upvalues_;
+
+        FunctionBody() : has_self_(false), line_(0),
+                         source_begin_(nullptr), source_end_(nullptr) { }
         FunctionBody(std::unique_ptr<SyntaxTree> param_list,
-                     std::unique_ptr<SyntaxTree> block, int line)
+                     std::unique_ptr<SyntaxTree> block, int line,
+                     const char *source_begin, const char *source_end)
             : param_list_(std::move(param_list)),
-              block_(std::move(block)), has_self_(false), line_(line)
+              block_(std::move(block)), has_self_(false), line_(line),
+              source_begin_(source_begin), source_end_(source_end)
         {
         }
 
@@ -12,6 +12,7 @@ namespace
 namespace oms
 {
     Table::Table()
+        : weak_mode_(TableWeak_None), gc_owner_(nullptr), storage_bytes_(0)
     {
     }
 
@@ -48,7 +49,10 @@ namespace oms
             return false;
 
         if (index == array_size + 1)
+        {
             AppendAndMergeFromHashToArray(value);
+            UpdateStorageBytes();
+        }
         else
             (*array_)[index - 1] = value;
 
@@ -74,6 +78,7 @@ namespace oms
             array_->insert(it, value);
             // Try to merge from hash to array
             MergeFromHashToArray();
+            UpdateStorageBytes();
         }
 
         return true;
@@ -113,7 +118,10 @@ namespace oms
         {
             // If value is nil, then just erase the element
             if (value.IsNil())
+            {
                 hash_->erase(it);
+                UpdateStorageBytes();
+            }
             else
                 it->second = value;
         }
@@ -121,7 +129,10 @@ namespace oms
         {
             // If key is not existed and value is not nil, then insert it
             if (!value.IsNil())
+            {
                 hash_->insert(std::make_pair(key, value));
+                UpdateStorageBytes();
+            }
         }
     }
 
@@ -250,4 +261,24 @@ namespace oms
         hash_->erase(it);
         return true;
     }
+
+    void Table::UpdateStorageBytes()
+    {
+        if (!gc_owner_)
+            return ;
+
+        // Node of hash part has key-value pair, next pointer and hash
+        std::size_t bytes = 0;
+        if (array_)
+            bytes += sizeof(Array) + array_->capacity() * sizeof(Value);
+        if (hash_)
+            bytes += sizeof(Hash) + hash_->bucket_count() * sizeof(void *) +
+                hash_->size() * (sizeof(Hash::value_type) + 2 * sizeof(void *));
+
+        if (bytes != storage_bytes_)
+        {
+            gc_owner_->ResizeObject(this, storage_bytes_, bytes);
+            storage_bytes_ = bytes;
+        }
+    }
 } // namespace oms
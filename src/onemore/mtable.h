@@ -9,6 +9,20 @@
 
 namespace oms
 {
+    // Weak mode of table, weak references do not keep objects alive
+    // in major GC, and entries of dead objects are removed after major
+    // GC marking. Only tables, closures and user data are referenced
+    // weakly, other values are always strong like Lua.
+    enum TableWeakMode
+    {
+        TableWeak_None,
+        TableWeak_Key,          // Keys are weak
+        TableWeak_Value,        // Values are weak
+        TableWeak_KeyValue,     // Keys and values are weak
+        TableWeak_Ephemeron,    // Keys are weak, values are alived
+                                // only when their keys are alived
+    };
+
     // Table has array part and hash table part.
     class Table : public GCObject
     {
@@ -17,6 +31,128 @@ namespace oms
 
         virtual void Accept(GCObjectVisitor *v);
 
+        // Mark member GC objects by marker of GC
+        template<typename Marker>
+        void MarkMembers(Marker &marker) const
+        {
+            if (array_)
+            {
+                for (const auto &value : *array_)
+                    marker.MarkValue(value);
+            }
+
+            if (hash_)
+            {
+                for (const auto &pair : *hash_)
+                {
+                    marker.MarkValue(pair.first);
+                    marker.MarkValue(pair.second);
+                }
+            }
+        }
+
+        // Mark member GC objects which are not referenced weakly, values
+        // of ephemeron table are marked when marker marked their keys
+        template<typename Marker>
+        void MarkStrongMembers(Marker &marker) const
+        {
+            bool weak_key = IsWeakKey();
+            bool weak_value = IsWeakValue();
+
+            // Keys of array part are numbers, which are never weak
+            if (array_)
+            {
+                for (const auto &value : *array_)
+                {
+                    if (!weak_value || !IsWeakReference(value))
+                        marker.MarkValue(value);
+                }
+            }
+
+            if (hash_)
+            {
+                for (const auto &pair : *hash_)
+                {
+                    bool weak = IsWeakReference(pair.first);
+                    if (!weak_key || !weak)
+                        marker.MarkValue(pair.first);
+
+                    if (weak_mode_ == TableWeak_Ephemeron)
+                    {
+                        if (!weak || marker.IsMarked(pair.first))
+                            marker.MarkValue(pair.second);
+                    }
+                    else if (!weak_value || !IsWeakReference(pair.second))
+                    {
+                        marker.MarkValue(pair.second);
+                    }
+                }
+            }
+        }
+
+        // Mark values of ephemeron table which keys are marked, return
+        // true when any value marked
+        template<typename Marker>
+        bool MarkEphemeronValues(Marker &marker) const
+        {
+            bool marked = false;
+            if (hash_)
+            {
+                for (const auto &pair : *hash_)
+                {
+                    if ((!IsWeakReference(pair.first) || marker.IsMarked(pair.first)) &&
+                        !marker.IsMarked(pair.second))
+                    {
+                        marker.MarkValue(pair.second);
+                        marked = true;
+                    }
+                }
+            }
+            return marked;
+        }
+
+        // Remove entries which weak key or weak value is dead, weak
+        // values of array part become nil
+        template<typename IsDead>
+        void RemoveDeadEntries(IsDead is_dead)
+        {
+            bool weak_key = IsWeakKey();
+            bool weak_value = IsWeakValue();
+
+            if (array_ && weak_value)
+            {
+                for (auto &value : *array_)
+                {
+                    if (IsWeakReference(value) && is_dead(value))
+                        value = Value();
+                }
+
+                while (!array_->empty() && array_->back().IsNil())
+                    array_->pop_back();
+            }
+
+            if (hash_)
+            {
+                for (auto it = hash_->begin(); it != hash_->end(); )
+                {
+                    if ((weak_key && IsWeakReference(it->first) && is_dead(it->first)) ||
+                        (weak_value && IsWeakReference(it->second) && is_dead(it->second)))
+                        it = hash_->erase(it);
+                    else
+                        ++it;
+                }
+            }
+
+            UpdateStorageBytes();
+        }
+
+        // Set weak mode of table, table needs barrier after weak mode
+        // changed, since GC may be marking it
+        void SetWeakMode(TableWeakMode mode)
+        { weak_mode_ = mode; }
+        TableWeakMode GetWeakMode() const
+        { return weak_mode_; }
+
         // Set array value by index, return true if success.
         // 'index' start from 1, if 'index' == ArraySize() + 1,
         // then append value to array.
@@ -54,8 +190,39 @@ namespace oms
         // Return the number of array part elements.
         std::size_t ArraySize() const;
 
+        // Set GC which bytes of array and hash parts are charged to,
+        // GC sets it when it allocates the table
+        void SetGC(GC *gc)
+        { gc_owner_ = gc; }
+
+        // Bytes of array and hash parts charged to GC
+        std::size_t GetStorageBytes() const
+        { return storage_bytes_; }
+
     private:
         typedef std::vector<Value> Array;
+
+        bool IsWeakKey() const
+        {
+            return weak_mode_ == TableWeak_Key ||
+                weak_mode_ == TableWeak_KeyValue ||
+                weak_mode_ == TableWeak_Ephemeron;
+        }
+
+        bool IsWeakValue() const
+        {
+            return weak_mode_ == TableWeak_Value ||
+                weak_mode_ == TableWeak_KeyValue;
+        }
+
+        // Value references GC object which can be referenced weakly
+        static bool IsWeakReference(const Value &value)
+        {
+            return value.type_ == ValueT_Table ||
+                value.type_ == ValueT_Closure ||
+                value.type_ == ValueT_UserData;
+        }
+
         typedef std::unordered_map<Value, Value> Hash;
 
         // Combine AppendToArray and MergeFromHashToArray
@@ -72,8 +239,14 @@ namespace oms
         // fit with array, return true if move success.
         bool MoveHashToArray(const Value &key);
 
+        // Charge changed bytes of array and hash parts to GC
+        void UpdateStorageBytes();
+
         std::unique_ptr<Array> array_;              // array part of table
         std::unique_ptr<Hash> hash_;                // hash table part of table
+        TableWeakMode weak_mode_;                   // weak mode of table
+        GC *gc_owner_;                              // GC which allocated table
+        std::size_t storage_bytes_;                 // bytes of array and hash parts
     };
 } // namespace oms
 
@@ -1,21 +1,86 @@
 #include "mtext_in_stream.h"
 
+#ifndef _MSC_VER
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif // _MSC_VER
+
 namespace io {
 namespace text {
     InStream::InStream(const std::string &path)
-        : stream_(nullptr)
+        : buffer_(nullptr), size_(0), pos_(0),
+          is_open_(false), is_mapped_(false)
+    {
+        is_open_ = MapFile(path) || ReadFile(path);
+    }
+
+    InStream::~InStream()
+    {
+#ifndef _MSC_VER
+        if (is_mapped_)
+            munmap(const_cast<char *>(buffer_), size_);
+#endif // _MSC_VER
+    }
+
+    bool InStream::MapFile(const std::string &path)
     {
 #ifdef _MSC_VER
-        fopen_s(&stream_, path.c_str(), "rb");
+        (void)path;
+        return false;
 #else
-        stream_ = fopen(path.c_str(), "rb");
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        // Only regular and non-empty file can be mapped
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+        {
+            close(fd);
+            return false;
+        }
+
+        auto size = static_cast<std::size_t>(st.st_size);
+        void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED)
+            return false;
+
+        buffer_ = static_cast<const char *>(p);
+        size_ = size;
+        is_mapped_ = true;
+        return true;
 #endif // _MSC_VER
     }
 
-    InStream::~InStream()
+    bool InStream::ReadFile(const std::string &path)
     {
-        if (stream_)
-            fclose(stream_);
+        FILE *stream = nullptr;
+#ifdef _MSC_VER
+        fopen_s(&stream, path.c_str(), "rb");
+#else
+        stream = fopen(path.c_str(), "rb");
+#endif // _MSC_VER
+        if (!stream)
+            return false;
+
+        std::size_t size = 0;
+        while (true)
+        {
+            data_.resize(size + kBlockSize);
+            auto count = fread(&data_[size], 1, kBlockSize, stream);
+            size += count;
+            if (count < kBlockSize)
+                break;
+        }
+        fclose(stream);
+
+        data_.resize(size);
+        buffer_ = data_.data();
+        size_ = size;
+        return true;
     }
 
     InStringStream::InStringStream(const std::string &str)
@@ -3,10 +3,14 @@
 
 #include <stdio.h>
 #include <string>
+#include <vector>
 
 namespace io {
 namespace text {
 
+    // Input stream of file, the whole file is mapped into memory
+    // when it is possible, otherwise it is read by blocks into a
+    // buffer, so file content is always in one contiguous buffer.
     class InStream
     {
     public:
@@ -18,16 +22,43 @@ namespace text {
 
         bool IsOpen() const
         {
-            return stream_ != nullptr;
+            return is_open_;
         }
 
         int GetChar()
         {
-            return fgetc(stream_);
+            if (pos_ < size_)
+                return static_cast<unsigned char>(buffer_[pos_++]);
+            else
+                return EOF;
+        }
+
+        // Content of file
+        const char * GetBuffer() const
+        {
+            return buffer_;
+        }
+
+        std::size_t GetSize() const
+        {
+            return size_;
         }
 
     private:
-        FILE *stream_;
+        bool MapFile(const std::string &path);
+        bool ReadFile(const std::string &path);
+
+        // Block size for reading file
+        static const std::size_t kBlockSize = 64 * 1024;
+
+        const char *buffer_;
+        std::size_t size_;
+        std::size_t pos_;
+        bool is_open_;
+        // buffer_ is mapped from file
+        bool is_mapped_;
+        // Storage of file content when file is not mapped
+        std::vector<char> data_;
     };
 
     class InStringStream
@@ -48,6 +79,17 @@ namespace text {
                 return EOF;
         }
 
+        // Content of string
+        const char * GetBuffer() const
+        {
+            return str_.data();
+        }
+
+        std::size_t GetSize() const
+        {
+            return str_.size();
+        }
+
     private:
         std::string str_;
         std::size_t pos_;
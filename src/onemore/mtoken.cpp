@@ -5,7 +5,7 @@
 namespace oms
 {
     const char *token_str[] = {
-        "and", "break", "do", "else", "elseif", "end",
+        "and", "break", "continue", "do", "else", "elseif", "end",
         "false", "for", "function", "if", "in",
         "local", "nil", "not", "or", "repeat",
         "return", "then", "true", "until", "while",
@@ -31,8 +31,9 @@ namespace oms
         int line_;                  // token line number in module
         int column_;                // token column number at 'line_'
         int token_;                 // token value
+        const char *end_;           // end of token in input buffer
 
-        TokenDetail() : str_(nullptr), module_(nullptr), line_(0), column_(0), token_(Token_EOF) { }
+        TokenDetail() : str_(nullptr), module_(nullptr), line_(0), column_(0), token_(Token_EOF), end_(nullptr) { }
     };
 
     std::string GetTokenStr(const TokenDetail &t);
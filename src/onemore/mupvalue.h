@@ -8,6 +8,7 @@ namespace oms
 {
     class Upvalue : public GCObject
     {
+        friend struct Stack;
     public:
         Upvalue() = default;
         virtual void Accept(GCObjectVisitor *v);
@@ -29,9 +30,24 @@ namespace oms
         Value * GetValue()
         { return ptr_value_; }
 
+        bool IsClosed() const
+        { return ptr_value_ == &value_; }
+
+        // Next upvalue in open upvalue list of stack
+        Upvalue * GetNextOpen() const
+        { return next_open_; }
+
+        // Mark member GC objects by marker of GC
+        template<typename Marker>
+        void MarkMembers(Marker &marker) const
+        { marker.MarkValue(*ptr_value_); }
+
     private:
         Value value_;
         Value *ptr_value_ = nullptr;
+        // Next upvalue in open upvalue list, it is threaded through
+        // upvalues, so open upvalues need no list nodes
+        Upvalue *next_open_ = nullptr;
     };
 } // namespace oms
 
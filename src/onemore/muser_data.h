@@ -32,6 +32,16 @@ namespace oms
             destroyed_ = true;
         }
 
+        // Take destroyer of user data which is not destroyed, then the
+        // caller destroys user data instead of destructor
+        Destroyer TakeDestroyer()
+        {
+            if (destroyed_)
+                return nullptr;
+            destroyed_ = true;
+            return destroyer_;
+        }
+
         void * GetData() const
         {
             return user_data_;
@@ -42,12 +52,22 @@ namespace oms
             return metatable_;
         }
 
+        // Mark member GC objects by marker of GC
+        template<typename Marker>
+        void MarkMembers(Marker &marker) const
+        {
+            if (metatable_)
+                marker.MarkObject(metatable_);
+        }
+
     private:
         // Point to user data
         void *user_data_ = nullptr;
         // Metatable of user data
         Table *metatable_ = nullptr;
-        // User data destroyer, call it when user data destroy
+        // User data destroyer, call it when user data destroy, it
+        // must touch no VM state, since it may be called in background
+        // finalizer thread
         Destroyer destroyer_ = nullptr;
         // Whether user data destroyed
         bool destroyed_ = false;
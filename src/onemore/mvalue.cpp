@@ -15,6 +15,7 @@ namespace oms
             case ValueT_Bool:
             case ValueT_Number:
             case ValueT_CFunction:
+            case ValueT_LeafCFunction:
                 break;
             case ValueT_Obj:
                 obj_->Accept(v);
@@ -47,6 +48,7 @@ namespace oms
             case ValueT_Bool: return "bool";
             case ValueT_Number: return "number";
             case ValueT_CFunction: return "C-Function";
+            case ValueT_LeafCFunction: return "C-Function";
             case ValueT_String: return "string";
             case ValueT_Closure: return "function";
             case ValueT_Table: return "table";
@@ -12,9 +12,18 @@ namespace oms
     class Table;
     class UserData;
     class State;
+    struct Value;
 
     typedef int (*CFunctionType)(State *);
 
+    // Leaf C function is called without CallInfo, it reads arg_count
+    // args in place and writes at most one result into result, returns
+    // count of results, or kLeafCFunctionError when it failed after
+    // setting error data of State
+    typedef int (*LeafCFunctionType)(State *, const Value *args,
+                                     int arg_count, Value *result);
+    const int kLeafCFunctionError = -1;
+
     enum ValueT
     {
         ValueT_Nil,
@@ -26,6 +35,7 @@ namespace oms
         ValueT_Table,
         ValueT_UserData,
         ValueT_CFunction,
+        ValueT_LeafCFunction,
     };
 
     // Value type of oms
@@ -40,6 +50,7 @@ namespace oms
             Table *table_;
             UserData *user_data_;
             CFunctionType cfunc_;
+            LeafCFunctionType leaf_cfunc_;
             double num_;
             bool bvalue_;
         };
@@ -54,6 +65,7 @@ namespace oms
         explicit Value(Table *table) : table_(table), type_(ValueT_Table) { }
         explicit Value(UserData *user_data) : user_data_(user_data), type_(ValueT_UserData) { }
         explicit Value(CFunctionType cfunc) : cfunc_(cfunc), type_(ValueT_CFunction) { }
+        explicit Value(LeafCFunctionType leaf_cfunc) : leaf_cfunc_(leaf_cfunc), type_(ValueT_LeafCFunction) { }
 
         void SetNil()
         { obj_ = nullptr; type_ = ValueT_Nil; }
@@ -89,6 +101,7 @@ namespace oms
             case ValueT_Table: return left.table_ == right.table_;
             case ValueT_UserData: return left.user_data_ == right.user_data_;
             case ValueT_CFunction: return left.cfunc_ == right.cfunc_;
+            case ValueT_LeafCFunction: return left.leaf_cfunc_ == right.leaf_cfunc_;
             default: return false;
         }
     }
@@ -124,6 +137,8 @@ namespace std
                     return hash<void *>()(t.user_data_);
                 case oms::ValueT_CFunction:
                     return hash<void *>()(reinterpret_cast<void *>(t.cfunc_));
+                case oms::ValueT_LeafCFunction:
+                    return hash<void *>()(reinterpret_cast<void *>(t.leaf_cfunc_));
                 default:
                     return hash<void *>()(t.obj_);
             }
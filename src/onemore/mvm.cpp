@@ -6,6 +6,7 @@
 #include "mexception.h"
 #include <assert.h>
 #include <math.h>
+#include <iterator>
 
 namespace
 {
@@ -100,6 +101,10 @@ namespace oms
                     a = GET_REGISTER_A(i);
                     if (Call(a, i)) return ;
                     break;
+                case OpType_TailCall:
+                    a = GET_REGISTER_A(i);
+                    if (TailCall(a, i)) return ;
+                    break;
                 case OpType_GetUpvalue:
                     a = GET_REGISTER_A(i);
                     b = GET_UPVALUE_B(i)->GetValue();
@@ -107,8 +112,11 @@ namespace oms
                     break;
                 case OpType_SetUpvalue:
                     a = GET_REGISTER_A(i);
-                    b = GET_UPVALUE_B(i)->GetValue();
-                    *b = *a;
+                    {
+                        auto upvalue = GET_UPVALUE_B(i);
+                        *upvalue->GetValue() = *a;
+                        CHECK_BARRIER(state_->GetGC(), upvalue);
+                    }
                     break;
                 case OpType_GetGlobal:
                     a = GET_REGISTER_A(i);
@@ -119,6 +127,7 @@ namespace oms
                     a = GET_REGISTER_A(i);
                     b = GET_CONST_VALUE(i);
                     state_->global_.table_->SetValue(*b, *a);
+                    CHECK_BARRIER(state_->GetGC(), state_->global_.table_);
                     break;
                 case OpType_Closure:
                     a = GET_REGISTER_A(i);
@@ -257,9 +266,16 @@ namespace oms
                     GET_REGISTER_ABC(i);
                     CheckTableType(a, b, "set", "to");
                     if (a->type_ == ValueT_Table)
+                    {
                         a->table_->SetValue(*b, *c);
+                        CHECK_BARRIER(state_->GetGC(), a->table_);
+                    }
                     else if (a->type_ == ValueT_UserData)
-                        a->user_data_->GetMetatable()->SetValue(*b, *c);
+                    {
+                        auto metatable = a->user_data_->GetMetatable();
+                        metatable->SetValue(*b, *c);
+                        CHECK_BARRIER(state_->GetGC(), metatable);
+                    }
                     else
                         assert(0);
                     break;
@@ -287,7 +303,7 @@ namespace oms
                     break;
                 case OpType_CloseUpvalue:
                     a = GET_REGISTER_A(i);
-                    state_->stack_.CloseUpvalueTo(a);
+                    state_->stack_.CloseUpvalueTo(a, state_->GetGC());
                     break;
                 case OpType_SetTop:
                     a = GET_REGISTER_A(i);
@@ -316,7 +332,8 @@ namespace oms
     bool VM::Call(Value *a, Instruction i)
     {
         if (a->type_ != ValueT_Closure &&
-            a->type_ != ValueT_CFunction)
+            a->type_ != ValueT_CFunction &&
+            a->type_ != ValueT_LeafCFunction)
         {
             ReportTypeError(a, "call");
             return true;
@@ -339,62 +356,79 @@ namespace oms
         }
     }
 
+    bool VM::TailCall(Value *a, Instruction i)
+    {
+        if (a->type_ != ValueT_Closure)
+            return Call(a, i);
+
+        assert(!state_->calls_.empty());
+        auto call = &state_->calls_.back();
+        int arg_count = Instruction::GetParamB(i);
+        if (Instruction::GetParamC(i))
+            arg_count = state_->stack_.top_ - a - 1;
+
+        // Move callee and args over current frame, results of callee
+        // are returned to the caller of current frame directly
+        auto dst = call->func_;
+        state_->stack_.CloseUpvalueTo(dst, state_->GetGC());
+        for (int n = 0; n <= arg_count; ++n)
+            dst[n] = a[n];
+        state_->stack_.SetNewTop(dst + 1 + arg_count);
+
+        state_->CallClosure(dst, arg_count, true);
+        return true;
+    }
+
     void VM::GenerateClosure(Value *a, Instruction i)
     {
         GET_CALLINFO_AND_PROTO();
         auto a_proto = proto->GetChildFunction(Instruction::GetParamBx(i));
+        auto closure = call->func_->closure_;
+        auto count = a_proto->GetUpvalueCount();
         a->type_ = ValueT_Closure;
+
+        // Reuse cached closure when its upvalues are the same, closed
+        // upvalues never match registers, so a closure capturing
+        // locals of a returned frame is not reused
+        auto cache = a_proto->GetClosureCache();
+        if (cache)
+        {
+            std::size_t index = 0;
+            for (; index < count; ++index)
+            {
+                auto upvalue_info = a_proto->GetUpvalue(index);
+                auto upvalue = cache->GetUpvalue(index);
+                if (upvalue_info->parent_local_)
+                {
+                    auto reg = call->register_ + upvalue_info->register_index_;
+                    if (upvalue->GetValue() != reg)
+                        break;
+                }
+                else if (upvalue != closure->GetUpvalue(upvalue_info->register_index_))
+                {
+                    break;
+                }
+            }
+
+            if (index == count)
+            {
+                a->closure_ = cache;
+                return ;
+            }
+        }
+
         a->closure_ = state_->NewClosure();
         a->closure_->SetPrototype(a_proto);
 
         // Prepare all upvalues
         auto new_closure = a->closure_;
-        auto closure = call->func_->closure_;
-        auto count = a_proto->GetUpvalueCount();
         for (std::size_t i = 0; i < count; ++i)
         {
             auto upvalue_info = a_proto->GetUpvalue(i);
             if (upvalue_info->parent_local_)
             {
-                Upvalue *upvalue = nullptr;
                 auto reg = call->register_ + upvalue_info->register_index_;
-                // find upvalue
-                auto& upvalue_list = state_->stack_.upvalue_list_;
-                auto r_iter = upvalue_list.rbegin();
-                for (; r_iter != upvalue_list.rend(); ++r_iter)
-                {
-                    if ((*r_iter)->GetValue() <= reg)
-                    {
-                        break;
-                    }
-                }
-                if (r_iter == upvalue_list.rend())
-                {
-                    // new upvalue
-                    upvalue = state_->NewUpvalue();
-                    upvalue->SetValuePtr(reg);
-                    upvalue_list.push_front(upvalue);
-                }
-                else if ((*r_iter)->GetValue() < reg)
-                {
-                    // new upvalue
-                    upvalue = state_->NewUpvalue();
-                    upvalue->SetValuePtr(reg);
-                    auto iter = r_iter.base();
-                    if (iter == upvalue_list.end())
-                    {
-                        upvalue_list.push_back(upvalue);
-                    }
-                    else
-                    {
-                        upvalue_list.insert(iter, upvalue);
-                    }
-                }
-                else
-                {
-                    assert((*r_iter)->GetValue() == reg);
-                    upvalue = *r_iter;
-                }
+                auto upvalue = state_->stack_.GetOpenUpvalue(reg, state_->GetGC());
                 new_closure->AddUpvalue(upvalue);
             }
             else
@@ -404,19 +438,37 @@ namespace oms
                 new_closure->AddUpvalue(upvalue);
             }
         }
+
+        a_proto->SetClosureCache(new_closure);
+        CHECK_BARRIER(state_->GetGC(), a_proto);
     }
 
     void VM::CopyVarArg(Value *a, Instruction i)
     {
-        GET_CALLINFO_AND_PROTO();
-        auto arg = call->func_ + 1;
-        int total_args = call->register_ - arg;
-        int vararg_count = total_args - proto->FixedArgCount();
-
-        arg += proto->FixedArgCount();
-        for (int i = 0; i < vararg_count; ++i)
-            *a++ = *arg++;
-        state_->stack_.SetNewTop(a);
+        assert(!state_->calls_.empty());
+        auto call = &state_->calls_.back();
+        auto arg = call->vararg_;
+        int vararg_count = call->vararg_count_;
+
+        // Copy all varargs when B is 0, otherwise copy B - 1 values,
+        // fill nil when varargs are not enough
+        int count = Instruction::GetParamB(i);
+        if (count == 0)
+        {
+            count = vararg_count;
+        }
+        else
+        {
+            --count;
+            for (int n = vararg_count; n < count; ++n)
+                a[n].SetNil();
+            if (vararg_count > count)
+                vararg_count = count;
+        }
+
+        for (int n = 0; n < vararg_count; ++n)
+            a[n] = arg[n];
+        state_->stack_.top_ = a + count;
     }
 
     void VM::Return(Value *a, Instruction i)
@@ -427,7 +479,7 @@ namespace oms
         auto dst = call->func_;
 
         // Ret will copy result over register,need close upvalue now
-        state_->stack_.CloseUpvalueTo(dst);
+        state_->stack_.CloseUpvalueTo(dst, state_->GetGC());
 
         int exp_count = Instruction::GetParamB(i);
         int exp_any = Instruction::GetParamC(i);
@@ -574,8 +626,23 @@ namespace oms
     {
         GET_CALLINFO_AND_PROTO();
         auto index = call->instruction_ - 1 - proto->GetOpCodes();
-        return { proto->GetModule()->GetCStr(),
-                 proto->GetInstructionLine(index) };
+        auto line = proto->GetInstructionLine(index);
+
+        // Functions built by libraries have no lines, e.g. iterators of
+        // string.gmatch, report position of their caller instead
+        if (line == 0 && state_->calls_.size() > 1)
+        {
+            auto caller = &*std::next(state_->calls_.rbegin());
+            if (caller->func_ && caller->func_->type_ == ValueT_Closure)
+            {
+                auto caller_proto = caller->func_->closure_->GetPrototype();
+                index = caller->instruction_ - 1 - caller_proto->GetOpCodes();
+                return { caller_proto->GetModule()->GetCStr(),
+                         caller_proto->GetInstructionLine(index) };
+            }
+        }
+
+        return { proto->GetModule()->GetCStr(), line };
     }
 
     void VM::CheckType(const Value *v, ValueT type, const char *op) const
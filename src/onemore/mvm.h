@@ -22,6 +22,11 @@ namespace oms
         // Execute next frame if return true
         bool Call(Value *a, Instruction i);
 
+        // Call closure in current frame which is replaced by callee
+        // frame, execute next frame if return true, c functions are
+        // called as normal calls and the next OpType_Ret returns
+        bool TailCall(Value *a, Instruction i);
+
         void GenerateClosure(Value *a, Instruction i);
         void CopyVarArg(Value *a, Instruction i);
         void Return(Value *a, Instruction i);
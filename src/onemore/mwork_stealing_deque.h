@@ -0,0 +1,137 @@
+#ifndef WORK_STEALING_DEQUE_H
+#define WORK_STEALING_DEQUE_H
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <assert.h>
+
+namespace oms
+{
+    // Chase-Lev work stealing deque of pointers, the owner thread
+    // pushes and pops at bottom, other threads steal at top. Buffers
+    // replaced by growing are kept until the deque destroyed, since
+    // thieves may be reading them.
+    template<typename T>
+    class WorkStealingDeque
+    {
+    public:
+        explicit WorkStealingDeque(std::size_t capacity = 1024)
+            : top_(0), bottom_(0)
+        {
+            assert(capacity != 0 && (capacity & (capacity - 1)) == 0);
+            buffers_.emplace_back(new Buffer(capacity));
+            buffer_ = buffers_.back().get();
+        }
+
+        WorkStealingDeque(const WorkStealingDeque&) = delete;
+        void operator = (const WorkStealingDeque&) = delete;
+
+        // Push an item at bottom, only owner thread calls it
+        void Push(T *item)
+        {
+            auto b = bottom_.load(std::memory_order_relaxed);
+            auto t = top_.load(std::memory_order_acquire);
+            auto buffer = buffer_.load(std::memory_order_relaxed);
+            if (b - t >= static_cast<std::ptrdiff_t>(buffer->capacity_))
+                buffer = Grow(buffer, t, b);
+
+            buffer->Put(b, item);
+            bottom_.store(b + 1, std::memory_order_release);
+        }
+
+        // Pop an item at bottom, only owner thread calls it, return
+        // nullptr when deque is empty
+        T * Pop()
+        {
+            auto b = bottom_.load(std::memory_order_relaxed) - 1;
+            auto buffer = buffer_.load(std::memory_order_relaxed);
+            bottom_.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto t = top_.load(std::memory_order_relaxed);
+
+            T *item = nullptr;
+            if (t <= b)
+            {
+                item = buffer->Get(b);
+                // Last item, race with thieves for it
+                if (t == b)
+                {
+                    if (!top_.compare_exchange_strong(t, t + 1,
+                                                      std::memory_order_seq_cst,
+                                                      std::memory_order_relaxed))
+                        item = nullptr;
+                    bottom_.store(b + 1, std::memory_order_relaxed);
+                }
+            }
+            else
+            {
+                bottom_.store(b + 1, std::memory_order_relaxed);
+            }
+            return item;
+        }
+
+        // Steal an item at top, any thread calls it, return nullptr
+        // when deque is empty or another thread took the item
+        T * Steal()
+        {
+            auto t = top_.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto b = bottom_.load(std::memory_order_acquire);
+            if (t >= b)
+                return nullptr;
+
+            auto buffer = buffer_.load(std::memory_order_acquire);
+            T *item = buffer->Get(t);
+            if (!top_.compare_exchange_strong(t, t + 1,
+                                              std::memory_order_seq_cst,
+                                              std::memory_order_relaxed))
+                return nullptr;
+            return item;
+        }
+
+        // Deque has items or not, it is a hint for thieves
+        bool IsEmpty() const
+        {
+            return top_.load(std::memory_order_acquire) >=
+                bottom_.load(std::memory_order_acquire);
+        }
+
+    private:
+        struct Buffer
+        {
+            explicit Buffer(std::size_t capacity)
+                : capacity_(capacity), items_(new std::atomic<T *>[capacity]) { }
+
+            T * Get(std::ptrdiff_t i) const
+            { return items_[i & (capacity_ - 1)].load(std::memory_order_relaxed); }
+
+            void Put(std::ptrdiff_t i, T *item)
+            { items_[i & (capacity_ - 1)].store(item, std::memory_order_relaxed); }
+
+            // Capacity is power of 2
+            std::size_t capacity_;
+            std::unique_ptr<std::atomic<T *>[]> items_;
+        };
+
+        // Double capacity of buffer and copy items in [t, b)
+        Buffer * Grow(Buffer *buffer, std::ptrdiff_t t, std::ptrdiff_t b)
+        {
+            buffers_.emplace_back(new Buffer(buffer->capacity_ * 2));
+            auto grown = buffers_.back().get();
+            for (auto i = t; i < b; ++i)
+                grown->Put(i, buffer->Get(i));
+            buffer_.store(grown, std::memory_order_release);
+            return grown;
+        }
+
+        std::atomic<std::ptrdiff_t> top_;
+        std::atomic<std::ptrdiff_t> bottom_;
+        std::atomic<Buffer *> buffer_;
+        // All buffers, only owner thread modifies it
+        std::vector<std::unique_ptr<Buffer>> buffers_;
+    };
+} // namespace oms
+
+#endif // WORK_STEALING_DEQUE_H
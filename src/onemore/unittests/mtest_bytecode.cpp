@@ -0,0 +1,562 @@
+#include "munit_test.h"
+#include "../mstate.h"
+#include "../mtable.h"
+#include "../mstring.h"
+#include "../mbytecode.h"
+#include "../mcompile_cache.h"
+#include "../mexception.h"
+#include "../mop_code.h"
+#include "../mlib_base.h"
+#include "../mlib_string.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <stdio.h>
+#include <time.h>
+#ifdef _MSC_VER
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#endif // _MSC_VER
+
+namespace
+{
+    oms::Value GetGlobal(oms::State &state, const char *name)
+    {
+        oms::Value key(state.GetString(name));
+        return state.GetGlobal()->table_->GetValue(key);
+    }
+
+    void WriteFile(const std::string &path, const std::string &content)
+    {
+        FILE *file = fopen(path.c_str(), "wb");
+        if (file)
+        {
+            fwrite(content.data(), 1, content.size(), file);
+            fclose(file);
+        }
+    }
+
+    std::string ReadFile(const std::string &path)
+    {
+        std::string content;
+        FILE *file = fopen(path.c_str(), "rb");
+        if (file)
+        {
+            char buffer[4096];
+            std::size_t count = 0;
+            while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+                content.append(buffer, count);
+            fclose(file);
+        }
+        return content;
+    }
+
+    // Run module in a new State, return global 'result'
+    std::string RunModule(const std::string &path,
+                          const std::string &bundle = std::string())
+    {
+        oms::State state;
+        lib::base::RegisterLibBase(&state);
+        lib::string::RegisterLibString(&state);
+        if (!bundle.empty())
+            state.LoadBundle(bundle);
+        state.DoModule(path);
+        auto result = GetGlobal(state, "result");
+        return result.type_ == oms::ValueT_String ? result.str_->GetStdString() : "";
+    }
+} // namespace
+
+// Bytecode has the same behavior as source, includes closures, upvalues,
+// varargs and constants, and it is loaded only when it is fresh
+TEST_CASE(bytecode_dump1)
+{
+    const std::string path = "bytecode_dump1.lua";
+    const std::string bytecode_path = path + oms::kBytecodeSuffix;
+    WriteFile(path,
+        "local prefix = 'v'\n"
+        "local function Counter()\n"
+        "    local n = 0\n"
+        "    return function(...) n = n + select('#', ...) return n end\n"
+        "end\n"
+        "local c = Counter()\n"
+        "c(1, 2) c(nil)\n"
+        "local t = { x = 1.5, [true] = 'yes', 'first' }\n"
+        "result = prefix .. c() .. t.x .. t[true] .. t[1] .. #string.upper('abc')\n");
+
+    auto source_result = RunModule(path);
+    EXPECT_TRUE(source_result == "v31.5yesfirst3");
+
+    {
+        oms::State state;
+        state.CompileModule(path);
+    }
+    EXPECT_TRUE(!ReadFile(bytecode_path).empty());
+    EXPECT_TRUE(RunModule(path) == source_result);
+
+    // Bytecode only
+    remove(path.c_str());
+    EXPECT_TRUE(RunModule(path) == source_result);
+
+    // Stale bytecode is not loaded
+    WriteFile(path, "result = 'changed source'\n");
+    EXPECT_TRUE(RunModule(path) == "changed source");
+
+    remove(path.c_str());
+    remove(bytecode_path.c_str());
+}
+
+// Runtime errors of bytecode report module and line, broken bytecode
+// throws BytecodeException, bytecode of other version is ignored
+TEST_CASE(bytecode_dump2)
+{
+    const std::string path = "bytecode_dump2.lua";
+    const std::string bytecode_path = path + oms::kBytecodeSuffix;
+    WriteFile(path,
+        "result = 'source'\n"
+        "local function Fail(t)\n"
+        "    return t.x\n"
+        "end\n"
+        "if fail then Fail(nil) end\n");
+
+    {
+        oms::State state;
+        state.CompileModule(path);
+    }
+
+    std::string error;
+    try
+    {
+        oms::State state;
+        oms::Value key(state.GetString("fail"));
+        oms::Value value(true);
+        state.GetGlobal()->table_->SetValue(key, value);
+        state.DoModule(path);
+    }
+    catch (const oms::RuntimeException &exp)
+    {
+        error = exp.What();
+    }
+    EXPECT_TRUE(error.find("bytecode_dump2.lua:3") == 0);
+
+    auto bytecode = ReadFile(bytecode_path);
+    WriteFile(bytecode_path, bytecode.substr(0, bytecode.size() / 2));
+    EXPECT_EXCEPTION(oms::BytecodeException, {
+        oms::State state;
+        state.DoModule(path);
+    });
+
+    bytecode[4] = oms::kBytecodeVersion + 1;
+    WriteFile(bytecode_path, bytecode);
+    EXPECT_TRUE(RunModule(path) == "source");
+
+    remove(path.c_str());
+    remove(bytecode_path.c_str());
+}
+
+// Instructions with operands out of range of their function throw
+// BytecodeException, random broken bytecode never crashes the reader
+TEST_CASE(bytecode_verify1)
+{
+    const std::string path = "bytecode_verify1.lua";
+    const std::string bytecode_path = path + oms::kBytecodeSuffix;
+    WriteFile(path,
+        "local t = { 1, 2, 'three' }\n"
+        "local function Sum(...)\n"
+        "    local s = 0\n"
+        "    for i = 1, select('#', ...) do s = s + (select(i, ...)) end\n"
+        "    return s, t\n"
+        "end\n"
+        "result = Sum(1, 2) .. t[3]\n");
+
+    {
+        oms::State state;
+        state.CompileModule(path);
+    }
+    auto bytecode = ReadFile(bytecode_path);
+    EXPECT_TRUE(RunModule(path) == "3three");
+
+    // Header, line, fixed arg count, vararg flag and instruction count,
+    // then instructions of main function are aligned to 4 bytes
+    const std::size_t kArgsOffset = 28 + 4;
+    const std::size_t kCodeOffset = 44;
+    auto verify = [&](std::size_t offset, const void *data, std::size_t size) {
+        auto broken = bytecode;
+        memcpy(&broken[offset], data, size);
+        oms::State state;
+        oms::UndumpFunction(&state, state.GetString(path),
+                            broken.data(), broken.size());
+    };
+    auto verify_code = [&](oms::Instruction i) {
+        verify(kCodeOffset, &i.opcode_, sizeof(i.opcode_));
+    };
+
+    int args = -1;
+    EXPECT_EXCEPTION(oms::BytecodeException, { verify(kArgsOffset, &args, sizeof(args)); });
+    args = 300;
+    EXPECT_EXCEPTION(oms::BytecodeException, { verify(kArgsOffset, &args, sizeof(args)); });
+
+    using oms::Instruction;
+    EXPECT_EXCEPTION(oms::BytecodeException, {
+        verify_code(Instruction::ABxCode(oms::OpType_LoadConst, 0, 1000));
+    });
+    EXPECT_EXCEPTION(oms::BytecodeException, {
+        verify_code(Instruction::ABxCode(oms::OpType_GetGlobal, 0, 1000));
+    });
+    EXPECT_EXCEPTION(oms::BytecodeException, {
+        verify_code(Instruction::ABxCode(oms::OpType_Closure, 0, 5));
+    });
+    EXPECT_EXCEPTION(oms::BytecodeException, {
+        verify_code(Instruction::ABCode(oms::OpType_GetUpvalue, 0, 0));
+    });
+    EXPECT_EXCEPTION(oms::BytecodeException, {
+        verify_code(Instruction::AsBxCode(oms::OpType_Jmp, 0, -1));
+    });
+    EXPECT_EXCEPTION(oms::BytecodeException, {
+        verify_code(Instruction::AsBxCode(oms::OpType_JmpFalse, 0, 1000));
+    });
+    EXPECT_EXCEPTION(oms::BytecodeException, {
+        verify_code(Instruction::ABCCode(oms::OpType_Ret, 0, 0, 1));
+    });
+    EXPECT_EXCEPTION(oms::BytecodeException, {
+        verify_code(Instruction::ABCCode(oms::OpType_Call, 250, 10, 0));
+    });
+    EXPECT_EXCEPTION(oms::BytecodeException, {
+        verify_code(Instruction::ABCCode(oms::OpType_ForStep, 0, 1, 2));
+    });
+    EXPECT_EXCEPTION(oms::BytecodeException, {
+        unsigned int op = 0xFF000000;
+        verify(kCodeOffset, &op, sizeof(op));
+    });
+
+    // Flip bytes with a fixed seed, bytecode is refused or loaded
+    unsigned int seed = 1;
+    int refused = 0;
+    for (int n = 0; n < 2000; ++n)
+    {
+        auto broken = bytecode;
+        for (int k = 0; k < 4; ++k)
+        {
+            seed = seed * 1103515245 + 12345;
+            auto pos = 28 + (seed >> 8) % (broken.size() - 28);
+            broken[pos] = static_cast<char>(broken[pos] ^ (1 << (seed >> 4) % 8));
+        }
+        try
+        {
+            oms::State state;
+            oms::UndumpFunction(&state, state.GetString(path),
+                                broken.data(), broken.size());
+        }
+        catch (const oms::BytecodeException &)
+        {
+            ++refused;
+        }
+    }
+    EXPECT_TRUE(refused > 0);
+
+    remove(path.c_str());
+    remove(bytecode_path.c_str());
+}
+
+// Modules in bundle image are loaded from the image without sources,
+// broken image throws BytecodeException
+TEST_CASE(bytecode_bundle1)
+{
+    const std::string bundle = "bytecode_bundle1.omb";
+    const std::string lib = "bytecode_bundle1_lib.lua";
+    const std::string main = "bytecode_bundle1_main.lua";
+    WriteFile(lib,
+        "function Join(sep, ...)\n"
+        "    local s = ''\n"
+        "    for i = 1, select('#', ...) do\n"
+        "        s = s .. (i > 1 and sep or '') .. select(i, ...)\n"
+        "    end\n"
+        "    return s\n"
+        "end\n");
+    WriteFile(main,
+        "require('" + lib + "')\n"
+        "local function Fail(t) return t.x end\n"
+        "if fail then Fail() end\n"
+        "result = Join('-', 'a', 2, 'c')\n");
+
+    {
+        oms::State state;
+        state.BuildBundle({ lib, main }, bundle);
+    }
+    remove(lib.c_str());
+    remove(main.c_str());
+    EXPECT_TRUE(RunModule(main, bundle) == "a-2-c");
+
+    std::string error;
+    try
+    {
+        oms::State state;
+        lib::base::RegisterLibBase(&state);
+        oms::Value key(state.GetString("fail"));
+        oms::Value value(true);
+        state.GetGlobal()->table_->SetValue(key, value);
+        state.LoadBundle(bundle);
+        state.DoModule(main);
+    }
+    catch (const oms::RuntimeException &exp)
+    {
+        error = exp.What();
+    }
+    EXPECT_TRUE(error.find(main + ":2") == 0);
+
+    auto image = ReadFile(bundle);
+    WriteFile(bundle, image.substr(0, 20));
+    EXPECT_EXCEPTION(oms::BytecodeException, {
+        oms::State state;
+        state.LoadBundle(bundle);
+    });
+
+    remove(bundle.c_str());
+}
+
+// Cached bytecode is loaded instead of compiling the source, broken
+// entries are compiled again, and entries are evicted by size cap
+TEST_CASE(compile_cache1)
+{
+    const std::string dir = "compile_cache1";
+    const std::string path = "compile_cache1.lua";
+    const std::string source = "result = 'source'\n";
+    auto entry = dir + "/" +
+        oms::CompileCache::GetKey(source.data(), source.size()) +
+        oms::kBytecodeSuffix;
+
+    auto run = [&](std::size_t max_bytes) {
+        oms::State state;
+        state.SetCompileCache(dir, max_bytes);
+        state.DoModule(path);
+        auto result = GetGlobal(state, "result");
+        return result.type_ == oms::ValueT_String ? result.str_->GetStdString() : "";
+    };
+
+    WriteFile(path, source);
+    EXPECT_TRUE(run(1024 * 1024) == "source");
+    EXPECT_TRUE(!ReadFile(entry).empty());
+
+    // Replace entry by bytecode of another source, which is loaded
+    WriteFile(path, "result = 'cached'\n");
+    {
+        oms::State state;
+        state.CompileModule(path);
+    }
+    WriteFile(entry, ReadFile(path + oms::kBytecodeSuffix));
+    remove((path + oms::kBytecodeSuffix).c_str());
+    WriteFile(path, source);
+    EXPECT_TRUE(run(1024 * 1024) == "cached");
+
+    // Broken entry
+    WriteFile(entry, "broken");
+    EXPECT_TRUE(run(1024 * 1024) == "source");
+    EXPECT_TRUE(ReadFile(entry).size() > 6);
+
+    // Entries of 5 sources, total size is not greater than cap
+    std::size_t max_bytes = ReadFile(entry).size() * 2;
+    std::vector<std::string> entries;
+    for (int i = 0; i < 5; ++i)
+    {
+        auto other = source + "local x = " + std::to_string(i) + "\n";
+        WriteFile(path, other);
+        EXPECT_TRUE(run(max_bytes) == "source");
+        entries.push_back(dir + "/" +
+            oms::CompileCache::GetKey(other.data(), other.size()) +
+            oms::kBytecodeSuffix);
+    }
+
+    std::size_t total = ReadFile(entry).size();
+    for (const auto &e : entries)
+        total += ReadFile(e).size();
+    EXPECT_TRUE(total > 0 && total <= max_bytes);
+    EXPECT_TRUE(!ReadFile(entries.back()).empty());
+
+    remove(entry.c_str());
+    for (const auto &e : entries)
+        remove(e.c_str());
+    remove(dir.c_str());
+    remove(path.c_str());
+}
+
+// Entries put by one cache are counted in memory and evicted by size
+// cap, stale temporary files of crashed writers are removed
+TEST_CASE(compile_cache2)
+{
+    const std::string dir = "compile_cache2";
+    const std::string bytecode(1000, 'b');
+    const std::string stale = dir + "/stale" + oms::kBytecodeSuffix + ".1.0.tmp";
+    const std::string fresh = dir + "/fresh" + oms::kBytecodeSuffix + ".1.1.tmp";
+
+    oms::CompileCache cache(dir, 4 * bytecode.size());
+    WriteFile(stale, "partial");
+    WriteFile(fresh, "partial");
+    struct utimbuf times;
+    times.actime = time(nullptr) - 3600;
+    times.modtime = times.actime;
+    utime(stale.c_str(), &times);
+
+    std::vector<std::string> keys;
+    for (int i = 0; i < 20; ++i)
+    {
+        keys.push_back("key" + std::to_string(i));
+        cache.Put(keys.back(), bytecode);
+    }
+
+    int cached = 0;
+    for (const auto &key : keys)
+    {
+        std::string value;
+        if (cache.Get(key, &value))
+        {
+            EXPECT_TRUE(value == bytecode);
+            ++cached;
+        }
+    }
+    EXPECT_TRUE(cached > 0 && cached <= 4);
+    std::string value;
+    EXPECT_TRUE(cache.Get(keys.back(), &value));
+    EXPECT_TRUE(ReadFile(stale).empty());
+    EXPECT_TRUE(ReadFile(fresh) == "partial");
+
+    for (const auto &key : keys)
+        cache.Remove(key);
+    remove(fresh.c_str());
+    remove(dir.c_str());
+}
+
+// Preloaded modules are compiled on worker threads and interned into
+// State when they are loaded, compile errors are thrown by loading
+TEST_CASE(preload_modules1)
+{
+    const std::string good = "preload_modules1_good.lua";
+    const std::string bad = "preload_modules1_bad.lua";
+    WriteFile(good,
+        "local prefix = 'good'\n"
+        "function Greet(name) return prefix .. ' ' .. name end\n"
+        "result = Greet('module')\n");
+    WriteFile(bad, "local x = = 1\n");
+
+    oms::State state;
+    state.PreloadModules({ good, bad, "preload_modules1_none.lua" }, 2);
+
+    // Sources are not read again after preloaded
+    remove(good.c_str());
+    state.DoModule(good);
+    auto result = GetGlobal(state, "result");
+    EXPECT_TRUE(result.type_ == oms::ValueT_String &&
+                result.str_ == state.GetString("good module"));
+
+    EXPECT_EXCEPTION(oms::ParseException, {
+        state.DoModule(bad);
+    });
+    EXPECT_EXCEPTION(oms::OpenFileFail, {
+        state.DoModule("preload_modules1_none.lua");
+    });
+
+    remove(bad.c_str());
+}
+
+// Modules with fresh bytecode or in compile cache are not compiled by
+// preloading, so they are loaded without sources or from the cache
+TEST_CASE(preload_modules2)
+{
+    const std::string path = "preload_modules2.lua";
+    const std::string bytecode_path = path + oms::kBytecodeSuffix;
+    const std::string dir = "preload_modules2";
+    const std::string source = "result = 'source'\n";
+    auto entry = dir + "/" +
+        oms::CompileCache::GetKey(source.data(), source.size()) +
+        oms::kBytecodeSuffix;
+
+    auto run = [&](bool cache) {
+        oms::State state;
+        if (cache)
+            state.SetCompileCache(dir, 1024 * 1024);
+        state.PreloadModules({ path }, 2);
+        state.DoModule(path);
+        auto result = GetGlobal(state, "result");
+        return result.type_ == oms::ValueT_String ? result.str_->GetStdString() : "";
+    };
+
+    // Bytecode only
+    WriteFile(path, "result = 'bytecode'\n");
+    {
+        oms::State state;
+        state.CompileModule(path);
+    }
+    remove(path.c_str());
+    EXPECT_TRUE(run(false) == "bytecode");
+    remove(bytecode_path.c_str());
+
+    // Cold module is put into compile cache by preloading
+    WriteFile(path, source);
+    EXPECT_TRUE(run(true) == "source");
+    EXPECT_TRUE(!ReadFile(entry).empty());
+
+    // Replace entry by bytecode of another source, which is loaded
+    WriteFile(path, "result = 'cached'\n");
+    {
+        oms::State state;
+        state.CompileModule(path);
+    }
+    WriteFile(entry, ReadFile(bytecode_path));
+    remove(bytecode_path.c_str());
+    WriteFile(path, source);
+    EXPECT_TRUE(run(true) == "cached");
+
+    remove(path.c_str());
+    remove(entry.c_str());
+    remove(dir.c_str());
+}
+
+// Functions of module compiled lazily have the same behavior as compiled
+// eagerly, and bytecode of lazy State contains all functions
+TEST_CASE(lazy_compile1)
+{
+    const std::string path = "lazy_compile1.lua";
+    std::string source = "local M = {}\n";
+    char buffer[512];
+    for (int i = 0; i < 20; ++i)
+    {
+        snprintf(buffer, sizeof(buffer),
+                 "function M.func_%d(a, b, ...)\n"
+                 "    local t = { name = \"func_%d\", value = %d.5, [a] = b }\n"
+                 "    if a >= b and t.value ~= %d then\n"
+                 "        return a .. 'string' .. b, ...\n"
+                 "    end\n"
+                 "    return t[a] or #t\n"
+                 "end\n",
+                 i, i, i, i);
+        source += buffer;
+    }
+    source +=
+        "local s = 0\n"
+        "for i = 1, 10 do s = s + M['func_' .. i](1, 2) end\n"
+        "result = 'done ' .. s\n";
+    WriteFile(path, source);
+
+    auto run = [&](bool lazy) {
+        oms::State state;
+        lib::base::RegisterLibBase(&state);
+        lib::string::RegisterLibString(&state);
+        state.SetLazyCompile(lazy);
+        state.DoModule(path);
+        auto value = GetGlobal(state, "result");
+        return value.type_ == oms::ValueT_String ? value.str_->GetStdString() : "";
+    };
+
+    EXPECT_TRUE(run(false) == "done 20");
+    EXPECT_TRUE(run(true) == "done 20");
+
+    // Bytecode of lazy State contains all functions
+    {
+        oms::State state;
+        state.SetLazyCompile(true);
+        state.CompileModule(path);
+    }
+    remove(path.c_str());
+    EXPECT_TRUE(RunModule(path) == "done 20");
+
+    remove((path + oms::kBytecodeSuffix).c_str());
+}
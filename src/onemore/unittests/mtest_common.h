@@ -16,14 +16,14 @@ class ParserWrapper
 public:
     explicit ParserWrapper(const std::string &str = "")
         : iss_(str), state_(), name_("parser"),
-          lexer_(&state_, &name_, std::bind(&io::text::InStringStream::GetChar, &iss_))
+          lexer_(&state_, &name_, iss_.GetBuffer(), iss_.GetSize())
     {
     }
 
     void SetInput(const std::string &input)
     {
         iss_.SetInputString(input);
-        lexer_.SetInputStream(std::bind(&io::text::InStringStream::GetChar, &iss_));
+        lexer_.SetInputBuffer(iss_.GetBuffer(), iss_.GetSize());
     }
 
     bool IsEOF()
@@ -1,8 +1,15 @@
+#include "munit_test.h"
 #include "../mgc.h"
 #include "../mtable.h"
 #include "../mfunction.h"
 #include "../mstring.h"
 #include "../mvalue.h"
+#include "../mobject_pool.h"
+#include "../mstate.h"
+#include "../mlib_base.h"
+#include "../mlib_table.h"
+#include "../mlib_io.h"
+#include "../muser_data.h"
 
 #ifdef _MSC_VER
 #include <Windows.h>
@@ -10,10 +17,15 @@
 #include <unistd.h>
 #endif // _MSC_VER
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <algorithm>
 #include <deque>
+#include <fstream>
+#include <sstream>
 #include <string>
+#include <unordered_set>
 
 oms::GC g_gc(oms::GC::DefaultDeleter(), true);
 std::deque<oms::Table *> g_globalTable;
@@ -135,9 +147,7 @@ oms::String * RandomString()
     for (int i = 0; i < count; ++i)
         str.push_back(RandomRange('a', 'z'));
 
-    auto s = g_gc.NewString();
-    s->SetValue(str);
-    return s;
+    return g_gc.NewString(str.c_str(), str.size());
 }
 
 oms::Value RandomValue(bool exclude_table)
@@ -201,7 +211,7 @@ void NewObjInGlobal()
     }
     else if (percent <= 50)
     {
-        g_globalString.push_back(g_gc.NewString(oms::GCGen2));
+        g_globalString.push_back(g_gc.NewString("", 0, oms::GCGen2));
     }
     else if (percent <= 60)
     {
@@ -351,6 +361,1108 @@ void RandomLoop()
     }
 }
 
+TEST_CASE(gc_barrier1)
+{
+    int deleted = 0;
+    oms::GC gc([&](oms::GCObject *, unsigned int) {
+        ++deleted;
+    });
+
+    auto old = gc.NewTable(oms::GCGen1);
+    auto root = [&](oms::GCObjectVisitor *v) { old->Accept(v); };
+    gc.SetRootTraveller(root, root);
+    gc.SetTortureMode(true);
+
+    // Young string stored in old table with barrier survives minor GC,
+    // and young garbage is freed
+    oms::Value key1(1.0);
+    oms::Value value1(gc.NewString("young1", 6));
+    old->SetValue(key1, value1);
+    for (int i = 0; i < 100; ++i)
+        CHECK_BARRIER(gc, old);
+    for (int i = 0; i < 8; ++i)
+        gc.NewString("garbage", 7);
+    gc.CheckGC();
+    EXPECT_TRUE(gc.GetMissingBarrierCount() == 0);
+    EXPECT_TRUE(deleted == 8);
+    EXPECT_TRUE(old->GetValue(key1).str_->GetStdString() == "young1");
+
+    // Barrier is cleared after GC, young string stored without barrier
+    // again is found by torture mode
+    oms::Value key2(2.0);
+    oms::Value value2(gc.NewString("young2", 6));
+    old->SetValue(key2, value2);
+    gc.CheckGC();
+    EXPECT_TRUE(gc.GetMissingBarrierCount() == 1);
+
+    CHECK_BARRIER(gc, old);
+    for (int i = 0; i < 8; ++i)
+        gc.NewString("garbage", 7);
+    gc.CheckGC();
+    EXPECT_TRUE(gc.GetMissingBarrierCount() == 1);
+    EXPECT_TRUE(deleted == 16);
+    EXPECT_TRUE(old->GetValue(key2).str_->GetStdString() == "young2");
+}
+
+TEST_CASE(gc_torture1)
+{
+    oms::State state;
+    lib::base::RegisterLibBase(&state);
+    lib::table::RegisterLibTable(&state);
+    state.GetGC().SetTortureMode(true);
+
+    state.DoString(
+        "local names = {}\n"
+        "for i = 1, 200 do names[i] = 'name' .. i end\n"
+        "local counter = 0\n"
+        "local function inc(s) counter = counter + #s; return counter end\n"
+        "local words = {}\n"
+        "for i = 1, 200 do table.insert(words, names[i] .. '_w') end\n"
+        "function get() return counter end\n"
+        "for i = 1, #words do inc(words[i]) end\n"
+        "last = names[200] .. words[200]\n"
+        "function make(s) local v = s; return function() return v end end\n"
+        "fs = {}\n"
+        "for i = 1, 50 do fs[i] = make('v' .. i) end\n"
+        "joined = ''\n"
+        "for i = 1, 50 do joined = joined .. fs[i]() end\n");
+
+    auto global = state.GetGlobal()->table_;
+    auto get = [&](const char *name) {
+        oms::Value key(state.GetString(name));
+        return global->GetValue(key);
+    };
+
+    EXPECT_TRUE(state.GetGC().GetMissingBarrierCount() == 0);
+    EXPECT_TRUE(get("last").str_->GetStdString() == "name200name200_w");
+
+    std::string joined;
+    for (int i = 1; i <= 50; ++i)
+        joined += "v" + std::to_string(i);
+    EXPECT_TRUE(get("joined").str_->GetStdString() == joined);
+
+    state.DoString("n = get()");
+    // Sum of lengths of 'name' .. i .. '_w', i = 1 ~ 200
+    int sum = 0;
+    for (int i = 1; i <= 200; ++i)
+        sum += 6 + static_cast<int>(std::to_string(i).size());
+    EXPECT_TRUE(get("n").num_ == sum);
+}
+
+TEST_CASE(gc_incremental1)
+{
+    int deleted = 0;
+    oms::GC gc([&](oms::GCObject *, unsigned int) {
+        ++deleted;
+    });
+
+    std::vector<oms::Table *> roots;
+    auto root = [&](oms::GCObjectVisitor *v) {
+        for (auto t : roots)
+            t->Accept(v);
+    };
+    gc.SetRootTraveller(root, root);
+    gc.SetMajorStepBudget(8);
+    gc.SetLazySweep(false);
+
+    // Chain of old tables
+    oms::Value next_key(1.0);
+    auto head = gc.NewTable(oms::GCGen1);
+    auto tail = head;
+    for (int i = 0; i < 99; ++i)
+    {
+        auto t = gc.NewTable(oms::GCGen1);
+        tail->SetValue(next_key, oms::Value(t));
+        tail = t;
+    }
+    roots.push_back(head);
+
+    // Garbage makes major GC start, old garbage is more than 1 MB
+    // and young garbage is more than 64 KB
+    const int kOldGarbage = 32768;
+    const int kYoungGarbage = 4096;
+    for (int i = 0; i < kOldGarbage; ++i)
+        gc.NewTable(oms::GCGen1);
+    for (int i = 0; i < kYoungGarbage; ++i)
+        gc.NewString("garbage", 7);
+    gc.CheckGC();
+    EXPECT_TRUE(gc.IsMajorGCRunning());
+    EXPECT_TRUE(deleted == 0);
+
+    // Store young strings into chain tables while major GC is marking
+    int garbage = kOldGarbage + kYoungGarbage;
+    int stored = 0;
+    auto t = head;
+    oms::Value young_key(2.0);
+    while (gc.IsMajorGCRunning())
+    {
+        oms::Value young(gc.NewString("young", 5));
+        t->SetValue(young_key, young);
+        CHECK_BARRIER(gc, t);
+        if (++stored > 100)
+            ++garbage;
+
+        auto next = t->GetValue(next_key);
+        t = next.IsNil() ? head : next.table_;
+
+        for (int i = 0; i < 64; ++i)
+            gc.NewString("garbage", 7);
+        garbage += 64;
+        gc.CheckGC();
+    }
+
+    EXPECT_TRUE(stored > 1);
+    EXPECT_TRUE(deleted == garbage);
+    for (t = head; t; )
+    {
+        auto young = t->GetValue(young_key);
+        if (!young.IsNil())
+            EXPECT_TRUE(young.str_->GetStdString() == "young");
+
+        auto next = t->GetValue(next_key);
+        t = next.IsNil() ? nullptr : next.table_;
+    }
+}
+
+TEST_CASE(gc_torture2)
+{
+    oms::State state;
+    lib::base::RegisterLibBase(&state);
+    state.GetGC().SetTortureMode(true);
+    state.GetGC().SetMajorStepBudget(16);
+
+    state.DoString(
+        "local list = nil\n"
+        "for i = 1, 600 do list = { next = list, name = 'n' .. i } end\n"
+        "local keep = {}\n"
+        "for i = 1, 300 do keep['k' .. i] = { i } end\n"
+        "count = 0\n"
+        "while list do count = count + #list.name; list = list.next end\n"
+        "sum = 0\n"
+        "for i = 1, 300 do sum = sum + keep['k' .. i][1] end\n");
+
+    auto global = state.GetGlobal()->table_;
+    auto get = [&](const char *name) {
+        oms::Value key(state.GetString(name));
+        return global->GetValue(key);
+    };
+
+    // Sum of lengths of 'n' .. i, i = 1 ~ 600
+    int count = 0;
+    for (int i = 1; i <= 600; ++i)
+        count += 1 + static_cast<int>(std::to_string(i).size());
+    EXPECT_TRUE(state.GetGC().GetMissingBarrierCount() == 0);
+    EXPECT_TRUE(get("count").num_ == count);
+    EXPECT_TRUE(get("sum").num_ == 45150);
+}
+
+oms::Table * NewTree(oms::GC &gc, int depth)
+{
+    auto t = gc.NewTable();
+    if (depth > 0)
+    {
+        t->SetArrayValue(1, oms::Value(NewTree(gc, depth - 1)));
+        t->SetArrayValue(2, oms::Value(NewTree(gc, depth - 1)));
+    }
+    return t;
+}
+
+TEST_CASE(gc_deep1)
+{
+    int deleted = 0;
+    oms::GC gc([&](oms::GCObject *, unsigned int) {
+        ++deleted;
+    });
+
+    std::vector<oms::Table *> roots;
+    auto root = [&](oms::GCObjectVisitor *v) {
+        for (auto t : roots)
+            t->Accept(v);
+    };
+    gc.SetRootTraveller(root, root);
+    gc.SetMajorStepBudget(0);
+
+    // Long linked list in GCGen0 is marked by minor GC
+    const int kListNodes = 1000000;
+    auto list = gc.NewTable();
+    for (int i = 1; i < kListNodes; ++i)
+    {
+        auto node = gc.NewTable();
+        node->SetArrayValue(1, oms::Value(list));
+        list = node;
+    }
+    roots.push_back(list);
+
+    gc.CheckGC();
+    EXPECT_TRUE(deleted == 0);
+
+    // Deep tree in GCGen0 and the list in GCGen1 are marked by major GC
+    const int kTreeDepth = 18;
+    roots.push_back(NewTree(gc, kTreeDepth));
+
+    gc.CheckGC();
+    EXPECT_TRUE(deleted == 0);
+}
+
+TEST_CASE(gc_pool1)
+{
+    oms::ObjectPool pool(24);
+    std::vector<void *> blocks;
+    for (int i = 0; i < 10000; ++i)
+        blocks.push_back(pool.Alloc());
+
+    auto slabs = pool.GetSlabCount();
+    EXPECT_TRUE(slabs > 1);
+
+    // Freed blocks are reused without new slabs
+    for (auto block : blocks)
+        pool.Free(block);
+    for (auto &block : blocks)
+        block = pool.Alloc();
+    EXPECT_TRUE(pool.GetSlabCount() == slabs);
+
+    // Only idle slabs are released
+    for (std::size_t i = 0; i < blocks.size() - 1; ++i)
+        pool.Free(blocks[i]);
+    pool.ReleaseIdleSlabs();
+    EXPECT_TRUE(pool.GetSlabCount() == 1);
+
+    pool.Free(blocks.back());
+    pool.ReleaseIdleSlabs();
+    EXPECT_TRUE(pool.GetSlabCount() == 0);
+}
+
+TEST_CASE(gc_pool2)
+{
+    int deleted = 0;
+    oms::GC gc([&](oms::GCObject *, unsigned int) {
+        ++deleted;
+    });
+
+    auto root = [](oms::GCObjectVisitor *) { };
+    gc.SetRootTraveller(root, root);
+
+    // Young garbage freed by minor GC returns memory to pools, new
+    // objects reuse it
+    const int kObjects = 2000;
+    for (int i = 0; i < kObjects; ++i)
+        gc.NewTable();
+    gc.CheckGC();
+    EXPECT_TRUE(deleted == kObjects);
+
+    auto slabs = gc.GetPoolSlabCount();
+    EXPECT_TRUE(slabs > 0);
+    for (int i = 0; i < kObjects; ++i)
+        gc.NewTable();
+    EXPECT_TRUE(gc.GetPoolSlabCount() == slabs);
+}
+
+TEST_CASE(gc_lazy_sweep1)
+{
+    int deleted = 0;
+    oms::String *dead = nullptr;
+    bool dead_deleted = false;
+    oms::GC gc([&](oms::GCObject *obj, unsigned int) {
+        ++deleted;
+        if (obj == dead)
+            dead_deleted = true;
+    });
+
+    auto live = gc.NewTable(oms::GCGen1);
+    auto root = [&](oms::GCObjectVisitor *v) { live->Accept(v); };
+    gc.SetRootTraveller(root, root);
+    gc.SetMajorStepBudget(0);
+
+    // Old garbage makes major GC run, dead objects are swept lazily
+    // after marking
+    const int kOldGarbage = 32768;
+    const int kYoungGarbage = 4096;
+    for (int i = 0; i < kOldGarbage; ++i)
+        gc.NewTable(oms::GCGen1);
+    dead = gc.NewString("dead", 4, oms::GCGen1);
+    for (int i = 0; i < kYoungGarbage; ++i)
+        gc.NewString("garbage", 7);
+    gc.CheckGC();
+    EXPECT_TRUE(gc.IsSweeping());
+    EXPECT_TRUE(deleted == 0);
+
+    // Dead string found again is not swept, young objects stored in
+    // alived object which is not swept survive minor GC
+    gc.Resurrect(dead);
+    oms::Value key(1.0);
+    int garbage = kOldGarbage + kYoungGarbage;
+    while (gc.IsSweeping())
+    {
+        live->SetValue(key, oms::Value(gc.NewString("young", 5)));
+        CHECK_BARRIER(gc, live);
+        for (int i = 0; i < 128; ++i)
+            gc.NewString("garbage", 7);
+        garbage += 128;
+        gc.CheckGC();
+    }
+
+    EXPECT_TRUE(!dead_deleted);
+    EXPECT_TRUE(dead->GetStdString() == "dead");
+    EXPECT_TRUE(live->GetValue(key).str_->GetStdString() == "young");
+    EXPECT_TRUE(deleted >= kOldGarbage + kYoungGarbage);
+    EXPECT_TRUE(deleted < garbage);
+}
+
+TEST_CASE(gc_pacing1)
+{
+    int deleted = 0;
+    oms::GC gc([&](oms::GCObject *, unsigned int) {
+        ++deleted;
+    });
+
+    auto root = [](oms::GCObjectVisitor *) { };
+    gc.SetRootTraveller(root, root);
+
+    // Large strings reach threshold bytes of GCGen0 by few objects
+    std::string large(1024 * 1024, 'x');
+    gc.NewString(large.c_str(), large.size());
+    EXPECT_TRUE(gc.GetTotalBytes() > large.size());
+    gc.CheckGC();
+    EXPECT_TRUE(deleted == 1);
+    EXPECT_TRUE(gc.GetTotalBytes() == 0);
+
+    // Small objects do not run GC before reach threshold bytes
+    for (int i = 0; i < 1024; ++i)
+        gc.NewUpvalue();
+    gc.CheckGC();
+    EXPECT_TRUE(deleted == 1);
+
+    // GC does not run when stopped until full GC
+    gc.Stop();
+    gc.NewString(large.c_str(), large.size());
+    gc.CheckGC();
+    EXPECT_TRUE(deleted == 1);
+    gc.FullGC();
+    EXPECT_TRUE(deleted == 1026);
+    gc.Restart();
+}
+
+// Array and hash parts of tables are charged to their generations, so
+// garbage of big tables runs GC without many new objects
+TEST_CASE(gc_pacing2)
+{
+    oms::GC gc;
+    auto root = [](oms::GCObjectVisitor *) { };
+    gc.SetRootTraveller(root, root);
+
+    auto t = gc.NewTable();
+    auto bytes = gc.GetTotalBytes();
+    oms::Value key(gc.NewString("key", 3));
+    for (int i = 1; i <= 1000; ++i)
+        t->SetArrayValue(i, oms::Value(static_cast<double>(i)));
+    t->SetValue(key, oms::Value(1.0));
+    EXPECT_TRUE(t->GetStorageBytes() >= 1000 * sizeof(oms::Value));
+    EXPECT_TRUE(gc.GetTotalBytes() >= bytes + t->GetStorageBytes());
+
+    auto stats = gc.GetStats();
+    EXPECT_TRUE(stats.type_bytes_[oms::GCObjectType_Table] ==
+                sizeof(oms::Table) + t->GetStorageBytes());
+    EXPECT_TRUE(stats.allocated_bytes_ - stats.freed_bytes_ == gc.GetTotalBytes());
+
+    // Removed entries of hash part are freed
+    auto storage = t->GetStorageBytes();
+    t->SetValue(key, oms::Value());
+    EXPECT_TRUE(t->GetStorageBytes() < storage);
+    stats = gc.GetStats();
+    EXPECT_TRUE(stats.allocated_bytes_ - stats.freed_bytes_ == gc.GetTotalBytes());
+
+    gc.FullGC();
+    stats = gc.GetStats();
+    EXPECT_TRUE(gc.GetTotalBytes() == 0);
+    EXPECT_TRUE(stats.allocated_bytes_ == stats.freed_bytes_);
+
+    oms::State state;
+    lib::base::RegisterLibBase(&state);
+    state.DoString(
+        "for i = 1, 50 do\n"
+        "    local t = {}\n"
+        "    for j = 1, 100000 do t[j] = j end\n"
+        "end\n");
+
+    // Without collections 50 arrays of 100000 values are alived
+    stats = state.GetGC().GetStats();
+    EXPECT_TRUE(stats.major_count_ > 0);
+    EXPECT_TRUE(state.GetGC().GetTotalBytes() < 10 * 100000 * sizeof(oms::Value));
+}
+
+TEST_CASE(gc_collectgarbage1)
+{
+    oms::State state;
+    lib::base::RegisterLibBase(&state);
+
+    state.DoString(
+        "local t = {}\n"
+        "for i = 1, 10000 do t[i] = {} end\n"
+        "before = collectgarbage('count')\n"
+        "for i = 1, 10000 do t[i] = nil end\n"
+        "collectgarbage()\n"
+        "after = collectgarbage('count')\n"
+        "pause = collectgarbage('setpause', 150)\n"
+        "pause2 = collectgarbage('setpause', 200)\n"
+        "stepmul = collectgarbage('setstepmul', 400)\n"
+        "repeat until collectgarbage('step')\n");
+
+    auto global = state.GetGlobal()->table_;
+    auto get = [&](const char *name) {
+        oms::Value key(state.GetString(name));
+        return global->GetValue(key);
+    };
+
+    EXPECT_TRUE(get("after").num_ < get("before").num_);
+    EXPECT_TRUE(get("pause").num_ == 200);
+    EXPECT_TRUE(get("pause2").num_ == 150);
+    EXPECT_TRUE(get("stepmul").num_ == 200);
+    EXPECT_TRUE(state.GetGC().GetStepMultiplier() == 400);
+    EXPECT_TRUE(!state.GetGC().IsMajorGCRunning());
+}
+
+// Count of key value pairs of table
+int CountEntries(oms::Table *t)
+{
+    int count = 0;
+    oms::Value key;
+    oms::Value value;
+    if (t->FirstKeyValue(key, value))
+    {
+        do
+        {
+            ++count;
+        } while (t->NextKeyValue(oms::Value(key), key, value));
+    }
+    return count;
+}
+
+TEST_CASE(gc_weak1)
+{
+    oms::GC gc;
+    std::vector<oms::Table *> roots;
+    auto root = [&](oms::GCObjectVisitor *v) {
+        for (auto t : roots)
+            t->Accept(v);
+    };
+    gc.SetRootTraveller(root, root);
+
+    auto alive = gc.NewTable();
+    auto weak_key = gc.NewTable();
+    auto weak_value = gc.NewTable();
+    auto weak_kv = gc.NewTable();
+    auto ephemeron = gc.NewTable();
+    weak_key->SetWeakMode(oms::TableWeak_Key);
+    weak_value->SetWeakMode(oms::TableWeak_Value);
+    weak_kv->SetWeakMode(oms::TableWeak_KeyValue);
+    ephemeron->SetWeakMode(oms::TableWeak_Ephemeron);
+    roots = { alive, weak_key, weak_value, weak_kv, ephemeron };
+
+    // Strings and numbers are never weak, value referencing its weak
+    // key keeps the key alived
+    oms::Value str(gc.NewString("s", 1));
+    auto cycle = gc.NewTable();
+    cycle->SetArrayValue(1, oms::Value(cycle));
+    weak_key->SetValue(oms::Value(alive), oms::Value(1.0));
+    weak_key->SetValue(oms::Value(gc.NewTable()), oms::Value(2.0));
+    weak_key->SetValue(str, oms::Value(3.0));
+    weak_key->SetValue(oms::Value(cycle), oms::Value(cycle));
+
+    // Dead values of array part become nil
+    weak_value->SetArrayValue(1, oms::Value(alive));
+    weak_value->SetArrayValue(2, oms::Value(gc.NewTable()));
+    weak_value->SetArrayValue(3, oms::Value(alive));
+    weak_value->SetArrayValue(4, oms::Value(gc.NewTable()));
+    weak_value->SetValue(str, oms::Value(gc.NewTable()));
+    weak_value->SetValue(oms::Value(gc.NewTable()), str);
+
+    weak_kv->SetValue(oms::Value(alive), oms::Value(alive));
+    weak_kv->SetValue(oms::Value(alive), oms::Value(alive));
+    weak_kv->SetValue(str, oms::Value(gc.NewTable()));
+    weak_kv->SetValue(oms::Value(gc.NewTable()), str);
+
+    // Values of alived keys are alived, which may make other keys
+    // alived, value referencing its own key does not keep it alived
+    auto chain = gc.NewTable();
+    auto chain_value = gc.NewTable();
+    auto self = gc.NewTable();
+    self->SetArrayValue(1, oms::Value(self));
+    ephemeron->SetValue(oms::Value(chain), oms::Value(chain_value));
+    ephemeron->SetValue(oms::Value(alive), oms::Value(chain));
+    ephemeron->SetValue(oms::Value(self), oms::Value(self));
+    ephemeron->SetValue(str, oms::Value(gc.NewTable()));
+
+    gc.FullGC();
+
+    EXPECT_TRUE(CountEntries(weak_key) == 3);
+    EXPECT_TRUE(weak_key->GetValue(oms::Value(alive)).num_ == 1.0);
+    EXPECT_TRUE(weak_key->GetValue(str).num_ == 3.0);
+    EXPECT_TRUE(weak_key->GetValue(oms::Value(cycle)).table_ == cycle);
+
+    EXPECT_TRUE(weak_value->ArraySize() == 3);
+    EXPECT_TRUE(weak_value->GetValue(oms::Value(2.0)).IsNil());
+    EXPECT_TRUE(weak_value->GetValue(oms::Value(3.0)).table_ == alive);
+    EXPECT_TRUE(weak_value->GetValue(str).IsNil());
+    // Three array values and the entry of strong key
+    EXPECT_TRUE(CountEntries(weak_value) == 4);
+
+    EXPECT_TRUE(CountEntries(weak_kv) == 1);
+    EXPECT_TRUE(weak_kv->GetValue(oms::Value(alive)).table_ == alive);
+
+    EXPECT_TRUE(CountEntries(ephemeron) == 3);
+    EXPECT_TRUE(ephemeron->GetValue(oms::Value(alive)).table_ == chain);
+    EXPECT_TRUE(ephemeron->GetValue(oms::Value(chain)).table_ == chain_value);
+    EXPECT_TRUE(ephemeron->GetValue(str).type_ == oms::ValueT_Table);
+
+    // Weak table becomes strong
+    weak_value->SetWeakMode(oms::TableWeak_None);
+    weak_value->SetValue(str, oms::Value(gc.NewTable()));
+    gc.FullGC();
+    EXPECT_TRUE(weak_value->GetValue(str).type_ == oms::ValueT_Table);
+}
+
+// Weak value table of which half values are alived, values are added
+// while major GC is marking incrementally, return count of alived
+// values, or -1 when a dead value is not removed
+int WeakIncremental(unsigned int threads)
+{
+    oms::GC gc;
+    auto strong = gc.NewTable();
+    auto weak = gc.NewTable();
+    weak->SetWeakMode(oms::TableWeak_Value);
+    auto root = [&](oms::GCObjectVisitor *v) {
+        strong->Accept(v);
+        weak->Accept(v);
+    };
+    gc.SetRootTraveller(root, root);
+    gc.SetMarkThreads(threads);
+    gc.SetMajorStepBudget(64);
+
+    const int kValues = 2000;
+    auto add = [&](int i) {
+        auto t = gc.NewTable();
+        weak->SetArrayValue(i, oms::Value(t));
+        CHECK_BARRIER(gc, weak);
+        if (i % 2 == 0)
+        {
+            strong->SetArrayValue(strong->ArraySize() + 1, oms::Value(t));
+            CHECK_BARRIER(gc, strong);
+        }
+    };
+
+    for (int i = 1; i <= kValues / 2; ++i)
+        add(i);
+    gc.StepGC();
+    if (!gc.IsMajorGCRunning())
+        return -1;
+    for (int i = kValues / 2 + 1; i <= kValues; ++i)
+        add(i);
+    while (!gc.StepGC())
+        ;
+
+    int alived = 0;
+    for (int i = 1; i <= static_cast<int>(weak->ArraySize()); ++i)
+    {
+        auto value = weak->GetValue(oms::Value(static_cast<double>(i)));
+        if (!value.IsNil())
+        {
+            if (i % 2 != 0)
+                return -1;
+            ++alived;
+        }
+    }
+    return alived;
+}
+
+TEST_CASE(gc_weak2)
+{
+    EXPECT_TRUE(WeakIncremental(1) == 1000);
+    EXPECT_TRUE(WeakIncremental(4) == 1000);
+}
+
+TEST_CASE(gc_weak3)
+{
+    oms::State state;
+    lib::base::RegisterLibBase(&state);
+    lib::table::RegisterLibTable(&state);
+
+    state.DoString(
+        "local cache = table.setweak({}, 'k')\n"
+        "local keep = {}\n"
+        "for i = 1, 100 do\n"
+        "    local k = {}\n"
+        "    cache[k] = i\n"
+        "    if i % 2 == 0 then keep[#keep + 1] = k end\n"
+        "end\n"
+        "collectgarbage()\n"
+        "count = 0\n"
+        "for k, v in pairs(cache) do count = count + 1 end\n"
+        "mode = table.getweak(cache)\n"
+        "table.setweak(cache, '')\n"
+        "mode2 = table.getweak(cache)\n");
+
+    auto global = state.GetGlobal()->table_;
+    auto get = [&](const char *name) {
+        oms::Value key(state.GetString(name));
+        return global->GetValue(key);
+    };
+
+    // Key in register of the last loop is still alived
+    EXPECT_TRUE(get("count").num_ >= 50 && get("count").num_ <= 51);
+    EXPECT_TRUE(get("mode").str_->GetStdString() == "k");
+    EXPECT_TRUE(get("mode2").str_->GetStdString() == "");
+}
+
+// Object to proxy map which proxies reference their objects keeps
+// memory stable in a long run
+TEST_CASE(gc_weak_soak)
+{
+    oms::State state;
+    lib::base::RegisterLibBase(&state);
+    lib::table::RegisterLibTable(&state);
+
+    state.DoString(
+        "local proxies = table.setweak({}, 'e')\n"
+        "local function proxy(obj)\n"
+        "    local p = proxies[obj]\n"
+        "    if not p then p = { obj = obj }; proxies[obj] = p end\n"
+        "    return p\n"
+        "end\n"
+        "first = 0\n"
+        "max = 0\n"
+        "for round = 1, 50 do\n"
+        "    for i = 1, 2000 do\n"
+        "        local obj = { i }\n"
+        "        proxy(obj)\n"
+        "        proxy(obj)\n"
+        "    end\n"
+        "    collectgarbage()\n"
+        "    local count = collectgarbage('count')\n"
+        "    if round == 1 then first = count end\n"
+        "    if count > max then max = count end\n"
+        "end\n"
+        "entries = 0\n"
+        "for k, v in pairs(proxies) do entries = entries + 1 end\n");
+
+    auto global = state.GetGlobal()->table_;
+    auto get = [&](const char *name) {
+        oms::Value key(state.GetString(name));
+        return global->GetValue(key);
+    };
+
+    EXPECT_TRUE(get("max").num_ <= get("first").num_ * 1.5);
+    EXPECT_TRUE(get("entries").num_ <= 1);
+}
+
+// Closures of nested frames share open upvalues, which are closed when
+// their frames return, even with collections between
+TEST_CASE(gc_open_upvalue1)
+{
+    oms::State state;
+    lib::base::RegisterLibBase(&state);
+
+    state.DoString(
+        "local function Level(depth)\n"
+        "    local a, b = depth, 0\n"
+        "    local get = function() return a + b end\n"
+        "    local inc = function() b = b + 1 end\n"
+        "    if depth > 0 then\n"
+        "        local inner_get, inner_inc = Level(depth - 1)\n"
+        "        inner_inc()\n"
+        "        b = b + inner_get()\n"
+        "    end\n"
+        "    collectgarbage()\n"
+        "    inc()\n"
+        "    return get, inc\n"
+        "end\n"
+        "local get, inc = Level(50)\n"
+        "inc()\n"
+        "result = get()\n"
+        "local closures = {}\n"
+        "for i = 1, 10 do\n"
+        "    closures[i] = function() return i end\n"
+        "end\n"
+        "sum = 0\n"
+        "for i = 1, 10 do sum = sum + closures[i]() end\n");
+
+    auto global = state.GetGlobal()->table_;
+    auto get = [&](const char *name) {
+        oms::Value key(state.GetString(name));
+        return global->GetValue(key);
+    };
+
+    // get of Level(n) returns n + 2 + get of Level(n - 1), get of
+    // Level(0) returns 1, then inc adds 1 to the outermost b
+    double level = 1;
+    for (int depth = 1; depth <= 50; ++depth)
+        level = depth + 2 + level;
+    EXPECT_TRUE(get("result").num_ == level + 1);
+    EXPECT_TRUE(get("sum").num_ == 55);
+}
+
+TEST_CASE(gc_stats1)
+{
+    oms::GC gc;
+    auto live = gc.NewTable(oms::GCGen1);
+    auto root = [&](oms::GCObjectVisitor *v) { live->Accept(v); };
+    gc.SetRootTraveller(root, root);
+    gc.SetMajorStepBudget(0);
+
+    // Half of young tables are promoted by minor GC
+    const int kTables = 1000;
+    for (int i = 0; i < kTables; ++i)
+    {
+        auto t = gc.NewTable();
+        if (i % 2 == 0)
+            live->SetArrayValue(live->ArraySize() + 1, oms::Value(t));
+    }
+    gc.NewString("str", 3);
+
+    auto stats = gc.GetStats();
+    EXPECT_TRUE(stats.objects_[oms::GCGen0] == kTables + 1);
+    EXPECT_TRUE(stats.objects_[oms::GCGen1] == 1);
+    EXPECT_TRUE(stats.type_objects_[oms::GCObjectType_Table] == kTables + 1);
+    EXPECT_TRUE(stats.type_objects_[oms::GCObjectType_String] == 1);
+    EXPECT_TRUE(stats.allocated_bytes_ == gc.GetTotalBytes());
+    EXPECT_TRUE(stats.minor_count_ == 0 && stats.major_count_ == 0);
+
+    gc.FullGC();
+    stats = gc.GetStats();
+    EXPECT_TRUE(stats.major_count_ == 1);
+    EXPECT_TRUE(stats.objects_[oms::GCGen1] == kTables / 2 + 1);
+    EXPECT_TRUE(stats.type_objects_[oms::GCObjectType_Table] == kTables / 2 + 1);
+    EXPECT_TRUE(stats.type_objects_[oms::GCObjectType_String] == 0);
+    EXPECT_TRUE(stats.allocated_bytes_ - stats.freed_bytes_ == gc.GetTotalBytes());
+    EXPECT_TRUE(stats.pause_count_ == 1);
+    EXPECT_TRUE(stats.total_pause_ >= stats.max_pause_);
+
+    // Minor GC promotes half of young bytes
+    for (int i = 0; i < kTables; ++i)
+    {
+        auto t = gc.NewTable();
+        if (i % 2 == 0)
+            live->SetArrayValue(live->ArraySize() + 1, oms::Value(t));
+    }
+    CHECK_BARRIER(gc, live);
+    while (gc.GetStats().minor_count_ == 0)
+    {
+        gc.NewString("garbage", 7);
+        gc.CheckGC();
+    }
+    stats = gc.GetStats();
+    EXPECT_TRUE(stats.promoted_bytes_ == (kTables / 2) * sizeof(oms::Table));
+    EXPECT_TRUE(stats.GetPromotionRate() > 0.0 && stats.GetPromotionRate() < 1.0);
+}
+
+struct SnapshotLine
+{
+    std::size_t id_;
+    std::string type_;
+    std::size_t bytes_;
+    std::size_t retained_;
+    std::size_t dominator_;
+    std::string description_;
+    std::vector<std::size_t> references_;
+};
+
+std::vector<SnapshotLine> ParseSnapshot(const std::string &snapshot)
+{
+    std::vector<SnapshotLine> lines;
+    std::istringstream in(snapshot);
+    std::string line;
+    std::getline(in, line);
+    std::getline(in, line);
+    while (std::getline(in, line))
+    {
+        std::istringstream fields(line);
+        SnapshotLine l;
+        std::string arrow;
+        fields >> l.id_ >> l.type_ >> l.bytes_ >> l.retained_ >>
+            l.dominator_ >> l.description_ >> arrow;
+        std::size_t ref = 0;
+        while (fields >> ref)
+            l.references_.push_back(ref);
+        lines.push_back(l);
+    }
+    return lines;
+}
+
+TEST_CASE(gc_snapshot1)
+{
+    oms::GC gc;
+    auto a = gc.NewTable();
+    auto root = [&](oms::GCObjectVisitor *v) { a->Accept(v); };
+    gc.SetRootTraveller(root, root);
+
+    // a -> b -> payload, a -> c -> b, so b is dominated by a, and
+    // b retains payload, c retains nothing else
+    auto b = gc.NewTable();
+    auto c = gc.NewTable();
+    auto payload = gc.NewString("payload", 7);
+    b->SetArrayValue(1, oms::Value(payload));
+    c->SetArrayValue(1, oms::Value(b));
+    a->SetArrayValue(1, oms::Value(b));
+    a->SetArrayValue(2, oms::Value(c));
+
+    // Garbage and weak references are not in snapshot
+    gc.NewTable();
+    auto weak = gc.NewTable();
+    weak->SetWeakMode(oms::TableWeak_Value);
+    weak->SetArrayValue(1, oms::Value(gc.NewTable()));
+    c->SetArrayValue(2, oms::Value(weak));
+
+    std::ostringstream out;
+    gc.DumpHeapSnapshot(out);
+    auto lines = ParseSnapshot(out.str());
+    EXPECT_TRUE(lines.size() == 5);
+
+    // Bytes of tables include their array parts
+    auto table_bytes = [](oms::Table *t) {
+        return sizeof(oms::Table) + t->GetStorageBytes();
+    };
+    std::size_t string_bytes = oms::String::GetAllocSize(7);
+    auto find = [&](std::size_t retained, const std::string &type) {
+        for (const auto &l : lines)
+        {
+            if (l.retained_ == retained && l.type_ == type)
+                return l;
+        }
+        return SnapshotLine();
+    };
+
+    // Lines are sorted by retained bytes
+    auto la = lines[0];
+    EXPECT_TRUE(la.dominator_ == 0);
+    EXPECT_TRUE(la.retained_ == table_bytes(a) + table_bytes(b) +
+                table_bytes(c) + table_bytes(weak) + string_bytes);
+    EXPECT_TRUE(la.description_ == "array=2");
+
+    auto lb = find(table_bytes(b) + string_bytes, "table");
+    auto lp = find(string_bytes, "string");
+    auto lc = find(table_bytes(c) + table_bytes(weak), "table");
+    EXPECT_TRUE(lp.description_ == "\"payload\"");
+    EXPECT_TRUE(lb.dominator_ == la.id_ && lc.dominator_ == la.id_);
+    EXPECT_TRUE(lp.dominator_ == lb.id_);
+    EXPECT_TRUE(lb.references_.size() == 1 && lb.references_[0] == lp.id_);
+    EXPECT_TRUE(lc.references_.size() == 2 && lc.references_[0] == lb.id_);
+}
+
+TEST_CASE(gc_stats2)
+{
+    oms::State state;
+    lib::base::RegisterLibBase(&state);
+
+    state.DoString(
+        "local t = {}\n"
+        "for i = 1, 1000 do t[i] = {} end\n"
+        "collectgarbage()\n"
+        "local stats = collectgarbage('stats')\n"
+        "tables = stats.table_objects\n"
+        "majors = stats.major_count\n"
+        "old = stats.gen1_objects + stats.gen2_objects\n"
+        "rate = stats.promotion_rate\n"
+        "dumped = collectgarbage('snapshot', 'gc_snapshot.tmp')\n");
+
+    auto global = state.GetGlobal()->table_;
+    auto get = [&](const char *name) {
+        oms::Value key(state.GetString(name));
+        return global->GetValue(key);
+    };
+
+    EXPECT_TRUE(get("tables").num_ >= 1001);
+    EXPECT_TRUE(get("majors").num_ == 1);
+    EXPECT_TRUE(get("old").num_ > 1000);
+    EXPECT_TRUE(get("rate").type_ == oms::ValueT_Number);
+    EXPECT_TRUE(get("dumped").bvalue_);
+
+    std::ifstream in("gc_snapshot.tmp");
+    std::string header;
+    std::getline(in, header);
+    EXPECT_TRUE(header.find("heap snapshot: ") == 0);
+    in.close();
+    remove("gc_snapshot.tmp");
+}
+
+// Closures without upvalues or with the same upvalues are reused,
+// closures capturing fresh locals are not
+TEST_CASE(gc_closure_cache1)
+{
+    oms::State state;
+    lib::base::RegisterLibBase(&state);
+
+    state.DoString(
+        "local function Each(t, f) for i = 1, #t do f(t[i]) end end\n"
+        "local t = { 1, 2, 3 }\n"
+        "local function Bytes(f)\n"
+        "    local before = collectgarbage('stats').allocated_bytes\n"
+        "    f()\n"
+        "    return collectgarbage('stats').allocated_bytes - before\n"
+        "end\n"
+        "local base = 10\n"
+        "total = 0\n"
+        "cached_bytes = Bytes(function()\n"
+        "    for n = 1, 10000 do\n"
+        "        Each(t, function(x) return x * 2 end)\n"
+        "        Each(t, function(x) total = total + x + base end)\n"
+        "    end\n"
+        "end)\n"
+        "fresh_bytes = Bytes(function()\n"
+        "    for n = 1, 10000 do\n"
+        "        local v = n\n"
+        "        Each(t, function(x) return x + v end)\n"
+        "        Each(t, function(x) total = total + x + v end)\n"
+        "    end\n"
+        "end)\n"
+        "local function New() return function() end end\n"
+        "same = New() == New()\n"
+        "local counters = {}\n"
+        "for i = 1, 2 do\n"
+        "    local count = i * 10\n"
+        "    counters[i] = function() count = count + 1; return count end\n"
+        "end\n"
+        "counters[1]()\n"
+        "distinct = counters[1] ~= counters[2]\n"
+        "first, second = counters[1](), counters[2]()\n");
+
+    auto global = state.GetGlobal()->table_;
+    auto get = [&](const char *name) {
+        oms::Value key(state.GetString(name));
+        return global->GetValue(key);
+    };
+
+    auto cached = get("cached_bytes").num_;
+    auto fresh = get("fresh_bytes").num_;
+    EXPECT_TRUE(cached * 100 < fresh);
+    // Reused closures still see current values of their upvalues
+    double total = 0;
+    for (int n = 1; n <= 10000; ++n)
+        total += (1 + 2 + 3 + 3 * 10) + (1 + 2 + 3 + 3 * n);
+    EXPECT_TRUE(get("total").num_ == total);
+    EXPECT_TRUE(get("same").bvalue_);
+    EXPECT_TRUE(get("distinct").bvalue_);
+    EXPECT_TRUE(get("first").num_ == 12);
+    EXPECT_TRUE(get("second").num_ == 21);
+}
+
+void CloseTempFile(void *file)
+{
+    fclose(static_cast<FILE *>(file));
+}
+
+oms::UserData * NewTempFile(oms::GC &gc)
+{
+    auto user_data = gc.NewUserData();
+    user_data->Set(tmpfile(), nullptr);
+    user_data->SetDestroyer(CloseTempFile);
+    return user_data;
+}
+
+TEST_CASE(gc_finalizer1)
+{
+    oms::GC gc;
+    auto root = [](oms::GCObjectVisitor *) { };
+    gc.SetRootTraveller(root, root);
+    gc.SetBackgroundFinalizer(true);
+
+    // Dead files are closed by finalizer thread
+    const int kFiles = 5000;
+    for (int i = 0; i < kFiles; ++i)
+    {
+        auto user_data = NewTempFile(gc);
+        EXPECT_TRUE(user_data->GetData());
+        gc.CheckGC();
+    }
+    gc.FullGC();
+    gc.WaitFinalizer();
+    EXPECT_TRUE(gc.GetFinalizedCount() == kFiles);
+}
+
+TEST_CASE(gc_finalizer2)
+{
+    oms::State state;
+    lib::base::RegisterLibBase(&state);
+    lib::io::RegisterLibIO(&state);
+    state.GetGC().SetBackgroundFinalizer(true);
+
+    state.DoString(
+        "opened = 0\n"
+        "for i = 1, 5000 do\n"
+        "    local f = io.open('gc_finalizer.tmp', 'w')\n"
+        "    if f then opened = opened + 1; f:write(i) end\n"
+        "end\n"
+        "collectgarbage()\n");
+
+    state.GetGC().WaitFinalizer();
+    oms::Value key(state.GetString("opened"));
+    EXPECT_TRUE(state.GetGlobal()->table_->GetValue(key).num_ == 5000);
+    // File in register of the last loop is still alived
+    EXPECT_TRUE(state.GetGC().GetFinalizedCount() >= 4999);
+    remove("gc_finalizer.tmp");
+}
+
+// Run major GC on a random graph of tables and strings, return whether
+// each table survived, the graph is the same for the same seed
+std::vector<bool> ParallelMarkGraph(unsigned int threads, bool incremental)
+{
+    std::unordered_set<oms::GCObject *> deleted;
+    oms::GC gc([&](oms::GCObject *obj, unsigned int) {
+        deleted.insert(obj);
+    });
+
+    std::vector<oms::Table *> roots;
+    auto root = [&](oms::GCObjectVisitor *v) {
+        for (auto t : roots)
+            t->Accept(v);
+    };
+    gc.SetRootTraveller(root, root);
+    gc.SetMarkThreads(threads);
+    gc.SetLazySweep(false);
+    gc.SetMajorStepBudget(incremental ? 64 : 0);
+
+    srand(2016);
+    const int kNodes = 20000;
+    std::vector<oms::Table *> nodes;
+    for (int i = 0; i < kNodes; ++i)
+        nodes.push_back(gc.NewTable(oms::GCGen1));
+    for (auto node : nodes)
+    {
+        node->SetArrayValue(1, oms::Value(nodes[RandomNum(kNodes)]));
+        if (RandomNum(3) == 0)
+            node->SetArrayValue(2, oms::Value(nodes[RandomNum(kNodes)]));
+        if (RandomNum(2) == 0)
+            node->SetValue(oms::Value(gc.NewString("s", 1, oms::GCGen1)),
+                           oms::Value(nodes[RandomNum(kNodes)]));
+    }
+    for (int i = 0; i < 8; ++i)
+        roots.push_back(nodes[RandomNum(kNodes)]);
+
+    // Incremental major GC marks a part of graph before the rest
+    // marked in parallel when it finishes
+    if (incremental)
+    {
+        for (int i = 0; i < 16; ++i)
+            gc.StepGC();
+    }
+    gc.FullGC();
+
+    std::vector<bool> alived;
+    for (auto node : nodes)
+        alived.push_back(deleted.count(node) == 0);
+    return alived;
+}
+
+TEST_CASE(gc_parallel_mark1)
+{
+    auto alived = ParallelMarkGraph(1, false);
+    EXPECT_TRUE(std::count(alived.begin(), alived.end(), true) > 0);
+    EXPECT_TRUE(std::count(alived.begin(), alived.end(), false) > 0);
+
+    EXPECT_TRUE(ParallelMarkGraph(4, false) == alived);
+    EXPECT_TRUE(ParallelMarkGraph(8, false) == alived);
+    EXPECT_TRUE(ParallelMarkGraph(1, true) == alived);
+    EXPECT_TRUE(ParallelMarkGraph(4, true) == alived);
+}
+
 //int main()
 //{
 //    srand(static_cast<unsigned int>(time(nullptr)));
@@ -5,17 +5,19 @@
 #include "../mtext_in_stream.h"
 #include "../mexception.h"
 #include <functional>
+#include <stdio.h>
 
 namespace
 {
     class LexerWrapper
     {
     public:
-        explicit LexerWrapper(const std::string &str)
+        explicit LexerWrapper(const std::string &str,
+                              oms::LexerType type = oms::LexerType_HandWritten)
             : iss_(str),
-              state_(),
+              state_(type),
               name_("lex"),
-              lexer_(&state_, &name_, std::bind(&io::text::InStringStream::GetChar, &iss_))
+              lexer_(&state_, &name_, iss_.GetBuffer(), iss_.GetSize())
         {
         }
 
@@ -25,6 +27,16 @@ namespace
             return lexer_.GetToken(&token);
         }
 
+        int GetToken(oms::TokenDetail &token)
+        {
+            return lexer_.GetToken(&token);
+        }
+
+        oms::State * GetState()
+        {
+            return &state_;
+        }
+
     private:
         io::text::InStringStream iss_;
         oms::State state_;
@@ -141,3 +153,133 @@ TEST_CASE(lex7)
         EXPECT_TRUE(lexer.GetToken() == oms::Token_Id);
     EXPECT_TRUE(lexer.GetToken() == oms::Token_EOF);
 }
+
+TEST_CASE(lex8)
+{
+    LexerWrapper lexer("3 .5 314.16e-2 0xff 123456789012345678901234567890 "
+                       "name 'name' \"a\\tb\" 'a\\101' and");
+    oms::TokenDetail token;
+    EXPECT_TRUE(lexer.GetToken(token) == oms::Token_Number && token.number_ == 3);
+    EXPECT_TRUE(lexer.GetToken(token) == oms::Token_Number && token.number_ == 0.5);
+    EXPECT_TRUE(lexer.GetToken(token) == oms::Token_Number && token.number_ == 3.1416);
+    EXPECT_TRUE(lexer.GetToken(token) == oms::Token_Number && token.number_ == 255);
+    EXPECT_TRUE(lexer.GetToken(token) == oms::Token_Number &&
+                token.number_ == 123456789012345678901234567890.0);
+
+    auto name = lexer.GetState()->GetString("name");
+    EXPECT_TRUE(lexer.GetToken(token) == oms::Token_Id && token.str_ == name);
+    EXPECT_TRUE(lexer.GetToken(token) == oms::Token_String && token.str_ == name);
+    EXPECT_TRUE(lexer.GetToken(token) == oms::Token_String &&
+                token.str_->GetStdString() == "a\tb");
+    EXPECT_TRUE(lexer.GetToken(token) == oms::Token_String &&
+                token.str_->GetStdString() == "aA");
+    EXPECT_TRUE(lexer.GetToken(token) == oms::Token_And);
+    EXPECT_TRUE(lexer.GetToken(token) == oms::Token_EOF);
+}
+
+TEST_CASE(lex_dfa1)
+{
+    // DFA lexer produces the same tokens as hand-written lexer
+    std::string source =
+        "-- comment\n--[[long\r\n comment]]\n"
+        "local function f(a, b, ...) return a..b, ... end\r\n"
+        "local t = { x = 1.5e3, [\"key\"] = 'v\\tal', y = .25, z = 0xFF }\n"
+        "if a == b or a ~= b and a <= b and a >= b then t.x = #t end\n"
+        "while not nil do break end repeat until true\n"
+        "for i = 1, 10 do continue end\n"
+        "s = [==[long\nstring]] ]==] .. [[x]] .. '' .. a[1] .. b.c:d()\n"
+        "$name _x x_1 andy or1 end_ a+b-c*d/e%f^g;h\n";
+
+    LexerWrapper hand(source, oms::LexerType_HandWritten);
+    LexerWrapper dfa(source, oms::LexerType_DFA);
+    oms::TokenDetail t1;
+    oms::TokenDetail t2;
+    int count = 0;
+    do
+    {
+        hand.GetToken(t1);
+        dfa.GetToken(t2);
+        ++count;
+        EXPECT_TRUE(t1.token_ == t2.token_);
+        EXPECT_TRUE(t1.line_ == t2.line_);
+        EXPECT_TRUE(t1.column_ == t2.column_);
+        if (t1.token_ == oms::Token_Number)
+            EXPECT_TRUE(t1.number_ == t2.number_);
+        else if (t1.token_ == oms::Token_Id || t1.token_ == oms::Token_String)
+            EXPECT_TRUE(t1.str_->GetStdString() == t2.str_->GetStdString());
+    } while (t1.token_ != oms::Token_EOF && t1.token_ == t2.token_);
+
+    EXPECT_TRUE(t2.token_ == oms::Token_EOF);
+    EXPECT_TRUE(count == 123);
+}
+
+TEST_CASE(lex_dfa2)
+{
+    LexerWrapper lexer("and andy nil", oms::LexerType_DFA);
+    oms::TokenDetail token;
+    EXPECT_TRUE(lexer.GetToken(token) == oms::Token_And && !token.str_);
+    EXPECT_TRUE(lexer.GetToken(token) == oms::Token_Id &&
+                token.str_->GetStdString() == "andy");
+    EXPECT_TRUE(lexer.GetToken(token) == oms::Token_Nil && !token.str_);
+    EXPECT_TRUE(lexer.GetToken(token) == oms::Token_EOF);
+
+    LexerWrapper bad_number("3.1e+x", oms::LexerType_DFA);
+    EXPECT_EXCEPTION(oms::LexException, {
+        bad_number.GetToken();
+    });
+
+    LexerWrapper bad_not_equal("a ~ b", oms::LexerType_DFA);
+    EXPECT_TRUE(bad_not_equal.GetToken() == oms::Token_Id);
+    EXPECT_EXCEPTION(oms::LexException, {
+        bad_not_equal.GetToken();
+    });
+
+    LexerWrapper bad_string("'abc\n'", oms::LexerType_DFA);
+    EXPECT_EXCEPTION(oms::LexException, {
+        bad_string.GetToken();
+    });
+}
+
+// Script in file is lexed from the contiguous buffer of InStream, both
+// lexers get the same tokens
+TEST_CASE(lex_file1)
+{
+    const char *path = "lex_file1.lua";
+    FILE *file = fopen(path, "wb");
+    EXPECT_TRUE(file);
+    if (!file)
+        return ;
+
+    for (int i = 0; i < 100; ++i)
+    {
+        fprintf(file,
+                "-- function %d\n"
+                "local function func_%d(a, b, ...)\n"
+                "    local t = { name = \"func_%d\", value = %d.5e1, [a] = b }\n"
+                "    if a >= b and t.value ~= 0x%x then\n"
+                "        return a .. 'string' .. b, ...\n"
+                "    end\n"
+                "    return t[a] or #t\n"
+                "end\n",
+                i, i, i, i, i);
+    }
+    fclose(file);
+
+    oms::LexerType types[] = { oms::LexerType_HandWritten, oms::LexerType_DFA };
+    for (auto type : types)
+    {
+        io::text::InStream is(path);
+        EXPECT_TRUE(is.IsOpen());
+
+        oms::State state(type);
+        oms::String name(path);
+        oms::Lexer lexer(&state, &name, is.GetBuffer(), is.GetSize());
+        oms::TokenDetail detail;
+        int tokens = 0;
+        while (lexer.GetToken(&detail) != oms::Token_EOF)
+            ++tokens;
+        EXPECT_TRUE(tokens == 100 * 57);
+    }
+
+    remove(path);
+}
@@ -1,6 +1,12 @@
 #include "munit_test.h"
 #include "../mstring.h"
 #include "../mstring_pool.h"
+#include "../mstring_pattern.h"
+#include "../mstate.h"
+#include "../mtable.h"
+#include "../mexception.h"
+#include "../mlib_string.h"
+#include "../mlib_base.h"
 
 TEST_CASE(string1)
 {
@@ -70,3 +76,182 @@ TEST_CASE(string2)
     EXPECT_TRUE(!s3);
     EXPECT_TRUE(!s4);
 }
+
+TEST_CASE(string3)
+{
+    std::string long_str = "abcdefghijklmnopqrstuvwxyz";
+    auto s1 = oms::String::New("abc", 3);
+    auto s2 = oms::String::New(long_str.c_str(), long_str.size());
+    oms::String str1("abc");
+    oms::String str2(long_str.c_str());
+
+    EXPECT_TRUE(*s1 == str1);
+    EXPECT_TRUE(*s2 == str2);
+    EXPECT_TRUE(s2->GetStdString() == long_str);
+    EXPECT_TRUE(s2->GetCStr()[s2->GetLength()] == 0);
+    EXPECT_TRUE(reinterpret_cast<const void *>(s2->GetCStr()) > s2 &&
+                s2->GetCStr() < reinterpret_cast<const char *>(s2) +
+                oms::String::GetAllocSize(long_str.size()));
+    EXPECT_TRUE(oms::String::GetAllocSize(0) == sizeof(oms::String));
+
+    oms::String ref;
+    ref.RefValue(long_str.c_str(), 3);
+    EXPECT_TRUE(ref == str1);
+    ref.RefValue(long_str.c_str(), long_str.size());
+    EXPECT_TRUE(ref == *s2);
+    EXPECT_TRUE(ref.GetCStr() == long_str.c_str());
+
+    delete s1;
+    delete s2;
+}
+
+namespace
+{
+    // Match pattern in 'str' from 'init', return matched string
+    // or "<nil>" when failed
+    std::string MatchPattern(const std::string &pattern,
+                             const std::string &str, std::size_t init = 0)
+    {
+        oms::Pattern p;
+        std::string error;
+        if (!p.Compile(pattern.c_str(), pattern.size(), error))
+            return error;
+
+        oms::Pattern::MatchState ms;
+        ms.src_init_ = str.c_str();
+        ms.src_end_ = str.c_str() + str.size();
+
+        const char *e = nullptr;
+        auto b = p.Find(ms, str.c_str() + init, e);
+        if (!b)
+            return "<nil>";
+        return std::string(b, e);
+    }
+} // namespace
+
+TEST_CASE(string_pattern1)
+{
+    EXPECT_TRUE(MatchPattern("wor", "hello world") == "wor");
+    EXPECT_TRUE(MatchPattern("l+", "hello world") == "ll");
+    EXPECT_TRUE(MatchPattern("l+", "hello world", 4) == "l");
+    EXPECT_TRUE(MatchPattern("^hello", "hello world") == "hello");
+    EXPECT_TRUE(MatchPattern("^world", "hello world") == "<nil>");
+    EXPECT_TRUE(MatchPattern("world$", "hello world") == "world");
+    EXPECT_TRUE(MatchPattern("%d+%.?%d*", "pi is 3.14!") == "3.14");
+    EXPECT_TRUE(MatchPattern("[%a_][%w_]*", "  _name1 = 2") == "_name1");
+    EXPECT_TRUE(MatchPattern("[^%s]+", "   abc  ") == "abc");
+    EXPECT_TRUE(MatchPattern("a.-b", "xaxxbxxb") == "axxb");
+    EXPECT_TRUE(MatchPattern("a.*b", "xaxxbxxb") == "axxbxxb");
+    EXPECT_TRUE(MatchPattern("%b()", "f(a(b)c) x") == "(a(b)c)");
+    EXPECT_TRUE(MatchPattern("%f[%a]%a+", "123abc") == "abc");
+    EXPECT_TRUE(MatchPattern("(h%a+) %1", "hi hello hello") == "hello hello");
+    EXPECT_TRUE(MatchPattern("", "abc") == "");
+}
+
+TEST_CASE(string_pattern2)
+{
+    oms::Pattern p;
+    std::string error;
+    EXPECT_TRUE(p.Compile("(%a+)=()(%d+)", 13, error));
+    EXPECT_TRUE(p.GetCaptureCount() == 3);
+    EXPECT_TRUE(!p.IsPlain());
+
+    std::string str = "key=123";
+    oms::Pattern::MatchState ms;
+    ms.src_init_ = str.c_str();
+    ms.src_end_ = str.c_str() + str.size();
+    EXPECT_TRUE(p.Match(ms, str.c_str()) == ms.src_end_);
+    EXPECT_TRUE(ms.level_ == 3);
+    EXPECT_TRUE(std::string(ms.capture_[0].init_, ms.capture_[0].len_) == "key");
+    EXPECT_TRUE(ms.capture_[1].len_ == oms::Pattern::kCapturePosition);
+    EXPECT_TRUE(ms.capture_[1].init_ - ms.src_init_ == 4);
+    EXPECT_TRUE(std::string(ms.capture_[2].init_, ms.capture_[2].len_) == "123");
+
+    oms::Pattern plain;
+    EXPECT_TRUE(plain.Compile("abc", 3, error));
+    EXPECT_TRUE(plain.IsPlain());
+
+    EXPECT_TRUE(!p.Compile("abc%", 4, error));
+    EXPECT_TRUE(!p.Compile("[abc", 4, error));
+    EXPECT_TRUE(!p.Compile("(abc", 4, error));
+    EXPECT_TRUE(!p.Compile("abc)", 4, error));
+    EXPECT_TRUE(!p.Compile("%1", 2, error));
+    EXPECT_TRUE(!p.Compile("%f", 2, error));
+}
+
+TEST_CASE(string_pattern3)
+{
+    const char *s = "abcabcabd";
+    EXPECT_TRUE(oms::Pattern::FindLiteral(s, 9, "abd", 3) == s + 6);
+    EXPECT_TRUE(oms::Pattern::FindLiteral(s, 9, "", 0) == s);
+    EXPECT_TRUE(!oms::Pattern::FindLiteral(s, 9, "abe", 3));
+    EXPECT_TRUE(!oms::Pattern::FindLiteral(s, 2, "abc", 3));
+}
+
+TEST_CASE(string_pattern4)
+{
+    oms::State state;
+    lib::base::RegisterLibBase(&state);
+    lib::string::RegisterLibString(&state);
+
+    state.DoString(
+        "s, n = string.gsub('hello world', '(%w+)', '<%1>')\n"
+        "t, m = string.gsub('$a $b', '%$(%w+)', { a = 1, b = 'x' })\n"
+        "u = string.gsub('abc', '%w', function(c) return c .. c end)\n"
+        "b, e, k = string.find('key = value', '(%w+)', 5)\n"
+        "x, y = string.match('2024-01', '(%d+)-(%d+)')\n"
+        "cat = ''\n"
+        "for w in string.gmatch('one two three', '%a+') do cat = cat .. w end\n"
+        "local it = string.gmatch('k1=v1, k2=v2', '(%w+)=(%w+)')\n"
+        "ik, iv = it({})\n"
+        "ik2 = it()\n"
+        "idone = it() == nil\n");
+
+    auto global = state.GetGlobal()->table_;
+    auto get = [&](const char *name) {
+        oms::Value key(state.GetString(name));
+        return global->GetValue(key);
+    };
+
+    EXPECT_TRUE(get("s").str_->GetStdString() == "<hello> <world>");
+    EXPECT_TRUE(get("n").num_ == 2);
+    EXPECT_TRUE(get("t").str_->GetStdString() == "1 x");
+    EXPECT_TRUE(get("u").str_->GetStdString() == "aabbcc");
+    EXPECT_TRUE(get("b").num_ == 7 && get("e").num_ == 11);
+    EXPECT_TRUE(get("k").str_->GetStdString() == "value");
+    EXPECT_TRUE(get("x").str_->GetStdString() == "2024");
+    EXPECT_TRUE(get("y").str_->GetStdString() == "01");
+    EXPECT_TRUE(get("cat").str_->GetStdString() == "onetwothree");
+    EXPECT_TRUE(get("ik").str_->GetStdString() == "k1");
+    EXPECT_TRUE(get("iv").str_->GetStdString() == "v1");
+    EXPECT_TRUE(get("ik2").str_->GetStdString() == "k2");
+    EXPECT_TRUE(get("idone").bvalue_);
+
+    EXPECT_EXCEPTION(oms::RuntimeException, {
+        state.DoString("string.find('abc', '[a')");
+    });
+}
+
+// Iterators of gmatch share one prototype built once for each State
+TEST_CASE(string_pattern5)
+{
+    oms::State state;
+    lib::base::RegisterLibBase(&state);
+    lib::string::RegisterLibString(&state);
+
+    state.DoString("string.gmatch('a', '%a')");
+    auto functions = state.GetGC().GetStats().type_objects_[oms::GCObjectType_Function];
+
+    state.DoString(
+        "count = 0\n"
+        "for i = 1, 1000 do\n"
+        "    for w in string.gmatch('one two', '%a+') do count = count + 1 end\n"
+        "end\n");
+
+    auto global = state.GetGlobal()->table_;
+    oms::Value key(state.GetString("count"));
+    EXPECT_TRUE(global->GetValue(key).num_ == 2000);
+    // Only the function of the chunk is new
+    EXPECT_TRUE(state.GetGC().GetStats().type_objects_[oms::GCObjectType_Function] ==
+                functions + 1);
+}
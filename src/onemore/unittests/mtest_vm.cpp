@@ -0,0 +1,331 @@
+#include "munit_test.h"
+#include "../mstate.h"
+#include "../mtable.h"
+#include "../mstring.h"
+#include "../mfunction.h"
+#include "../mlib_base.h"
+#include "../mlib_math.h"
+#include "../mlib_string.h"
+#include "../mlib_api.h"
+#include "../mexception.h"
+#include <string>
+
+namespace
+{
+    oms::Value GetGlobal(oms::State &state, const char *name)
+    {
+        oms::Value key(state.GetString(name));
+        return state.GetGlobal()->table_->GetValue(key);
+    }
+
+    int Add(oms::State *state)
+    {
+        oms::StackAPI api(state);
+        if (!api.CheckArgs(2, oms::ValueT_Number, oms::ValueT_Number))
+            return 0;
+
+        api.PushNumber(api.GetNumber(0) + api.GetNumber(1));
+        return 1;
+    }
+
+    int LeafAdd(oms::State *state, const oms::Value *args, int arg_count,
+                oms::Value *result)
+    {
+        oms::LeafArgs leaf(state, args, arg_count);
+        if (!leaf.CheckArgs(2, oms::ValueT_Number, oms::ValueT_Number))
+            return oms::kLeafCFunctionError;
+
+        *result = oms::Value(leaf.GetNumber(0) + leaf.GetNumber(1));
+        return 1;
+    }
+
+    int IsCFunction(oms::State *state)
+    {
+        oms::StackAPI api(state);
+        api.PushBool(api.IsCFunction(0));
+        return 1;
+    }
+
+    // Run script in a new State, return global 'result'
+    std::string RunScript(const char *script, bool lazy)
+    {
+        oms::State state;
+        lib::base::RegisterLibBase(&state);
+        state.SetLazyCompile(lazy);
+        state.DoString(script);
+        auto result = GetGlobal(state, "result");
+        return result.type_ == oms::ValueT_String ? result.str_->GetStdString() : "";
+    }
+
+} // namespace
+
+// Tail calls run in constant stack, deep recursions which overflow the
+// stack with normal calls are finished
+TEST_CASE(vm_tail_call1)
+{
+    oms::State state;
+    lib::base::RegisterLibBase(&state);
+
+    state.DoString(
+        "local function Sum(n, acc)\n"
+        "    if n == 0 then return acc end\n"
+        "    return Sum(n - 1, acc + n)\n"
+        "end\n"
+        "sum = Sum(1000000, 0)\n"
+        "local even, odd\n"
+        "function even(n) if n == 0 then return true end return odd(n - 1) end\n"
+        "function odd(n) if n == 0 then return false end return even(n - 1) end\n"
+        "is_even = even(100001)\n"
+        "local t = { n = 5 }\n"
+        "function t:Get(k) if k == 0 then return self.n end return self:Get(k - 1) end\n"
+        "member = t:Get(100000)\n");
+
+    EXPECT_TRUE(GetGlobal(state, "sum").num_ == 500000500000.0);
+    EXPECT_TRUE(GetGlobal(state, "is_even").bvalue_ == false);
+    EXPECT_TRUE(GetGlobal(state, "member").num_ == 5);
+}
+
+// Tail calls return all results of callee, close upvalues of replaced
+// frame, and call c functions as normal calls
+TEST_CASE(vm_tail_call2)
+{
+    oms::State state;
+    lib::base::RegisterLibBase(&state);
+
+    state.DoString(
+        "local function Multi(a) return a, a + 1, a + 2 end\n"
+        "local function Tail(...) return Multi(...) end\n"
+        "a, b, c = Tail(1)\n"
+        "local function Capture(n)\n"
+        "    local x = n * 10\n"
+        "    local get = function() return x end\n"
+        "    if n == 0 then return get end\n"
+        "    return Capture(n - 1)\n"
+        "end\n"
+        "captured = Capture(5)()\n"
+        "local function Type(v) return type(v) end\n"
+        "type_name = Type(1)\n"
+        "local function Count(...) return Multi(...), 0 end\n"
+        "x, y, z = Count(7)\n");
+
+    EXPECT_TRUE(GetGlobal(state, "a").num_ == 1);
+    EXPECT_TRUE(GetGlobal(state, "b").num_ == 2);
+    EXPECT_TRUE(GetGlobal(state, "c").num_ == 3);
+    EXPECT_TRUE(GetGlobal(state, "captured").num_ == 0);
+    EXPECT_TRUE(GetGlobal(state, "type_name").str_->GetStdString() == "number");
+    EXPECT_TRUE(GetGlobal(state, "x").num_ == 7);
+    EXPECT_TRUE(GetGlobal(state, "y").num_ == 0);
+    EXPECT_TRUE(GetGlobal(state, "z").IsNil());
+}
+
+// Varargs are read in place by select, and copied as many as needed
+TEST_CASE(vm_vararg1)
+{
+    oms::State state;
+    lib::base::RegisterLibBase(&state);
+
+    state.DoString(
+        "local function Count(...) return select('#', ...) end\n"
+        "none, one_nil, three = Count(), Count(nil), Count(1, nil, 3)\n"
+        "second, third = select(2, 'a', 'b', 'c')\n"
+        "last = select(-1, 'a', 'b', 'c')\n"
+        "beyond = Count(select(5, 'a', 'b'))\n"
+        "local function Fixed(a, b, ...) return a, b, select('#', ...) end\n"
+        "fixed_a, fixed_b, fixed_count = Fixed(1)\n"
+        "local function First(...) local x, y = ... return x, y end\n"
+        "first_x, first_y = First(7, 8, 9)\n"
+        "local function Middle(...) return ..., 'end' end\n"
+        "middle, middle_end = Middle()\n"
+        "local function Wrap(...) return Count(...) end\n"
+        "wrapped = Wrap(1, 2, 3, 4, 5)\n"
+        "local function Sum(...)\n"
+        "    local s = 0\n"
+        "    for i = 1, select('#', ...) do s = s + select(i, ...) end\n"
+        "    return s\n"
+        "end\n"
+        "sum = Sum(1, 2, 3, 4)\n");
+
+    EXPECT_TRUE(GetGlobal(state, "none").num_ == 0);
+    EXPECT_TRUE(GetGlobal(state, "one_nil").num_ == 1);
+    EXPECT_TRUE(GetGlobal(state, "three").num_ == 3);
+    EXPECT_TRUE(GetGlobal(state, "second").str_->GetStdString() == "b");
+    EXPECT_TRUE(GetGlobal(state, "third").str_->GetStdString() == "c");
+    EXPECT_TRUE(GetGlobal(state, "last").str_->GetStdString() == "c");
+    EXPECT_TRUE(GetGlobal(state, "beyond").num_ == 0);
+    EXPECT_TRUE(GetGlobal(state, "fixed_a").num_ == 1);
+    EXPECT_TRUE(GetGlobal(state, "fixed_b").IsNil());
+    EXPECT_TRUE(GetGlobal(state, "fixed_count").num_ == 0);
+    EXPECT_TRUE(GetGlobal(state, "first_x").num_ == 7);
+    EXPECT_TRUE(GetGlobal(state, "first_y").num_ == 8);
+    EXPECT_TRUE(GetGlobal(state, "middle").IsNil());
+    EXPECT_TRUE(GetGlobal(state, "middle_end").str_->GetStdString() == "end");
+    EXPECT_TRUE(GetGlobal(state, "wrapped").num_ == 5);
+    EXPECT_TRUE(GetGlobal(state, "sum").num_ == 10);
+}
+
+// Leaf C functions return one result in place of the callee, and report
+// errors like normal C functions
+TEST_CASE(vm_leaf_cfunction1)
+{
+    oms::State state;
+    lib::base::RegisterLibBase(&state);
+    lib::math::RegisterLibMath(&state);
+    lib::string::RegisterLibString(&state);
+
+    state.DoString(
+        "abs, upper, after = math.abs(-2), string.upper('ab'), 'after'\n"
+        "max = math.max(3, 9, 4)\n"
+        "local function Tail() return math.floor(2.5) end\n"
+        "floor = Tail()\n"
+        "gsub = string.gsub('ab cd', '%w+', string.upper)\n"
+        "type_name = type(math.sin)\n"
+        "local ok = 0\n"
+        "for i = 1, 100 do ok = ok + string.len(string.sub('hello', 1, i % 5)) end\n"
+        "len = ok\n");
+
+    EXPECT_TRUE(GetGlobal(state, "abs").num_ == 2);
+    EXPECT_TRUE(GetGlobal(state, "upper").str_->GetStdString() == "AB");
+    EXPECT_TRUE(GetGlobal(state, "after").str_->GetStdString() == "after");
+    EXPECT_TRUE(GetGlobal(state, "max").num_ == 9);
+    EXPECT_TRUE(GetGlobal(state, "floor").num_ == 2);
+    EXPECT_TRUE(GetGlobal(state, "gsub").str_->GetStdString() == "AB CD");
+    EXPECT_TRUE(GetGlobal(state, "type_name").str_->GetStdString() == "function");
+    EXPECT_TRUE(GetGlobal(state, "len").num_ == 200);
+
+    std::string error;
+    try
+    {
+        state.DoString("math.abs('x')");
+    }
+    catch (const oms::RuntimeException &exp)
+    {
+        error = exp.What();
+    }
+    EXPECT_TRUE(error.find("argument #1 is a string value, expect a number value") !=
+                std::string::npos);
+
+    error.clear();
+    try
+    {
+        state.DoString("string.sub()");
+    }
+    catch (const oms::RuntimeException &exp)
+    {
+        error = exp.What();
+    }
+    EXPECT_TRUE(error.find("expect 2 arguments") != std::string::npos);
+}
+
+// Leaf C functions are C functions for StackAPI and have the same
+// results as normal C functions in loops
+TEST_CASE(vm_leaf_cfunction2)
+{
+    oms::State state;
+    oms::Library lib(&state);
+    lib.RegisterFunc("add", Add);
+    lib.RegisterFunc("leaf_add", LeafAdd);
+    lib.RegisterFunc("is_cfunction", IsCFunction);
+
+    state.DoString(
+        "normal_is_cfunction = is_cfunction(add)\n"
+        "leaf_is_cfunction = is_cfunction(leaf_add)\n"
+        "closure_is_cfunction = is_cfunction(function() end)\n");
+    EXPECT_TRUE(GetGlobal(state, "normal_is_cfunction").bvalue_);
+    EXPECT_TRUE(GetGlobal(state, "leaf_is_cfunction").bvalue_);
+    EXPECT_TRUE(!GetGlobal(state, "closure_is_cfunction").bvalue_);
+
+    state.DoString(
+        "local s = 0\n"
+        "for i = 1, 1000 do s = add(s, i) end\n"
+        "normal = s\n"
+        "s = 0\n"
+        "for i = 1, 1000 do s = leaf_add(s, i) end\n"
+        "leaf = s\n");
+
+    EXPECT_TRUE(GetGlobal(state, "normal").num_ == 500500);
+    EXPECT_TRUE(GetGlobal(state, "leaf").num_ == 500500);
+}
+
+// Lazy functions have the same behavior as functions compiled with
+// module, includes upvalues of enclosing functions, 'self', varargs and
+// shadowed names, and functions not called are not compiled
+TEST_CASE(vm_lazy_compile1)
+{
+    const char *script =
+        "local prefix = 'p'\n"
+        "local function Counter(step)\n"
+        "    local n = 0\n"
+        "    return function(...)\n"
+        "        n = n + step + select('#', ...)\n"
+        "        return prefix .. n\n"
+        "    end\n"
+        "end\n"
+        "local T = { v = 1 }\n"
+        "function T:Add(x) self.v = self.v + x return self.v end\n"
+        "local function Outer(a)\n"
+        "    local b = a * 2\n"
+        "    return function()\n"
+        "        return function(c) return prefix .. a .. b .. c end\n"
+        "    end\n"
+        "end\n"
+        "local y = 1\n"
+        "local function GetY() return y end\n"
+        "local y = 2\n"
+        "local function Fib(n)\n"
+        "    if n < 2 then return n end\n"
+        "    return Fib(n - 1) + Fib(n - 2)\n"
+        "end\n"
+        "function Used() return y end\n"
+        "function Unused() return prefix .. undefined end\n"
+        "local c = Counter(1)\n"
+        "c() c(1, 2)\n"
+        "result = c() .. T:Add(2) .. Outer(3)()(4) .. GetY() .. Used() .. Fib(10)\n";
+
+    EXPECT_TRUE(RunScript(script, false) == "p53p3641255");
+    EXPECT_TRUE(RunScript(script, true) == "p53p3641255");
+
+    oms::State state;
+    lib::base::RegisterLibBase(&state);
+    state.SetLazyCompile(true);
+    state.DoString(script);
+    auto used = GetGlobal(state, "Used").closure_->GetPrototype();
+    auto unused = GetGlobal(state, "Unused").closure_->GetPrototype();
+    EXPECT_TRUE(!used->GetLazySource() && used->OpCodeSize() > 0);
+    EXPECT_TRUE(unused->GetLazySource() && unused->OpCodeSize() == 0);
+}
+
+// Runtime errors of lazy functions report their lines, code generation
+// errors of lazy functions are thrown on their first call
+TEST_CASE(vm_lazy_compile2)
+{
+    std::string error;
+    try
+    {
+        oms::State state;
+        state.SetLazyCompile(true);
+        state.DoString(
+            "local a = 1\n"
+            "local function Fail(t)\n"
+            "\n"
+            "    return t.x\n"
+            "end\n"
+            "Fail(nil)\n", "lazy");
+    }
+    catch (const oms::RuntimeException &exp)
+    {
+        error = exp.What();
+    }
+    EXPECT_TRUE(error.find("lazy:4") == 0);
+
+    std::string script = "function Big()\n";
+    for (int i = 0; i < 300; ++i)
+        script += "    local a" + std::to_string(i) + " = " + std::to_string(i) + "\n";
+    script += "end\n";
+
+    oms::State state;
+    state.SetLazyCompile(true);
+    state.DoString(script);
+    EXPECT_EXCEPTION(oms::CodeGenerateException, {
+        state.DoString("Big()");
+    });
+}